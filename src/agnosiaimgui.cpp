@@ -3,9 +3,22 @@
 #include "devicelibrary.h"
 #include "entrypoint.h"
 #include "graphics/buffers.h"
+#include "graphics/deferreddeletion.h"
+#include "graphics/dynamicresolution.h"
 #include "graphics/graphicspipeline.h"
+#include "graphics/lightgrid.h"
+#include "graphics/materialtable.h"
+#include "graphics/objecttable.h"
+#include "graphics/occlusionrasterizer.h"
 #include "graphics/pipelinebuilder.h"
+#include "graphics/rendergraph.h"
+#include "graphics/samplercache.h"
+#include "graphics/shadowcascades.h"
+#include "graphics/temporalaa.h"
 #include "graphics/texture.h"
+#include "graphics/texturearray.h"
+#include "graphics/texturestreamer.h"
+#include "settings.h"
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_vulkan.h"
@@ -13,10 +26,12 @@
 #include "utils/types.h"
 #include <glm/gtc/type_ptr.hpp>
 #include "utils/deletion.h"
+#include "utils/threadpool.h"
 
-PipelineBuilder builder;
 Agnosia_T::Pipeline graphicsSolid;
 Agnosia_T::Pipeline graphicsWireframe;
+Agnosia_T::Pipeline depthPrepassSolid;
+Agnosia_T::Pipeline depthPrepassWireframe;
 Agnosia_T::Pipeline fullscreenSolid;
 Agnosia_T::Pipeline fullscreenWireframe;
 
@@ -24,10 +39,49 @@ VkDescriptorPool imGuiDescriptorPool;
 static bool wireframe = false;
 float lineWidth = 1.0f;
 
+// Swap in whichever set of pipelines the wireframe toggle asks for.
+void addPipelines() {
+  if(wireframe) {
+    Graphics::addGraphicsPipeline(graphicsWireframe);
+    Graphics::addDepthPrepassPipeline(depthPrepassWireframe);
+    Graphics::addFullscreenPipeline(fullscreenWireframe);
+  } else {
+    Graphics::addGraphicsPipeline(graphicsSolid);
+    Graphics::addDepthPrepassPipeline(depthPrepassSolid);
+    Graphics::addFullscreenPipeline(fullscreenSolid);
+  }
+}
+
+bool samplerSettingsEdit(const char *label, SamplerCache::Settings &settings) {
+  static const char *addressModes[] = {"Repeat", "Mirrored Repeat", "Clamp To Edge", "Clamp To Border"};
+  bool changed = false;
+  if (ImGui::TreeNode(label)) {
+    bool nearest = settings.filter == VK_FILTER_NEAREST;
+    if (ImGui::Checkbox("Nearest Filtering", &nearest)) {
+      settings.filter = nearest ? VK_FILTER_NEAREST : VK_FILTER_LINEAR;
+      changed = true;
+    }
+    int addressMode = static_cast<int>(settings.addressMode);
+    if (ImGui::Combo("Address Mode", &addressMode, addressModes, IM_ARRAYSIZE(addressModes))) {
+      settings.addressMode = static_cast<VkSamplerAddressMode>(addressMode);
+      changed = true;
+    }
+    int anisotropy = static_cast<int>(settings.maxAnisotropy);
+    if (ImGui::SliderInt("Anisotropy", &anisotropy, 1, 16, "%dx", ImGuiSliderFlags_AlwaysClamp)) {
+      settings.maxAnisotropy = static_cast<float>(anisotropy);
+      changed = true;
+    }
+    ImGui::TreePop();
+  }
+  return changed;
+}
+
 void initTransformsWindow(AssetCache& cache) {
   if (ImGui::TreeNode("Model Transforms")) {
     for (Model *model : cache.getModels()) {
-      ImGui::DragFloat3(model->getID().c_str(), const_cast<float *>(glm::value_ptr(model->getPos())));
+      if (ImGui::DragFloat3(model->getID().c_str(), glm::value_ptr(model->getPos()))) {
+        model->markDirty();
+      }
     }
     ImGui::TreePop();
   }
@@ -42,34 +96,236 @@ void initTransformsWindow(AssetCache& cache) {
     ImGui::DragFloat3("Light Position", Graphics::getLightPos());
     ImGui::ColorPicker3("Light Color", Graphics::getLightColor(), ImGuiColorEditFlags_NoInputs | ImGuiColorEditFlags_PickerHueWheel | ImGuiColorEditFlags_NoAlpha | ImGuiColorEditFlags_NoSidePreview);
     ImGui::DragFloat("Light Power", &Graphics::getLightPower(), 0.5f, 1.0f, FLT_MAX, NULL, ImGuiSliderFlags_AlwaysClamp);
+    int scattered = static_cast<int>(LightGrid::getScatteredLights());
+    if (ImGui::SliderInt("Scattered Lights", &scattered, 0, LightGrid::MAX_SCATTERED_LIGHTS, "%d", ImGuiSliderFlags_AlwaysClamp)) {
+      LightGrid::getScatteredLights() = static_cast<uint32_t>(scattered);
+    }
+    ImGui::DragFloat("Scatter Radius", &LightGrid::getScatterRadius(), 0.1f, 0.5f, 100.0f, "%.1f", ImGuiSliderFlags_AlwaysClamp);
+    ImGui::DragFloat("Scattered Light Power", &LightGrid::getScatteredIntensity(), 0.005f, 0.001f, 10.0f, "%.3f", ImGuiSliderFlags_AlwaysClamp);
+    ImGui::Text("%u lights binned into %ux%ux%u clusters", LightGrid::getLightCount(), LightGrid::CLUSTER_X, LightGrid::CLUSTER_Y,
+                LightGrid::CLUSTER_Z);
+    ImGui::Separator();
+    ImGui::DragFloat3("Sun Direction", Graphics::getSunDirection(), 0.01f, -1.0f, 1.0f);
+    ImGui::ColorEdit3("Sun Color", Graphics::getSunColor(), ImGuiColorEditFlags_NoInputs);
+    ImGui::DragFloat("Sun Power", &Graphics::getSunPower(), 0.05f, 0.0f, 100.0f, "%.2f", ImGuiSliderFlags_AlwaysClamp);
+    ImGui::Checkbox("Sun Shadows", &ShadowCascades::getEnabled());
+    ImGui::BeginDisabled(!ShadowCascades::getEnabled());
+    ImGui::DragFloat("Shadow Distance", &ShadowCascades::getShadowDistance(), 0.5f, 1.0f, 1000.0f, "%.1f", ImGuiSliderFlags_AlwaysClamp);
+    ImGui::SliderFloat("Cascade Split Lambda", &ShadowCascades::getSplitLambda(), 0.0f, 1.0f);
+    ImGui::SliderFloat("Sun Redraw Threshold", &ShadowCascades::getLightThreshold(), 0.0f, 5.0f, "%.2f deg");
+    ImGui::SliderFloat("Cascade Margin", &ShadowCascades::getMargin(), 0.0f, 1.0f);
+    if (ImGui::Button("Redraw Cascades")) {
+      ShadowCascades::invalidate();
+    }
+    const ShadowCascades::Stats &shadowStats = ShadowCascades::getStats();
+    ImGui::Text("Cascades redrawn: %u of %u, %u static casters", shadowStats.cascadesRendered, ShadowCascades::CASCADE_COUNT,
+                shadowStats.staticCasters);
+    ImGui::Text("Cascades composited: %u, %u dynamic casters", shadowStats.cascadesComposited, shadowStats.dynamicCasters);
+    ImGui::EndDisabled();
     ImGui::TreePop();
   }
 }
 void initRenderWindow(AssetCache& cache) {
+  ImGui::Checkbox("GPU Driven Culling", &Graphics::getGPUDriven());
+  ImGui::BeginDisabled(!Graphics::getGPUDriven());
+  ImGui::Checkbox("Occlusion Culling", &Graphics::getOcclusionCulling());
+  ImGui::EndDisabled();
+  ImGui::BeginDisabled(Graphics::getGPUDriven());
+  ImGui::Checkbox("CPU Occlusion Culling", &OcclusionRasterizer::getEnabled());
+  ImGui::EndDisabled();
+  if (!Graphics::getGPUDriven() && OcclusionRasterizer::getEnabled()) {
+    const OcclusionRasterizer::Stats &stats = OcclusionRasterizer::getStats();
+    ImGui::Text("CPU occlusion: %u of %u culled, %u occluder triangles", stats.culled, stats.tested, stats.occluderTriangles);
+    ImGui::Text("Raster %.2f ms, test %.2f ms (%u workers)", stats.rasterMilliseconds, stats.testMilliseconds, ThreadPool::get().getWorkerCount());
+  }
+  ImGui::BeginDisabled(Graphics::getGPUDriven());
+  ImGui::Checkbox("Cache Static Draws", &Graphics::getCacheStaticDraws());
+  ImGui::Checkbox("Parallel Recording", &Graphics::getParallelRecording());
+  ImGui::EndDisabled();
+  ImGui::Text("Recording %.2f ms, %u secondaries%s", Graphics::getRecordMilliseconds(), Graphics::getSecondaryCount(),
+              Graphics::getStaticDrawsReused() ? ", draws cached" : "");
+  ImGui::Checkbox("Depth Pre-pass", &Graphics::getDepthPrepass());
+  if (DeviceControl::supportsPipelineStatistics()) {
+    ImGui::Text("Fragment shader invocations: %llu", static_cast<unsigned long long>(Graphics::getFragmentInvocations()));
+  }
+  ImGui::BeginDisabled(!DynamicResolution::isSupported());
+  ImGui::Checkbox("Dynamic Resolution", &DynamicResolution::getEnabled());
+  ImGui::EndDisabled();
+  if (DynamicResolution::getEnabled()) {
+    ImGui::DragFloat("Target GPU Time (ms)", &DynamicResolution::getTargetMilliseconds(), 0.1f, 1.0f, 100.0f, "%.1f", ImGuiSliderFlags_AlwaysClamp);
+    ImGui::SliderFloat("Minimum Render Scale", &DynamicResolution::getMinScale(), DynamicResolution::MIN_SCALE, 1.0f, "%.2f", ImGuiSliderFlags_AlwaysClamp);
+  } else {
+    ImGui::SliderFloat("Render Scale", &DynamicResolution::getScale(), DynamicResolution::MIN_SCALE, 1.0f, "%.2f", ImGuiSliderFlags_AlwaysClamp);
+  }
+  const VkExtent2D renderExtent = DynamicResolution::getRenderExtent();
+  ImGui::Text("Rendering at %ux%u, scene GPU time %.2f ms", renderExtent.width, renderExtent.height, DynamicResolution::getGPUMilliseconds());
+  ImGui::Checkbox("Temporal Anti-Aliasing", &TemporalAA::getEnabled());
+  if (TemporalAA::getEnabled()) {
+    ImGui::SliderFloat("Current Frame Weight", &TemporalAA::getBlend(), 0.02f, 1.0f, "%.2f", ImGuiSliderFlags_AlwaysClamp);
+    if (DeviceControl::getPerPixelSampleCount() != VK_SAMPLE_COUNT_1_BIT) {
+      ImGui::TextDisabled("MSAA is still on, 1x in Settings saves its shading cost.");
+    }
+  }
+  ImGui::Text("Objects: %u", ObjectTable::getObjectCount());
   if(ImGui::Checkbox("Wireframe?", &wireframe)) {
     // Rebuild graphics pipeline if setting is changed.
-    if(wireframe) {
-      Graphics::addGraphicsPipeline(graphicsWireframe);
-      Graphics::addFullscreenPipeline(fullscreenWireframe);
-    } else {                                  
-      Graphics::addGraphicsPipeline(graphicsSolid);
-      Graphics::addFullscreenPipeline(fullscreenSolid);
-    }    
+    addPipelines();
   }
   ImGui::DragFloat("Line Width", &lineWidth, 1.0f, 1.0f, 64.0f, NULL, ImGuiSliderFlags_AlwaysClamp);
+  ImGui::Text("Textures: %u (%u unique on GPU)", cache.getTextureCount(), cache.getUniqueTextureCount());
+  ImGui::Text("Array pages: %u holding %u small textures", TextureArrayPool::getPageCount(), TextureArrayPool::getPooledTextureCount());
+  ImGui::Text("Bindless texture slots in use: %u (%s)", Buffers::getTextureSlotCount(),
+              Buffers::usesDescriptorBuffer() ? "descriptor buffer" : "descriptor sets");
+  ImGui::Text("GPU objects awaiting deletion: %u", DeferredDeletion::getPendingCount());
+  const std::vector<RenderGraph::PassInfo> &graphPasses = RenderGraph::getLastPasses();
+  uint32_t culledPasses = 0, graphBarriers = 0;
+  for (const RenderGraph::PassInfo &pass : graphPasses) {
+    culledPasses += pass.culled ? 1 : 0;
+    graphBarriers += pass.barriers;
+  }
+  ImGui::Text("Render graph: %zu passes (%u culled), %u barriers", graphPasses.size(), culledPasses, graphBarriers);
+  ImGui::Text("Transient targets: %.1f MB, %.1f MB saved by aliasing", RenderGraph::getTransientBytes() / (1024.0f * 1024.0f),
+              RenderGraph::getAliasedBytes() / (1024.0f * 1024.0f));
+  if (RenderGraph::getLazyBytes() > 0) {
+    const VkDeviceSize lazyCommitted = RenderGraph::getLazyCommittedBytes();
+    ImGui::Text("Lazily allocated: %.1f MB reserved, %.1f MB saved", RenderGraph::getLazyBytes() / (1024.0f * 1024.0f),
+                (RenderGraph::getLazyBytes() - lazyCommitted) / (1024.0f * 1024.0f));
+  }
+  if (ImGui::TreeNode("Render Graph Passes")) {
+    for (const RenderGraph::PassInfo &pass : graphPasses) {
+      if (pass.culled) {
+        ImGui::TextDisabled("%s (culled)", pass.name);
+      } else {
+        ImGui::Text("%s, %u barriers", pass.name, pass.barriers);
+      }
+    }
+    ImGui::TreePop();
+  }
+
+  int budgetMB = static_cast<int>(TextureStreamer::getBudget() / (1024 * 1024));
+  if(ImGui::DragInt("Texture Streaming Budget (MB)", &budgetMB, 8.0f, 16, 16384, NULL, ImGuiSliderFlags_AlwaysClamp)) {
+    TextureStreamer::getBudget() = static_cast<VkDeviceSize>(budgetMB) * 1024 * 1024;
+  }
+  ImGui::Text("Streaming: %u textures, %.1f MB resident", TextureStreamer::getStreamingTextureCount(),
+              TextureStreamer::getResidentBytes() / (1024.0f * 1024.0f));
+
+  if (ImGui::TreeNode("Materials")) {
+    ImGui::Text("Material table entries: %u, unique samplers: %u", MaterialTable::getMaterialCount(), SamplerCache::getSamplerCount());
+    for (Material *material : cache.getMaterials()) {
+      ImGui::PushID(material->getID().c_str());
+      ImGui::Text("%s (ID %u)", material->getID().c_str(), material->getMaterialID());
+      // Edits only rewrite this material's record, objects using it pick it up through their material ID.
+      bool changed = ImGui::ColorEdit3("Base Color", glm::value_ptr(material->getBaseColorFactor()));
+      changed |= ImGui::SliderFloat("Roughness", &material->getRoughnessFactor(), 0.0f, 1.0f);
+      changed |= ImGui::SliderFloat("Metallic", &material->getMetallicFactor(), 0.0f, 1.0f);
+      bool unlit = (material->getFlags() & Material::FLAG_UNLIT) != 0;
+      if (ImGui::Checkbox("Unlit", &unlit)) {
+        material->getFlags() ^= Material::FLAG_UNLIT;
+        changed = true;
+      }
+      changed |= samplerSettingsEdit("Diffuse Sampler", material->getDiffuseSampler());
+      changed |= samplerSettingsEdit("ORM Sampler", material->getORMSampler());
+      if (changed) {
+        material->markDirty();
+      }
+      ImGui::PopID();
+    }
+    ImGui::TreePop();
+  }
   
   for(Model *model : cache.getModels()) {
     
     if(ImGui::Button(("Kill " + model->getID()).c_str())) {
+      // Its buffers outlive it until the frames in flight are done, the model itself is gone right away.
       cache.remove(model->getID());
+      continue;
     }
     
     int polycount =  model->getIndices()/3;
     ImGui::Text("Polycount: %d", polycount);
+    bool occluder = model->getOccluder();
+    if (ImGui::Checkbox(("Occluder##" + model->getID()).c_str(), &occluder)) {
+      model->setOccluder(occluder);
+    }
+    ImGui::SameLine();
+    ImGui::Checkbox(("Dynamic##" + model->getID()).c_str(), &model->getDynamic());
   }
   
 }
 
+const char *presentModeName(VkPresentModeKHR mode) {
+  switch (mode) {
+    case VK_PRESENT_MODE_IMMEDIATE_KHR: return "Immediate (tearing)";
+    case VK_PRESENT_MODE_MAILBOX_KHR: return "Mailbox";
+    case VK_PRESENT_MODE_FIFO_KHR: return "FIFO (V-Sync)";
+    case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "FIFO Relaxed";
+    default: return "Other";
+  }
+}
+// "Off" without multisampling, "4x" and so on otherwise.
+static void formatSampleCount(char (&label)[16], uint32_t samples) {
+  if (samples == VK_SAMPLE_COUNT_1_BIT) {
+    snprintf(label, sizeof(label), "Off");
+  } else {
+    snprintf(label, sizeof(label), "%ux", samples);
+  }
+}
+void initSettingsWindow() {
+  // Edits stay here until applied, the renderer keeps what it has until then.
+  static Settings::Quality edited = Settings::get();
+  static const std::vector<VkPresentModeKHR> presentModes = DeviceControl::getPresentModes();
+
+  const VkSampleCountFlags sampleCounts = DeviceControl::getSupportedSampleCounts();
+  char samplesLabel[16];
+  formatSampleCount(samplesLabel, static_cast<uint32_t>(edited.msaaSamples));
+  if (ImGui::BeginCombo("MSAA", samplesLabel)) {
+    for (uint32_t samples = VK_SAMPLE_COUNT_1_BIT; samples <= VK_SAMPLE_COUNT_64_BIT; samples <<= 1) {
+      if (!(sampleCounts & samples)) {
+        continue;
+      }
+      formatSampleCount(samplesLabel, samples);
+      if (ImGui::Selectable(samplesLabel, edited.msaaSamples == samples)) {
+        edited.msaaSamples = static_cast<VkSampleCountFlagBits>(samples);
+      }
+    }
+    ImGui::EndCombo();
+  }
+  ImGui::BeginDisabled(edited.msaaSamples == VK_SAMPLE_COUNT_1_BIT);
+  ImGui::Checkbox("Sample Shading", &edited.sampleShading);
+  ImGui::BeginDisabled(!edited.sampleShading);
+  ImGui::SliderFloat("Min Sample Shading", &edited.minSampleShading, 0.0f, 1.0f, "%.2f", ImGuiSliderFlags_AlwaysClamp);
+  ImGui::EndDisabled();
+  ImGui::EndDisabled();
+
+  int anisotropy = static_cast<int>(edited.maxAnisotropy);
+  if (ImGui::SliderInt("Max Anisotropy", &anisotropy, 1, 16, "%dx", ImGuiSliderFlags_AlwaysClamp)) {
+    edited.maxAnisotropy = static_cast<float>(anisotropy);
+  }
+  if (ImGui::BeginCombo("Present Mode", presentModeName(edited.presentMode))) {
+    for (VkPresentModeKHR mode : presentModes) {
+      if (ImGui::Selectable(presentModeName(mode), edited.presentMode == mode)) {
+        edited.presentMode = mode;
+      }
+    }
+    ImGui::EndCombo();
+  }
+  int framesInFlight = static_cast<int>(edited.framesInFlight);
+  if (ImGui::SliderInt("Frames In Flight", &framesInFlight, 1, Settings::MAX_FRAMES_IN_FLIGHT, "%d", ImGuiSliderFlags_AlwaysClamp)) {
+    edited.framesInFlight = static_cast<uint32_t>(framesInFlight);
+  }
+
+  // Applied before the next frame, only what depends on the changed values gets rebuilt.
+  ImGui::BeginDisabled(edited == Settings::get());
+  if (ImGui::Button("Apply")) {
+    Settings::request(edited);
+  }
+  ImGui::SameLine();
+  if (ImGui::Button("Revert")) {
+    edited = Settings::get();
+  }
+  ImGui::EndDisabled();
+}
+
 void drawTabs(AssetCache& cache) {
   if (ImGui::BeginTabBar("MainTabBar", ImGuiTabBarFlags_Reorderable)) {
     if (ImGui::BeginTabItem("Transforms Control")) {
@@ -80,6 +336,10 @@ void drawTabs(AssetCache& cache) {
       initRenderWindow(cache);
       ImGui::EndTabItem();
     }
+    if(ImGui::BeginTabItem("Settings")) {
+      initSettingsWindow();
+      ImGui::EndTabItem();
+    }
 
     ImGui::EndTabBar();
   }
@@ -103,6 +363,62 @@ void Gui::drawImGui(AssetCache& cache) {
   ImGui::Render();
 }
 
+// Frames in flight may still be drawing with them.
+void retirePipelines() {
+  for (const Agnosia_T::Pipeline &pipeline : {graphicsSolid, graphicsWireframe, depthPrepassSolid, depthPrepassWireframe, fullscreenSolid, fullscreenWireframe}) {
+    if (pipeline.pipeline != VK_NULL_HANDLE) {
+      DeferredDeletion::pipeline(pipeline);
+    }
+  }
+}
+// Everything baked with the sample count, or whether sample shading is on, is built here so it can be built again.
+void buildPipelines() {
+  retirePipelines();
+  // A fresh builder each time, it keeps whatever the last pipeline set.
+  PipelineBuilder builder;
+  builder.setReplaceable(true);
+  graphicsSolid = builder.setCullMode(VK_CULL_MODE_NONE)
+                         .setPolygonMode(VK_POLYGON_MODE_FILL)
+                         .setDynamicDepth(VK_TRUE)
+                         .Build();
+  graphicsWireframe = builder.setCullMode(VK_CULL_MODE_NONE)
+                             .setPolygonMode(VK_POLYGON_MODE_LINE)
+                             .setDynamicDepth(VK_TRUE)
+                             .Build();
+  // Rasterized exactly like the pipelines above, or the EQUAL test after the pre-pass would drop fragments.
+  depthPrepassSolid = PipelineBuilder().setReplaceable(true)
+                                       .setVertexShader("src/shaders/depth.vert")
+                                       .setFragmentShader("")
+                                       .setColorWriteMask(0)
+                                       .setCullMode(VK_CULL_MODE_NONE)
+                                       .setPolygonMode(VK_POLYGON_MODE_FILL)
+                                       .setDynamicDepth(VK_TRUE)
+                                       .Build();
+  depthPrepassWireframe = PipelineBuilder().setReplaceable(true)
+                                           .setVertexShader("src/shaders/depth.vert")
+                                           .setFragmentShader("")
+                                           .setColorWriteMask(0)
+                                           .setCullMode(VK_CULL_MODE_NONE)
+                                           .setPolygonMode(VK_POLYGON_MODE_LINE)
+                                           .setDynamicDepth(VK_TRUE)
+                                           .Build();
+
+  fullscreenSolid = builder.setCullMode(VK_CULL_MODE_NONE)
+                           .setDynamicDepth(VK_FALSE)
+                           .setVertexShader("src/shaders/fullscreen.vert")
+                           .setFragmentShader("src/shaders/fullscreen.frag")
+                           .setPolygonMode(VK_POLYGON_MODE_FILL)
+                           .setDepthCompareOp(VK_COMPARE_OP_LESS_OR_EQUAL)
+                           .Build();
+  
+  fullscreenWireframe = builder.setCullMode(VK_CULL_MODE_NONE)
+                               .setVertexShader("src/shaders/fullscreen.vert")
+                               .setFragmentShader("src/shaders/fullscreen.frag")
+                               .setPolygonMode(VK_POLYGON_MODE_LINE)
+                               .setDepthCompareOp(VK_COMPARE_OP_LESS_OR_EQUAL)
+                               .Build();
+}
+
 void Gui::initImgui(VkInstance instance) {
   auto load_vk_func = [&](const char *fn) {
     if (auto proc = vkGetDeviceProcAddr(DeviceControl::getDevice(), fn))
@@ -137,11 +453,11 @@ void Gui::initImgui(VkInstance instance) {
   VK_CHECK(vkCreateDescriptorPool(DeviceControl::getDevice(), &ImGuiPoolInfo, nullptr, &imGuiDescriptorPool));
   DeletionQueue::get().push_function([=](){vkDestroyDescriptorPool(DeviceControl::getDevice(), imGuiDescriptorPool, nullptr);});
 
+  // The UI is drawn straight into the swapchain image after the scene has been upscaled, no MSAA and no depth.
   VkPipelineRenderingCreateInfo pipelineRenderingCreateInfo{
       .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO,
       .colorAttachmentCount = 1,
       .pColorAttachmentFormats = &DeviceControl::getImageFormat(),
-      .depthAttachmentFormat = DeviceControl::getDepthFormat(),
   };
 
   ImGui_ImplVulkan_InitInfo initInfo{
@@ -153,38 +469,24 @@ void Gui::initImgui(VkInstance instance) {
       .DescriptorPool = imGuiDescriptorPool,
       .MinImageCount = Buffers::getMaxFramesInFlight(),
       .ImageCount = Buffers::getMaxFramesInFlight(),
-      .MSAASamples = DeviceControl::getPerPixelSampleCount(),
+      .MSAASamples = VK_SAMPLE_COUNT_1_BIT,
       .UseDynamicRendering = true,
       .PipelineRenderingCreateInfo = pipelineRenderingCreateInfo,
   };
 
   ImGui_ImplVulkan_Init(&initInfo);
 
-  
-  graphicsSolid = builder.setCullMode(VK_CULL_MODE_NONE)
-                         .setPolygonMode(VK_POLYGON_MODE_FILL)
-                         .Build();
-  graphicsWireframe = builder.setCullMode(VK_CULL_MODE_NONE)
-                             .setPolygonMode(VK_POLYGON_MODE_LINE)
-                             .Build();
+  buildPipelines();
+  DeletionQueue::get().push_function([=](){retirePipelines();});
 
-  fullscreenSolid = builder.setCullMode(VK_CULL_MODE_NONE)
-                           .setVertexShader("src/shaders/fullscreen.vert")
-                           .setFragmentShader("src/shaders/fullscreen.frag")
-                           .setPolygonMode(VK_POLYGON_MODE_FILL)
-                           .setDepthCompareOp(VK_COMPARE_OP_LESS_OR_EQUAL)
-                           .Build();
-  
-  fullscreenWireframe = builder.setCullMode(VK_CULL_MODE_NONE)
-                               .setVertexShader("src/shaders/fullscreen.vert")
-                               .setFragmentShader("src/shaders/fullscreen.frag")
-                               .setPolygonMode(VK_POLYGON_MODE_LINE)
-                               .setDepthCompareOp(VK_COMPARE_OP_LESS_OR_EQUAL)
-                               .Build();
   DeletionQueue::get().push_function([=](){ImGui::DestroyContext();});
   DeletionQueue::get().push_function([=](){ImGui_ImplGlfw_Shutdown();});
   DeletionQueue::get().push_function([=](){ImGui_ImplVulkan_Shutdown();});
 }
+void Gui::rebuildPipelines() {
+  buildPipelines();
+  addPipelines();
+}
 bool Gui::getWireframe() {
   return wireframe;
 }
@@ -6,6 +6,8 @@ class Gui {
 public:
   static void drawImGui(AssetCache& cache);
   static void initImgui(VkInstance instance);
+  // Builds the scene pipelines again and swaps them in, for when the sample count or sample shading changed.
+  static void rebuildPipelines();
   static bool getWireframe();
   static float getLineWidth();
 };
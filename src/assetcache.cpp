@@ -1,14 +1,90 @@
-
 #include "assetcache.h"
+#include "utils/helpers.h"
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <string_view>
+
+// The second hash every hit is confirmed with. The standard library's byte hash shares nothing with hashBytes, so
+// a collision in one tells nothing about the other.
+static uint64_t checkHash(const void* data, size_t size) {
+  return std::hash<std::string_view>{}(std::string_view(static_cast<const char*>(data), size));
+}
+
+Texture* AssetCache::acquireTexture(const std::string& ID, SharedTexture& shared) {
+  shared.refCount++;
+  textureRegistry.insert_or_assign(ID, &shared);
+  return shared.texture.get();
+}
+AssetCache::SharedTexture* AssetCache::findTexture(uint64_t pixelHash, uint64_t pixelCheck, VkFormat format, bool streaming) {
+  auto [first, last] = textureStorage.equal_range(pixelHash);
+  for (auto it = first; it != last; ++it) {
+    Texture *texture = it->second.texture.get();
+    if (it->second.pixelCheck == pixelCheck && texture->getFormat() == format && texture->isStreaming() == streaming) {
+      return &it->second;
+    }
+  }
+  return nullptr;
+}
 
-Texture* AssetCache::fetchLoadTexture(const std::string& ID, const std::string& path) {
+Texture* AssetCache::fetchLoadTexture(const std::string& ID, const std::string& path, VkFormat format, bool streaming) {
   auto it = textureRegistry.find(ID);
   if(it != textureRegistry.end()) {
-    return &it->second;
+    return it->second->texture.get();
+  }
+
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    throw std::runtime_error("Failed to open texture: " + path);
+  }
+  std::vector<unsigned char> fileData((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+  // The same bytes loaded as sRGB and as UNORM (or streamed and not) are different images on the GPU, so both seed the hashes.
+  uint64_t variant = static_cast<uint64_t>(format) | (static_cast<uint64_t>(streaming) << 32);
+  uint64_t seed = hashBytes(&variant, sizeof(variant));
+  uint64_t fileHash = hashBytes(fileData.data(), fileData.size(), seed);
+  uint64_t fileCheck = checkHash(fileData.data(), fileData.size());
+  FileEntry *fileEntry = nullptr;
+  auto [firstFile, lastFile] = fileHashes.equal_range(fileHash);
+  for (auto fileIt = firstFile; fileIt != lastFile; ++fileIt) {
+    if (fileIt->second.fileCheck == fileCheck) {
+      fileEntry = &fileIt->second;
+    }
+  }
+  // The texture the file last decoded to may have been removed since.
+  if (fileEntry) {
+    if (SharedTexture *shared = findTexture(fileEntry->pixelHash, fileEntry->pixelCheck, format, streaming)) {
+      return acquireTexture(ID, *shared);
+    }
+  }
+
+  // Different files can still decode to identical pixels (re-encoded or renamed placeholders), so check again after decoding.
+  Texture::DecodedImage decoded = Texture::decode(fileData, path);
+  uint64_t dimensions[2] = {static_cast<uint64_t>(decoded.width), static_cast<uint64_t>(decoded.height)};
+  uint64_t pixelHash = hashBytes(decoded.pixels.data(), decoded.pixels.size(), hashBytes(dimensions, sizeof(dimensions), seed));
+  uint64_t pixelCheck = checkHash(decoded.pixels.data(), decoded.pixels.size());
+  if (fileEntry) {
+    *fileEntry = {fileCheck, pixelHash, pixelCheck};
   } else {
-    textureRegistry.insert_or_assign(ID, Texture(ID, path));
-    return &textureRegistry.at(ID);
+    fileHashes.emplace(fileHash, FileEntry{fileCheck, pixelHash, pixelCheck});
   }
+
+  SharedTexture *shared = findTexture(pixelHash, pixelCheck, format, streaming);
+  if (!shared) {
+    auto sharedIt = textureStorage.emplace(pixelHash, SharedTexture{std::make_unique<Texture>(ID, decoded, format, streaming), 0, pixelHash, pixelCheck});
+    shared = &sharedIt->second;
+  }
+  return acquireTexture(ID, *shared);
+}
+Texture* AssetCache::fetchLoadORMTexture(const std::string& ID, const std::string& aoPath, const std::string& roughnessPath, const std::string& metallicPath, bool streaming) {
+  auto it = textureRegistry.find(ID);
+  if(it != textureRegistry.end()) {
+    return it->second->texture.get();
+  }
+  // ORM data is linear, so it must not be run through the sRGB decode when sampled.
+  return fetchLoadTexture(ID, Texture::packORM(ID, aoPath, roughnessPath, metallicPath), VK_FORMAT_R8G8B8A8_UNORM, streaming);
 }
 Material* AssetCache::findMaterial(const std::string& ID) {
   auto it = materialRegistry.find(ID);
@@ -24,13 +100,42 @@ void AssetCache::store(std::unique_ptr<Material>&& material) {
 }
 void AssetCache::store(std::unique_ptr<Model>&& model) {
   modelRegistry.insert_or_assign(model->getID(), std::move(model));
+  modelGeneration++;
 }
 void AssetCache::remove(const std::string& ID) {
-  textureRegistry.erase(ID);
+  auto textureIt = textureRegistry.find(ID);
+  if (textureIt != textureRegistry.end()) {
+    SharedTexture& shared = *textureIt->second;
+    // Only free the image once the last ID referencing it is gone. Frames in flight may still sample it, destroy()
+    // leaves the image to DeferredDeletion.
+    if (--shared.refCount == 0) {
+      shared.texture->destroy();
+      auto [first, last] = textureStorage.equal_range(shared.pixelHash);
+      textureStorage.erase(std::find_if(first, last, [&](const auto& entry) { return &entry.second == &shared; }));
+    }
+    textureRegistry.erase(textureIt);
+  }
   materialRegistry.erase(ID);
-  modelRegistry.erase(ID);
+  if (modelRegistry.erase(ID) > 0) {
+    modelGeneration++;
+  }
+}
+void AssetCache::clear() {
+  // Models point at materials, which point at textures, so tear down in that order.
+  modelRegistry.clear();
+  modelGeneration++;
+  materialRegistry.clear();
+  for (auto& it : textureStorage) {
+    it.second.texture->destroy();
+  }
+  textureStorage.clear();
+  textureRegistry.clear();
+  fileHashes.clear();
 }
 
+uint32_t AssetCache::getUniqueTextureCount() const { return static_cast<uint32_t>(textureStorage.size()); }
+uint32_t AssetCache::getTextureCount() const { return static_cast<uint32_t>(textureRegistry.size()); }
+
 std::vector<Model*> AssetCache::getModels() {
   std::vector<Model*> models;
   for(auto& it : modelRegistry) {
@@ -39,3 +144,12 @@ std::vector<Model*> AssetCache::getModels() {
   return models;
 }
 
+uint64_t AssetCache::getModelGeneration() const { return modelGeneration; }
+
+std::vector<Material*> AssetCache::getMaterials() {
+  std::vector<Material*> materials;
+  for(auto& it : materialRegistry) {
+    materials.push_back(it.second.get());
+  }
+  return materials;
+}
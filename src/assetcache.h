@@ -3,6 +3,7 @@
 #include "graphics/material.h"
 #include "graphics/model.h"
 #include "graphics/texture.h"
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <unordered_map>
@@ -11,12 +12,41 @@
 
 class AssetCache {
   private:
-    std::unordered_map<std::string, Texture> textureRegistry;
+    // A single GPU image, shared by every texture ID whose file or decoded pixels match it.
+    struct SharedTexture {
+      std::unique_ptr<Texture> texture;
+      uint32_t refCount;
+      uint64_t pixelHash;
+      // A second hash of the pixels from an unrelated algorithm, a hit only counts when both match.
+      uint64_t pixelCheck;
+    };
+    // Keyed by the hash of the decoded pixels (and format), which is what actually lands on the GPU. Entries whose
+    // hashes collide share a bucket and are told apart by pixelCheck.
+    std::unordered_multimap<uint64_t, SharedTexture> textureStorage;
+    struct FileEntry {
+      uint64_t fileCheck;
+      uint64_t pixelHash;
+      uint64_t pixelCheck;
+    };
+    // File content hash -> pixel hashes, so a byte-identical file is matched without being decoded again.
+    std::unordered_multimap<uint64_t, FileEntry> fileHashes;
+    // Texture ID -> its entry, elements of the multimap stay where they are as it grows.
+    std::unordered_map<std::string, SharedTexture*> textureRegistry;
     std::unordered_map<std::string, std::unique_ptr<Material>> materialRegistry;
     std::unordered_map<std::string, std::unique_ptr<Model>> modelRegistry;
+
+    // Bumped whenever a model is stored or removed, so cached per model work can tell it's stale.
+    uint64_t modelGeneration = 0;
+
+    Texture* acquireTexture(const std::string& ID, SharedTexture& shared);
+    SharedTexture* findTexture(uint64_t pixelHash, uint64_t pixelCheck, VkFormat format, bool streaming);
     
   public:
-    Texture* fetchLoadTexture(const std::string& ID, const std::string& path);
+    // Streaming textures only keep the mips that are needed on screen in VRAM, see TextureStreamer.
+    Texture* fetchLoadTexture(const std::string& ID, const std::string& path, VkFormat format = VK_FORMAT_R8G8B8A8_SRGB, bool streaming = false);
+    // Packs the three maps into one (cached on disk) texture, see Texture::packORM.
+    Texture* fetchLoadORMTexture(const std::string& ID, const std::string& aoPath,
+                                 const std::string& roughnessPath, const std::string& metallicPath, bool streaming = false);
     Material* findMaterial(const std::string& ID);
     Model* findModel(const std::string& ID);
 
@@ -24,6 +54,14 @@ class AssetCache {
     void store(std::unique_ptr<Model>&& model);
 
     void remove(const std::string& ID);
+    // Free every GPU texture still held by the cache, along with the models and materials using them.
+    // Must run before the device is destroyed.
+    void clear();
+
+    uint32_t getUniqueTextureCount() const;
+    uint32_t getTextureCount() const;
 
     std::vector<Model*> getModels();
+    uint64_t getModelGeneration() const;
+    std::vector<Material*> getMaterials();
 };
@@ -1,4 +1,5 @@
 #include "devicelibrary.h"
+#include "settings.h"
 #include "utils/deletion.h"
 #include "utils/helpers.h"
 #include <algorithm>
@@ -21,6 +22,9 @@ std::vector<VkImageView> swapChainImageViews;
 VkFormat swapChainImageFormat;
 VkExtent2D swapChainExtent;
 
+bool descriptorBufferSupported = false;
+bool pipelineStatisticsSupported = false;
+
 struct SwapChainSupportDetails {
   VkSurfaceCapabilitiesKHR capabilities;
   std::vector<VkSurfaceFormatKHR> formats;
@@ -109,6 +113,30 @@ bool checkDeviceExtensionSupport(VkPhysicalDevice device) {
   return requiredExtensions.empty();
 }
 
+bool checkDescriptorBufferSupport(VkPhysicalDevice device) {
+  // Optional, when missing the bindless sets fall back to a regular descriptor pool.
+  uint32_t extensionCount;
+  vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+  std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+  vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+  bool extensionFound = std::any_of(availableExtensions.begin(), availableExtensions.end(), [](const VkExtensionProperties &extension) {
+    return std::string(extension.extensionName) == VK_EXT_DESCRIPTOR_BUFFER_EXTENSION_NAME;
+  });
+  if (!extensionFound) {
+    return false;
+  }
+  VkPhysicalDeviceDescriptorBufferFeaturesEXT descriptorBufferFeatures{
+    .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_FEATURES_EXT,
+  };
+  VkPhysicalDeviceFeatures2 features{
+    .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+    .pNext = &descriptorBufferFeatures,
+  };
+  vkGetPhysicalDeviceFeatures2(device, &features);
+  return descriptorBufferFeatures.descriptorBuffer;
+}
+
 bool isDeviceSuitable(VkPhysicalDevice device) {
   // These two are simple, create a structure to hold the apiVersion,
   // driverVersion, vendorID, deviceID and type, name, and a few other settings.
@@ -154,11 +182,11 @@ VkPresentModeKHR chooseSwapPresentMode(
   // The second of the three settings, arguably the most important, the
   // presentation mode! This dictates how images are displayed. MAILBOX is
   // basically equivalent to triple buffering, it avoids screen tearing with
-  // fairly low latency, However, it is not always supported, so in the case
-  // that it isn't, currently we will default to FIFO, This is most similarly to
-  // standard V-Sync.
+  // fairly low latency, IMMEDIATE doesn't wait at all and tears. Whichever the
+  // settings ask for is used when supported, otherwise we default to FIFO, the
+  // only mode that is guaranteed, and most similar to standard V-Sync.
   for (const auto &availablePresentMode : availablePresentModes) {
-    if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR) {
+    if (availablePresentMode == Settings::get().presentMode) {
       return availablePresentMode;
     }
   }
@@ -195,34 +223,12 @@ VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR &capabilities,
   }
 }
 
-VkSampleCountFlagBits getMaxUsableSampleCount() {
+VkSampleCountFlags querySampleCounts(VkPhysicalDevice device) {
   VkPhysicalDeviceProperties physicalDeviceProps;
-  VkSampleCountFlags maxCounts;
-  vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProps);
-
-  VkSampleCountFlags counts =
-      physicalDeviceProps.limits.framebufferColorSampleCounts &
-      physicalDeviceProps.limits.framebufferDepthSampleCounts;
-  if (counts & VK_SAMPLE_COUNT_64_BIT) {
-    return VK_SAMPLE_COUNT_64_BIT;
-  }
-  if (counts & VK_SAMPLE_COUNT_32_BIT) {
-    return VK_SAMPLE_COUNT_32_BIT;
-  }
-  if (counts & VK_SAMPLE_COUNT_16_BIT) {
-    return VK_SAMPLE_COUNT_16_BIT;
-  }
-  if (counts & VK_SAMPLE_COUNT_8_BIT) {
-    return VK_SAMPLE_COUNT_8_BIT;
-  }
-  if (counts & VK_SAMPLE_COUNT_4_BIT) {
-    return VK_SAMPLE_COUNT_4_BIT;
-  }
-  if (counts & VK_SAMPLE_COUNT_2_BIT) {
-    return VK_SAMPLE_COUNT_2_BIT;
-  }
+  vkGetPhysicalDeviceProperties(device, &physicalDeviceProps);
 
-  return VK_SAMPLE_COUNT_1_BIT;
+  return physicalDeviceProps.limits.framebufferColorSampleCounts &
+         physicalDeviceProps.limits.framebufferDepthSampleCounts;
 }
 // --------------------------------------- External Functions ----------------------------------------- //
 void DeviceControl::pickPhysicalDevice(VkInstance &instance) {
@@ -241,7 +247,7 @@ void DeviceControl::pickPhysicalDevice(VkInstance &instance) {
       // Once we have buttons or such, maybe ask the user or write a config file
       // for which GPU to use?
       physicalDevice = device;
-      perPixelSampleCount = getMaxUsableSampleCount();
+      perPixelSampleCount = getUsableSampleCount(Settings::get().msaaSamples);
       break;
     }
   }
@@ -276,9 +282,23 @@ void DeviceControl::createLogicalDevice() {
     queueCreateInfos.push_back(queueCreateSingularInfo);
   }
   
+  std::vector<const char *> enabledExtensions = deviceExtensions;
+  descriptorBufferSupported = checkDescriptorBufferSupport(physicalDevice);
+  VkPhysicalDeviceFeatures supportedFeatures;
+  vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+  pipelineStatisticsSupported = supportedFeatures.pipelineStatisticsQuery;
+  if (descriptorBufferSupported) {
+    enabledExtensions.push_back(VK_EXT_DESCRIPTOR_BUFFER_EXTENSION_NAME);
+  }
+  VkPhysicalDeviceDescriptorBufferFeaturesEXT descriptorBufferFeatures {
+    .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_FEATURES_EXT,
+    .pNext = nullptr,
+    .descriptorBuffer = true,
+  };
+
   VkPhysicalDeviceRayTracingPipelineFeaturesKHR raytracingFeatures {
     .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_FEATURES_KHR,
-    .pNext = nullptr,
+    .pNext = descriptorBufferSupported ? &descriptorBufferFeatures : nullptr,
   };
 
   VkPhysicalDeviceAccelerationStructureFeaturesKHR accelerationFeatures {
@@ -289,6 +309,7 @@ void DeviceControl::createLogicalDevice() {
   VkPhysicalDeviceVulkan12Features features12{
       .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
       .pNext = &accelerationFeatures,
+      .drawIndirectCount = true,
       .shaderSampledImageArrayNonUniformIndexing = true,
       .shaderStorageBufferArrayNonUniformIndexing = true,
       .shaderStorageImageArrayNonUniformIndexing = true,
@@ -309,18 +330,27 @@ void DeviceControl::createLogicalDevice() {
       .dynamicRendering = true,
 
   };
+  VkPhysicalDeviceVulkan14Features features14{
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_4_FEATURES,
+      .pNext = &features13,
+      .pushDescriptor = true,
+  };
   VkPhysicalDeviceFeatures featuresBase{
       .robustBufferAccess = true,
       .sampleRateShading = true,
+      .multiDrawIndirect = true,
+      .drawIndirectFirstInstance = true,
       .fillModeNonSolid = true,
       .wideLines = true,
       .largePoints = true,
       .samplerAnisotropy = true,
+      .pipelineStatisticsQuery = pipelineStatisticsSupported,
+      .shaderStorageImageWriteWithoutFormat = true,
   };
 
   VkPhysicalDeviceFeatures2 deviceFeatures{
       .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
-      .pNext = &features13,
+      .pNext = &features14,
       .features = featuresBase,
   };
 
@@ -329,8 +359,8 @@ void DeviceControl::createLogicalDevice() {
     .pNext = &deviceFeatures,
     .queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size()),
     .pQueueCreateInfos = queueCreateInfos.data(),
-    .enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size()),
-    .ppEnabledExtensionNames = deviceExtensions.data(),
+    .enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size()),
+    .ppEnabledExtensionNames = enabledExtensions.data(),
   };
   
   VK_CHECK(vkCreateDevice(physicalDevice, &createDeviceInfo, nullptr, &device));
@@ -339,7 +369,7 @@ void DeviceControl::createLogicalDevice() {
   vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
   vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
 }
-void DeviceControl::createSwapChain(GLFWwindow *window) {
+void DeviceControl::createSwapChain(GLFWwindow *window, VkSwapchainKHR oldSwapChain) {
   SwapChainSupportDetails swapChainSupport = querySwapChainSupport(physicalDevice);
 
   VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
@@ -370,7 +400,8 @@ void DeviceControl::createSwapChain(GLFWwindow *window) {
   // can use TRANSFER_DST and use a memory operation to transfer the image to a
   // swap chain, this is also a TODO item eventually.
   createSwapChainInfo.imageArrayLayers = 1;
-  createSwapChainInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+  // The scene is rendered elsewhere and upscaled in with a blit, only the UI is drawn into it directly.
+  createSwapChainInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
 
   // This handles swap chain images across multiple queue families, ie, if the
   // graphics queue family is different from the present queue
@@ -397,10 +428,9 @@ void DeviceControl::createSwapChain(GLFWwindow *window) {
   // that means you wont be able to read them reliably.. I am curious if this
   // would affect screen-space rendering techniques, may be something to note.
   createSwapChainInfo.clipped = VK_TRUE;
-  // This is something that needs to be implemented later, operations like
-  // resizing the window invalidate the swap chain and require you to recreate
-  // it and reference the old one specified here, will revisit in a few days.
-  // createSwapChainInfo.oldSwapchain = VK_NULL_HANDLE;
+  // Resizing the window invalidates the swap chain, the new one is created from the old one so frames still
+  // presenting from it can finish while we carry on. The caller destroys the old one once they have.
+  createSwapChainInfo.oldSwapchain = oldSwapChain;
 
   VK_CHECK(vkCreateSwapchainKHR(device, &createSwapChainInfo, nullptr, &swapChain));
 
@@ -412,10 +442,15 @@ void DeviceControl::createSwapChain(GLFWwindow *window) {
   swapChainExtent = extent;
 }
 
-VkImageView DeviceControl::createImageView(VkImage image, VkFormat format, VkImageAspectFlags flags, uint32_t mipLevels) {
+VkImageView DeviceControl::createImageView(VkImage image, VkFormat format, VkImageAspectFlags flags, uint32_t mipLevels, VkImageUsageFlags usage) {
   // This defines the parameters of a newly created image object!
+  VkImageViewUsageCreateInfo usageInfo{};
+  usageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_USAGE_CREATE_INFO;
+  usageInfo.usage = usage;
+
   VkImageViewCreateInfo viewInfo{};
   viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  viewInfo.pNext = usage != 0 ? &usageInfo : nullptr;
   viewInfo.image = image;
   viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
   viewInfo.format = format;
@@ -458,6 +493,22 @@ VkSampleCountFlagBits &DeviceControl::getPerPixelSampleCount() {
 VkQueue &DeviceControl::getGraphicsQueue() { return graphicsQueue; }
 VkQueue &DeviceControl::getPresentQueue() { return presentQueue; }
 VkSurfaceKHR &DeviceControl::getSurface() { return surface; }
+bool DeviceControl::supportsDescriptorBuffer() { return descriptorBufferSupported; }
+bool DeviceControl::supportsPipelineStatistics() { return pipelineStatisticsSupported; }
+VkSampleCountFlags DeviceControl::getSupportedSampleCounts() { return querySampleCounts(physicalDevice); }
+VkSampleCountFlagBits DeviceControl::getUsableSampleCount(VkSampleCountFlagBits requested) {
+  // The highest supported count that isn't over the request, 1 sample is always there.
+  VkSampleCountFlags counts = querySampleCounts(physicalDevice);
+  for (uint32_t samples = requested; samples > 1; samples >>= 1) {
+    if (counts & samples) {
+      return static_cast<VkSampleCountFlagBits>(samples);
+    }
+  }
+  return VK_SAMPLE_COUNT_1_BIT;
+}
+std::vector<VkPresentModeKHR> DeviceControl::getPresentModes() {
+  return querySwapChainSupport(physicalDevice).presentModes;
+}
 
 VkFormat findSupportedFormat(const std::vector<VkFormat> &candidates, VkImageTiling tiling, VkFormatFeatureFlags features) {
   for (VkFormat format : candidates) {
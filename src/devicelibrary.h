@@ -21,10 +21,13 @@ public:
   static void pickPhysicalDevice(VkInstance &instance);
   static void createLogicalDevice();
   static void createSurface(VkInstance &instance, GLFWwindow *window);
-  static void createSwapChain(GLFWwindow *window);
+  // Passing the swapchain being replaced lets the driver hand its resources over, it's retired but not destroyed.
+  static void createSwapChain(GLFWwindow *window, VkSwapchainKHR oldSwapChain = VK_NULL_HANDLE);
+  // A non-zero usage restricts what the view is used for, needed when the image has usages its format can't support.
   static VkImageView createImageView(VkImage image, VkFormat format,
                                      VkImageAspectFlags flags,
-                                     uint32_t mipLevels);
+                                     uint32_t mipLevels,
+                                     VkImageUsageFlags usage = 0);
   static void createImageViews();
   static void createCommandPool();
   static QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device);
@@ -43,4 +46,13 @@ public:
   static VkSampleCountFlagBits &getPerPixelSampleCount();
   static std::vector<VkImageView> &getSwapChainImageViews();
   static VkSwapchainKHR &getSwapChain();
+  // Whether VK_EXT_descriptor_buffer was found and enabled on the logical device.
+  static bool supportsDescriptorBuffer();
+  // Whether pipeline statistics queries were enabled, only used to count fragment shader invocations.
+  static bool supportsPipelineStatistics();
+  // Sample counts usable for both the color and depth targets.
+  static VkSampleCountFlags getSupportedSampleCounts();
+  // The closest supported count at or below the request.
+  static VkSampleCountFlagBits getUsableSampleCount(VkSampleCountFlagBits requested);
+  static std::vector<VkPresentModeKHR> getPresentModes();
 };
@@ -2,17 +2,33 @@
 #include "assetcache.h"
 #include "devicelibrary.h"
 #include "entrypoint.h"
+#include "settings.h"
 #include "graphics/buffers.h"
+#include "graphics/deferreddeletion.h"
 #include "graphics/graphicspipeline.h"
 
 #include "graphics/model.h"
 #include "graphics/pipelinebuilder.h"
+#include "graphics/downsampler.h"
+#include "graphics/dynamicresolution.h"
+#include "graphics/hizpyramid.h"
+#include "graphics/lightgrid.h"
+#include "graphics/materialtable.h"
+#include "graphics/meshpool.h"
+#include "graphics/objecttable.h"
+#include "graphics/samplercache.h"
+#include "graphics/secondarycommands.h"
+#include "graphics/shadowcascades.h"
+#include "graphics/temporalaa.h"
 #include "graphics/render.h"
+#include "graphics/rendergraph.h"
 #include "graphics/texture.h"
+#include "graphics/texturestreamer.h"
 #include "utils/helpers.h"
 #include "utils/types.h"
 #include <memory>
 #include "utils/deletion.h"
+#include "utils/threadpool.h"
 
 #include "volk.h"
 #define GLFW_INCLUDE_VULKAN
@@ -25,6 +41,7 @@ const uint32_t WIDTH = 800;
 const uint32_t HEIGHT = 600;
 
 DeletionQueue* DeletionQueue::instance = nullptr;
+ThreadPool* ThreadPool::instance = nullptr;
 
 // Getters and Setters!
 void EntryApp::setFramebufferResized(bool setter) {
@@ -81,21 +98,23 @@ void createInstance() {
   DeletionQueue::get().push_function([=](){vkDestroyInstance(vulkaninstance, nullptr);});
 }
 void initAgnosia() {
-  Texture* checkermap = cache.fetchLoadTexture("checkermap", "assets/textures/checkermap.png");
-  Texture* metallicPlaceholder = cache.fetchLoadTexture("metallicPlaceholder", "assets/textures/placeholderMetallic.jpg");
-  Texture* roughnessPlaceholder = cache.fetchLoadTexture("roughnessPlaceholder", "assets/textures/placeholderRoughness.jpg");
-  Texture* ambientOcclusionPlaceholder = cache.fetchLoadTexture("ambientOcclusionPlaceholder", "assets/textures/placeholderAO.jpg");
+  Texture::beginUploads();
+  Texture* checkermap = cache.fetchLoadTexture("checkermap", "assets/textures/checkermap.png", VK_FORMAT_R8G8B8A8_SRGB, true);
+  Texture* ormPlaceholder = cache.fetchLoadORMTexture("ormPlaceholder", "assets/textures/placeholderAO.jpg",
+                                                                        "assets/textures/placeholderRoughness.jpg",
+                                                                        "assets/textures/placeholderMetallic.jpg", true);
+  Texture::submitUploads();
   
-  auto sphereMaterial = std::make_unique<Material>("sphereMaterial", checkermap, metallicPlaceholder, roughnessPlaceholder, ambientOcclusionPlaceholder);
-  auto stanfordDragonMaterial = std::make_unique<Material>("stanfordDragonMaterial", checkermap, metallicPlaceholder, roughnessPlaceholder, ambientOcclusionPlaceholder);
-  auto teapotMaterial = std::make_unique<Material>("teapotMaterial", checkermap, metallicPlaceholder, roughnessPlaceholder, ambientOcclusionPlaceholder);
+  auto sphereMaterial = std::make_unique<Material>("sphereMaterial", checkermap, ormPlaceholder);
+  auto stanfordDragonMaterial = std::make_unique<Material>("stanfordDragonMaterial", checkermap, ormPlaceholder);
+  auto teapotMaterial = std::make_unique<Material>("teapotMaterial", checkermap, ormPlaceholder);
   cache.store(std::move(sphereMaterial));
   cache.store(std::move(stanfordDragonMaterial));
   cache.store(std::move(teapotMaterial));
 
-  auto uvSphere = std::make_unique<Model>("uvSphere", *cache.findMaterial("sphereMaterial"), "assets/models/UVSphere.obj", glm::vec3(0.0f, 0.0f, 0.0f));
-  auto stanfordDragon = std::make_unique<Model>("stanfordDragon", *cache.findMaterial("stanfordDragonMaterial"), "assets/models/StanfordDragon800k.obj", glm::vec3(0.0f, 2.0f, 0.0f));
-  auto teapot = std::make_unique<Model>("teapot", *cache.findMaterial("teapotMaterial"), "assets/models/teapot.obj", glm::vec3(1.0f, -3.0f, -1.0f));
+  auto uvSphere = std::make_unique<Model>("uvSphere", cache.findMaterial("sphereMaterial"), "assets/models/UVSphere.obj", glm::vec3(0.0f, 0.0f, 0.0f), true);
+  auto stanfordDragon = std::make_unique<Model>("stanfordDragon", cache.findMaterial("stanfordDragonMaterial"), "assets/models/StanfordDragon800k.obj", glm::vec3(0.0f, 2.0f, 0.0f), true);
+  auto teapot = std::make_unique<Model>("teapot", cache.findMaterial("teapotMaterial"), "assets/models/teapot.obj", glm::vec3(1.0f, -3.0f, -1.0f));
   cache.store(std::move(uvSphere));
   cache.store(std::move(stanfordDragon));
   cache.store(std::move(teapot));
@@ -107,44 +126,111 @@ void initVulkan() {
   // Initialize vulkan and set up pipeline.
   createInstance();
   volkLoadInstance(vulkaninstance);
+  // The sample count and present mode are picked from these.
+  Settings::load();
   DeviceControl::createSurface(vulkaninstance, window);
   DeviceControl::pickPhysicalDevice(vulkaninstance);
   DeviceControl::createLogicalDevice();
   volkLoadDevice(DeviceControl::getDevice());
   DeviceControl::createSwapChain(window);
   Buffers::createMemoryAllocator(vulkaninstance);
+  DeferredDeletion::init();
+  RenderGraph::init();
   DeviceControl::createImageViews();
   Buffers::createDescriptorSetLayout();
   PipelineBuilder builder;
     
-  Agnosia_T::Pipeline graphics = builder.setCullMode(VK_CULL_MODE_BACK_BIT).Build();
+  Agnosia_T::Pipeline graphics = builder.setCullMode(VK_CULL_MODE_BACK_BIT).setDynamicDepth(VK_TRUE).Build();
+  Agnosia_T::Pipeline depthPrepass = PipelineBuilder().setVertexShader("src/shaders/depth.vert")
+                                                      .setFragmentShader("")
+                                                      .setColorWriteMask(0)
+                                                      .setCullMode(VK_CULL_MODE_BACK_BIT)
+                                                      .setDynamicDepth(VK_TRUE)
+                                                      .Build();
 
   Agnosia_T::Pipeline fullscreen = builder.setCullMode(VK_CULL_MODE_NONE)
+                                          .setDynamicDepth(VK_FALSE)
                                           .setVertexShader("src/shaders/fullscreen.vert")
                                           .setFragmentShader("src/shaders/fullscreen.frag")
                                           .setDepthCompareOp(VK_COMPARE_OP_LESS_OR_EQUAL)
                                           .Build();
                                       
   Graphics::addGraphicsPipeline(graphics);
+  Graphics::addDepthPrepassPipeline(depthPrepass);
   Graphics::addFullscreenPipeline(fullscreen);
+  Graphics::createCullPipeline();
   Buffers::createDescriptorPool();
   Graphics::createCommandPool();
+  TextureStreamer::init();
+  Downsampler::createPipeline();
+  TemporalAA::createPipeline();
+  LightGrid::createPipeline();
+  ShadowCascades::createPipeline();
+  // Textures take a bindless slot as they load, so the sets have to exist first.
+  Buffers::createDescriptorSet();
+  SamplerCache::init();
+  MaterialTable::create();
+  ObjectTable::create();
+  LightGrid::create();
+  ShadowCascades::create();
+  MeshPool::create();
   initAgnosia();
   // Image creation MUST be after command pool, because command buffers are utilized.
   Texture::createColorImage();
   Texture::createDepthImage();
-  Buffers::createDescriptorSet(cache.getModels());
+  Texture::createSceneImage();
+  HiZPyramid::create();
+  TemporalAA::create();
   Graphics::createCommandBuffer();
+  SecondaryCommands::create();
+  Graphics::createFrameData();
+  DynamicResolution::create();
   Render::createSyncObject();
   
 
   Gui::initImgui(vulkaninstance);
 }
 
+// Anything the settings tab asked for last frame, applied between frames.
+void applySettings() {
+  const Settings::Quality previous = Settings::get();
+  Settings::Quality quality;
+  if (!Settings::takeRequest(quality)) {
+    return;
+  }
+  // Nothing in flight can be using what gets replaced.
+  vkDeviceWaitIdle(DeviceControl::getDevice());
+
+  const VkSampleCountFlagBits samples = DeviceControl::getUsableSampleCount(quality.msaaSamples);
+  const bool samplesChanged = samples != DeviceControl::getPerPixelSampleCount();
+  DeviceControl::getPerPixelSampleCount() = samples;
+  if (quality.presentMode != previous.presentMode) {
+    // Brings new render targets along with it.
+    Render::recreateSwapChain();
+  } else if (samplesChanged) {
+    Render::recreateRenderTargets();
+  }
+  if (samplesChanged || quality.sampleShading != previous.sampleShading || quality.minSampleShading != previous.minSampleShading) {
+    Gui::rebuildPipelines();
+  }
+  if (quality.maxAnisotropy != previous.maxAnisotropy) {
+    // Each material asks the sampler cache again, which applies the new cap.
+    for (Material *material : cache.getMaterials()) {
+      material->markDirty();
+    }
+  }
+  if (quality.framesInFlight != previous.framesInFlight) {
+    Render::setCurrentFrame(0);
+  }
+  Settings::save();
+}
+
 void mainLoop() {
   while (!glfwWindowShouldClose(window)) {
     glfwPollEvents();
 
+    applySettings();
+
     Gui::drawImGui(cache);
     Render::drawFrame(cache);
   }
@@ -152,6 +238,9 @@ void mainLoop() {
 }
 
 void cleanup() {
+  DeletionQueue::get().push_function([=](){cache.clear();});
+  // Before the models go, a frame that gave up early may have left occlusion work running.
+  DeletionQueue::get().push_function([=](){ThreadPool::destruct();});
   DeletionQueue::get().push_function([=](){Render::cleanupSwapChain();});
   DeletionQueue::get().flush();
   
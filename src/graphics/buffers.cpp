@@ -1,6 +1,8 @@
 #include "../devicelibrary.h"
+#include "../settings.h"
 #include "../utils/helpers.h"
 #include "buffers.h"
+#include "deferreddeletion.h"
 #include "model.h"
 #include <cstdint>
 #include <glm/ext/matrix_clip_space.hpp>
@@ -25,6 +27,8 @@ constexpr int SAMPLER_BINDING = 2;
 constexpr int STORAGE_COUNT = 65536;
 constexpr int SAMPLER_COUNT = 65536;
 constexpr int IMAGE_COUNT = 65536;
+// The spec only guarantees 4000 live samplers, there is no point making the sampler heap larger than that.
+constexpr int DESCRIPTOR_BUFFER_SAMPLER_COUNT = 4000;
 
 // Create descriptor pool
 VkDescriptorPool descriptorPool;
@@ -32,14 +36,34 @@ VkDescriptorPool descriptorPool;
 VkDescriptorSetLayout texturesSetLayouts;
 VkDescriptorSet texturesSets;
 
-VkSampler sampler;
 VkDescriptorSetLayout samplerDescriptorSetLayout;
 VkDescriptorSet samplerDescriptorSet;
 
+// Descriptor buffer backend (VK_EXT_descriptor_buffer), when in use the sets above are never allocated and both
+// bindless sets are bound straight from these buffers instead.
+bool useDescriptorBuffer = false;
+VkPhysicalDeviceDescriptorBufferPropertiesEXT descriptorBufferProperties = {
+  .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_PROPERTIES_EXT,
+};
+Agnosia_T::AllocatedBuffer resourceDescriptorBuffer;
+Agnosia_T::AllocatedBuffer samplerDescriptorBuffer;
+VkDeviceAddress resourceDescriptorAddress;
+VkDeviceAddress samplerDescriptorAddress;
+VkDeviceSize resourceDescriptorSize;
+VkDeviceSize samplerDescriptorSize;
+VkDeviceSize imageBindingOffset;
+VkDeviceSize samplerBindingOffset;
+
 VkCommandPool commandPool;
 std::vector<VkCommandBuffer> commandBuffers;
 
-const int MAX_FRAMES_IN_FLIGHT = 2;
+// Everything per frame is sized for the most frames the settings allow, fewer may actually be in use.
+const int MAX_FRAMES_IN_FLIGHT = Settings::MAX_FRAMES_IN_FLIGHT;
+
+// Texture slot allocation, freed slots come back through DeferredDeletion once no frame in flight can read them.
+std::vector<uint32_t> freeTextureSlots;
+uint32_t nextTextureSlot = 0;
+uint32_t usedTextureSlots = 0;
 
 VmaAllocator allocator;
 
@@ -61,6 +85,33 @@ void Buffers::createMemoryAllocator(VkInstance vkInstance) {
   DeletionQueue::get().push_function([=](){vmaDestroyAllocator(allocator);});
 }
 
+VkDescriptorSetLayout createBindlessLayout(const std::vector<VkDescriptorSetLayoutBinding> &bindings, bool descriptorBuffer) {
+  // Descriptor buffers have no notion of update-after-bind, descriptors are plain memory and writing one only has to
+  // avoid what a frame in flight reads, which the slot allocator already guarantees.
+  VkDescriptorBindingFlags flags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT;
+  if (!descriptorBuffer) {
+    flags |= VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT;
+  }
+  std::vector<VkDescriptorBindingFlags> bindingFlags(bindings.size(), flags);
+  VkDescriptorSetLayoutBindingFlagsCreateInfo setLayoutBindingsFlags = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO,
+      .bindingCount = static_cast<uint32_t>(bindingFlags.size()),
+      .pBindingFlags = bindingFlags.data(),
+  };
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+      .pNext = &setLayoutBindingsFlags,
+      .flags = descriptorBuffer ? VK_DESCRIPTOR_SET_LAYOUT_CREATE_DESCRIPTOR_BUFFER_BIT_EXT
+                                : VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT,
+      .bindingCount = static_cast<uint32_t>(bindings.size()),
+      .pBindings = bindings.data(),
+  };
+  VkDescriptorSetLayout layout;
+  VK_CHECK(vkCreateDescriptorSetLayout(DeviceControl::getDevice(), &layoutInfo, nullptr, &layout));
+  return layout;
+}
+
 void Buffers::createDescriptorSetLayout() {
   // Create a table of pointers to data, a Descriptor Set!
 
@@ -88,37 +139,46 @@ void Buffers::createDescriptorSetLayout() {
       .pImmutableSamplers = nullptr,
   };
 
-  std::vector<VkDescriptorSetLayoutBinding> bindings = {
-      storageLayoutBinding, imageLayoutBinding, samplerLayoutBinding};
+  if (DeviceControl::supportsDescriptorBuffer()) {
+    // Resources and samplers come from differently flagged buffers, so each set only holds one kind. Samplers are
+    // capped to what a device can ever have allocated at once.
+    samplerLayoutBinding.descriptorCount = DESCRIPTOR_BUFFER_SAMPLER_COUNT;
+    texturesSetLayouts = createBindlessLayout({storageLayoutBinding, imageLayoutBinding}, true);
+    samplerDescriptorSetLayout = createBindlessLayout({samplerLayoutBinding}, true);
 
-  std::vector<VkDescriptorBindingFlags> bindingFlags = {
-      VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT,
-      VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT,
-      VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT,
-  };
-  VkDescriptorSetLayoutBindingFlagsCreateInfo setLayoutBindingsFlags = {
-      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO,
-      .bindingCount = 3,
-      .pBindingFlags = bindingFlags.data(),
-  };
-
-  VkDescriptorSetLayoutCreateInfo layoutInfo = {
-      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-      .pNext = &setLayoutBindingsFlags,
-      .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT,
-      .bindingCount = static_cast<uint32_t>(bindings.size()),
-      .pBindings = bindings.data(),
-
-  };
-  
-    VK_CHECK(vkCreateDescriptorSetLayout(DeviceControl::getDevice(), &layoutInfo, nullptr, &texturesSetLayouts));
-    DeletionQueue::get().push_function([=](){vkDestroyDescriptorSetLayout(DeviceControl::getDevice(), texturesSetLayouts, nullptr);});
-    
-  
-    VK_CHECK(vkCreateDescriptorSetLayout(DeviceControl::getDevice(), &layoutInfo, nullptr, &samplerDescriptorSetLayout));
-    DeletionQueue::get().push_function([=](){vkDestroyDescriptorSetLayout(DeviceControl::getDevice(), samplerDescriptorSetLayout, nullptr);});
+    VkPhysicalDeviceProperties2 properties = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+      .pNext = &descriptorBufferProperties,
+    };
+    vkGetPhysicalDeviceProperties2(DeviceControl::getPhysicalDevice(), &properties);
+    vkGetDescriptorSetLayoutSizeEXT(DeviceControl::getDevice(), texturesSetLayouts, &resourceDescriptorSize);
+    vkGetDescriptorSetLayoutSizeEXT(DeviceControl::getDevice(), samplerDescriptorSetLayout, &samplerDescriptorSize);
+    vkGetDescriptorSetLayoutBindingOffsetEXT(DeviceControl::getDevice(), texturesSetLayouts, IMAGE_BINDING, &imageBindingOffset);
+    vkGetDescriptorSetLayoutBindingOffsetEXT(DeviceControl::getDevice(), samplerDescriptorSetLayout, SAMPLER_BINDING, &samplerBindingOffset);
+
+    useDescriptorBuffer = resourceDescriptorSize <= descriptorBufferProperties.maxResourceDescriptorBufferRange &&
+                          samplerDescriptorSize <= descriptorBufferProperties.maxSamplerDescriptorBufferRange;
+    if (!useDescriptorBuffer) {
+      // Too big for this device to address in one binding, fall back to the pool.
+      vkDestroyDescriptorSetLayout(DeviceControl::getDevice(), texturesSetLayouts, nullptr);
+      vkDestroyDescriptorSetLayout(DeviceControl::getDevice(), samplerDescriptorSetLayout, nullptr);
+      samplerLayoutBinding.descriptorCount = SAMPLER_COUNT;
+    }
+  }
+  if (!useDescriptorBuffer) {
+    std::vector<VkDescriptorSetLayoutBinding> bindings = {
+        storageLayoutBinding, imageLayoutBinding, samplerLayoutBinding};
+    texturesSetLayouts = createBindlessLayout(bindings, false);
+    samplerDescriptorSetLayout = createBindlessLayout(bindings, false);
+  }
+  DeletionQueue::get().push_function([=](){vkDestroyDescriptorSetLayout(DeviceControl::getDevice(), texturesSetLayouts, nullptr);});
+  DeletionQueue::get().push_function([=](){vkDestroyDescriptorSetLayout(DeviceControl::getDevice(), samplerDescriptorSetLayout, nullptr);});
 }
 void Buffers::createDescriptorPool() {
+  if (useDescriptorBuffer) {
+    // Descriptors live in our own buffers, nothing to pool.
+    return;
+  }
 
   std::vector<VkDescriptorPoolSize> poolSizes = {
       {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, STORAGE_COUNT},
@@ -136,75 +196,59 @@ void Buffers::createDescriptorPool() {
   VK_CHECK(vkCreateDescriptorPool(DeviceControl::getDevice(), &poolInfo, nullptr, &descriptorPool));
   DeletionQueue::get().push_function([=](){vkDestroyDescriptorPool(DeviceControl::getDevice(), descriptorPool, nullptr);});
 }
-void Buffers::createDescriptorSet(std::vector<Model *> models) {
-  // Create the allocater struct for the textures.
-  VkDescriptorSetAllocateInfo textureAllocInfo = {
-    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-    .descriptorPool = descriptorPool,
-    .descriptorSetCount = 1,
-    .pSetLayouts = &texturesSetLayouts,
-  };
-  VK_CHECK(vkAllocateDescriptorSets(DeviceControl::getDevice(), &textureAllocInfo, &texturesSets));
-  // Create the allocater struct for the samplers.
-  VkDescriptorSetAllocateInfo samplerAllocInfo = {
-    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-    .descriptorPool = descriptorPool,
-    .descriptorSetCount = 1,
-    .pSetLayouts = &samplerDescriptorSetLayout,
-  };
-  VK_CHECK(vkAllocateDescriptorSets(DeviceControl::getDevice(), &samplerAllocInfo, &samplerDescriptorSet));
-  
-  for(int model = 0; model < models.size(); model++) {
-    // Textures for each model
-    VkDescriptorImageInfo modelTexInfo[4];
-    for(int i = 0; i < 4; i++) {
-      modelTexInfo[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    }
-    
-    modelTexInfo[0].imageView = models[model]->getMaterial().getDiffuseTexture()->getImageView();
-    modelTexInfo[1].imageView = models[model]->getMaterial().getMetallicTexture()->getImageView();
-    modelTexInfo[2].imageView = models[model]->getMaterial().getAOTexture()->getImageView();
-    modelTexInfo[3].imageView = models[model]->getMaterial().getRoughnessTexture()->getImageView();
-
-    VkWriteDescriptorSet modelTexWriter = {
-      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-      .dstSet = texturesSets,
-      .dstBinding = IMAGE_BINDING,
-      .dstArrayElement = static_cast<uint32_t>(4*(model+1)),
-      .descriptorCount = 4,
-      .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
-      .pImageInfo = modelTexInfo,
-    };
-    vkUpdateDescriptorSets(DeviceControl::getDevice(), 1, &modelTexWriter, 0, nullptr);
-  }  
-
-  // Now we create the one sampler we are going to use right now.
-  VkPhysicalDeviceProperties properties{};
-  vkGetPhysicalDeviceProperties(DeviceControl::getPhysicalDevice(), &properties);
-
-  VkSamplerCreateInfo samplerInfo = {
-    .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
-    .pNext = nullptr,
-    .magFilter = VK_FILTER_LINEAR,
-    .minFilter = VK_FILTER_LINEAR,
-    .mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
-    .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
-    .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
-    .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
-    .mipLodBias = 0.0f,
-    .anisotropyEnable = VK_TRUE,
-    .maxAnisotropy = properties.limits.maxSamplerAnisotropy,
-    .compareEnable = VK_FALSE,
-    .compareOp = VK_COMPARE_OP_ALWAYS,
-    .minLod = 0.0f,
-    .maxLod = VK_LOD_CLAMP_NONE,
-    .borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK,
-    .unnormalizedCoordinates = VK_FALSE,
+Agnosia_T::AllocatedBuffer createDescriptorBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkDeviceAddress &address) {
+  // Host visible so descriptors can be written in place, VMA will still pick device local memory when it's mappable.
+  Agnosia_T::AllocatedBuffer buffer = Buffers::createBuffer(size,
+    VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT,
+    usage | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_AUTO);
+  VkBufferDeviceAddressInfo addressInfo = {
+    .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+    .buffer = buffer.buffer,
   };
+  address = vkGetBufferDeviceAddress(DeviceControl::getDevice(), &addressInfo);
+  DeletionQueue::get().push_function([=](){vmaDestroyBuffer(allocator, buffer.buffer, buffer.allocation);});
+  return buffer;
+}
+void writeDescriptor(const Agnosia_T::AllocatedBuffer &buffer, VkDeviceSize offset, const VkDescriptorGetInfoEXT &getInfo, size_t size) {
+  vkGetDescriptorEXT(DeviceControl::getDevice(), &getInfo, size, static_cast<char *>(buffer.info.pMappedData) + offset);
+  // No-op on coherent memory.
+  vmaFlushAllocation(allocator, buffer.allocation, offset, size);
+}
 
-  VK_CHECK(vkCreateSampler(DeviceControl::getDevice(), &samplerInfo, nullptr, &sampler));
-  DeletionQueue::get().push_function([=](){vkDestroySampler(DeviceControl::getDevice(), sampler, nullptr);});
-  
+void Buffers::createDescriptorSet() {
+  if (useDescriptorBuffer) {
+    resourceDescriptorBuffer = createDescriptorBuffer(resourceDescriptorSize, VK_BUFFER_USAGE_RESOURCE_DESCRIPTOR_BUFFER_BIT_EXT, resourceDescriptorAddress);
+    samplerDescriptorBuffer = createDescriptorBuffer(samplerDescriptorSize, VK_BUFFER_USAGE_SAMPLER_DESCRIPTOR_BUFFER_BIT_EXT, samplerDescriptorAddress);
+  } else {
+    // Create the allocater struct for the textures.
+    VkDescriptorSetAllocateInfo textureAllocInfo = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+      .descriptorPool = descriptorPool,
+      .descriptorSetCount = 1,
+      .pSetLayouts = &texturesSetLayouts,
+    };
+    VK_CHECK(vkAllocateDescriptorSets(DeviceControl::getDevice(), &textureAllocInfo, &texturesSets));
+    // Create the allocater struct for the samplers.
+    VkDescriptorSetAllocateInfo samplerAllocInfo = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+      .descriptorPool = descriptorPool,
+      .descriptorSetCount = 1,
+      .pSetLayouts = &samplerDescriptorSetLayout,
+    };
+    VK_CHECK(vkAllocateDescriptorSets(DeviceControl::getDevice(), &samplerAllocInfo, &samplerDescriptorSet));
+  }
+}
+void Buffers::writeSamplerSlot(uint32_t slot, VkSampler sampler) {
+  if (useDescriptorBuffer) {
+    VkDescriptorGetInfoEXT getInfo = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_GET_INFO_EXT,
+      .type = VK_DESCRIPTOR_TYPE_SAMPLER,
+      .data = {.pSampler = &sampler},
+    };
+    size_t descriptorSize = descriptorBufferProperties.samplerDescriptorSize;
+    writeDescriptor(samplerDescriptorBuffer, samplerBindingOffset + slot * descriptorSize, getInfo, descriptorSize);
+    return;
+  }
   VkDescriptorImageInfo samplerInfoSet = {
     .sampler = sampler,
   };
@@ -213,6 +257,7 @@ void Buffers::createDescriptorSet(std::vector<Model *> models) {
     .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
     .dstSet = samplerDescriptorSet,
     .dstBinding = SAMPLER_BINDING,
+    .dstArrayElement = slot,
     .descriptorCount = 1,
     .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER,
     .pImageInfo = &samplerInfoSet,
@@ -221,6 +266,82 @@ void Buffers::createDescriptorSet(std::vector<Model *> models) {
   vkUpdateDescriptorSets(DeviceControl::getDevice(), 1, &samplerWriteSet, 0, nullptr);
 }
 
+uint32_t Buffers::allocateTextureSlot(VkImageView imageView) {
+  uint32_t slot;
+  if (!freeTextureSlots.empty()) {
+    slot = freeTextureSlots.back();
+    freeTextureSlots.pop_back();
+  } else {
+    if (nextTextureSlot >= IMAGE_COUNT) {
+      throw std::runtime_error("Ran out of bindless texture slots!");
+    }
+    slot = nextTextureSlot++;
+  }
+  usedTextureSlots++;
+  writeTextureSlot(slot, imageView);
+  return slot;
+}
+void Buffers::writeTextureSlot(uint32_t slot, VkImageView imageView) {
+  // UPDATE_AFTER_BIND lets us write this while the set is bound, as long as no frame in flight reads this slot.
+  VkDescriptorImageInfo imageInfo = {
+    .imageView = imageView,
+    .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+  };
+  if (useDescriptorBuffer) {
+    // Same rule with a descriptor buffer, except the write is a straight memcpy into the bound buffer.
+    VkDescriptorGetInfoEXT getInfo = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_GET_INFO_EXT,
+      .type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+      .data = {.pSampledImage = &imageInfo},
+    };
+    size_t descriptorSize = descriptorBufferProperties.sampledImageDescriptorSize;
+    writeDescriptor(resourceDescriptorBuffer, imageBindingOffset + slot * descriptorSize, getInfo, descriptorSize);
+    return;
+  }
+  VkWriteDescriptorSet textureWriter = {
+    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+    .dstSet = texturesSets,
+    .dstBinding = IMAGE_BINDING,
+    .dstArrayElement = slot,
+    .descriptorCount = 1,
+    .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+    .pImageInfo = &imageInfo,
+  };
+  vkUpdateDescriptorSets(DeviceControl::getDevice(), 1, &textureWriter, 0, nullptr);
+}
+void Buffers::freeTextureSlot(uint32_t slot) {
+  DeferredDeletion::textureSlot(slot);
+  usedTextureSlots--;
+}
+void Buffers::reuseTextureSlot(uint32_t slot) { freeTextureSlots.push_back(slot); }
+uint32_t Buffers::getTextureSlotCount() { return usedTextureSlots; }
+
+void Buffers::bindDescriptors(VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint, VkPipelineLayout layout) {
+  if (useDescriptorBuffer) {
+    VkDescriptorBufferBindingInfoEXT bindingInfos[] = {
+      {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_BUFFER_BINDING_INFO_EXT,
+        .address = resourceDescriptorAddress,
+        .usage = VK_BUFFER_USAGE_RESOURCE_DESCRIPTOR_BUFFER_BIT_EXT,
+      },
+      {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_BUFFER_BINDING_INFO_EXT,
+        .address = samplerDescriptorAddress,
+        .usage = VK_BUFFER_USAGE_SAMPLER_DESCRIPTOR_BUFFER_BIT_EXT,
+      },
+    };
+    vkCmdBindDescriptorBuffersEXT(commandBuffer, 2, bindingInfos);
+    // Set 0 reads from buffer 0 and set 1 from buffer 1, both from the start.
+    uint32_t bufferIndices[] = {0, 1};
+    VkDeviceSize offsets[] = {0, 0};
+    vkCmdSetDescriptorBufferOffsetsEXT(commandBuffer, bindPoint, layout, 0, 2, bufferIndices, offsets);
+    return;
+  }
+  VkDescriptorSet sets[] = {texturesSets, samplerDescriptorSet};
+  vkCmdBindDescriptorSets(commandBuffer, bindPoint, layout, 0, 2, sets, 0, nullptr);
+}
+bool Buffers::usesDescriptorBuffer() { return useDescriptorBuffer; }
+
 uint32_t Buffers::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) {
   // Graphics cards offer different types of memory to allocate from, here we
   // query to find the right type of memory for our needs. Query the available
@@ -17,8 +17,24 @@ public:
   static void createMemoryAllocator(VkInstance vkInstance);
   static VmaAllocator getAllocator();
   static void createDescriptorSetLayout();
-  static void createDescriptorSet(std::vector<Model *> models);
+  static void createDescriptorSet();
   static void createDescriptorPool();
+
+  // Bindless texture slots, an index into the sampled image array that stays the same for as long as the image lives.
+  // Only the slot's own descriptor is written, the rest of the set is left alone.
+  static uint32_t allocateTextureSlot(VkImageView imageView);
+  static void writeTextureSlot(uint32_t slot, VkImageView imageView);
+  // Freed slots go through DeferredDeletion, they are only handed out again once every frame submitted before has finished.
+  static void freeTextureSlot(uint32_t slot);
+  // For DeferredDeletion, once no frame in flight can read the slot.
+  static void reuseTextureSlot(uint32_t slot);
+  static uint32_t getTextureSlotCount();
+  // Samplers are handed out by the SamplerCache, this only writes the descriptor.
+  static void writeSamplerSlot(uint32_t slot, VkSampler sampler);
+  // Bind both bindless sets (0 and 1) for the given layout, through descriptor buffers when the device has them.
+  static void bindDescriptors(VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint, VkPipelineLayout layout);
+  // Pipelines using the bindless sets must be created with VK_PIPELINE_CREATE_DESCRIPTOR_BUFFER_BIT_EXT when true.
+  static bool usesDescriptorBuffer();
   
   
   static uint32_t findMemoryType(uint32_t typeFilter,
@@ -29,6 +45,7 @@ public:
   static VkDescriptorSetLayout &getTextureDescriptorSetLayouts();
   static VkDescriptorSetLayout &getSamplerDescriptorSetLayout();
   
+  // How many of each per frame resource exist, Settings::get().framesInFlight says how many are cycled through.
   static uint32_t getMaxFramesInFlight();
   static std::vector<VkCommandBuffer> &getCommandBuffers();
 
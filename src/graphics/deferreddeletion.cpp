@@ -0,0 +1,132 @@
+#include "deferreddeletion.h"
+#include "buffers.h"
+#include "meshpool.h"
+#include "../devicelibrary.h"
+#include "../utils/deletion.h"
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+struct RetiredImage {
+  VkImage image;
+  VmaAllocation allocation;
+};
+struct RetiredIndexRange {
+  uint32_t firstIndex;
+  uint32_t indexCount;
+};
+// Everything handed over while `serial` was the last submission, grouped by type so each is destroyed in one loop.
+struct RetiredBatch {
+  uint64_t serial;
+  std::vector<Agnosia_T::Pipeline> pipelines;
+  std::vector<VkImageView> imageViews;
+  std::vector<RetiredImage> images;
+  std::vector<Agnosia_T::AllocatedBuffer> buffers;
+  std::vector<VmaAllocation> memory;
+  std::vector<VkSemaphore> semaphores;
+  std::vector<VkSwapchainKHR> swapChains;
+  std::vector<RetiredIndexRange> indexRanges;
+  std::vector<uint32_t> textureSlots;
+};
+std::deque<RetiredBatch> retiredBatches;
+// Destroyed batches, emptied but keeping their capacity, so steady asset churn doesn't allocate.
+std::vector<RetiredBatch> spareBatches;
+uint64_t lastSubmittedSerial = 0;
+uint64_t lastCompletedSerial = 0;
+uint32_t pendingHandles = 0;
+
+static RetiredBatch &currentBatch() {
+  pendingHandles++;
+  if (!retiredBatches.empty() && retiredBatches.back().serial == lastSubmittedSerial) {
+    return retiredBatches.back();
+  }
+  if (spareBatches.empty()) {
+    retiredBatches.emplace_back();
+  } else {
+    retiredBatches.push_back(std::move(spareBatches.back()));
+    spareBatches.pop_back();
+  }
+  retiredBatches.back().serial = lastSubmittedSerial;
+  return retiredBatches.back();
+}
+// Views before the images they look at, images and buffers before memory they were only bound to, and the swapchain
+// after the views of its images.
+static void destroyBatch(RetiredBatch &batch) {
+  VkDevice device = DeviceControl::getDevice();
+  for (const Agnosia_T::Pipeline &pipeline : batch.pipelines) {
+    vkDestroyPipeline(device, pipeline.pipeline, nullptr);
+    vkDestroyPipelineLayout(device, pipeline.layout, nullptr);
+  }
+  for (VkImageView imageView : batch.imageViews) {
+    vkDestroyImageView(device, imageView, nullptr);
+  }
+  for (const RetiredImage &image : batch.images) {
+    vmaDestroyImage(Buffers::getAllocator(), image.image, image.allocation);
+  }
+  for (const Agnosia_T::AllocatedBuffer &buffer : batch.buffers) {
+    vmaDestroyBuffer(Buffers::getAllocator(), buffer.buffer, buffer.allocation);
+  }
+  for (VmaAllocation allocation : batch.memory) {
+    vmaFreeMemory(Buffers::getAllocator(), allocation);
+  }
+  for (VkSemaphore semaphore : batch.semaphores) {
+    vkDestroySemaphore(device, semaphore, nullptr);
+  }
+  for (VkSwapchainKHR swapChain : batch.swapChains) {
+    vkDestroySwapchainKHR(device, swapChain, nullptr);
+  }
+  for (const RetiredIndexRange &range : batch.indexRanges) {
+    MeshPool::freeIndices(range.firstIndex, range.indexCount);
+  }
+  for (uint32_t slot : batch.textureSlots) {
+    Buffers::reuseTextureSlot(slot);
+  }
+  pendingHandles -= static_cast<uint32_t>(batch.pipelines.size() + batch.imageViews.size() + batch.images.size() +
+                                          batch.buffers.size() + batch.memory.size() + batch.semaphores.size() +
+                                          batch.swapChains.size() + batch.indexRanges.size() +
+                                          batch.textureSlots.size());
+  batch.pipelines.clear();
+  batch.imageViews.clear();
+  batch.images.clear();
+  batch.buffers.clear();
+  batch.memory.clear();
+  batch.semaphores.clear();
+  batch.swapChains.clear();
+  batch.indexRanges.clear();
+  batch.textureSlots.clear();
+}
+
+void DeferredDeletion::init() {
+  // The device is idle by the time the DeletionQueue is flushed.
+  DeletionQueue::get().push_function([=](){
+    for (RetiredBatch &batch : retiredBatches) {
+      destroyBatch(batch);
+    }
+    retiredBatches.clear();
+    spareBatches.clear();
+  });
+}
+
+uint64_t DeferredDeletion::submitted() { return ++lastSubmittedSerial; }
+void DeferredDeletion::completed(uint64_t serial) {
+  // A fence covers every submission before its own on the queue, so everything up to the serial is done.
+  lastCompletedSerial = std::max(lastCompletedSerial, serial);
+  while (!retiredBatches.empty() && retiredBatches.front().serial <= lastCompletedSerial) {
+    destroyBatch(retiredBatches.front());
+    spareBatches.push_back(std::move(retiredBatches.front()));
+    retiredBatches.pop_front();
+  }
+}
+
+void DeferredDeletion::imageView(VkImageView imageView) { currentBatch().imageViews.push_back(imageView); }
+void DeferredDeletion::image(VkImage image, VmaAllocation allocation) { currentBatch().images.push_back({image, allocation}); }
+void DeferredDeletion::buffer(const Agnosia_T::AllocatedBuffer& buffer) { currentBatch().buffers.push_back(buffer); }
+void DeferredDeletion::memory(VmaAllocation allocation) { currentBatch().memory.push_back(allocation); }
+void DeferredDeletion::pipeline(const Agnosia_T::Pipeline& pipeline) { currentBatch().pipelines.push_back(pipeline); }
+void DeferredDeletion::semaphore(VkSemaphore semaphore) { currentBatch().semaphores.push_back(semaphore); }
+void DeferredDeletion::swapChain(VkSwapchainKHR swapChain) { currentBatch().swapChains.push_back(swapChain); }
+void DeferredDeletion::indexRange(uint32_t firstIndex, uint32_t indexCount) { currentBatch().indexRanges.push_back({firstIndex, indexCount}); }
+void DeferredDeletion::textureSlot(uint32_t slot) { currentBatch().textureSlots.push_back(slot); }
+
+uint32_t DeferredDeletion::getPendingCount() { return pendingHandles; }
@@ -0,0 +1,38 @@
+#pragma once
+#include "volk.h"
+#include "../utils/types.h"
+#include <cstdint>
+
+// Destruction of GPU objects that frames in flight may still be using. Unlike the DeletionQueue, which only runs at
+// shutdown, whatever is handed over here is destroyed as soon as the frames submitted before it have finished, so
+// assets removed at runtime give their memory back. Handles are kept as plain values in per submission batches, no
+// closures, and a finished batch is emptied and reused.
+class DeferredDeletion {
+public:
+  // Destroys anything still pending at shutdown, after everything registered with the DeletionQueue later than this.
+  // Must be called after the allocator exists.
+  static void init();
+  // Numbers a frame submission, call right after it. The returned serial is what to pass to completed() once the
+  // submission's fence has been waited on.
+  static uint64_t submitted();
+  // Every submission up to and including `serial` has finished, destroys what was handed over before them.
+  static void completed(uint64_t serial);
+
+  // The view goes before the image when both are handed over in the same frame.
+  static void imageView(VkImageView imageView);
+  // A null allocation only destroys the image, for images bound to memory they share (see memory()).
+  static void image(VkImage image, VmaAllocation allocation);
+  static void buffer(const Agnosia_T::AllocatedBuffer& buffer);
+  // Memory allocated on its own and bound to images, freed after every image of the batch.
+  static void memory(VmaAllocation allocation);
+  static void pipeline(const Agnosia_T::Pipeline& pipeline);
+  static void semaphore(VkSemaphore semaphore);
+  static void swapChain(VkSwapchainKHR swapChain);
+  // A range of the MeshPool's index buffer, returned to the pool rather than destroyed.
+  static void indexRange(uint32_t firstIndex, uint32_t indexCount);
+  // A bindless texture slot, handed back to Buffers for reuse. Frames in flight may still read its descriptor.
+  static void textureSlot(uint32_t slot);
+
+  // How many handles are waiting on a frame to finish.
+  static uint32_t getPendingCount();
+};
@@ -0,0 +1,350 @@
+#include "downsampler.h"
+#include "buffers.h"
+#include "deferreddeletion.h"
+#include "pipelinebuilder.h"
+#include "../devicelibrary.h"
+#include "../utils/deletion.h"
+#include "../utils/helpers.h"
+
+#include <algorithm>
+
+namespace {
+  // Matches downsample.comp, 12 levels per dispatch and a 64x64 block of tile results for the last six.
+  constexpr uint32_t MAX_MIPS_PER_PASS = 12;
+  constexpr uint32_t TILE_SIZE = 32;
+  constexpr uint32_t MAX_TILES = 64 * 64;
+  constexpr VkDeviceSize LAYER_ATOMICS_SIZE = 16 + MAX_TILES * 16;
+
+  struct DownsamplePushConstants {
+    VkDeviceAddress atomics;
+    uint32_t sourceSize[2];
+    uint32_t mipSize[2];
+    uint32_t mipCount;
+    uint32_t reduction;
+    uint32_t srgb;
+    uint32_t tileCount;
+  };
+}
+
+VkDescriptorSetLayout downsampleSetLayout;
+VkSampler downsampleSampler;
+Agnosia_T::Pipeline downsamplePipeline;
+
+// Storage writes can't go through an sRGB view, the shader encodes by hand and writes to a UNORM alias instead.
+static VkFormat storageFormat(VkFormat format) {
+  switch (format) {
+    case VK_FORMAT_R8G8B8A8_SRGB: return VK_FORMAT_R8G8B8A8_UNORM;
+    case VK_FORMAT_B8G8R8A8_SRGB: return VK_FORMAT_B8G8R8A8_UNORM;
+    default: return format;
+  }
+}
+static VkImageView createView(VkImage image, VkFormat format, VkImageAspectFlags aspect, uint32_t mip, uint32_t baseLayer, uint32_t layerCount, VkImageUsageFlags usage) {
+  VkImageViewUsageCreateInfo usageInfo{
+    .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_USAGE_CREATE_INFO,
+    .usage = usage,
+  };
+  VkImageViewCreateInfo viewInfo{
+    .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+    .pNext = &usageInfo,
+    .image = image,
+    .viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY,
+    .format = format,
+    .subresourceRange = {
+      .aspectMask = aspect,
+      .baseMipLevel = mip,
+      .levelCount = 1,
+      .baseArrayLayer = baseLayer,
+      .layerCount = layerCount,
+    },
+  };
+  VkImageView view;
+  VK_CHECK(vkCreateImageView(DeviceControl::getDevice(), &viewInfo, nullptr, &view));
+  return view;
+}
+
+void Downsampler::createPipeline() {
+  // Sources are only ever read with texelFetch, the sampler is just there to make a combined image sampler.
+  VkSamplerCreateInfo samplerInfo{
+    .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+    .magFilter = VK_FILTER_NEAREST,
+    .minFilter = VK_FILTER_NEAREST,
+    .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+    .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+    .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+    .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+  };
+  VK_CHECK(vkCreateSampler(DeviceControl::getDevice(), &samplerInfo, nullptr, &downsampleSampler));
+
+  // Targets come and go with textures and render targets, push descriptors save us from pooling sets for them.
+  VkDescriptorSetLayoutBinding bindings[] = {
+    {
+      .binding = 0,
+      .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+      .descriptorCount = 1,
+      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+      .pImmutableSamplers = &downsampleSampler,
+    },
+    {
+      .binding = 1,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+      .descriptorCount = MAX_MIPS_PER_PASS,
+      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+    },
+  };
+  VkDescriptorSetLayoutCreateInfo layoutInfo{
+    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+    .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT,
+    .bindingCount = 2,
+    .pBindings = bindings,
+  };
+  VK_CHECK(vkCreateDescriptorSetLayout(DeviceControl::getDevice(), &layoutInfo, nullptr, &downsampleSetLayout));
+
+  downsamplePipeline = PipelineBuilder()
+    .setComputeShader("src/shaders/downsample.comp")
+    .setDescriptorSetLayouts({downsampleSetLayout})
+    .setPushConstantSize(sizeof(DownsamplePushConstants))
+    .BuildCompute();
+
+  DeletionQueue::get().push_function([=](){vkDestroyDescriptorSetLayout(DeviceControl::getDevice(), downsampleSetLayout, nullptr);});
+  DeletionQueue::get().push_function([=](){vkDestroySampler(DeviceControl::getDevice(), downsampleSampler, nullptr);});
+}
+
+// Split [firstMip, firstMip + mipCount) into dispatches of up to 12 levels. The second half of a dispatch only covers
+// a 64x64 block of tiles, so a first level bigger than 2048 gets a six level dispatch of its own first.
+static Downsampler::Target buildTarget(VkImageView sourceView, VkImageLayout sourceLayout, VkExtent2D sourceExtent,
+                                       VkImage image, VkFormat format, VkExtent2D extent, uint32_t firstMip, uint32_t mipCount,
+                                       uint32_t baseLayer, uint32_t layerCount, Downsampler::Reduction reduction) {
+  VkFormat writeFormat = storageFormat(format);
+  Downsampler::Target target{
+    .image = image,
+    .firstMip = firstMip,
+    .mipCount = mipCount,
+    .baseLayer = baseLayer,
+    .layerCount = layerCount,
+    .srgb = writeFormat != format,
+    .reduction = reduction,
+  };
+
+  bool needsAtomics = false;
+  uint32_t mip = firstMip;
+  VkExtent2D passSourceExtent = sourceExtent;
+  VkExtent2D passExtent = extent;
+  while (mip < firstMip + mipCount) {
+    uint32_t limit = std::max(passExtent.width, passExtent.height) <= TILE_SIZE * 64 ? MAX_MIPS_PER_PASS : MAX_MIPS_PER_PASS / 2;
+    uint32_t count = std::min(limit, firstMip + mipCount - mip);
+    needsAtomics |= count > MAX_MIPS_PER_PASS / 2;
+
+    Downsampler::Pass pass{
+      .sourceView = sourceView,
+      .sourceLayout = sourceLayout,
+      .sourceExtent = passSourceExtent,
+      .extent = passExtent,
+      .firstMip = mip,
+      .mipViews = std::vector<VkImageView>(count),
+    };
+    if (mip != firstMip) {
+      // Later dispatches read the last level of the previous one, which is still in GENERAL.
+      pass.sourceView = createView(image, format, VK_IMAGE_ASPECT_COLOR_BIT, mip - 1, baseLayer, layerCount, VK_IMAGE_USAGE_SAMPLED_BIT);
+      pass.sourceLayout = VK_IMAGE_LAYOUT_GENERAL;
+      target.ownedViews.push_back(pass.sourceView);
+    }
+    for (uint32_t i = 0; i < count; i++) {
+      pass.mipViews[i] = createView(image, writeFormat, VK_IMAGE_ASPECT_COLOR_BIT, mip + i, baseLayer, layerCount, VK_IMAGE_USAGE_STORAGE_BIT);
+      target.ownedViews.push_back(pass.mipViews[i]);
+    }
+    target.passes.push_back(pass);
+
+    mip += count;
+    passSourceExtent = {std::max(passExtent.width >> (count - 1), 1u), std::max(passExtent.height >> (count - 1), 1u)};
+    passExtent = {std::max(passSourceExtent.width >> 1, 1u), std::max(passSourceExtent.height >> 1, 1u)};
+  }
+
+  if (needsAtomics) {
+    target.atomics = Buffers::createBuffer(LAYER_ATOMICS_SIZE * layerCount, 0,
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+      VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE);
+    VkBufferDeviceAddressInfo addressInfo{
+      .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+      .buffer = target.atomics.buffer,
+    };
+    target.atomicsAddress = vkGetBufferDeviceAddress(DeviceControl::getDevice(), &addressInfo);
+  }
+  return target;
+}
+
+void Downsampler::addTargetUsage(VkImageCreateInfo& imageInfo) {
+  if (imageInfo.mipLevels <= 1) {
+    return;
+  }
+  imageInfo.usage |= VK_IMAGE_USAGE_STORAGE_BIT;
+  // An sRGB image can't have storage usage itself, only through a UNORM view.
+  if (storageFormat(imageInfo.format) != imageInfo.format) {
+    imageInfo.flags |= VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT | VK_IMAGE_CREATE_EXTENDED_USAGE_BIT;
+  }
+}
+Downsampler::Target Downsampler::createTarget(VkImage image, VkFormat format, VkExtent2D extent, uint32_t mipLevels,
+                                              uint32_t baseLayer, uint32_t layerCount, Reduction reduction) {
+  // The first level is read through its own format, so sRGB is decoded for us by the hardware.
+  VkImageView sourceView = createView(image, format, VK_IMAGE_ASPECT_COLOR_BIT, 0, baseLayer, layerCount, VK_IMAGE_USAGE_SAMPLED_BIT);
+  VkExtent2D firstExtent = {std::max(extent.width >> 1, 1u), std::max(extent.height >> 1, 1u)};
+
+  Target target = buildTarget(sourceView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, extent, image, format, firstExtent, 1, mipLevels - 1, baseLayer, layerCount, reduction);
+  target.ownedViews.push_back(sourceView);
+  return target;
+}
+
+Downsampler::Target Downsampler::createTarget(VkImageView sourceView, VkImageLayout sourceLayout, VkExtent2D sourceExtent,
+                                              VkImage image, VkFormat format, VkExtent2D extent, uint32_t mipLevels,
+                                              uint32_t layerCount, Reduction reduction) {
+  return buildTarget(sourceView, sourceLayout, sourceExtent, image, format, extent, 0, mipLevels, 0, layerCount, reduction);
+}
+
+void Downsampler::destroyTarget(Target& target) {
+  for (VkImageView view : target.ownedViews) {
+    DeferredDeletion::imageView(view);
+  }
+  target.ownedViews.clear();
+  target.passes.clear();
+  if (target.atomics.buffer != VK_NULL_HANDLE) {
+    DeferredDeletion::buffer(target.atomics);
+    target.atomics = {};
+  }
+}
+
+void Downsampler::record(VkCommandBuffer commandBuffer, Target& target) {
+  if (target.passes.empty()) {
+    return;
+  }
+  VkImageSubresourceRange range{
+    .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+    .baseMipLevel = target.firstMip,
+    .levelCount = target.mipCount,
+    .baseArrayLayer = target.baseLayer,
+    .layerCount = target.layerCount,
+  };
+
+  // The counters reset themselves, but clear them anyway so a dispatch that never finished can't poison the next.
+  if (target.atomics.buffer != VK_NULL_HANDLE) {
+    vkCmdFillBuffer(commandBuffer, target.atomics.buffer, 0, VK_WHOLE_SIZE, 0);
+  }
+  const VkBufferMemoryBarrier2 atomicsBarrier{
+    .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2,
+    .srcStageMask = VK_PIPELINE_STAGE_2_CLEAR_BIT,
+    .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+    .dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+    .dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+    .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .buffer = target.atomics.buffer,
+    .offset = 0,
+    .size = VK_WHOLE_SIZE,
+  };
+  // Every destination level gets fully overwritten, so whatever was there can be discarded.
+  const VkImageMemoryBarrier2 toGeneral{
+    .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+    .srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+    .srcAccessMask = 0,
+    .dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+    .dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT | VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+    .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+    .newLayout = VK_IMAGE_LAYOUT_GENERAL,
+    .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .image = target.image,
+    .subresourceRange = range,
+  };
+  const VkDependencyInfo startDependency{
+    .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+    .bufferMemoryBarrierCount = target.atomics.buffer != VK_NULL_HANDLE ? 1u : 0u,
+    .pBufferMemoryBarriers = &atomicsBarrier,
+    .imageMemoryBarrierCount = 1,
+    .pImageMemoryBarriers = &toGeneral,
+  };
+  vkCmdPipelineBarrier2(commandBuffer, &startDependency);
+
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, downsamplePipeline.pipeline);
+
+  for (size_t i = 0; i < target.passes.size(); i++) {
+    const Pass& pass = target.passes[i];
+    if (i > 0) {
+      // The previous dispatch wrote the level this one reads.
+      const VkMemoryBarrier2 passBarrier{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+        .srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+        .srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+        .dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+        .dstAccessMask = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+      };
+      const VkDependencyInfo passDependency{
+        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        .memoryBarrierCount = 1,
+        .pMemoryBarriers = &passBarrier,
+      };
+      vkCmdPipelineBarrier2(commandBuffer, &passDependency);
+    }
+
+    VkDescriptorImageInfo sourceInfo{
+      .imageView = pass.sourceView,
+      .imageLayout = pass.sourceLayout,
+    };
+    // Every element of the array has to be valid, pad the unused ones with the last level.
+    VkDescriptorImageInfo mipInfos[MAX_MIPS_PER_PASS];
+    for (uint32_t mip = 0; mip < MAX_MIPS_PER_PASS; mip++) {
+      mipInfos[mip] = {
+        .imageView = pass.mipViews[std::min<size_t>(mip, pass.mipViews.size() - 1)],
+        .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+      };
+    }
+    VkWriteDescriptorSet writes[] = {
+      {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstBinding = 0,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .pImageInfo = &sourceInfo,
+      },
+      {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstBinding = 1,
+        .descriptorCount = MAX_MIPS_PER_PASS,
+        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+        .pImageInfo = mipInfos,
+      },
+    };
+    vkCmdPushDescriptorSet(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, downsamplePipeline.layout, 0, 2, writes);
+
+    uint32_t groupsX = (pass.extent.width + TILE_SIZE - 1) / TILE_SIZE;
+    uint32_t groupsY = (pass.extent.height + TILE_SIZE - 1) / TILE_SIZE;
+    DownsamplePushConstants pushConstants{
+      .atomics = target.atomicsAddress,
+      .sourceSize = {pass.sourceExtent.width, pass.sourceExtent.height},
+      .mipSize = {pass.extent.width, pass.extent.height},
+      .mipCount = static_cast<uint32_t>(pass.mipViews.size()),
+      .reduction = static_cast<uint32_t>(target.reduction),
+      .srgb = target.srgb ? 1u : 0u,
+      .tileCount = groupsX * groupsY,
+    };
+    vkCmdPushConstants(commandBuffer, downsamplePipeline.layout, VK_SHADER_STAGE_ALL, 0, sizeof(DownsamplePushConstants), &pushConstants);
+    vkCmdDispatch(commandBuffer, groupsX, groupsY, target.layerCount);
+  }
+
+  const VkImageMemoryBarrier2 toShaderRead{
+    .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+    .srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+    .srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+    .dstStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+    .dstAccessMask = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+    .oldLayout = VK_IMAGE_LAYOUT_GENERAL,
+    .newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+    .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .image = target.image,
+    .subresourceRange = range,
+  };
+  const VkDependencyInfo endDependency{
+    .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+    .imageMemoryBarrierCount = 1,
+    .pImageMemoryBarriers = &toShaderRead,
+  };
+  vkCmdPipelineBarrier2(commandBuffer, &endDependency);
+}
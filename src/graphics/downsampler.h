@@ -0,0 +1,61 @@
+#pragma once
+#include "volk.h"
+#include <cstdint>
+#include <vector>
+#include "../utils/types.h"
+
+// Compute mip generation, one dispatch writes up to 12 levels (see downsample.comp).
+// Works on anything with storage usage: texture mip chains, and render targets like a depth pyramid.
+class Downsampler {
+public:
+  enum class Reduction : uint32_t {
+    AVERAGE = 0,
+    MAX = 1,
+    MIN = 2,
+  };
+
+  // One dispatch, reading sourceView and writing up to 12 levels of the destination.
+  struct Pass {
+    VkImageView sourceView;
+    VkImageLayout sourceLayout;
+    VkExtent2D sourceExtent;
+    VkExtent2D extent;
+    uint32_t firstMip;
+    std::vector<VkImageView> mipViews;
+  };
+  struct Target {
+    VkImage image;
+    uint32_t firstMip;
+    uint32_t mipCount;
+    uint32_t baseLayer;
+    uint32_t layerCount;
+    bool srgb;
+    Reduction reduction;
+    std::vector<Pass> passes;
+    // Views this target created and has to destroy, an external source view is left alone.
+    std::vector<VkImageView> ownedViews;
+    // Tile results and the atomic counter of finished workgroups for every layer.
+    Agnosia_T::AllocatedBuffer atomics;
+    VkDeviceAddress atomicsAddress;
+  };
+
+  static void createPipeline();
+
+  // Add what the downsampler needs to write the mips of an image about to be created, nothing when it only has one.
+  static void addTargetUsage(VkImageCreateInfo& imageInfo);
+
+  // Fill mips [1, mipLevels) of layers [baseLayer, baseLayer + layerCount) from their own first level.
+  // The image needs STORAGE usage, and MUTABLE_FORMAT | EXTENDED_USAGE when the format is sRGB.
+  static Target createTarget(VkImage image, VkFormat format, VkExtent2D extent, uint32_t mipLevels,
+                             uint32_t baseLayer = 0, uint32_t layerCount = 1, Reduction reduction = Reduction::AVERAGE);
+  // Fill every mip of the image from a different image, the first level can be any size up to the source's.
+  static Target createTarget(VkImageView sourceView, VkImageLayout sourceLayout, VkExtent2D sourceExtent,
+                             VkImage image, VkFormat format, VkExtent2D extent, uint32_t mipLevels,
+                             uint32_t layerCount = 1, Reduction reduction = Reduction::AVERAGE);
+  // Through DeferredDeletion, a frame in flight may still be using its views.
+  static void destroyTarget(Target& target);
+
+  // The source has to be readable by compute in sourceLayout already. Destination levels are discarded,
+  // written, then left in SHADER_READ_ONLY_OPTIMAL.
+  static void record(VkCommandBuffer commandBuffer, Target& target);
+};
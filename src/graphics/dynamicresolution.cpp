@@ -0,0 +1,106 @@
+#include "dynamicresolution.h"
+#include "buffers.h"
+#include "../devicelibrary.h"
+#include "../utils/deletion.h"
+#include "../utils/helpers.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Two timestamps per frame in flight, the start of its commands and the end of its scene.
+VkQueryPool timestampQueries = VK_NULL_HANDLE;
+std::vector<bool> timestampsWritten;
+// Nanoseconds per tick, and the bits of a timestamp that actually count.
+float timestampPeriod = 1.0f;
+uint64_t timestampMask = 0;
+
+bool dynamicResolution = true;
+float renderScale = 1.0f;
+float minRenderScale = 0.5f;
+float targetMilliseconds = 1000.0f / 60.0f;
+float gpuMilliseconds = 0.0f;
+VkExtent2D renderExtent;
+
+// How far each frame moves towards the scale that would have hit the target. The measurement is a few frames old and
+// noisy, going all the way would overshoot and oscillate.
+constexpr float CONTROLLER_GAIN = 0.1f;
+// The extent only changes in steps of this much of the swapchain, so small wobbles don't re-record cached draws.
+constexpr float SCALE_STEP = 1.0f / 32.0f;
+
+static void updateScale() {
+  if (dynamicResolution && gpuMilliseconds > 0.0f) {
+    // GPU time mostly scales with the pixel count, the square of the scale.
+    float ideal = renderScale * std::sqrt(targetMilliseconds / gpuMilliseconds);
+    renderScale = std::clamp(renderScale + (ideal - renderScale) * CONTROLLER_GAIN, minRenderScale, 1.0f);
+  }
+  renderScale = std::clamp(renderScale, DynamicResolution::MIN_SCALE, 1.0f);
+
+  float stepped = std::round(renderScale / SCALE_STEP) * SCALE_STEP;
+  VkExtent2D screenExtent = DeviceControl::getSwapChainExtent();
+  renderExtent = {
+    std::clamp(static_cast<uint32_t>(screenExtent.width * stepped), 1u, screenExtent.width),
+    std::clamp(static_cast<uint32_t>(screenExtent.height * stepped), 1u, screenExtent.height),
+  };
+}
+
+void DynamicResolution::create() {
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(DeviceControl::getPhysicalDevice(), &properties);
+  uint32_t graphicsFamily = DeviceControl::findQueueFamilies(DeviceControl::getPhysicalDevice()).graphicsFamily.value();
+  uint32_t familyCount = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(DeviceControl::getPhysicalDevice(), &familyCount, nullptr);
+  std::vector<VkQueueFamilyProperties> families(familyCount);
+  vkGetPhysicalDeviceQueueFamilyProperties(DeviceControl::getPhysicalDevice(), &familyCount, families.data());
+
+  const uint32_t validBits = families[graphicsFamily].timestampValidBits;
+  updateScale();
+  if (validBits == 0) {
+    dynamicResolution = false;
+    return;
+  }
+  timestampPeriod = properties.limits.timestampPeriod;
+  timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+  VkQueryPoolCreateInfo queryPoolInfo = {
+    .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+    .queryType = VK_QUERY_TYPE_TIMESTAMP,
+    .queryCount = 2 * Buffers::getMaxFramesInFlight(),
+  };
+  VK_CHECK(vkCreateQueryPool(DeviceControl::getDevice(), &queryPoolInfo, nullptr, &timestampQueries));
+  timestampsWritten.assign(Buffers::getMaxFramesInFlight(), false);
+  DeletionQueue::get().push_function([=](){
+    vkDestroyQueryPool(DeviceControl::getDevice(), timestampQueries, nullptr);
+    timestampQueries = VK_NULL_HANDLE;
+  });
+}
+
+void DynamicResolution::beginFrame(VkCommandBuffer commandBuffer, uint32_t frame) {
+  if (timestampQueries != VK_NULL_HANDLE) {
+    // The frame's fence has been waited on, so whatever it measured last time is ready.
+    if (timestampsWritten[frame]) {
+      uint64_t timestamps[2];
+      if (vkGetQueryPoolResults(DeviceControl::getDevice(), timestampQueries, 2 * frame, 2, sizeof(timestamps), timestamps,
+                                sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+        gpuMilliseconds = static_cast<float>((timestamps[1] - timestamps[0]) & timestampMask) * timestampPeriod / 1e6f;
+      }
+    }
+    vkCmdResetQueryPool(commandBuffer, timestampQueries, 2 * frame, 2);
+    vkCmdWriteTimestamp2(commandBuffer, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, timestampQueries, 2 * frame);
+    timestampsWritten[frame] = true;
+  }
+  updateScale();
+}
+void DynamicResolution::endScene(VkCommandBuffer commandBuffer, uint32_t frame) {
+  if (timestampQueries != VK_NULL_HANDLE) {
+    vkCmdWriteTimestamp2(commandBuffer, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, timestampQueries, 2 * frame + 1);
+  }
+}
+
+VkExtent2D DynamicResolution::getRenderExtent() { return renderExtent; }
+float &DynamicResolution::getScale() { return renderScale; }
+bool &DynamicResolution::getEnabled() { return dynamicResolution; }
+float &DynamicResolution::getTargetMilliseconds() { return targetMilliseconds; }
+float &DynamicResolution::getMinScale() { return minRenderScale; }
+float DynamicResolution::getGPUMilliseconds() { return gpuMilliseconds; }
+bool DynamicResolution::isSupported() { return timestampQueries != VK_NULL_HANDLE; }
@@ -0,0 +1,31 @@
+#pragma once
+#include "volk.h"
+#include <cstdint>
+
+// Renders the scene at a fraction of the swapchain resolution, picked every frame to hold the GPU frame time near a
+// target, then upscales it to the swapchain. The render targets stay swapchain sized and the scene only covers the top
+// left getRenderExtent() of them, so a new scale costs nothing but the recorded draws that baked the old viewport.
+// GPU time comes from a pair of timestamps around each frame's scene, read back once its fence has been waited on.
+class DynamicResolution {
+public:
+  // Lowest scale either the controller or a fixed render scale can go to.
+  static constexpr float MIN_SCALE = 0.25f;
+
+  static void create();
+  // The frame's first command. Reads what this frame slot measured last time and feeds the controller, so the extent
+  // for the frame being recorded is settled once it returns.
+  static void beginFrame(VkCommandBuffer commandBuffer, uint32_t frame);
+  // After the scene, before anything waits on the swapchain image, so a V-Sync stall isn't mistaken for GPU load.
+  static void endScene(VkCommandBuffer commandBuffer, uint32_t frame);
+
+  // The part of the render targets the scene is drawn into this frame.
+  static VkExtent2D getRenderExtent();
+  // Adjusted by the controller when enabled, a fixed render scale otherwise.
+  static float &getScale();
+  static bool &getEnabled();
+  static float &getTargetMilliseconds();
+  static float &getMinScale();
+  // From the last measured frame, zero when the graphics queue has no timestamps (the controller stays off then).
+  static float getGPUMilliseconds();
+  static bool isSupported();
+};
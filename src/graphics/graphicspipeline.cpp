@@ -3,21 +3,46 @@
 #include "../utils/helpers.h"
 #include "buffers.h"
 #include "graphicspipeline.h"
+#include "hizpyramid.h"
+#include "lightgrid.h"
+#include "pipelinebuilder.h"
 #include "../agnosiaimgui.h"
+#include "dynamicresolution.h"
 #include "imgui.h"
 #include "imgui_impl_vulkan.h"
 #include "render.h"
 #include "texture.h"
+#include "texturestreamer.h"
+#include "materialtable.h"
+#include "meshpool.h"
+#include "objecttable.h"
+#include "occlusionrasterizer.h"
+#include "rendergraph.h"
+#include "renderqueue.h"
+#include "secondarycommands.h"
+#include "shadowcascades.h"
+#include "temporalaa.h"
+#include "../utils/threadpool.h"
 #include "../utils/deletion.h"
 #include "vulkan/vulkan_core.h"
  
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 #include <glm/ext/matrix_clip_space.hpp>
 #include <glm/ext/matrix_transform.hpp>
+#include <glm/gtc/matrix_access.hpp>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <vector>
 
 float lightPos[4] = {5.0f, 5.0f, 5.0f, 0.44f};
 float lightColor[4] = {1.0f, 1.0f, 1.0f, 0.44f};
 float lightPower = 1.0f;
+// Toward the sun, it lights everything from infinitely far away and is the one light casting shadows.
+float sunDirection[4] = {0.3f, 0.5f, 1.0f, 0.44f};
+float sunColor[4] = {1.0f, 0.95f, 0.85f, 0.44f};
+float sunPower = 2.0f;
 float camPos[4] = {3.0f, 3.0f, 3.0f, 0.44f};
 float centerPos[4] = {0.0f, 0.0f, 0.0f, 0.44f};
 float upDir[4] = {0.0f, 0.0f, 1.0f, 0.44f};
@@ -26,238 +51,786 @@ float distanceField[2] = {0.1f, 100.0f};
 
 std::deque<Agnosia_T::Pipeline> graphicsHistory;
 std::deque<Agnosia_T::Pipeline> fullscreenHistory;
-
-void Graphics::createCommandPool() {
-  // Commands in Vulkan are not executed using function calls, you have to
-  // record the ops you wish to perform to command buffers, pools manage the
-  // memory used by the buffer!
-  DeviceControl::QueueFamilyIndices queueFamilyIndices = DeviceControl::findQueueFamilies(DeviceControl::getPhysicalDevice());
-
-  VkCommandPoolCreateInfo poolInfo{};
-  poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-  poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-  poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
-
-  VK_CHECK(vkCreateCommandPool(DeviceControl::getDevice(), &poolInfo, nullptr, &Buffers::getCommandPool()));
-  
-  DeletionQueue::get().push_function([=](){vkDestroyCommandPool(DeviceControl::getDevice(), Buffers::getCommandPool(), nullptr);});
+// Depth only versions of the graphics pipelines, kept in step with graphicsHistory.
+std::deque<Agnosia_T::Pipeline> depthPrepassHistory;
+
+// The scene record is rewritten every frame and the draw list by every frame's culling pass, so each frame in flight
+// gets its own copy. Objects themselves persist in the ObjectTable.
+struct FrameData {
+  Agnosia_T::AllocatedBuffer scene;
+  VkDeviceAddress sceneAddress;
+  // The early (or only) phase's draw list, and the late phase's when occlusion culling.
+  Agnosia_T::AllocatedBuffer draws;
+  VkDeviceAddress drawsAddress;
+  RenderGraph::Buffer drawsResource;
+  Agnosia_T::AllocatedBuffer lateDraws;
+  VkDeviceAddress lateDrawsAddress;
+  RenderGraph::Buffer lateDrawsResource;
+  uint32_t drawCapacity;
+};
+std::vector<FrameData> frameData;
+
+// Culled draws start this far into the draw buffer, after the count.
+constexpr VkDeviceSize DRAW_COMMANDS_OFFSET = 16;
+bool gpuDriven = true;
+bool occlusionCulling = true;
+// Split the CPU path's draws across the worker threads, each into its own secondary command buffer.
+bool parallelRecording = true;
+// Below this many draws a batch isn't worth a secondary.
+constexpr uint32_t MIN_DRAWS_PER_BATCH = 256;
+float recordMilliseconds = 0.0f;
+uint32_t secondaryCount = 0;
+
+// Draw commands don't depend on where models are (that's in the ObjectTable), so the CPU path's draw list only changes
+// when models come or go. It's recorded once per frame in flight into a persistent secondary and executed as is until
+// anything baked into it changes. Pipeline and swapchain changes clear `valid`, the rest is compared every frame.
+struct StaticDrawsKey {
+  uint64_t modelGeneration;
+  // Moves when the frame's buffers are reallocated.
+  VkDeviceAddress sceneAddress;
+  float lineWidth;
+  bool depthPrepass;
+  // Baked into the viewport, moves with the dynamic resolution.
+  uint32_t renderWidth;
+  uint32_t renderHeight;
+  bool operator==(const StaticDrawsKey&) const = default;
+};
+struct StaticDraws {
+  StaticDrawsKey key;
+  // Where the camera was when the draws were sorted.
+  glm::vec3 eye;
+  bool valid;
+};
+// How far the camera moves, as a fraction of the far plane, before the cached draws are sorted front to back again.
+constexpr float STATIC_DRAWS_RESORT_DISTANCE = 0.05f;
+bool cacheStaticDraws = true;
+std::vector<StaticDraws> staticDraws;
+bool staticDrawsReused = false;
+
+// Lay down depth with positions only first, so the expensive fragment shader only runs once per pixel.
+bool depthPrepass = false;
+// Fragment shader invocations per frame, to see what the pre-pass saves. One query per frame in flight.
+VkQueryPool statisticsQueries = VK_NULL_HANDLE;
+std::vector<bool> statisticsWritten;
+uint64_t fragmentInvocations = 0;
+// The unjittered view projection the last recorded frame used, motion vectors are measured against it.
+glm::mat4 previousViewProjection;
+bool previousViewProjectionValid = false;
+Agnosia_T::Pipeline cullPipeline;
+VkDescriptorSetLayout cullSetLayout;
+VkSampler hizSampler;
+
+// Matches cull.comp.
+constexpr uint32_t CULL_PHASE_FRUSTUM = 0;
+constexpr uint32_t CULL_PHASE_EARLY = 1;
+constexpr uint32_t CULL_PHASE_LATE = 2;
+
+static VkDeviceAddress getAddress(VkBuffer buffer) {
+  VkBufferDeviceAddressInfo addressInfo = {
+    .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+    .buffer = buffer,
+  };
+  return vkGetBufferDeviceAddress(DeviceControl::getDevice(), &addressInfo);
 }
-void Graphics::createCommandBuffer() {
-  Buffers::getCommandBuffers().resize(Buffers::getMaxFramesInFlight());
-
-  VkCommandBufferAllocateInfo allocInfo{};
-  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-  allocInfo.commandPool = Buffers::getCommandPool();
-  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-  allocInfo.commandBufferCount = (uint32_t)Buffers::getCommandBuffers().size();
-
-  VK_CHECK(vkAllocateCommandBuffers(DeviceControl::getDevice(), &allocInfo, Buffers::getCommandBuffers().data()));
+static FrameData allocateFrameData(uint32_t drawCapacity) {
+  FrameData frame;
+  frame.scene = Buffers::createBuffer(sizeof(Agnosia_T::SceneBuffer), VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_AUTO);
+  frame.sceneAddress = getAddress(frame.scene.buffer);
+  frame.draws = Buffers::createBuffer(DRAW_COMMANDS_OFFSET + sizeof(VkDrawIndexedIndirectCommand) * drawCapacity, 0, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE);
+  frame.drawsAddress = getAddress(frame.draws.buffer);
+  frame.drawsResource = RenderGraph::importBuffer(frame.draws.buffer);
+  frame.lateDraws = Buffers::createBuffer(DRAW_COMMANDS_OFFSET + sizeof(VkDrawIndexedIndirectCommand) * drawCapacity, 0, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE);
+  frame.lateDrawsAddress = getAddress(frame.lateDraws.buffer);
+  frame.lateDrawsResource = RenderGraph::importBuffer(frame.lateDraws.buffer);
+  frame.drawCapacity = drawCapacity;
+  return frame;
 }
-void Graphics::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex, AssetCache& cache) {
-  VkCommandBufferBeginInfo beginInfo{};
-  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-
-  VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo));
-  
-  const VkImageMemoryBarrier2 imageMemoryBarrier{
-      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
-      .pNext = nullptr,
-      .srcStageMask = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-      .srcAccessMask = 0,
-      .dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-      .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
-      .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-      .newLayout = VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL,
-      .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-      .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-      .image = DeviceControl::getSwapChainImages()[imageIndex],
-      .subresourceRange =
-          {
-              .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-              .baseMipLevel = 0,
-              .levelCount = 1,
-              .baseArrayLayer = 0,
-              .layerCount = 1,
-          },
-  };
-  const VkDependencyInfo dependencyInfo{
-      .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
-      .pNext = nullptr,
-      .imageMemoryBarrierCount = 1,
-      .pImageMemoryBarriers = &imageMemoryBarrier,
+static void destroyFrameData(FrameData& frame) {
+  RenderGraph::releaseBuffer(frame.drawsResource);
+  RenderGraph::releaseBuffer(frame.lateDrawsResource);
+  vmaDestroyBuffer(Buffers::getAllocator(), frame.scene.buffer, frame.scene.allocation);
+  vmaDestroyBuffer(Buffers::getAllocator(), frame.draws.buffer, frame.draws.allocation);
+  vmaDestroyBuffer(Buffers::getAllocator(), frame.lateDraws.buffer, frame.lateDraws.allocation);
+}
+static glm::mat4 sceneModel() {
+  return glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, 0.0f));
+}
+static glm::mat4 sceneView() {
+  return glm::lookAt(glm::vec3(camPos[0], camPos[1], camPos[2]),
+                     glm::vec3(centerPos[0], centerPos[1], centerPos[2]),
+                     glm::vec3(upDir[0], upDir[1], upDir[2]));
+}
+static glm::mat4 sceneProjection() {
+  glm::mat4 proj = glm::perspective(glm::radians(depthField),
+                    DeviceControl::getSwapChainExtent().width / (float)DeviceControl::getSwapChainExtent().height,
+                    distanceField[0], distanceField[1]);
+  // GLM was created for OpenGL, where the Y coordinate was inverted. This simply flips the sign.
+  proj[1][1] *= -1;
+  return proj;
+}
+// Shifts the whole image by `jitter` render pixels. Applied after the projection, so it's the same sub-pixel offset at
+// every depth.
+static glm::mat4 jitterProjection(const glm::mat4& proj, glm::vec2 jitter, VkExtent2D renderExtent) {
+  glm::vec2 offset = jitter * 2.0f / glm::vec2(renderExtent.width, renderExtent.height);
+  return glm::translate(glm::mat4(1.0f), glm::vec3(offset, 0.0f)) * proj;
+}
+static void extractFrustumPlanes(const glm::mat4& clip, glm::vec4 planes[6]) {
+  // Gribb/Hartmann, sums of the clip matrix rows. Depth is 0 to 1, so the near plane is the third row on its own.
+  glm::vec4 row0 = glm::row(clip, 0);
+  glm::vec4 row1 = glm::row(clip, 1);
+  glm::vec4 row2 = glm::row(clip, 2);
+  glm::vec4 row3 = glm::row(clip, 3);
+  planes[0] = row3 + row0;
+  planes[1] = row3 - row0;
+  planes[2] = row3 + row1;
+  planes[3] = row3 - row1;
+  planes[4] = row2;
+  planes[5] = row3 - row2;
+  for (int i = 0; i < 6; i++) {
+    planes[i] /= glm::length(glm::vec3(planes[i]));
+  }
+}
+// Reset the draw count, then cull the ObjectTable into the draw list for the indirect draw to read.
+static void addCullPasses(const FrameData& frame, const Agnosia_T::AllocatedBuffer& draws, RenderGraph::Buffer drawsResource,
+                          VkDeviceAddress drawsAddress, uint32_t objectRange, uint32_t phase) {
+  const VkBuffer drawBuffer = draws.buffer;
+  RenderGraph::addPass("clear draw count", [=](VkCommandBuffer commandBuffer) {
+    vkCmdFillBuffer(commandBuffer, drawBuffer, 0, sizeof(uint32_t), 0);
+  }).write(drawsResource, RenderGraph::BUFFER_CLEAR);
+
+  const Agnosia_T::CullPushConstants cullConsts = {
+    .sceneBufferAddress = frame.sceneAddress,
+    .drawBufferAddress = drawsAddress,
+    .visibilityAddress = ObjectTable::getVisibilityAddress(),
+    .objectRange = objectRange,
+    .phase = phase,
   };
-  vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
-
-  // ------------------- DYNAMIC RENDER INFO ---------------------- //
+  // The visibility buffer is read after the last phase (maybe last frame's) wrote it.
+  RenderGraph::addPass(phase == CULL_PHASE_LATE ? "late cull" : "cull", [=](VkCommandBuffer commandBuffer) {
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline.pipeline);
+    // Only the late phase samples the pyramid, but the binding has to be valid for every phase.
+    VkDescriptorImageInfo hizInfo = {
+      .imageView = HiZPyramid::getView(),
+      .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+    };
+    VkWriteDescriptorSet hizWrite = {
+      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+      .dstBinding = 0,
+      .descriptorCount = 1,
+      .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+      .pImageInfo = &hizInfo,
+    };
+    vkCmdPushDescriptorSet(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline.layout, 0, 1, &hizWrite);
+    vkCmdPushConstants(commandBuffer, cullPipeline.layout, VK_SHADER_STAGE_ALL, 0, sizeof(Agnosia_T::CullPushConstants), &cullConsts);
+    vkCmdDispatch(commandBuffer, (objectRange + 63) / 64, 1, 1);
+  }).write(drawsResource, RenderGraph::BUFFER_COMPUTE_STORAGE)
+    .write(ObjectTable::getVisibilityBuffer(), RenderGraph::BUFFER_COMPUTE_STORAGE)
+    .read(HiZPyramid::getImage(), RenderGraph::COMPUTE_SAMPLED);
+}
+// With occlusion culling the scene is drawn in two passes around the Hi-Z build. The first clears, keeps what it drew
+// and resolves depth for the pyramid, the last loads all that and resolves color to the swapchain.
+// The draws can come from secondaries instead, then nothing else may be recorded inline until the pass ends.
+// Without MSAA there is nothing to resolve, the scene is drawn straight into the scene image. Either way only the
+// dynamic resolution's corner of the targets is rendered, see DynamicResolution. Motion vectors go into the second
+// attachment, only kept past the last pass for the temporal resolve.
+static void beginScenePass(VkCommandBuffer commandBuffer, bool first, bool last, VkRenderingFlags flags = 0) {
+  const bool resolve = DeviceControl::getPerPixelSampleCount() != VK_SAMPLE_COUNT_1_BIT;
   const VkRenderingAttachmentInfo colorAttachmentInfo = {
       .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
-      .imageView = Texture::getColorImage().imageView,
+      .imageView = RenderGraph::getView(resolve ? Texture::getColorImage() : Texture::getSceneImage()),
       .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-      .resolveMode = VK_RESOLVE_MODE_AVERAGE_BIT,
-      .resolveImageView = DeviceControl::getSwapChainImageViews()[imageIndex],
+      .resolveMode = resolve && last ? VK_RESOLVE_MODE_AVERAGE_BIT : VK_RESOLVE_MODE_NONE,
+      .resolveImageView = resolve && last ? RenderGraph::getView(Texture::getSceneImage()) : VK_NULL_HANDLE,
       .resolveImageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-      .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+      .loadOp = first ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_LOAD,
       .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
       .clearValue = {.color = {0.0f, 0.0f, 0.0f, 1.0f}},
   };
+  const bool temporal = TemporalAA::getEnabled();
+  const VkImageView velocityResolve = RenderGraph::getView(TemporalAA::getVelocityResolveImage());
+  const VkRenderingAttachmentInfo velocityAttachmentInfo = {
+      .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+      .imageView = RenderGraph::getView(TemporalAA::getVelocityImage()),
+      .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+      .resolveMode = velocityResolve != VK_NULL_HANDLE && last ? VK_RESOLVE_MODE_AVERAGE_BIT : VK_RESOLVE_MODE_NONE,
+      .resolveImageView = last ? velocityResolve : VK_NULL_HANDLE,
+      .resolveImageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+      .loadOp = first ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_LOAD,
+      .storeOp = temporal || !last ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE,
+      .clearValue = {.color = {0.0f, 0.0f, 0.0f, 0.0f}},
+  };
+  const VkRenderingAttachmentInfo colorAttachments[] = {colorAttachmentInfo, velocityAttachmentInfo};
   const VkRenderingAttachmentInfo depthAttachmentInfo = {
       .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
-      .imageView = Texture::getDepthImage().imageView,
+      .imageView = RenderGraph::getView(Texture::getDepthImage()),
       .imageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
-      .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-      .storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+      .resolveMode = last ? VK_RESOLVE_MODE_NONE : HiZPyramid::getResolveMode(),
+      .resolveImageView = last ? VK_NULL_HANDLE : RenderGraph::getView(HiZPyramid::getResolveImage()),
+      .resolveImageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
+      .loadOp = first ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_LOAD,
+      .storeOp = last ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE,
       .clearValue = {.depthStencil = {1.0f, 0}},
   };
 
   const VkRenderingInfo renderInfo{
       .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
-      .renderArea = { .offset = {0, 0}, .extent = DeviceControl::getSwapChainExtent() },
+      .flags = flags,
+      .renderArea = { .offset = {0, 0}, .extent = DynamicResolution::getRenderExtent() },
       .layerCount = 1,
-      .colorAttachmentCount = 1,
-      .pColorAttachments = &colorAttachmentInfo,
+      .colorAttachmentCount = 2,
+      .pColorAttachments = colorAttachments,
       .pDepthAttachment = &depthAttachmentInfo,
   };
 
   vkCmdBeginRendering(commandBuffer, &renderInfo);
-
-  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsHistory.front().pipeline);
+}
+// What beginScenePass() renders into, for the graph. The first pass clears everything, the last one's resolves rewrite
+// the render extent of their targets.
+static void useSceneTargets(RenderGraph::Pass pass, bool first, bool last) {
+  const bool resolve = DeviceControl::getPerPixelSampleCount() != VK_SAMPLE_COUNT_1_BIT;
+  const RenderGraph::Image color = resolve ? Texture::getColorImage() : Texture::getSceneImage();
+  if (first) {
+    pass.overwrite(color, RenderGraph::COLOR_ATTACHMENT)
+      .overwrite(TemporalAA::getVelocityImage(), RenderGraph::COLOR_ATTACHMENT)
+      .overwrite(Texture::getDepthImage(), RenderGraph::DEPTH_ATTACHMENT);
+  } else {
+    pass.write(color, RenderGraph::COLOR_ATTACHMENT)
+      .write(TemporalAA::getVelocityImage(), RenderGraph::COLOR_ATTACHMENT)
+      .write(Texture::getDepthImage(), RenderGraph::DEPTH_ATTACHMENT);
+  }
+  if (last) {
+    if (resolve) {
+      pass.overwrite(Texture::getSceneImage(), RenderGraph::RESOLVE_ATTACHMENT);
+    }
+    if (TemporalAA::getVelocityResolveImage().valid()) {
+      pass.overwrite(TemporalAA::getVelocityResolveImage(), RenderGraph::RESOLVE_ATTACHMENT);
+    }
+  } else if (HiZPyramid::getResolveImage().valid()) {
+    pass.overwrite(HiZPyramid::getResolveImage(), RenderGraph::DEPTH_RESOLVE_ATTACHMENT);
+  }
+}
+// Secondaries executed inside the scene pass have to be told its attachment formats, there is no render pass to inherit.
+static void beginSceneSecondary(VkCommandBuffer commandBuffer, VkCommandBufferUsageFlags usage = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT) {
+  const VkFormat colorFormats[] = {DeviceControl::getImageFormat(), TemporalAA::VELOCITY_FORMAT};
+  const VkCommandBufferInheritanceRenderingInfo renderingInfo = {
+    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO,
+    .colorAttachmentCount = 2,
+    .pColorAttachmentFormats = colorFormats,
+    .depthAttachmentFormat = DeviceControl::getDepthFormat(),
+    .rasterizationSamples = DeviceControl::getPerPixelSampleCount(),
+  };
+  const VkCommandBufferInheritanceInfo inheritanceInfo = {
+    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+    .pNext = &renderingInfo,
+    // The primary's statistics query is active while these run.
+    .pipelineStatistics = statisticsQueries != VK_NULL_HANDLE ? VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT : 0u,
+  };
+  const VkCommandBufferBeginInfo beginInfo = {
+    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+    .flags = usage | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+    .pInheritanceInfo = &inheritanceInfo,
+  };
+  VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+}
+static void setSceneViewport(VkCommandBuffer commandBuffer) {
   VkViewport viewport{};
   viewport.x = 0.0f;
   viewport.y = 0.0f;
-  viewport.width = (float)DeviceControl::getSwapChainExtent().width;
-  viewport.height = (float)DeviceControl::getSwapChainExtent().height;
+  viewport.width = (float)DynamicResolution::getRenderExtent().width;
+  viewport.height = (float)DynamicResolution::getRenderExtent().height;
   viewport.minDepth = 0.0f;
   viewport.maxDepth = 1.0f;
   vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 
   VkRect2D scissor{};
   scissor.offset = {0, 0};
-  scissor.extent = DeviceControl::getSwapChainExtent();
+  scissor.extent = DynamicResolution::getRenderExtent();
   vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+}
+// Everything the scene draws need, again after the culling pass has had the command buffer.
+// The pipeline and index buffer are left to the draws, see recordIndirectDraws and RenderQueue::record.
+static void bindSceneState(VkCommandBuffer commandBuffer, const FrameData& frame) {
+  setSceneViewport(commandBuffer);
 
   vkCmdSetLineWidth(commandBuffer, Gui::getLineWidth());
 
-  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsHistory.front().layout, 0, 1, &Buffers::getTextureDescriptorSets(), 0, nullptr);
-  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsHistory.front().layout, 1, 1, &Buffers::getSamplerDescriptorSet(), 0, nullptr);
+  Buffers::bindDescriptors(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsHistory.front().layout);
 
-  int modelID = 0;
+  // Shared by every draw, each finds its object record through gl_InstanceIndex.
+  Agnosia_T::GPUPushConstants pushConsts = {
+    .sceneBufferAddress = frame.sceneAddress,
+  };
+  vkCmdPushConstants(commandBuffer, graphicsHistory.front().layout, VK_SHADER_STAGE_ALL, 0, sizeof(Agnosia_T::GPUPushConstants), &pushConsts);
+}
+// With the pre-pass on, the scene is drawn twice: depth only with writes on, then shaded with an EQUAL test and
+// writes off. Both pipelines keep these dynamic, so it carries over binds between them.
+static void setSceneDepthState(VkCommandBuffer commandBuffer, bool shading) {
+  const bool equal = depthPrepass && shading;
+  vkCmdSetDepthWriteEnable(commandBuffer, equal ? VK_FALSE : VK_TRUE);
+  vkCmdSetDepthCompareOp(commandBuffer, equal ? VK_COMPARE_OP_EQUAL : VK_COMPARE_OP_LESS);
+}
+static void recordIndirectDraws(VkCommandBuffer commandBuffer, VkBuffer draws, uint32_t maxDraws) {
+  vkCmdBindIndexBuffer(commandBuffer, MeshPool::getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
+  if (depthPrepass) {
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, depthPrepassHistory.front().pipeline);
+    setSceneDepthState(commandBuffer, false);
+    vkCmdDrawIndexedIndirectCount(commandBuffer, draws, DRAW_COMMANDS_OFFSET, draws, 0, maxDraws, sizeof(VkDrawIndexedIndirectCommand));
+  }
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsHistory.front().pipeline);
+  setSceneDepthState(commandBuffer, true);
+  vkCmdDrawIndexedIndirectCount(commandBuffer, draws, DRAW_COMMANDS_OFFSET, draws, 0, maxDraws, sizeof(VkDrawIndexedIndirectCommand));
+}
 
-  Agnosia_T::SceneBuffer sceneData;
-  
-  
-  sceneData.model = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, 0.0f));
+// Queue the CPU path's draw per model and sort them, nearest first.
+static void buildRenderQueue(const std::vector<Model *>& models, bool cpuOcclusion) {
+  const glm::mat4 model = sceneModel();
+  const glm::vec3 eye = glm::vec3(camPos[0], camPos[1], camPos[2]);
+  const VkPipeline pipeline = graphicsHistory.front().pipeline;
+  RenderQueue::clear();
+  for (Model *sceneObject : models) {
+    if (cpuOcclusion && !OcclusionRasterizer::isVisible(sceneObject->getObjectID())) {
+      continue;
+    }
+    // Distance to the nearest point of the bounds, anything past the far plane is clipped anyway.
+    glm::vec3 center = glm::vec3(model * glm::vec4(sceneObject->getPos() + sceneObject->getBoundsCenter(), 1.0f));
+    float depth = (glm::length(center - eye) - sceneObject->getBoundsRadius()) / distanceField[1];
+    // Every model owns its range of the MeshPool, so the object ID stands in for the mesh.
+    RenderQueue::push(pipeline, MeshPool::getIndexBuffer(), depth, sceneObject->getMaterial().getMaterialID(), sceneObject->getObjectID(),
+                      sceneObject->getIndices(), sceneObject->getFirstIndex(), sceneObject->getObjectID());
+  }
+  RenderQueue::sort();
+}
+// [first, last) of the sorted queue, depth only first when the pre-pass is on.
+static void recordQueuedDraws(VkCommandBuffer commandBuffer, uint32_t first, uint32_t last, bool prepass, bool shading) {
+  if (prepass) {
+    setSceneDepthState(commandBuffer, false);
+    RenderQueue::record(commandBuffer, first, last, depthPrepassHistory.front().pipeline);
+  }
+  if (shading) {
+    setSceneDepthState(commandBuffer, true);
+    RenderQueue::record(commandBuffer, first, last);
+  }
+}
+// Records a secondary per batch of the sorted queue on the workers, returned in draw order. With the pre-pass every
+// batch records its depth only draws into a second secondary, all of which run before any shading. Nothing a batch touches
+// is written while they run: the queue and the pipeline history only change on the main thread.
+static std::vector<VkCommandBuffer> recordParallelDraws(const FrameData& frame) {
+  const uint32_t count = static_cast<uint32_t>(RenderQueue::getDraws().size());
+  const uint32_t batches = std::min(SecondaryCommands::getThreadCount(), (count + MIN_DRAWS_PER_BATCH - 1) / MIN_DRAWS_PER_BATCH);
+  const uint32_t shadingOffset = depthPrepass ? batches : 0;
+  std::vector<VkCommandBuffer> secondaries(shadingOffset + batches);
+  const uint32_t currentFrame = Render::getCurrentFrame();
+  ThreadPool::get().parallelBatches(count, batches, [&](uint32_t batch, uint32_t first, uint32_t last) {
+    for (bool shading : {false, true}) {
+      if (!shading && !depthPrepass) {
+        continue;
+      }
+      VkCommandBuffer commandBuffer = SecondaryCommands::acquire(currentFrame, batch);
+      beginSceneSecondary(commandBuffer);
+      // Secondaries inherit no state, each binds everything for itself.
+      bindSceneState(commandBuffer, frame);
+      recordQueuedDraws(commandBuffer, first, last, !shading, shading);
+      VK_CHECK(vkEndCommandBuffer(commandBuffer));
+      secondaries[(shading ? shadingOffset : 0) + batch] = commandBuffer;
+    }
+  });
+  return secondaries;
+}
+// This frame's copy of the cached draw list, re-recorded first if it's stale. Its front to back order goes stale as the
+// camera moves, which only costs early-Z rejections, so it is only re-sorted once the camera has moved far enough.
+static VkCommandBuffer recordStaticDraws(const FrameData& frame, const std::vector<Model *>& models, uint64_t modelGeneration) {
+  const uint32_t currentFrame = Render::getCurrentFrame();
+  if (staticDraws.size() != Buffers::getMaxFramesInFlight()) {
+    staticDraws.assign(Buffers::getMaxFramesInFlight(), StaticDraws{.valid = false});
+  }
+  const StaticDrawsKey key = {
+    .modelGeneration = modelGeneration,
+    .sceneAddress = frame.sceneAddress,
+    .lineWidth = Gui::getLineWidth(),
+    .depthPrepass = depthPrepass,
+    .renderWidth = DynamicResolution::getRenderExtent().width,
+    .renderHeight = DynamicResolution::getRenderExtent().height,
+  };
+  const glm::vec3 eye = glm::vec3(camPos[0], camPos[1], camPos[2]);
+  StaticDraws& cached = staticDraws[currentFrame];
+  VkCommandBuffer commandBuffer = SecondaryCommands::getPersistent(currentFrame);
+  staticDrawsReused = cached.valid && cached.key == key &&
+                      glm::length(eye - cached.eye) <= STATIC_DRAWS_RESORT_DISTANCE * distanceField[1];
+  if (staticDrawsReused) {
+    return commandBuffer;
+  }
+  // Only this frame's fence guarded the old recording, which has been waited on.
+  beginSceneSecondary(commandBuffer, 0);
+  buildRenderQueue(models, false);
+  bindSceneState(commandBuffer, frame);
+  recordQueuedDraws(commandBuffer, 0, static_cast<uint32_t>(RenderQueue::getDraws().size()), depthPrepass, true);
+  VK_CHECK(vkEndCommandBuffer(commandBuffer));
+  cached = {.key = key, .eye = eye, .valid = true};
+  return commandBuffer;
+}
+// The fullscreen pass, the last thing drawn into the scene pass. The UI waits for the upscale, see addPresentPasses.
+static void recordOverlay(VkCommandBuffer commandBuffer, const FrameData& frame) {
+  // It may be alone in a secondary, which inherits no viewport, descriptors or push constants. fullscreen.frag reads the
+  // scene through them, and its layout matches the graphics pipeline's.
+  bindSceneState(commandBuffer, frame);
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, fullscreenHistory.front().pipeline);
+  vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+}
+// Stretches the rendered corner of the scene image over the swapchain image, then draws the UI on top at full
+// resolution and hands the image to the presentation engine. After the temporal resolve its output is copied instead,
+// it's swapchain sized already.
+static void addPresentPasses(RenderGraph::Image source, RenderGraph::Image swapChainImage, bool temporal) {
+  const VkExtent2D screenExtent = DeviceControl::getSwapChainExtent();
+  const VkExtent2D sourceExtent = temporal ? screenExtent : DynamicResolution::getRenderExtent();
+  RenderGraph::addPass("upscale", [=](VkCommandBuffer commandBuffer) {
+    const VkImageBlit2 region = {
+      .sType = VK_STRUCTURE_TYPE_IMAGE_BLIT_2,
+      .srcSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, .mipLevel = 0, .baseArrayLayer = 0, .layerCount = 1},
+      .srcOffsets = {{0, 0, 0}, {static_cast<int32_t>(sourceExtent.width), static_cast<int32_t>(sourceExtent.height), 1}},
+      .dstSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, .mipLevel = 0, .baseArrayLayer = 0, .layerCount = 1},
+      .dstOffsets = {{0, 0, 0}, {static_cast<int32_t>(screenExtent.width), static_cast<int32_t>(screenExtent.height), 1}},
+    };
+    const VkBlitImageInfo2 blitInfo = {
+      .sType = VK_STRUCTURE_TYPE_BLIT_IMAGE_INFO_2,
+      .srcImage = RenderGraph::getImage(source),
+      .srcImageLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+      .dstImage = RenderGraph::getImage(swapChainImage),
+      .dstImageLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+      .regionCount = 1,
+      .pRegions = &region,
+      .filter = VK_FILTER_LINEAR,
+    };
+    vkCmdBlitImage2(commandBuffer, &blitInfo);
+  }).read(source, RenderGraph::BLIT_SOURCE)
+    .overwrite(swapChainImage, RenderGraph::BLIT_DESTINATION);
 
-  sceneData.view = glm::lookAt(glm::vec3(camPos[0], camPos[1], camPos[2]),
-                   glm::vec3(centerPos[0], centerPos[1], centerPos[2]),
-                   glm::vec3(upDir[0], upDir[1], upDir[2]));
+  RenderGraph::addPass("ui", [=](VkCommandBuffer commandBuffer) {
+    const VkRenderingAttachmentInfo uiAttachmentInfo = {
+      .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+      .imageView = RenderGraph::getView(swapChainImage),
+      .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+      .loadOp = VK_ATTACHMENT_LOAD_OP_LOAD,
+      .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+    };
+    const VkRenderingInfo uiRenderInfo = {
+      .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
+      .renderArea = { .offset = {0, 0}, .extent = screenExtent },
+      .layerCount = 1,
+      .colorAttachmentCount = 1,
+      .pColorAttachments = &uiAttachmentInfo,
+    };
+    vkCmdBeginRendering(commandBuffer, &uiRenderInfo);
+    ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), commandBuffer);
+    vkCmdEndRendering(commandBuffer);
+  }).write(swapChainImage, RenderGraph::COLOR_ATTACHMENT);
 
-  sceneData.proj = glm::perspective(glm::radians(depthField),
-                    DeviceControl::getSwapChainExtent().width / (float)DeviceControl::getSwapChainExtent().height,
-                    distanceField[0], distanceField[1]);
-    
-  // GLM was created for OpenGL, where the Y coordinate was inverted. This simply flips the sign.
-  sceneData.proj[1][1] *= -1;
-  sceneData.lightPos = glm::vec3(lightPos[0], lightPos[1], lightPos[2]);
-  sceneData.lightColor = glm::vec3(lightColor[0], lightColor[1], lightColor[2]);
-  sceneData.lightPower = lightPower;
-  sceneData.camPos = glm::vec3(camPos[0], camPos[1], camPos[2]);
-  
-  const size_t sceneBufferSize = sizeof(Agnosia_T::SceneBuffer);
-  Agnosia_T::AllocatedBuffer sceneBuffer = Buffers::createBuffer(sceneBufferSize*(cache.getModels().size()), VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_AUTO);
-  void *sceneBufferData = sceneBuffer.info.pMappedData;
+  // Records nothing, it's only there for the transition to the present layout.
+  RenderGraph::addPass("present").read(swapChainImage, RenderGraph::PRESENT).keep();
+}
 
-  VkBufferDeviceAddressInfo sceneBufferDeviceAddressInfo = {
-    .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
-    .buffer = sceneBuffer.buffer,
-  };
+void Graphics::createCommandPool() {
+  // Commands in Vulkan are not executed using function calls, you have to
+  // record the ops you wish to perform to command buffers, pools manage the
+  // memory used by the buffer!
+  DeviceControl::QueueFamilyIndices queueFamilyIndices = DeviceControl::findQueueFamilies(DeviceControl::getPhysicalDevice());
+
+  VkCommandPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+
+  VK_CHECK(vkCreateCommandPool(DeviceControl::getDevice(), &poolInfo, nullptr, &Buffers::getCommandPool()));
   
-  VkDeviceAddress sceneBufferAddress = vkGetBufferDeviceAddress(DeviceControl::getDevice(), &sceneBufferDeviceAddressInfo);
-
-  for (Model *model : cache.getModels()) {
-    //printf("Model: %d\n", modelID);
-    // Per model push constants
-    sceneData.vertexBuffer = model->getBuffers().vertexBufferAddress;
-    sceneData.objPosition = model->getPos();
-    sceneData.diffuseID = ((modelID+1)*4);
-    sceneData.metallicID = ((modelID+1)*4)+1;
-    sceneData.aoID = ((modelID+1)*4)+2;
-    sceneData.roughnessID = ((modelID+1)*4)+3;
-
-    // Copy the gpu buffer
-    memcpy((char*) sceneBufferData + (sceneBufferSize * modelID), &sceneData, sceneBufferSize);
-    
-    Agnosia_T::GPUPushConstants pushConsts = {
-      .gpuBufferAddress = sceneBufferAddress + (sceneBufferSize * modelID),
+  DeletionQueue::get().push_function([=](){vkDestroyCommandPool(DeviceControl::getDevice(), Buffers::getCommandPool(), nullptr);});
+}
+void Graphics::createCommandBuffer() {
+  Buffers::getCommandBuffers().resize(Buffers::getMaxFramesInFlight());
+
+  VkCommandBufferAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  allocInfo.commandPool = Buffers::getCommandPool();
+  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  allocInfo.commandBufferCount = (uint32_t)Buffers::getCommandBuffers().size();
+
+  VK_CHECK(vkAllocateCommandBuffers(DeviceControl::getDevice(), &allocInfo, Buffers::getCommandBuffers().data()));
+}
+void Graphics::createFrameData() {
+  for (uint32_t i = 0; i < Buffers::getMaxFramesInFlight(); i++) {
+    frameData.push_back(allocateFrameData(64));
+  }
+  DeletionQueue::get().push_function([=](){
+    for (FrameData& frame : frameData) {
+      destroyFrameData(frame);
+    }
+    frameData.clear();
+  });
+
+  if (DeviceControl::supportsPipelineStatistics()) {
+    VkQueryPoolCreateInfo queryPoolInfo = {
+      .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+      .queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS,
+      .queryCount = Buffers::getMaxFramesInFlight(),
+      .pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT,
     };
+    VK_CHECK(vkCreateQueryPool(DeviceControl::getDevice(), &queryPoolInfo, nullptr, &statisticsQueries));
+    statisticsWritten.assign(Buffers::getMaxFramesInFlight(), false);
+    DeletionQueue::get().push_function([=](){
+      vkDestroyQueryPool(DeviceControl::getDevice(), statisticsQueries, nullptr);
+      statisticsQueries = VK_NULL_HANDLE;
+    });
+  }
+}
+void Graphics::createCullPipeline() {
+  // The pyramid is only read with texelFetch, like the downsampler's source.
+  VkSamplerCreateInfo samplerInfo{
+    .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+    .magFilter = VK_FILTER_NEAREST,
+    .minFilter = VK_FILTER_NEAREST,
+    .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+    .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+    .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+    .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+    .maxLod = VK_LOD_CLAMP_NONE,
+  };
+  VK_CHECK(vkCreateSampler(DeviceControl::getDevice(), &samplerInfo, nullptr, &hizSampler));
+
+  // The pyramid is recreated with the swapchain, so it gets pushed rather than living in a set.
+  VkDescriptorSetLayoutBinding binding{
+    .binding = 0,
+    .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+    .descriptorCount = 1,
+    .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+    .pImmutableSamplers = &hizSampler,
+  };
+  VkDescriptorSetLayoutCreateInfo layoutInfo{
+    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+    .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT,
+    .bindingCount = 1,
+    .pBindings = &binding,
+  };
+  VK_CHECK(vkCreateDescriptorSetLayout(DeviceControl::getDevice(), &layoutInfo, nullptr, &cullSetLayout));
 
-    vkCmdPushConstants(commandBuffer, graphicsHistory.front().layout, VK_SHADER_STAGE_ALL, 0, sizeof(Agnosia_T::GPUPushConstants), &pushConsts);
+  cullPipeline = PipelineBuilder()
+    .setComputeShader("src/shaders/cull.comp")
+    .setDescriptorSetLayouts({cullSetLayout})
+    .setPushConstantSize(sizeof(Agnosia_T::CullPushConstants))
+    .BuildCompute();
 
-    vkCmdBindIndexBuffer(commandBuffer, model->getBuffers().indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+  DeletionQueue::get().push_function([=](){vkDestroyDescriptorSetLayout(DeviceControl::getDevice(), cullSetLayout, nullptr);});
+  DeletionQueue::get().push_function([=](){vkDestroySampler(DeviceControl::getDevice(), hizSampler, nullptr);});
+}
+void Graphics::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex, AssetCache& cache) {
+  VkCommandBufferBeginInfo beginInfo{};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 
-    vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(model->getIndices()), 1, 0, 0, 0);
-    modelID++;  
+  VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+  // This frame's fence has been waited on, the secondaries it executed last time are free.
+  SecondaryCommands::reset(Render::getCurrentFrame());
+  const auto recordStart = std::chrono::steady_clock::now();
+
+  // Started before the fence wait, whatever the workers haven't finished yet gets waited on here.
+  const bool cpuOcclusion = OcclusionRasterizer::finish();
+
+  // Upload any material and object edits before anything reads the tables.
+  MaterialTable::flush(commandBuffer);
+  ObjectTable::flush(commandBuffer);
+
+  FrameData& frame = frameData[Render::getCurrentFrame()];
+  const uint32_t currentFrame = Render::getCurrentFrame();
+  if (statisticsQueries != VK_NULL_HANDLE) {
+    // The frame's fence has been waited on, so whatever it counted last time is ready.
+    if (statisticsWritten[currentFrame]) {
+      vkGetQueryPoolResults(DeviceControl::getDevice(), statisticsQueries, currentFrame, 1, sizeof(uint64_t), &fragmentInvocations,
+                            sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    }
+    vkCmdResetQueryPool(commandBuffer, statisticsQueries, currentFrame, 1);
+    statisticsWritten[currentFrame] = true;
+  }
+  // Settles this frame's render extent.
+  DynamicResolution::beginFrame(commandBuffer, currentFrame);
+  const uint32_t objectRange = ObjectTable::getObjectRange();
+  // This frame's fence has been waited on, so its buffers are free to rewrite (or replace).
+  if (frame.drawCapacity < objectRange) {
+    destroyFrameData(frame);
+    frame = allocateFrameData(std::max(objectRange, frame.drawCapacity * 2));
   }
 
-  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, fullscreenHistory.front().pipeline);
+  // Read once, the scene pass and the resolve have to agree on it.
+  const bool temporal = TemporalAA::getEnabled();
+  // Sub-pixel offset of this frame's samples, the temporal resolve gathers them back up over the frames.
+  const glm::vec2 jitter = TemporalAA::nextJitter(DynamicResolution::getRenderExtent());
+
+  Agnosia_T::SceneBuffer sceneData;
+  sceneData.objects = ObjectTable::getAddress();
+  sceneData.materials = MaterialTable::getAddress();
   
-  if(cache.getModels().empty()) {
-    memcpy((char*) sceneBufferData, &sceneData, sceneBufferSize);
-    
-    Agnosia_T::GPUPushConstants pushConsts = {
-      .gpuBufferAddress = sceneBufferAddress,
-    };
+  sceneData.model = sceneModel();
+  sceneData.view = sceneView();
+  sceneData.proj = jitterProjection(sceneProjection(), jitter, DynamicResolution::getRenderExtent());
+  sceneData.viewProj = sceneProjection() * sceneData.view * sceneData.model;
+  sceneData.previousViewProj = previousViewProjectionValid ? previousViewProjection : sceneData.viewProj;
+  previousViewProjection = sceneData.viewProj;
+  previousViewProjectionValid = true;
+  sceneData.camPos = glm::vec3(camPos[0], camPos[1], camPos[2]);
+  extractFrustumPlanes(sceneData.viewProj, sceneData.frustumPlanes);
+  // The UI's light goes first, then whatever else lights the scene this frame.
+  const glm::vec3 keyColor = glm::vec3(lightColor[0], lightColor[1], lightColor[2]);
+  LightGrid::update(currentFrame, {
+    .position = glm::vec3(lightPos[0], lightPos[1], lightPos[2]),
+    .radius = LightGrid::radiusFor(keyColor, lightPower),
+    .color = keyColor,
+    .intensity = lightPower,
+  }, glm::vec3(centerPos[0], centerPos[1], centerPos[2]));
+  sceneData.lights = LightGrid::getLightAddress(currentFrame);
+  sceneData.clusters = LightGrid::getClusterAddress();
+  sceneData.lightCount = LightGrid::getLightCount();
+  const glm::vec2 sliceScaleBias = LightGrid::getSliceScaleBias(distanceField[0], distanceField[1]);
+  sceneData.clusterScale = sliceScaleBias.x;
+  sceneData.clusterBias = sliceScaleBias.y;
+  sceneData.sunDirection = glm::vec3(sunDirection[0], sunDirection[1], sunDirection[2]);
+  sceneData.sunColor = glm::vec3(sunColor[0], sunColor[1], sunColor[2]);
+  sceneData.sunIntensity = sunPower;
+  std::vector<Model *> models = cache.getModels();
+  ShadowCascades::update(sceneData.view, glm::radians(depthField),
+                         DeviceControl::getSwapChainExtent().width / (float)DeviceControl::getSwapChainExtent().height,
+                         distanceField[0], distanceField[1], sceneData.sunDirection, models, sceneData);
+  memcpy(frame.scene.info.pMappedData, &sceneData, sizeof(Agnosia_T::SceneBuffer));
+
+  const VkExtent2D renderExtent = DynamicResolution::getRenderExtent();
+  LightGrid::addBinPass(frame.sceneAddress, sceneProjection(), distanceField[0], distanceField[1]);
+  // Nothing at all when neither the sun, the camera nor any caster moved enough to matter.
+  ShadowCascades::addPasses(frame.sceneAddress);
+  const bool occlusion = gpuDriven && occlusionCulling && objectRange > 0;
+  if (gpuDriven && objectRange > 0) {
+    addCullPasses(frame, frame.draws, frame.drawsResource, frame.drawsAddress, objectRange, occlusion ? CULL_PHASE_EARLY : CULL_PHASE_FRUSTUM);
+  }
 
-    vkCmdPushConstants(commandBuffer, graphicsHistory.front().layout, VK_SHADER_STAGE_ALL, 0, sizeof(Agnosia_T::GPUPushConstants), &pushConsts);
+  // The GPU driven path is a single indirect draw, there is nothing to cache or split up. Neither is used with
+  // occlusion culling, so the whole frame is one scene pass. CPU occlusion changes the draw list every frame.
+  const bool staticDrawsCached = cacheStaticDraws && !gpuDriven && !cpuOcclusion;
+  const bool parallel = !staticDrawsCached && parallelRecording && !gpuDriven;
+  const bool secondaryContents = staticDrawsCached || parallel;
+  staticDrawsReused = false;
+
+  // The secondaries are recorded now, the passes executing them only once the graph records the frame.
+  std::vector<VkCommandBuffer> secondaries;
+  if (staticDrawsCached) {
+    secondaries.push_back(recordStaticDraws(frame, models, cache.getModelGeneration()));
+  } else if (parallel) {
+    buildRenderQueue(models, cpuOcclusion);
+    secondaries = recordParallelDraws(frame);
+  } else if (!gpuDriven) {
+    buildRenderQueue(models, cpuOcclusion);
+  }
+  if (secondaryContents) {
+    // Any workers are done with the first pool by now, the overlay goes after the draws.
+    VkCommandBuffer overlay = SecondaryCommands::acquire(Render::getCurrentFrame(), 0);
+    beginSceneSecondary(overlay);
+    recordOverlay(overlay, frame);
+    VK_CHECK(vkEndCommandBuffer(overlay));
+    secondaries.push_back(overlay);
+  }
+  secondaryCount = static_cast<uint32_t>(secondaries.size());
+
+  // Whichever scene pass is last draws the overlay and closes the statistics query and the scene timing.
+  const auto finishScene = [&](VkCommandBuffer commandBuffer) {
+    if (secondaryContents) {
+      vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(secondaries.size()), secondaries.data());
+    } else {
+      recordOverlay(commandBuffer, frame);
+    }
+    vkCmdEndRendering(commandBuffer);
+    if (statisticsQueries != VK_NULL_HANDLE) {
+      vkCmdEndQuery(commandBuffer, statisticsQueries, currentFrame);
+    }
+    DynamicResolution::endScene(commandBuffer, currentFrame);
+  };
 
+  // ------------------- DYNAMIC RENDER INFO ---------------------- //
+  // Kept for the query even if nothing were to read what they draw.
+  RenderGraph::Pass scenePass = RenderGraph::addPass(occlusion ? "early scene" : "scene", [&](VkCommandBuffer commandBuffer) {
+    if (statisticsQueries != VK_NULL_HANDLE) {
+      vkCmdBeginQuery(commandBuffer, statisticsQueries, currentFrame, 0);
+    }
+    beginScenePass(commandBuffer, true, !occlusion, secondaryContents ? VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT : 0);
+    if (!secondaryContents) {
+      bindSceneState(commandBuffer, frame);
+      if (gpuDriven) {
+        if (objectRange > 0) {
+          recordIndirectDraws(commandBuffer, frame.draws.buffer, objectRange);
+        }
+      } else {
+        recordQueuedDraws(commandBuffer, 0, static_cast<uint32_t>(RenderQueue::getDraws().size()), depthPrepass, true);
+      }
+    }
+    if (occlusion) {
+      vkCmdEndRendering(commandBuffer);
+    } else {
+      finishScene(commandBuffer);
+    }
+  });
+  scenePass.keep()
+    .read(LightGrid::getClusterBuffer(), RenderGraph::BUFFER_FRAGMENT_STORAGE)
+    .read(ShadowCascades::getShadowImage(), RenderGraph::FRAGMENT_SAMPLED);
+  useSceneTargets(scenePass, true, !occlusion);
+  if (gpuDriven && objectRange > 0) {
+    scenePass.read(frame.drawsResource, RenderGraph::BUFFER_INDIRECT);
   }
 
-  vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+  if (occlusion) {
+    // Last frame's visible set is down, build the pyramid from it and draw whatever it doesn't hide that wasn't drawn yet.
+    HiZPyramid::addBuildPass(renderExtent);
+    addCullPasses(frame, frame.lateDraws, frame.lateDrawsResource, frame.lateDrawsAddress, objectRange, CULL_PHASE_LATE);
+
+    RenderGraph::Pass latePass = RenderGraph::addPass("late scene", [&](VkCommandBuffer commandBuffer) {
+      beginScenePass(commandBuffer, false, true);
+      bindSceneState(commandBuffer, frame);
+      recordIndirectDraws(commandBuffer, frame.lateDraws.buffer, objectRange);
+      finishScene(commandBuffer);
+    });
+    latePass.keep()
+      .read(frame.lateDrawsResource, RenderGraph::BUFFER_INDIRECT)
+      .read(LightGrid::getClusterBuffer(), RenderGraph::BUFFER_FRAGMENT_STORAGE)
+      .read(ShadowCascades::getShadowImage(), RenderGraph::FRAGMENT_SAMPLED);
+    useSceneTargets(latePass, false, true);
+  }
 
-  ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), commandBuffer);
-  
-  vkCmdEndRendering(commandBuffer);
+  for (Model *model : models) {
+    // Tell the texture streamer how many pixels tall this model is on screen, so it knows which mips are worth loading.
+    float distance = glm::length(sceneData.camPos - (model->getPos() + model->getBoundsCenter()));
+    float projectedPixels = distance > model->getBoundsRadius()
+      ? model->getBoundsRadius() * 2.0f * DeviceControl::getSwapChainExtent().height / (2.0f * distance * std::tan(glm::radians(depthField) * 0.5f))
+      : std::numeric_limits<float>::max();
+    TextureStreamer::requestProjectedSize(model->getMaterial().getDiffuseTexture(), projectedPixels);
+    TextureStreamer::requestProjectedSize(model->getMaterial().getORMTexture(), projectedPixels);
+  }
 
-  
-  const VkImageMemoryBarrier2 prePresentImageBarrier{
-      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
-      .pNext = nullptr,
-      .srcStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
-      .srcAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
-      .dstStageMask = VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT,
-      .dstAccessMask = 0,
-      .oldLayout = VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL,
-      .newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-      .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-      .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-      .image = DeviceControl::getSwapChainImages()[imageIndex],
-      .subresourceRange =
-          {
-              .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-              .baseMipLevel = 0,
-              .levelCount = 1,
-              .baseArrayLayer = 0,
-              .layerCount = 1,
-          },
-  };
-  const VkDependencyInfo depInfo{
-      .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
-      .pNext = nullptr,
-      .imageMemoryBarrierCount = 1,
-      .pImageMemoryBarriers = &prePresentImageBarrier,
-  };
+  RenderGraph::Image source = Texture::getSceneImage();
+  if (temporal) {
+    source = TemporalAA::addResolvePass(source, renderExtent, jitter);
+  } else {
+    // Nothing was accumulated while off, it would come back stale.
+    TemporalAA::resetHistory();
+  }
+  const RenderGraph::Image swapChainImage = Render::getSwapChainImage(imageIndex);
+  // Waited on at the transfer stage, the swapchain image is first touched by the upscale blit.
+  RenderGraph::acquired(swapChainImage, VK_PIPELINE_STAGE_2_TRANSFER_BIT);
+  addPresentPasses(source, swapChainImage, temporal);
 
-  vkCmdPipelineBarrier2(Buffers::getCommandBuffers()[Render::getCurrentFrame()], &depInfo);
+  RenderGraph::execute(commandBuffer);
 
   VK_CHECK(vkEndCommandBuffer(commandBuffer));
-  
-  vmaDestroyBuffer(Buffers::getAllocator(), sceneBuffer.buffer, sceneBuffer.allocation);
-  
+  recordMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - recordStart).count();
 }
 
+glm::mat4 Graphics::getViewProjection() { return sceneProjection() * sceneView() * sceneModel(); }
 float *Graphics::getCamPos() { return camPos; }
 float *Graphics::getLightPos() { return lightPos; }
 float *Graphics::getLightColor() { return lightColor; }
 float &Graphics::getLightPower() { return lightPower; }
+float *Graphics::getSunDirection() { return sunDirection; }
+float *Graphics::getSunColor() { return sunColor; }
+float &Graphics::getSunPower() { return sunPower; }
 float *Graphics::getCenterPos() { return centerPos; }
 float *Graphics::getUpDir() { return upDir; }
 float &Graphics::getDepthField() { return depthField; }
@@ -266,7 +839,26 @@ float *Graphics::getDistanceField() { return distanceField; }
 
 void Graphics::addGraphicsPipeline(Agnosia_T::Pipeline pipeline) {
     graphicsHistory.push_front(pipeline);
+    invalidateStaticDraws();
+}
+void Graphics::addDepthPrepassPipeline(Agnosia_T::Pipeline pipeline) {
+    depthPrepassHistory.push_front(pipeline);
+    invalidateStaticDraws();
 }
 void Graphics::addFullscreenPipeline(Agnosia_T::Pipeline pipeline) {
     fullscreenHistory.push_front(pipeline);
 }
+bool &Graphics::getGPUDriven() { return gpuDriven; }
+bool &Graphics::getOcclusionCulling() { return occlusionCulling; }
+bool &Graphics::getParallelRecording() { return parallelRecording; }
+bool &Graphics::getDepthPrepass() { return depthPrepass; }
+uint64_t Graphics::getFragmentInvocations() { return fragmentInvocations; }
+float Graphics::getRecordMilliseconds() { return recordMilliseconds; }
+uint32_t Graphics::getSecondaryCount() { return secondaryCount; }
+bool &Graphics::getCacheStaticDraws() { return cacheStaticDraws; }
+bool Graphics::getStaticDrawsReused() { return staticDrawsReused; }
+void Graphics::invalidateStaticDraws() {
+  for (StaticDraws& cached : staticDraws) {
+    cached.valid = false;
+  }
+}
@@ -7,18 +7,50 @@ class Graphics {
 public:
   static void createCommandPool();
   static void createCommandBuffer();
+  // Per frame in flight scene and draw buffers.
+  static void createFrameData();
   static void recordCommandBuffer(VkCommandBuffer cmndBuffer, uint32_t imageIndex, AssetCache& cache);
 
   static void addGraphicsPipeline(Agnosia_T::Pipeline pipeline);
   static void addFullscreenPipeline(Agnosia_T::Pipeline pipeline);
+  // The depth only twin of the graphics pipeline added alongside it (same rasterization, depth.vert, no color).
+  static void addDepthPrepassPipeline(Agnosia_T::Pipeline pipeline);
+  // Frustum and Hi-Z occlusion culls the ObjectTable into the indirect draw lists (see cull.comp).
+  static void createCullPipeline();
   
+  // Of the camera as the next recorded frame will see it, for CPU side culling.
+  static glm::mat4 getViewProjection();
   static float *getCamPos();
   static float *getLightPos();
   static float *getLightColor();
   static float &getLightPower();
+  // Points toward the sun, doesn't need to be normalized.
+  static float *getSunDirection();
+  static float *getSunColor();
+  static float &getSunPower();
   static float *getCenterPos();
   static float *getUpDir();
   static float &getDepthField();
   static float *getDistanceField();
+  // Cull and build draws on the GPU (one indirect draw), instead of a draw per model recorded on the CPU.
+  static bool &getGPUDriven();
+  // Draw last frame's visible set, build the Hi-Z pyramid, then draw what it doesn't hide. Needs GPU driven culling.
+  static bool &getOcclusionCulling();
+  // Record the CPU path's draws on the worker threads into secondary command buffers.
+  static bool &getParallelRecording();
+  // Draw the scene depth only first, then shade it with an EQUAL depth test so each pixel is shaded once.
+  static bool &getDepthPrepass();
+  // From the last finished frame, zero when pipeline statistics queries aren't supported.
+  static uint64_t getFragmentInvocations();
+  // How long the last recordCommandBuffer took, and how many secondaries it executed.
+  static float getRecordMilliseconds();
+  static uint32_t getSecondaryCount();
+  // Keep the CPU path's draw list in a secondary per frame in flight, re-recorded only when models, pipelines or the
+  // swapchain change.
+  static bool &getCacheStaticDraws();
+  // Whether the last frame executed its cached draw list without re-recording it.
+  static bool getStaticDrawsReused();
+  // For changes the cached draw lists can't notice by themselves, like the swapchain being recreated.
+  static void invalidateStaticDraws();
   
 };
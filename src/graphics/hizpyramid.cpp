@@ -0,0 +1,160 @@
+#include "hizpyramid.h"
+#include "buffers.h"
+#include "deferreddeletion.h"
+#include "downsampler.h"
+#include "texture.h"
+#include "../devicelibrary.h"
+#include "../utils/helpers.h"
+
+#include <algorithm>
+#include <bit>
+
+constexpr VkFormat PYRAMID_FORMAT = VK_FORMAT_R32_SFLOAT;
+
+// Only used when depth is multisampled, the pyramid can't read an MSAA image.
+RenderGraph::Image depthResolve;
+VkResolveModeFlagBits depthResolveMode = VK_RESOLVE_MODE_NONE;
+RenderGraph::Image depthSource;
+VkExtent2D depthSourceExtent;
+// The source is a transient, so its view and the downsampler target reading it are made once the graph has placed it,
+// and again whenever it places it somewhere else.
+VkImageView depthSourceView = VK_NULL_HANDLE;
+uint64_t depthSourceGeneration = 0;
+
+Texture::Image pyramid;
+RenderGraph::Image pyramidImage;
+VkExtent2D pyramidExtent;
+uint32_t pyramidMips;
+Downsampler::Target pyramidTarget;
+
+static VkResolveModeFlagBits pickResolveMode() {
+  VkPhysicalDeviceDepthStencilResolveProperties resolveProperties{
+    .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DEPTH_STENCIL_RESOLVE_PROPERTIES,
+  };
+  VkPhysicalDeviceProperties2 properties{
+    .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+    .pNext = &resolveProperties,
+  };
+  vkGetPhysicalDeviceProperties2(DeviceControl::getPhysicalDevice(), &properties);
+  // The farthest sample keeps the pyramid conservative along edges, sample zero is all that is guaranteed.
+  if (resolveProperties.supportedDepthResolveModes & VK_RESOLVE_MODE_MAX_BIT) {
+    return VK_RESOLVE_MODE_MAX_BIT;
+  }
+  return VK_RESOLVE_MODE_SAMPLE_ZERO_BIT;
+}
+static Texture::Image createImage(VkFormat format, VkExtent2D extent, uint32_t mipLevels, VkImageUsageFlags usage) {
+  VkImageCreateInfo imageInfo{
+    .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+    .imageType = VK_IMAGE_TYPE_2D,
+    .format = format,
+    .extent = {extent.width, extent.height, 1},
+    .mipLevels = mipLevels,
+    .arrayLayers = 1,
+    .samples = VK_SAMPLE_COUNT_1_BIT,
+    .tiling = VK_IMAGE_TILING_OPTIMAL,
+    .usage = usage,
+    .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+  };
+  VmaAllocationCreateInfo vmaCreateInfo = {
+    .usage = VMA_MEMORY_USAGE_GPU_ONLY,
+  };
+  Texture::Image image;
+  VK_CHECK(vmaCreateImage(Buffers::getAllocator(), &imageInfo, &vmaCreateInfo, &image.image, &image.alloc, nullptr));
+  return image;
+}
+static void destroySourceTarget() {
+  if (depthSourceView == VK_NULL_HANDLE) {
+    return;
+  }
+  Downsampler::destroyTarget(pyramidTarget);
+  DeferredDeletion::imageView(depthSourceView);
+  depthSourceView = VK_NULL_HANDLE;
+}
+static void updateSourceTarget() {
+  if (depthSourceView != VK_NULL_HANDLE && depthSourceGeneration == RenderGraph::getTransientGeneration()) {
+    return;
+  }
+  destroySourceTarget();
+  // The downsampler reads its source as an array.
+  VkImageViewCreateInfo sourceViewInfo{
+    .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+    .image = RenderGraph::getImage(depthSource),
+    .viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY,
+    .format = DeviceControl::getDepthFormat(),
+    .subresourceRange = {
+      .aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
+      .baseMipLevel = 0,
+      .levelCount = 1,
+      .baseArrayLayer = 0,
+      .layerCount = 1,
+    },
+  };
+  VK_CHECK(vkCreateImageView(DeviceControl::getDevice(), &sourceViewInfo, nullptr, &depthSourceView));
+  pyramidTarget = Downsampler::createTarget(depthSourceView, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL, depthSourceExtent,
+                                            pyramid.image, PYRAMID_FORMAT, pyramidExtent, pyramidMips, 1, Downsampler::Reduction::MAX);
+  depthSourceGeneration = RenderGraph::getTransientGeneration();
+}
+
+void HiZPyramid::create() {
+  VkExtent2D screenExtent = DeviceControl::getSwapChainExtent();
+  VkFormat depthFormat = DeviceControl::getDepthFormat();
+
+  if (DeviceControl::getPerPixelSampleCount() != VK_SAMPLE_COUNT_1_BIT) {
+    depthResolveMode = pickResolveMode();
+    depthResolve = RenderGraph::createTransientImage({
+      .format = depthFormat,
+      .extent = screenExtent,
+      .samples = VK_SAMPLE_COUNT_1_BIT,
+      .usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+      .aspect = VK_IMAGE_ASPECT_DEPTH_BIT,
+    });
+    depthSource = depthResolve;
+  } else {
+    depthResolveMode = VK_RESOLVE_MODE_NONE;
+    depthResolve = {};
+    depthSource = Texture::getDepthImage();
+  }
+  depthSourceExtent = screenExtent;
+
+  // Rounding down keeps every level an exact halving of the last, so a 2x2 footprint always covers what it should.
+  pyramidExtent = {std::bit_floor(screenExtent.width), std::bit_floor(screenExtent.height)};
+  pyramidMips = std::bit_width(std::max(pyramidExtent.width, pyramidExtent.height));
+  pyramid = createImage(PYRAMID_FORMAT, pyramidExtent, pyramidMips, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
+  pyramid.imageView = DeviceControl::createImageView(pyramid.image, PYRAMID_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT, pyramidMips);
+  // Undefined until the first build, the graph readies it for the cull that binds it before then.
+  pyramidImage = RenderGraph::importImage(pyramid.image, pyramid.imageView, VK_IMAGE_ASPECT_COLOR_BIT, pyramidMips);
+}
+void HiZPyramid::destroy() {
+  destroySourceTarget();
+  RenderGraph::releaseImage(pyramidImage);
+  DeferredDeletion::imageView(pyramid.imageView);
+  DeferredDeletion::image(pyramid.image, pyramid.alloc);
+  if (depthResolve.valid()) {
+    RenderGraph::destroyTransientImage(depthResolve);
+    depthResolve = {};
+  }
+}
+
+void HiZPyramid::addBuildPass(VkExtent2D renderExtent) {
+  // The downsampler discards the levels itself, writes them and leaves them ready to sample.
+  const RenderGraph::Use pyramidWrite = {
+    VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+    VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+  };
+  RenderGraph::addPass("hi-z build", [=](VkCommandBuffer commandBuffer) {
+    updateSourceTarget();
+    // The first level reads the source by its size alone, so this is all it takes to reduce just the rendered corner.
+    pyramidTarget.passes.front().sourceExtent = renderExtent;
+    Downsampler::record(commandBuffer, pyramidTarget);
+  }).read(depthSource, RenderGraph::COMPUTE_SAMPLED_DEPTH)
+    .overwrite(pyramidImage, pyramidWrite);
+}
+
+VkResolveModeFlagBits HiZPyramid::getResolveMode() { return depthResolveMode; }
+RenderGraph::Image HiZPyramid::getResolveImage() { return depthResolve; }
+RenderGraph::Image HiZPyramid::getImage() { return pyramidImage; }
+VkImageView HiZPyramid::getView() { return pyramid.imageView; }
+VkExtent2D HiZPyramid::getExtent() { return pyramidExtent; }
+uint32_t HiZPyramid::getMipCount() { return pyramidMips; }
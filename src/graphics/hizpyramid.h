@@ -0,0 +1,28 @@
+#pragma once
+#include "volk.h"
+#include "rendergraph.h"
+#include <cstdint>
+
+// Max depth pyramid of the frame, for the late occlusion cull (see cull.comp). Level 0 is the screen rounded down to a
+// power of two, every texel holds the farthest depth under it. Sized with the swapchain, so it is recreated alongside
+// the depth image. Only the part of the depth the scene was rendered into is reduced, stretched over the whole pyramid,
+// so the cull can keep mapping the viewport onto it.
+class HiZPyramid {
+public:
+  static void create();
+  // Through DeferredDeletion, so create() can be called straight after while frames in flight finish with the old one.
+  static void destroy();
+
+  // How the depth pass resolves into getResolveImage(), a render graph transient. NONE (and an invalid image) when
+  // depth is single sampled, then the pyramid reads the depth image itself.
+  static VkResolveModeFlagBits getResolveMode();
+  static RenderGraph::Image getResolveImage();
+  // The pass reducing the renderExtent corner of the depth into every level, after the depth pass.
+  static void addBuildPass(VkExtent2D renderExtent);
+
+  // Imported into the render graph. Only the late cull reads it, but the early one binds it too.
+  static RenderGraph::Image getImage();
+  static VkImageView getView();
+  static VkExtent2D getExtent();
+  static uint32_t getMipCount();
+};
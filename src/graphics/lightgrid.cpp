@@ -0,0 +1,153 @@
+#include "lightgrid.h"
+#include "buffers.h"
+#include "pipelinebuilder.h"
+#include "../devicelibrary.h"
+#include "../utils/deletion.h"
+#include "../utils/helpers.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+namespace {
+  // Matches cluster.comp.
+  struct ClusterPushConstants {
+    VkDeviceAddress sceneBufferAddress;
+    glm::mat4 inverseProj;
+    float nearPlane;
+    float farPlane;
+  };
+  struct FrameLights {
+    Agnosia_T::AllocatedBuffer buffer;
+    VkDeviceAddress address;
+    uint32_t capacity;
+  };
+}
+
+constexpr uint32_t CLUSTER_COUNT = LightGrid::CLUSTER_X * LightGrid::CLUSTER_Y * LightGrid::CLUSTER_Z;
+static_assert(CLUSTER_COUNT % 64 == 0, "cluster.comp runs one full workgroup per 64 froxels");
+// A light count and MAX_CLUSTER_LIGHTS indices per froxel.
+constexpr VkDeviceSize CLUSTER_BYTES = sizeof(uint32_t) * (1 + LightGrid::MAX_CLUSTER_LIGHTS);
+// Radiance below this isn't worth a froxel slot.
+constexpr float LIGHT_CUTOFF = 0.01f;
+
+Agnosia_T::Pipeline clusterPipeline;
+Agnosia_T::AllocatedBuffer clusterBuffer;
+VkDeviceAddress clusterAddress;
+RenderGraph::Buffer clusterResource;
+std::vector<FrameLights> frameLights;
+std::vector<Agnosia_T::PointLight> lights;
+
+uint32_t scatteredLights = 0;
+float scatterRadius = 10.0f;
+float scatteredIntensity = 0.05f;
+const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+static VkDeviceAddress getAddress(VkBuffer buffer) {
+  VkBufferDeviceAddressInfo addressInfo = {
+    .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+    .buffer = buffer,
+  };
+  return vkGetBufferDeviceAddress(DeviceControl::getDevice(), &addressInfo);
+}
+// Host visible like the scene buffer, the lights are rewritten every frame.
+static FrameLights allocateFrameLights(uint32_t capacity) {
+  FrameLights frame;
+  frame.buffer = Buffers::createBuffer(sizeof(Agnosia_T::PointLight) * capacity, VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT,
+                                       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_AUTO);
+  frame.address = getAddress(frame.buffer.buffer);
+  frame.capacity = capacity;
+  return frame;
+}
+// Evenly spread over the disc by the golden angle, each with its own orbit speed, height and hue.
+static void scatterLights(glm::vec3 center) {
+  const float time = std::chrono::duration<float>(std::chrono::steady_clock::now() - startTime).count();
+  for (uint32_t i = 0; i < scatteredLights; i++) {
+    const float spread = std::sqrt((i + 0.5f) / scatteredLights) * scatterRadius;
+    const float speed = 0.1f + 0.4f * std::fmod(i * 0.618034f, 1.0f);
+    const float angle = i * 2.399963f + time * speed;
+    const float height = 0.25f + 2.0f * std::fmod(i * 0.754878f, 1.0f);
+    // A fully saturated hue, one of the six sides of the color wheel plus where along it.
+    const float hue = std::fmod(i * 0.381966f, 1.0f) * 6.0f;
+    const glm::vec3 color = glm::clamp(glm::vec3(std::abs(hue - 3.0f) - 1.0f, 2.0f - std::abs(hue - 2.0f), 2.0f - std::abs(hue - 4.0f)),
+                                       0.0f, 1.0f);
+    // The scene's up is +Z.
+    lights.push_back({
+      .position = center + glm::vec3(std::cos(angle) * spread, std::sin(angle) * spread, height),
+      .radius = LightGrid::radiusFor(color, scatteredIntensity),
+      .color = color,
+      .intensity = scatteredIntensity,
+    });
+  }
+}
+
+void LightGrid::createPipeline() {
+  // Everything it reads and writes is reached through the scene buffer, there is nothing to bind.
+  clusterPipeline = PipelineBuilder()
+    .setComputeShader("src/shaders/cluster.comp")
+    .setPushConstantSize(sizeof(ClusterPushConstants))
+    .BuildCompute();
+}
+void LightGrid::create() {
+  clusterBuffer = Buffers::createBuffer(CLUSTER_BYTES * CLUSTER_COUNT, 0, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                                        VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE);
+  clusterAddress = getAddress(clusterBuffer.buffer);
+  clusterResource = RenderGraph::importBuffer(clusterBuffer.buffer);
+  DeletionQueue::get().push_function([=](){vmaDestroyBuffer(Buffers::getAllocator(), clusterBuffer.buffer, clusterBuffer.allocation);});
+
+  for (uint32_t i = 0; i < Buffers::getMaxFramesInFlight(); i++) {
+    frameLights.push_back(allocateFrameLights(64));
+  }
+  DeletionQueue::get().push_function([=](){
+    for (FrameLights& frame : frameLights) {
+      vmaDestroyBuffer(Buffers::getAllocator(), frame.buffer.buffer, frame.buffer.allocation);
+    }
+    frameLights.clear();
+  });
+}
+
+void LightGrid::update(uint32_t frame, const Agnosia_T::PointLight& keyLight, glm::vec3 center) {
+  lights.clear();
+  lights.push_back(keyLight);
+  scatterLights(center);
+
+  FrameLights& current = frameLights[frame];
+  if (current.capacity < lights.size()) {
+    vmaDestroyBuffer(Buffers::getAllocator(), current.buffer.buffer, current.buffer.allocation);
+    current = allocateFrameLights(std::max(static_cast<uint32_t>(lights.size()), current.capacity * 2));
+  }
+  memcpy(current.buffer.info.pMappedData, lights.data(), sizeof(Agnosia_T::PointLight) * lights.size());
+}
+void LightGrid::addBinPass(VkDeviceAddress sceneAddress, const glm::mat4& proj, float nearPlane, float farPlane) {
+  const ClusterPushConstants pushConstants = {
+    .sceneBufferAddress = sceneAddress,
+    .inverseProj = glm::inverse(proj),
+    .nearPlane = nearPlane,
+    .farPlane = farPlane,
+  };
+  // Every froxel's list is rewritten, after last frame's scene passes are done reading them.
+  RenderGraph::addPass("light binning", [=](VkCommandBuffer commandBuffer) {
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, clusterPipeline.pipeline);
+    vkCmdPushConstants(commandBuffer, clusterPipeline.layout, VK_SHADER_STAGE_ALL, 0, sizeof(ClusterPushConstants), &pushConstants);
+    vkCmdDispatch(commandBuffer, CLUSTER_COUNT / 64, 1, 1);
+  }).write(clusterResource, RenderGraph::BUFFER_COMPUTE_STORAGE);
+}
+
+VkDeviceAddress LightGrid::getLightAddress(uint32_t frame) { return frameLights[frame].address; }
+VkDeviceAddress LightGrid::getClusterAddress() { return clusterAddress; }
+RenderGraph::Buffer LightGrid::getClusterBuffer() { return clusterResource; }
+uint32_t LightGrid::getLightCount() { return static_cast<uint32_t>(lights.size()); }
+glm::vec2 LightGrid::getSliceScaleBias(float nearPlane, float farPlane) {
+  const float scale = CLUSTER_Z / std::log(farPlane / nearPlane);
+  return glm::vec2(scale, -std::log(nearPlane) * scale);
+}
+float LightGrid::radiusFor(glm::vec3 color, float intensity) {
+  const float brightest = std::max(std::max(color.r, color.g), color.b) * intensity;
+  return std::sqrt(std::max(brightest, 0.0f) / LIGHT_CUTOFF);
+}
+
+uint32_t &LightGrid::getScatteredLights() { return scatteredLights; }
+float &LightGrid::getScatterRadius() { return scatterRadius; }
+float &LightGrid::getScatteredIntensity() { return scatteredIntensity; }
@@ -0,0 +1,45 @@
+#pragma once
+#include "volk.h"
+#include "rendergraph.h"
+#include "../utils/types.h"
+#include <cstdint>
+#include <glm/glm.hpp>
+
+// Clustered forward lighting. The view frustum is cut into a froxel grid, CLUSTER_X by CLUSTER_Y tiles of the screen
+// and CLUSTER_Z slices spaced exponentially in depth. Every frame cluster.comp culls the frame's point lights against
+// each froxel and lists the ones reaching it, so base.frag only shades those however many lights the scene has. Next to
+// the key light from the UI, any number of scattered lights can orbit the scene center to load it up.
+class LightGrid {
+public:
+  // Match common.glsl.
+  static constexpr uint32_t CLUSTER_X = 16;
+  static constexpr uint32_t CLUSTER_Y = 9;
+  static constexpr uint32_t CLUSTER_Z = 24;
+  static constexpr uint32_t MAX_CLUSTER_LIGHTS = 128;
+  static constexpr uint32_t MAX_SCATTERED_LIGHTS = 8192;
+
+  static void createPipeline();
+  // The cluster buffer and a light buffer per frame in flight.
+  static void create();
+
+  // Writes this frame's lights, the key light first, into the frame's light buffer. Its fence has been waited on, so
+  // the buffer is replaced straight away if they don't fit.
+  static void update(uint32_t frame, const Agnosia_T::PointLight& keyLight, glm::vec3 center);
+  // The binning pass, after update() and before the scene passes. `proj` without the temporal jitter.
+  static void addBinPass(VkDeviceAddress sceneAddress, const glm::mat4& proj, float nearPlane, float farPlane);
+
+  static VkDeviceAddress getLightAddress(uint32_t frame);
+  static VkDeviceAddress getClusterAddress();
+  // For the scene passes to declare their reads to the render graph.
+  static RenderGraph::Buffer getClusterBuffer();
+  // Of the last update().
+  static uint32_t getLightCount();
+  // log(view depth) * scale + bias is the slice a depth falls in.
+  static glm::vec2 getSliceScaleBias(float nearPlane, float farPlane);
+  // Where a light's inverse square falloff drops below anything worth shading, it's binned and faded out by then.
+  static float radiusFor(glm::vec3 color, float intensity);
+
+  static uint32_t &getScatteredLights();
+  static float &getScatterRadius();
+  static float &getScatteredIntensity();
+};
@@ -1,13 +1,42 @@
 #include "material.h"
+#include "materialtable.h"
 
-Material::Material(const std::string &matID, Texture* diffuseTexture, Texture* metallicTexture, Texture* roughnessTexture, Texture* ambientOcclusionTexture)
-    : ID(matID), diffuseTexture(diffuseTexture), metallicTexture(metallicTexture), roughnessTexture(roughnessTexture), ambientOcclusionTexture(ambientOcclusionTexture) {}
+Material::Material(const std::string &matID, Texture* diffuseTexture, Texture* ormTexture)
+    : ID(matID), diffuseTexture(diffuseTexture), ormTexture(ormTexture),
+      baseColorFactor(1.0f), roughnessFactor(1.0f), metallicFactor(1.0f), flags(0),
+      // ORM detail at grazing angles is rarely visible, so it doesn't get the full anisotropic tap count.
+      diffuseSampler{.maxAnisotropy = 16.0f}, ormSampler{.maxAnisotropy = 4.0f},
+      materialID(MaterialTable::allocate()) {
+  updateRecord();
+}
+Material::~Material() { MaterialTable::free(this->materialID); }
+
+void Material::updateRecord() {
+  // Slots of streaming textures change as their mips come and go, TextureStreamer::commit() marks us dirty when they do.
+  Agnosia_T::GPUMaterial record = {
+    .diffuseSlot = this->diffuseTexture->getSlot(),
+    .diffuseLayer = this->diffuseTexture->getLayer(),
+    .ormSlot = this->ormTexture->getSlot(),
+    .ormLayer = this->ormTexture->getLayer(),
+    .baseColorFactor = this->baseColorFactor,
+    .roughnessFactor = this->roughnessFactor,
+    .metallicFactor = this->metallicFactor,
+    .flags = this->flags,
+    .diffuseSampler = SamplerCache::getSampler(this->diffuseSampler),
+    .ormSampler = SamplerCache::getSampler(this->ormSampler),
+  };
+  MaterialTable::update(this->materialID, record);
+}
+void Material::markDirty() { updateRecord(); }
 
 std::string Material::getID() const { return ID; }
+uint32_t Material::getMaterialID() const { return this->materialID; }
 
 Texture* Material::getDiffuseTexture() { return this->diffuseTexture; }
-Texture* Material::getMetallicTexture() { return this->metallicTexture; }
-Texture* Material::getRoughnessTexture() { return this->roughnessTexture; }
-Texture* Material::getAOTexture() { return this->ambientOcclusionTexture; }
-
-
+Texture* Material::getORMTexture() { return this->ormTexture; }
+glm::vec4 &Material::getBaseColorFactor() { return this->baseColorFactor; }
+float &Material::getRoughnessFactor() { return this->roughnessFactor; }
+float &Material::getMetallicFactor() { return this->metallicFactor; }
+uint32_t &Material::getFlags() { return this->flags; }
+SamplerCache::Settings &Material::getDiffuseSampler() { return this->diffuseSampler; }
+SamplerCache::Settings &Material::getORMSampler() { return this->ormSampler; }
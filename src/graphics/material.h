@@ -1,25 +1,51 @@
 #pragma once
 
 #include "texture.h"
+#include "samplercache.h"
 #include "volk.h"
+#include <glm/glm.hpp>
 #include <string>
 
 class Material {
 protected:
   std::string ID;
   Texture* diffuseTexture;
-  Texture* metallicTexture;
-  Texture* roughnessTexture;
-  Texture* ambientOcclusionTexture;
+  // Ambient Occlusion, Roughness and Metallic packed into the R, G and B channels respectively.
+  Texture* ormTexture;
+  // Multiplied into the texture values in the shader.
+  glm::vec4 baseColorFactor;
+  float roughnessFactor;
+  float metallicFactor;
+  uint32_t flags;
+  // How each texture is sampled, samplers themselves are shared through the SamplerCache.
+  SamplerCache::Settings diffuseSampler;
+  SamplerCache::Settings ormSampler;
+  // Index of our record in the MaterialTable.
+  uint32_t materialID;
+
+  void updateRecord();
 
 public:
-  Material(const std::string &matID, Texture* diffuseTexture, Texture* metallicTexture, Texture* roughnessTexture, Texture* ambientOcclusionTexture);
+  // Skip lighting and output the base color as is.
+  static constexpr uint32_t FLAG_UNLIT = 1u << 0;
+
+  Material(const std::string &matID, Texture* diffuseTexture, Texture* ormTexture);
+  ~Material();
+  // The table entry is owned, so materials are shared by pointer instead of copied around.
+  Material(const Material&) = delete;
+  Material& operator=(const Material&) = delete;
   
   std::string getID() const;
+  uint32_t getMaterialID() const;
   
   Texture* getDiffuseTexture();
-  Texture* getMetallicTexture();
-  Texture* getRoughnessTexture();
-  Texture* getAOTexture();
-  
+  Texture* getORMTexture();
+  glm::vec4 &getBaseColorFactor();
+  float &getRoughnessFactor();
+  float &getMetallicFactor();
+  uint32_t &getFlags();
+  SamplerCache::Settings &getDiffuseSampler();
+  SamplerCache::Settings &getORMSampler();
+  // Push edits made through the getters above to the GPU.
+  void markDirty();
 };
@@ -0,0 +1,119 @@
+#include "materialtable.h"
+#include "buffers.h"
+#include "../devicelibrary.h"
+#include "../utils/deletion.h"
+#include "../utils/helpers.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+Agnosia_T::AllocatedBuffer materialBuffer;
+VkDeviceAddress materialBufferAddress;
+
+std::vector<Agnosia_T::GPUMaterial> materialRecords;
+std::vector<bool> dirtyMaterials;
+std::vector<uint32_t> freeMaterialIDs;
+uint32_t materialCount = 0;
+
+void MaterialTable::create() {
+  materialBuffer = Buffers::createBuffer(sizeof(Agnosia_T::GPUMaterial) * MAX_MATERIALS, 0,
+    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+    VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE);
+  VkBufferDeviceAddressInfo addressInfo = {
+    .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+    .buffer = materialBuffer.buffer,
+  };
+  materialBufferAddress = vkGetBufferDeviceAddress(DeviceControl::getDevice(), &addressInfo);
+  DeletionQueue::get().push_function([=](){vmaDestroyBuffer(Buffers::getAllocator(), materialBuffer.buffer, materialBuffer.allocation);});
+}
+
+uint32_t MaterialTable::allocate() {
+  uint32_t materialID;
+  if (!freeMaterialIDs.empty()) {
+    materialID = freeMaterialIDs.back();
+    freeMaterialIDs.pop_back();
+  } else {
+    if (materialRecords.size() >= MAX_MATERIALS) {
+      throw std::runtime_error("Ran out of material table entries!");
+    }
+    materialID = static_cast<uint32_t>(materialRecords.size());
+    materialRecords.emplace_back();
+    dirtyMaterials.push_back(false);
+  }
+  materialCount++;
+  return materialID;
+}
+void MaterialTable::free(uint32_t materialID) {
+  // No need to wait on the GPU, a reused ID is only rewritten by a later frame's flush, which is ordered after
+  // every earlier read of the table.
+  freeMaterialIDs.push_back(materialID);
+  dirtyMaterials[materialID] = false;
+  materialCount--;
+}
+void MaterialTable::update(uint32_t materialID, const Agnosia_T::GPUMaterial& record) {
+  materialRecords[materialID] = record;
+  dirtyMaterials[materialID] = true;
+}
+
+void MaterialTable::flush(VkCommandBuffer commandBuffer) {
+  // Gather runs of dirty records so neighbouring edits go up as one update.
+  struct Range {
+    uint32_t first;
+    uint32_t count;
+  };
+  std::vector<Range> ranges;
+  for (uint32_t i = 0; i < dirtyMaterials.size(); i++) {
+    if (!dirtyMaterials[i]) {
+      continue;
+    }
+    if (!ranges.empty() && ranges.back().first + ranges.back().count == i) {
+      ranges.back().count++;
+    } else {
+      ranges.push_back({i, 1});
+    }
+    dirtyMaterials[i] = false;
+  }
+  if (ranges.empty()) {
+    return;
+  }
+
+  // Earlier frames may still be reading the records we are about to overwrite.
+  VkBufferMemoryBarrier2 barrier = {
+    .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2,
+    .srcStageMask = VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+    .srcAccessMask = 0,
+    .dstStageMask = VK_PIPELINE_STAGE_2_COPY_BIT,
+    .dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+    .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .buffer = materialBuffer.buffer,
+    .offset = 0,
+    .size = VK_WHOLE_SIZE,
+  };
+  VkDependencyInfo dependencyInfo = {
+    .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+    .bufferMemoryBarrierCount = 1,
+    .pBufferMemoryBarriers = &barrier,
+  };
+  vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+
+  // vkCmdUpdateBuffer is capped at 64KB per call.
+  constexpr uint32_t MAX_RECORDS_PER_UPDATE = 65536 / sizeof(Agnosia_T::GPUMaterial);
+  for (const Range& range : ranges) {
+    for (uint32_t first = range.first; first < range.first + range.count; first += MAX_RECORDS_PER_UPDATE) {
+      uint32_t count = std::min(MAX_RECORDS_PER_UPDATE, range.first + range.count - first);
+      vkCmdUpdateBuffer(commandBuffer, materialBuffer.buffer, first * sizeof(Agnosia_T::GPUMaterial),
+                        count * sizeof(Agnosia_T::GPUMaterial), &materialRecords[first]);
+    }
+  }
+
+  barrier.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+  barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+  barrier.dstStageMask = VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+  barrier.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT;
+  vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+}
+
+VkDeviceAddress MaterialTable::getAddress() { return materialBufferAddress; }
+uint32_t MaterialTable::getMaterialCount() { return materialCount; }
@@ -0,0 +1,22 @@
+#pragma once
+#include "volk.h"
+#include <cstdint>
+#include "../utils/types.h"
+
+// Every material's GPU record lives in one device local buffer, objects just carry the index of theirs.
+// Records are kept on the CPU too, changes are uploaded with vkCmdUpdateBuffer at the start of the next frame.
+class MaterialTable {
+public:
+  static constexpr uint32_t MAX_MATERIALS = 4096;
+
+  static void create();
+  static uint32_t allocate();
+  static void free(uint32_t materialID);
+  // Only the records changed since the last flush get uploaded.
+  static void update(uint32_t materialID, const Agnosia_T::GPUMaterial& record);
+  // Record the uploads, must be outside of a render pass.
+  static void flush(VkCommandBuffer commandBuffer);
+
+  static VkDeviceAddress getAddress();
+  static uint32_t getMaterialCount();
+};
@@ -0,0 +1,128 @@
+#include "meshpool.h"
+#include "buffers.h"
+#include "../devicelibrary.h"
+#include "../utils/deletion.h"
+#include "../utils/helpers.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+// 4MB to start with, doubled whenever a mesh doesn't fit.
+constexpr uint32_t INITIAL_INDEX_CAPACITY = 1u << 20;
+
+Agnosia_T::AllocatedBuffer indexPool;
+uint32_t indexPoolCapacity = 0;
+uint32_t indexPoolCount = 0;
+
+struct IndexRange {
+  uint32_t firstIndex;
+  uint32_t indexCount;
+};
+// Holes below indexPoolCount, sorted and never touching each other.
+std::vector<IndexRange> freeRanges;
+
+// First fit out of the holes, the pool only grows when none of them is big enough.
+static bool reuseRange(uint32_t indexCount, uint32_t& firstIndex) {
+  auto it = std::find_if(freeRanges.begin(), freeRanges.end(), [&](const IndexRange& range) { return range.indexCount >= indexCount; });
+  if (it == freeRanges.end()) {
+    return false;
+  }
+  firstIndex = it->firstIndex;
+  it->firstIndex += indexCount;
+  it->indexCount -= indexCount;
+  if (it->indexCount == 0) {
+    freeRanges.erase(it);
+  }
+  return true;
+}
+
+static Agnosia_T::AllocatedBuffer createIndexPool(uint32_t capacity) {
+  return Buffers::createBuffer(static_cast<size_t>(capacity) * sizeof(uint32_t), 0,
+    VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+    VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE);
+}
+
+void MeshPool::create() {
+  indexPool = createIndexPool(INITIAL_INDEX_CAPACITY);
+  indexPoolCapacity = INITIAL_INDEX_CAPACITY;
+  DeletionQueue::get().push_function([=](){vmaDestroyBuffer(Buffers::getAllocator(), indexPool.buffer, indexPool.allocation);});
+}
+
+uint32_t MeshPool::uploadIndices(const std::vector<uint32_t>& indices) {
+  const uint32_t indexCount = static_cast<uint32_t>(indices.size());
+  uint32_t firstIndex = indexPoolCount;
+  const bool reused = indexCount > 0 && reuseRange(indexCount, firstIndex);
+  if (!reused && static_cast<uint64_t>(indexPoolCount) + indexCount > UINT32_MAX) {
+    throw std::runtime_error("Ran out of room in the index pool!");
+  }
+  const size_t uploadSize = indices.size() * sizeof(uint32_t);
+
+  Agnosia_T::AllocatedBuffer stagingBuffer = Buffers::createBuffer(uploadSize,
+      VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT,
+      VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+      VMA_MEMORY_USAGE_AUTO);
+  memcpy(stagingBuffer.info.pMappedData, indices.data(), uploadSize);
+
+  uint32_t newCapacity = indexPoolCapacity;
+  while (static_cast<uint64_t>(firstIndex) + indexCount > newCapacity) {
+    newCapacity = newCapacity > UINT32_MAX / 2 ? UINT32_MAX : newCapacity * 2;
+  }
+  Agnosia_T::AllocatedBuffer oldPool = indexPool;
+  if (newCapacity != indexPoolCapacity) {
+    indexPool = createIndexPool(newCapacity);
+  }
+
+  immediate_submit([&](VkCommandBuffer cmd) {
+    if (oldPool.buffer != indexPool.buffer && indexPoolCount > 0) {
+      VkBufferCopy growCopy = {
+        .srcOffset = 0,
+        .dstOffset = 0,
+        .size = indexPoolCount * sizeof(uint32_t),
+      };
+      vkCmdCopyBuffer(cmd, oldPool.buffer, indexPool.buffer, 1, &growCopy);
+    }
+    VkBufferCopy indexCopy = {
+      .srcOffset = 0,
+      .dstOffset = firstIndex * sizeof(uint32_t),
+      .size = uploadSize,
+    };
+    vkCmdCopyBuffer(cmd, stagingBuffer.buffer, indexPool.buffer, 1, &indexCopy);
+  });
+  vmaDestroyBuffer(Buffers::getAllocator(), stagingBuffer.buffer, stagingBuffer.allocation);
+
+  if (oldPool.buffer != indexPool.buffer) {
+    // immediate_submit idles the queue, so no frame can still be drawing from the old pool.
+    vmaDestroyBuffer(Buffers::getAllocator(), oldPool.buffer, oldPool.allocation);
+    indexPoolCapacity = newCapacity;
+  }
+  if (!reused) {
+    indexPoolCount += indexCount;
+  }
+  return firstIndex;
+}
+void MeshPool::freeIndices(uint32_t firstIndex, uint32_t indexCount) {
+  if (indexCount == 0) {
+    return;
+  }
+  auto next = std::lower_bound(freeRanges.begin(), freeRanges.end(), firstIndex,
+                               [](const IndexRange& range, uint32_t index) { return range.firstIndex < index; });
+  auto it = freeRanges.insert(next, {firstIndex, indexCount});
+  // Merge with the holes on either side.
+  if (it + 1 != freeRanges.end() && it->firstIndex + it->indexCount == (it + 1)->firstIndex) {
+    it->indexCount += (it + 1)->indexCount;
+    freeRanges.erase(it + 1);
+  }
+  if (it != freeRanges.begin() && (it - 1)->firstIndex + (it - 1)->indexCount == it->firstIndex) {
+    (it - 1)->indexCount += it->indexCount;
+    it = freeRanges.erase(it) - 1;
+  }
+  // A hole at the end just shortens the pool.
+  if (it->firstIndex + it->indexCount == indexPoolCount) {
+    indexPoolCount = it->firstIndex;
+    freeRanges.erase(it);
+  }
+}
+
+VkBuffer MeshPool::getIndexBuffer() { return indexPool.buffer; }
+uint32_t MeshPool::getIndexCount() { return indexPoolCount; }
@@ -0,0 +1,18 @@
+#pragma once
+#include "volk.h"
+#include <cstdint>
+#include <vector>
+
+// Every mesh's indices live in one shared index buffer, so one bind covers every draw and indirect draws can reach
+// any mesh through firstIndex. Freed ranges are handed out again to later meshes that fit in them.
+class MeshPool {
+public:
+  static void create();
+  // Copy the indices in, returns the firstIndex they start at. Grows the pool (and waits on the GPU) when full.
+  static uint32_t uploadIndices(const std::vector<uint32_t>& indices);
+  // Give a range back. Frames in flight may still draw from it, so this goes through DeferredDeletion::indexRange().
+  static void freeIndices(uint32_t firstIndex, uint32_t indexCount);
+
+  static VkBuffer getIndexBuffer();
+  static uint32_t getIndexCount();
+};
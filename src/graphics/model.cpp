@@ -1,5 +1,8 @@
 #include "buffers.h"
+#include "deferreddeletion.h"
+#include "meshpool.h"
 #include "model.h"
+#include "objecttable.h"
 #include <stdexcept>
 #include "../devicelibrary.h"
 #include "../utils/helpers.h"
@@ -13,8 +16,9 @@
 #define VMA_STATIC_VULKAN_FUNCTIONS 0
 #define VMA_DYNAMIC_VULKAN_FUNCTIONS 1
 #include "vk_mem_alloc.h"
+#include <array>
 #include <cstring>
-#include "../utils/deletion.h"
+#include <limits>
 
 // chatgpt did this and the haters can WEEP fuck hash functions.
 namespace std {
@@ -32,17 +36,12 @@ template <> struct hash<Agnosia_T::Vertex> {
 
 } // namespace std
 
-
-Model::Model(const std::string &modelID, const Material &material, const std::string &modelPath, const glm::vec3 &objPos)
-  : ID(modelID), material(material), objPosition(objPos), modelPath(modelPath) {
-
-  std::vector<Agnosia_T::Vertex> vertices;
-  // Index buffer definition, showing which points to reuse.
-  std::vector<uint32_t> indices;
+// Read the OBJ into deduplicated vertices and the indices into them.
+static void loadMesh(const std::string &modelPath, std::vector<Agnosia_T::Vertex> &vertices, std::vector<uint32_t> &indices) {
   tinyobj::ObjReaderConfig readerConfig;
   tinyobj::ObjReader reader;
 
-  if (!reader.ParseFromFile(this->modelPath, readerConfig)) {
+  if (!reader.ParseFromFile(modelPath, readerConfig)) {
     if (!reader.Error().empty()) {
       throw std::runtime_error(reader.Error());
     }
@@ -84,14 +83,167 @@ Model::Model(const std::string &modelID, const Material &material, const std::st
       indices.push_back(uniqueVertices[vertex]);
     }
   }
+}
+
+// Conservative inner hull: mark every cell of a coarse grid over the bounds that the surface passes through, flood the
+// outside in from the border, and keep the faces of the cells that are left. Those lie entirely inside the mesh, so the
+// occluder never covers anything the model doesn't. Meshes that aren't closed at the grid's resolution leak, and just
+// end up with a smaller (or no) occluder.
+static Model::OccluderMesh buildOccluderMesh(const std::vector<Agnosia_T::Vertex> &vertices, const std::vector<uint32_t> &indices) {
+  glm::vec3 boundsMin(std::numeric_limits<float>::max());
+  glm::vec3 boundsMax(std::numeric_limits<float>::lowest());
+  for (const Agnosia_T::Vertex &vertex : vertices) {
+    boundsMin = glm::min(boundsMin, vertex.pos);
+    boundsMax = glm::max(boundsMax, vertex.pos);
+  }
+  constexpr int GRID = 24;
+  // One cell of padding all around, so the flood can get around the whole mesh.
+  constexpr int PADDED = GRID + 2;
+  const glm::vec3 cellSize = glm::max((boundsMax - boundsMin) / static_cast<float>(GRID), glm::vec3(1e-6f));
+  auto cellIndex = [](int x, int y, int z) { return (z * PADDED + y) * PADDED + x; };
+
+  enum : uint8_t { INSIDE, SURFACE, OUTSIDE };
+  std::vector<uint8_t> cells(PADDED * PADDED * PADDED, INSIDE);
+
+  // Split triangles until they span at most a cell along every axis, then their bounds can't miss a cell they touch.
+  std::vector<std::array<glm::vec3, 3>> pending;
+  for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+    pending.push_back({(vertices[indices[i]].pos - boundsMin) / cellSize,
+                       (vertices[indices[i + 1]].pos - boundsMin) / cellSize,
+                       (vertices[indices[i + 2]].pos - boundsMin) / cellSize});
+    while (!pending.empty()) {
+      std::array<glm::vec3, 3> triangle = pending.back();
+      pending.pop_back();
+      glm::vec3 low = glm::min(glm::min(triangle[0], triangle[1]), triangle[2]);
+      glm::vec3 high = glm::max(glm::max(triangle[0], triangle[1]), triangle[2]);
+      if (glm::any(glm::greaterThan(high - low, glm::vec3(1.0f)))) {
+        int edge = 0;
+        float longest = -1.0f;
+        for (int e = 0; e < 3; e++) {
+          glm::vec3 d = triangle[(e + 1) % 3] - triangle[e];
+          if (glm::dot(d, d) > longest) {
+            longest = glm::dot(d, d);
+            edge = e;
+          }
+        }
+        glm::vec3 middle = (triangle[edge] + triangle[(edge + 1) % 3]) * 0.5f;
+        std::array<glm::vec3, 3> half = triangle;
+        half[(edge + 1) % 3] = middle;
+        pending.push_back(half);
+        half = triangle;
+        half[edge] = middle;
+        pending.push_back(half);
+        continue;
+      }
+      glm::ivec3 first = glm::clamp(glm::ivec3(glm::floor(low)), glm::ivec3(0), glm::ivec3(GRID - 1));
+      glm::ivec3 last = glm::clamp(glm::ivec3(glm::floor(high)), glm::ivec3(0), glm::ivec3(GRID - 1));
+      for (int z = first.z; z <= last.z; z++) {
+        for (int y = first.y; y <= last.y; y++) {
+          for (int x = first.x; x <= last.x; x++) {
+            cells[cellIndex(x + 1, y + 1, z + 1)] = SURFACE;
+          }
+        }
+      }
+    }
+  }
+
+  // Stepping off the end of a row wraps into the next one, but only ever from padding into padding, which is outside anyway.
+  const int steps[6] = {1, -1, PADDED, -PADDED, PADDED * PADDED, -PADDED * PADDED};
+  std::vector<int> flood = {cellIndex(0, 0, 0)};
+  cells[flood.front()] = OUTSIDE;
+  while (!flood.empty()) {
+    int cell = flood.back();
+    flood.pop_back();
+    for (int step : steps) {
+      int next = cell + step;
+      if (next >= 0 && next < static_cast<int>(cells.size()) && cells[next] == INSIDE) {
+        cells[next] = OUTSIDE;
+        flood.push_back(next);
+      }
+    }
+  }
+
+  // A quad wherever an inside cell meets one that isn't, sharing the grid corners between them.
+  Model::OccluderMesh mesh;
+  std::unordered_map<int, uint32_t> corners;
+  auto corner = [&](glm::ivec3 position) {
+    auto [it, inserted] = corners.try_emplace((position.z * (GRID + 1) + position.y) * (GRID + 1) + position.x,
+                                              static_cast<uint32_t>(mesh.positions.size()));
+    if (inserted) {
+      mesh.positions.push_back(boundsMin + glm::vec3(position) * cellSize);
+    }
+    return it->second;
+  };
+  for (int z = 0; z < GRID; z++) {
+    for (int y = 0; y < GRID; y++) {
+      for (int x = 0; x < GRID; x++) {
+        if (cells[cellIndex(x + 1, y + 1, z + 1)] != INSIDE) {
+          continue;
+        }
+        for (int face = 0; face < 6; face++) {
+          if (cells[cellIndex(x + 1, y + 1, z + 1) + steps[face]] == INSIDE) {
+            continue;
+          }
+          const int axis = face / 2;
+          const int u = (axis + 1) % 3;
+          const int v = (axis + 2) % 3;
+          glm::ivec3 base(x, y, z);
+          base[axis] += face % 2 == 0 ? 1 : 0;
+          glm::ivec3 alongU(0), alongV(0);
+          alongU[u] = 1;
+          alongV[v] = 1;
+          uint32_t quad[4] = {corner(base), corner(base + alongU), corner(base + alongU + alongV), corner(base + alongV)};
+          mesh.indices.insert(mesh.indices.end(), {quad[0], quad[1], quad[2], quad[0], quad[2], quad[3]});
+        }
+      }
+    }
+  }
+  return mesh;
+}
+
+
+Model::Model(const std::string &modelID, Material *material, const std::string &modelPath, const glm::vec3 &objPos, bool occluder)
+  : ID(modelID), material(material), objPosition(objPos), modelPath(modelPath), occluder(occluder), dynamic(false) {
+
+  std::vector<Agnosia_T::Vertex> vertices;
+  // Index buffer definition, showing which points to reuse.
+  std::vector<uint32_t> indices;
+  loadMesh(this->modelPath, vertices, indices);
+
+  // Bounding sphere around the center of the mesh's AABB, used to find how large the model is on screen.
+  glm::vec3 boundsMin(std::numeric_limits<float>::max());
+  glm::vec3 boundsMax(std::numeric_limits<float>::lowest());
+  for (const Agnosia_T::Vertex &vertex : vertices) {
+    boundsMin = glm::min(boundsMin, vertex.pos);
+    boundsMax = glm::max(boundsMax, vertex.pos);
+  }
+  this->boundsCenter = (boundsMin + boundsMax) * 0.5f;
+  this->boundsRadius = 0.0f;
+  for (const Agnosia_T::Vertex &vertex : vertices) {
+    this->boundsRadius = std::max(this->boundsRadius, glm::length(vertex.pos - this->boundsCenter));
+  }
+  // Only occluders pay for the hull, setOccluder() builds it for models switched on later.
+  if (this->occluder) {
+    this->occluderMesh = buildOccluderMesh(vertices, indices);
+  }
+  this->occluderBuilt = this->occluder;
 
   const size_t vertexBufferSize = vertices.size() * sizeof(Agnosia_T::Vertex);
-  const size_t indexBufferSize = indices.size() * sizeof(uint32_t);
+  // The depth pre-pass only needs positions, pulled out here so it doesn't fetch the rest of every vertex.
+  std::vector<glm::vec3> positions(vertices.size());
+  for (size_t i = 0; i < vertices.size(); i++) {
+    positions[i] = vertices[i].pos;
+  }
+  const size_t positionBufferSize = positions.size() * sizeof(glm::vec3);
 
   this->buffers.vertexBuffer = Buffers::createBuffer(vertexBufferSize,
                                                   VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT,
                                                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
                                                   VMA_MEMORY_USAGE_AUTO);
+  this->buffers.positionBuffer = Buffers::createBuffer(positionBufferSize,
+                                                  VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT,
+                                                  VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                                                  VMA_MEMORY_USAGE_AUTO);
     
   // Find the address of the vertex buffer!
   VkBufferDeviceAddressInfo vertexDeviceAddressInfo = {
@@ -99,22 +251,16 @@ Model::Model(const std::string &modelID, const Material &material, const std::st
     .buffer = this->buffers.vertexBuffer.buffer,
   };
   this->buffers.vertexBufferAddress = vkGetBufferDeviceAddress(DeviceControl::getDevice(), &vertexDeviceAddressInfo);
-
-  // Create the index buffer to iterate over and check for duplicate vertices
-  this->buffers.indexBuffer = Buffers::createBuffer(indexBufferSize,
-                                                 VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT,
-                                                 VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-                                                 VMA_MEMORY_USAGE_AUTO);
-  // Find the address of the vertex buffer!
-  VkBufferDeviceAddressInfo indexDeviceAddressInfo = {
+  VkBufferDeviceAddressInfo positionDeviceAddressInfo = {
     .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
-    .buffer = this->buffers.indexBuffer.buffer,
+    .buffer = this->buffers.positionBuffer.buffer,
   };
-  this->buffers.indexBufferAddress = vkGetBufferDeviceAddress(DeviceControl::getDevice(), &indexDeviceAddressInfo);
+  this->buffers.positionBufferAddress = vkGetBufferDeviceAddress(DeviceControl::getDevice(), &positionDeviceAddressInfo);
 
   // Allocate a buffer to use memory that will first, request the ability to *be* mapped, then persistently mapped and fetched.
+  // Both streams share it, positions after the vertices.
   Agnosia_T::AllocatedBuffer stagingBuffer = Buffers::createBuffer(
-      vertexBufferSize + indexBufferSize,
+      vertexBufferSize + positionBufferSize,
       VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT,
       VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
       VMA_MEMORY_USAGE_AUTO);
@@ -123,8 +269,7 @@ Model::Model(const std::string &modelID, const Material &material, const std::st
 
   // Copy the vertex buffer
   memcpy(data, vertices.data(), vertexBufferSize);
-  // Copy the index buffer
-  memcpy((char *)data + vertexBufferSize, indices.data(), indexBufferSize);
+  memcpy(static_cast<char *>(data) + vertexBufferSize, positions.data(), positionBufferSize);
 
   immediate_submit([&](VkCommandBuffer cmd) {
     VkBufferCopy vertexCopy{0};
@@ -134,29 +279,71 @@ Model::Model(const std::string &modelID, const Material &material, const std::st
 
     vkCmdCopyBuffer(cmd, stagingBuffer.buffer, this->buffers.vertexBuffer.buffer, 1, &vertexCopy);
 
-    VkBufferCopy indexCopy{0};
-    indexCopy.dstOffset = 0;
-    indexCopy.srcOffset = vertexBufferSize;
-    indexCopy.size = indexBufferSize;
+    VkBufferCopy positionCopy{0};
+    positionCopy.dstOffset = 0;
+    positionCopy.srcOffset = vertexBufferSize;
+    positionCopy.size = positionBufferSize;
 
-    vkCmdCopyBuffer(cmd, stagingBuffer.buffer, this->buffers.indexBuffer.buffer, 1, &indexCopy);
+    vkCmdCopyBuffer(cmd, stagingBuffer.buffer, this->buffers.positionBuffer.buffer, 1, &positionCopy);
   });
   
   vmaDestroyBuffer(Buffers::getAllocator(), stagingBuffer.buffer, stagingBuffer.allocation);
+
+  // Indices go in the shared pool, so every mesh can be drawn from one index buffer binding.
+  this->firstIndex = MeshPool::uploadIndices(indices);
   
   this->verticeCount = vertices.size();
   this->indiceCount = indices.size();
   
-  Agnosia_T::AllocatedBuffer vertexBuffer = this->buffers.vertexBuffer;
-  Agnosia_T::AllocatedBuffer indexBuffer = this->buffers.indexBuffer;
-  DeletionQueue::get().push_function([=](){vmaDestroyBuffer(Buffers::getAllocator(), indexBuffer.buffer, indexBuffer.allocation);});
-  DeletionQueue::get().push_function([=](){vmaDestroyBuffer(Buffers::getAllocator(), vertexBuffer.buffer, vertexBuffer.allocation);});
+  this->objectID = ObjectTable::allocate();
+  updateRecord();
 }
+Model::~Model() {
+  ObjectTable::free(this->objectID);
+  // Removing a model mid session gives its vertex memory back once no frame in flight draws it.
+  DeferredDeletion::buffer(this->buffers.vertexBuffer);
+  DeferredDeletion::buffer(this->buffers.positionBuffer);
+  // Every model uploads its own indices, so it is the only user of its range.
+  DeferredDeletion::indexRange(this->firstIndex, this->indiceCount);
+}
+
+void Model::updateRecord() {
+  Agnosia_T::ObjectData record = {
+    .vertexBuffer = this->buffers.vertexBufferAddress,
+    .positionBuffer = this->buffers.positionBufferAddress,
+    .objPosition = this->objPosition,
+    .materialID = this->material->getMaterialID(),
+    .boundsCenter = this->boundsCenter,
+    .boundsRadius = this->boundsRadius,
+    .firstIndex = this->firstIndex,
+    .indexCount = this->indiceCount,
+  };
+  ObjectTable::update(this->objectID, record);
+}
+void Model::markDirty() { updateRecord(); }
 
 std::string Model::getID() { return this->ID; }
 glm::vec3 &Model::getPos() { return this->objPosition; }
-Material &Model::getMaterial() { return this->material; }
+glm::vec3 &Model::getBoundsCenter() { return this->boundsCenter; }
+float Model::getBoundsRadius() { return this->boundsRadius; }
+Material &Model::getMaterial() { return *this->material; }
 Agnosia_T::GPUMeshBuffers Model::getBuffers() { return this->buffers; }
 uint32_t Model::getIndices() { return this->indiceCount; }
+uint32_t Model::getFirstIndex() { return this->firstIndex; }
+uint32_t Model::getObjectID() { return this->objectID; }
+const Model::OccluderMesh &Model::getOccluderMesh() { return this->occluderMesh; }
+bool Model::getOccluder() { return this->occluder; }
+void Model::setOccluder(bool occluder) {
+  // The mesh isn't kept on the CPU, so it's read from disk again the first time.
+  if (occluder && !this->occluderBuilt) {
+    std::vector<Agnosia_T::Vertex> vertices;
+    std::vector<uint32_t> indices;
+    loadMesh(this->modelPath, vertices, indices);
+    this->occluderMesh = buildOccluderMesh(vertices, indices);
+    this->occluderBuilt = true;
+  }
+  this->occluder = occluder;
+}
+bool &Model::getDynamic() { return this->dynamic; }
 uint32_t Model::getVertices() { return this->verticeCount; }
 
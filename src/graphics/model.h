@@ -6,26 +6,67 @@
 #include "material.h"
 #include <glm/glm.hpp>
 #include <string>
+#include <vector>
 
 class Model {
+public:
+  // Voxelized inner hull of the mesh the CPU occlusion rasterizer draws, in model space. Always inside the mesh.
+  struct OccluderMesh {
+    std::vector<glm::vec3> positions;
+    std::vector<uint32_t> indices;
+  };
+
 protected:
   std::string ID;
   Agnosia_T::GPUMeshBuffers buffers;
-  Material material;
+  // Owned by the AssetCache, shared by every model using it.
+  Material *material;
   glm::vec3 objPosition;
+  // Bounding sphere of the mesh, in model space.
+  glm::vec3 boundsCenter;
+  float boundsRadius;
   uint32_t verticeCount;
   uint32_t indiceCount;
+  // Where our indices start in the MeshPool's shared index buffer.
+  uint32_t firstIndex;
+  // Index of our record in the ObjectTable, doubles as the instance index of our draw.
+  uint32_t objectID;
   std::string modelPath;
+  OccluderMesh occluderMesh;
+  bool occluder;
+  // Whether occluderMesh has been built, it stays around once it has.
+  bool occluderBuilt;
+  bool dynamic;
+
+  void updateRecord();
 
 public:
-  Model(const std::string &modelID, const Material &material,
-        const std::string &modelPath, const glm::vec3 &opjPos);
+  Model(const std::string &modelID, Material *material,
+        const std::string &modelPath, const glm::vec3 &opjPos, bool occluder = false);
+  ~Model();
+  // The table entry is owned, same as Material.
+  Model(const Model&) = delete;
+  Model& operator=(const Model&) = delete;
 
   Agnosia_T::GPUMeshBuffers getBuffers();
   std::string getID();
   glm::vec3 &getPos();
+  glm::vec3 &getBoundsCenter();
+  float getBoundsRadius();
   Material &getMaterial();
   std::string getModelPath();
   uint32_t getIndices();
+  uint32_t getFirstIndex();
+  uint32_t getObjectID();
+  const OccluderMesh &getOccluderMesh();
+  // Drawn into the CPU occlusion buffer, worth it for big solid models that hide a lot.
+  bool getOccluder();
+  // Builds the occluder mesh the first time it is switched on.
+  void setOccluder(bool occluder);
+  // Expected to move every frame. Its shadow is drawn fresh each frame on top of the cached static ones, rather than
+  // forcing the ShadowCascades to re-render everything around it whenever it moves.
+  bool &getDynamic();
+  // Push edits made through getPos() to the GPU.
+  void markDirty();
   uint32_t getVertices();
 };
@@ -0,0 +1,156 @@
+#include "objecttable.h"
+#include "buffers.h"
+#include "../devicelibrary.h"
+#include "../utils/deletion.h"
+#include "../utils/helpers.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+Agnosia_T::AllocatedBuffer objectBuffer;
+VkDeviceAddress objectBufferAddress;
+Agnosia_T::AllocatedBuffer visibilityBuffer;
+VkDeviceAddress visibilityBufferAddress;
+RenderGraph::Buffer visibilityResource;
+
+std::vector<Agnosia_T::ObjectData> objectRecords;
+std::vector<bool> dirtyObjects;
+// Each record's position as of the last flush, it becomes the previous position of the next one.
+std::vector<glm::vec3> flushedPositions;
+// Moved in the last flush, they go up once more so their previous position catches up and the motion stops.
+std::vector<uint32_t> settlingObjects;
+std::vector<uint32_t> freeObjectIDs;
+uint32_t objectCount = 0;
+
+void ObjectTable::create() {
+  objectBuffer = Buffers::createBuffer(sizeof(Agnosia_T::ObjectData) * MAX_OBJECTS, 0,
+    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+    VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE);
+  VkBufferDeviceAddressInfo addressInfo = {
+    .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+    .buffer = objectBuffer.buffer,
+  };
+  objectBufferAddress = vkGetBufferDeviceAddress(DeviceControl::getDevice(), &addressInfo);
+  DeletionQueue::get().push_function([=](){vmaDestroyBuffer(Buffers::getAllocator(), objectBuffer.buffer, objectBuffer.allocation);});
+
+  visibilityBuffer = Buffers::createBuffer(sizeof(uint32_t) * MAX_OBJECTS, 0,
+    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+    VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE);
+  addressInfo.buffer = visibilityBuffer.buffer;
+  visibilityBufferAddress = vkGetBufferDeviceAddress(DeviceControl::getDevice(), &addressInfo);
+  immediate_submit([&](VkCommandBuffer cmd) {
+    vkCmdFillBuffer(cmd, visibilityBuffer.buffer, 0, VK_WHOLE_SIZE, 0);
+  });
+  visibilityResource = RenderGraph::importBuffer(visibilityBuffer.buffer);
+  DeletionQueue::get().push_function([=](){vmaDestroyBuffer(Buffers::getAllocator(), visibilityBuffer.buffer, visibilityBuffer.allocation);});
+}
+
+uint32_t ObjectTable::allocate() {
+  uint32_t objectID;
+  if (!freeObjectIDs.empty()) {
+    objectID = freeObjectIDs.back();
+    freeObjectIDs.pop_back();
+  } else {
+    if (objectRecords.size() >= MAX_OBJECTS) {
+      throw std::runtime_error("Ran out of object table entries!");
+    }
+    objectID = static_cast<uint32_t>(objectRecords.size());
+    objectRecords.emplace_back();
+    dirtyObjects.push_back(false);
+    flushedPositions.emplace_back(0.0f);
+  }
+  objectCount++;
+  return objectID;
+}
+void ObjectTable::free(uint32_t objectID) {
+  // Same as materials, a later flush is ordered after every earlier read, so the zeroing can go up with the rest.
+  freeObjectIDs.push_back(objectID);
+  objectRecords[objectID] = {};
+  flushedPositions[objectID] = glm::vec3(0.0f);
+  dirtyObjects[objectID] = true;
+  objectCount--;
+}
+void ObjectTable::update(uint32_t objectID, const Agnosia_T::ObjectData& record) {
+  // A new object didn't move to get where it is.
+  if (objectRecords[objectID].indexCount == 0) {
+    flushedPositions[objectID] = record.objPosition;
+  }
+  objectRecords[objectID] = record;
+  dirtyObjects[objectID] = true;
+}
+
+void ObjectTable::flush(VkCommandBuffer commandBuffer) {
+  // Gather runs of dirty records so neighbouring edits go up as one update.
+  struct Range {
+    uint32_t first;
+    uint32_t count;
+  };
+  std::vector<Range> ranges;
+  for (uint32_t objectID : settlingObjects) {
+    dirtyObjects[objectID] = true;
+  }
+  settlingObjects.clear();
+  for (uint32_t i = 0; i < dirtyObjects.size(); i++) {
+    if (!dirtyObjects[i]) {
+      continue;
+    }
+    Agnosia_T::ObjectData& record = objectRecords[i];
+    record.previousPosition = flushedPositions[i];
+    flushedPositions[i] = record.objPosition;
+    if (record.previousPosition != record.objPosition) {
+      settlingObjects.push_back(i);
+    }
+    if (!ranges.empty() && ranges.back().first + ranges.back().count == i) {
+      ranges.back().count++;
+    } else {
+      ranges.push_back({i, 1});
+    }
+    dirtyObjects[i] = false;
+  }
+  if (ranges.empty()) {
+    return;
+  }
+
+  // Earlier frames may still be culling or drawing from the records we are about to overwrite.
+  VkBufferMemoryBarrier2 barrier = {
+    .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2,
+    .srcStageMask = VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+    .srcAccessMask = 0,
+    .dstStageMask = VK_PIPELINE_STAGE_2_COPY_BIT,
+    .dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+    .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .buffer = objectBuffer.buffer,
+    .offset = 0,
+    .size = VK_WHOLE_SIZE,
+  };
+  VkDependencyInfo dependencyInfo = {
+    .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+    .bufferMemoryBarrierCount = 1,
+    .pBufferMemoryBarriers = &barrier,
+  };
+  vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+
+  // vkCmdUpdateBuffer is capped at 64KB per call.
+  constexpr uint32_t MAX_RECORDS_PER_UPDATE = 65536 / sizeof(Agnosia_T::ObjectData);
+  for (const Range& range : ranges) {
+    for (uint32_t first = range.first; first < range.first + range.count; first += MAX_RECORDS_PER_UPDATE) {
+      uint32_t count = std::min(MAX_RECORDS_PER_UPDATE, range.first + range.count - first);
+      vkCmdUpdateBuffer(commandBuffer, objectBuffer.buffer, first * sizeof(Agnosia_T::ObjectData),
+                        count * sizeof(Agnosia_T::ObjectData), &objectRecords[first]);
+    }
+  }
+
+  barrier.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+  barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+  barrier.dstStageMask = VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+  barrier.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT;
+  vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+}
+
+VkDeviceAddress ObjectTable::getAddress() { return objectBufferAddress; }
+VkDeviceAddress ObjectTable::getVisibilityAddress() { return visibilityBufferAddress; }
+RenderGraph::Buffer ObjectTable::getVisibilityBuffer() { return visibilityResource; }
+uint32_t ObjectTable::getObjectCount() { return objectCount; }
+uint32_t ObjectTable::getObjectRange() { return static_cast<uint32_t>(objectRecords.size()); }
@@ -0,0 +1,32 @@
+#pragma once
+#include "volk.h"
+#include <cstdint>
+#include "rendergraph.h"
+#include "../utils/types.h"
+
+// Every model's per object record (vertex buffer, position, bounds, index range, material) lives in one device local
+// buffer, indexed by object ID. Works like the MaterialTable, only changed records are uploaded on flush. Both the
+// culling pass and the vertex shader read it, draws reach their record through gl_InstanceIndex.
+class ObjectTable {
+public:
+  static constexpr uint32_t MAX_OBJECTS = 65536;
+
+  static void create();
+  static uint32_t allocate();
+  // The record is zeroed so anything walking the whole table (the culling pass) skips it from now on.
+  static void free(uint32_t objectID);
+  // The record's previousPosition is ignored, flush() fills it in with where the object was at the last flush.
+  static void update(uint32_t objectID, const Agnosia_T::ObjectData& record);
+  // Record the uploads, must be outside of a render pass. Objects that moved go up again on the next flush too, so
+  // their motion vectors drop back to zero once they stop.
+  static void flush(VkCommandBuffer commandBuffer);
+
+  static VkDeviceAddress getAddress();
+  // A uint per object ID the occlusion cull keeps between frames, zeroed at creation so new objects get tested.
+  static VkDeviceAddress getVisibilityAddress();
+  // The same buffer, for the culling passes to declare to the render graph.
+  static RenderGraph::Buffer getVisibilityBuffer();
+  static uint32_t getObjectCount();
+  // One past the highest ID ever handed out, how far the culling pass has to look.
+  static uint32_t getObjectRange();
+};
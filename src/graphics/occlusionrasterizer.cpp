@@ -0,0 +1,303 @@
+#include "occlusionrasterizer.h"
+#include "model.h"
+#include "../utils/threadpool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace {
+  // Every thread owns a band of rows while rasterizing, so the depth buffer never needs locking.
+  constexpr uint32_t BAND_HEIGHT = 16;
+
+  // Just enough of a SIMD wrapper to write the loops once. Masks are all-ones lanes, like the compares return them.
+#if defined(__AVX2__)
+  constexpr uint32_t LANES = 8;
+  using Lanes = __m256;
+  inline Lanes splat(float value) { return _mm256_set1_ps(value); }
+  inline Lanes steps() { return _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f); }
+  inline Lanes load(const float *data) { return _mm256_loadu_ps(data); }
+  inline void store(float *data, Lanes value) { _mm256_storeu_ps(data, value); }
+  inline Lanes add(Lanes a, Lanes b) { return _mm256_add_ps(a, b); }
+  inline Lanes mul(Lanes a, Lanes b) { return _mm256_mul_ps(a, b); }
+  inline Lanes min(Lanes a, Lanes b) { return _mm256_min_ps(a, b); }
+  inline Lanes greaterEqual(Lanes a, Lanes b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+  inline Lanes both(Lanes a, Lanes b) { return _mm256_and_ps(a, b); }
+  inline Lanes select(Lanes mask, Lanes a, Lanes b) { return _mm256_blendv_ps(b, a, mask); }
+  inline bool any(Lanes mask) { return _mm256_movemask_ps(mask) != 0; }
+#elif defined(__SSE2__)
+  constexpr uint32_t LANES = 4;
+  using Lanes = __m128;
+  inline Lanes splat(float value) { return _mm_set1_ps(value); }
+  inline Lanes steps() { return _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f); }
+  inline Lanes load(const float *data) { return _mm_loadu_ps(data); }
+  inline void store(float *data, Lanes value) { _mm_storeu_ps(data, value); }
+  inline Lanes add(Lanes a, Lanes b) { return _mm_add_ps(a, b); }
+  inline Lanes mul(Lanes a, Lanes b) { return _mm_mul_ps(a, b); }
+  inline Lanes min(Lanes a, Lanes b) { return _mm_min_ps(a, b); }
+  inline Lanes greaterEqual(Lanes a, Lanes b) { return _mm_cmpge_ps(a, b); }
+  inline Lanes both(Lanes a, Lanes b) { return _mm_and_ps(a, b); }
+  inline Lanes select(Lanes mask, Lanes a, Lanes b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+  inline bool any(Lanes mask) { return _mm_movemask_ps(mask) != 0; }
+#else
+  constexpr uint32_t LANES = 1;
+  using Lanes = float;
+  inline Lanes splat(float value) { return value; }
+  inline Lanes steps() { return 0.0f; }
+  inline Lanes load(const float *data) { return *data; }
+  inline void store(float *data, Lanes value) { *data = value; }
+  inline Lanes add(Lanes a, Lanes b) { return a + b; }
+  inline Lanes mul(Lanes a, Lanes b) { return a * b; }
+  inline Lanes min(Lanes a, Lanes b) { return std::min(a, b); }
+  inline Lanes greaterEqual(Lanes a, Lanes b) { return a >= b ? 1.0f : 0.0f; }
+  inline Lanes both(Lanes a, Lanes b) { return a * b; }
+  inline Lanes select(Lanes mask, Lanes a, Lanes b) { return mask != 0.0f ? a : b; }
+  inline bool any(Lanes mask) { return mask != 0.0f; }
+#endif
+  static_assert(OcclusionRasterizer::WIDTH % LANES == 0 && OcclusionRasterizer::HEIGHT % BAND_HEIGHT == 0);
+
+  struct Occluder {
+    const Model::OccluderMesh *mesh;
+    glm::vec3 position;
+  };
+  struct Bounds {
+    uint32_t objectID;
+    glm::vec3 center;
+    float radius;
+  };
+  // Edge functions (inside is >= 0 for all three) and the farthest depth of the triangle, which it writes wherever
+  // it covers. Flat depth keeps occluders conservative, they never claim to be nearer than they are.
+  struct Triangle {
+    float edgeX[3];
+    float edgeY[3];
+    float edgeConstant[3];
+    float depth;
+    int minX, maxX;
+    int minY, maxY;
+  };
+
+  using Clock = std::chrono::steady_clock;
+}
+
+std::vector<float> occlusionDepth(OcclusionRasterizer::WIDTH * OcclusionRasterizer::HEIGHT);
+std::vector<Occluder> frameOccluders;
+std::vector<Bounds> frameBounds;
+// One list per occluder, so setup can run in parallel without sharing anything.
+std::vector<std::vector<Triangle>> occluderTriangles;
+std::vector<uint8_t> occlusionVisibility;
+glm::mat4 occlusionViewProjection;
+
+ThreadPool::Group occlusionGroup;
+bool occlusionPending = false;
+bool cpuOcclusionEnabled = true;
+OcclusionRasterizer::Stats jobStats;
+OcclusionRasterizer::Stats occlusionStats;
+
+static void setupTriangles(const Occluder &occluder, std::vector<Triangle> &triangles) {
+  triangles.clear();
+  const Model::OccluderMesh &mesh = *occluder.mesh;
+  std::vector<glm::vec4> clip(mesh.positions.size());
+  for (size_t i = 0; i < mesh.positions.size(); i++) {
+    clip[i] = occlusionViewProjection * glm::vec4(mesh.positions[i] + occluder.position, 1.0f);
+  }
+
+  for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+    const glm::vec4 corners[3] = {clip[mesh.indices[i]], clip[mesh.indices[i + 1]], clip[mesh.indices[i + 2]]};
+    // Clipping isn't worth it for an occluder, anything crossing the near plane is dropped.
+    if (corners[0].z <= 0.0f || corners[1].z <= 0.0f || corners[2].z <= 0.0f) {
+      continue;
+    }
+    glm::vec2 screen[3];
+    float depth = 0.0f;
+    for (int v = 0; v < 3; v++) {
+      glm::vec3 ndc = glm::vec3(corners[v]) / corners[v].w;
+      screen[v] = {(ndc.x * 0.5f + 0.5f) * OcclusionRasterizer::WIDTH, (ndc.y * 0.5f + 0.5f) * OcclusionRasterizer::HEIGHT};
+      depth = std::max(depth, ndc.z);
+    }
+    if (depth >= 1.0f) {
+      continue;
+    }
+    float area = (screen[1].x - screen[0].x) * (screen[2].y - screen[0].y) - (screen[1].y - screen[0].y) * (screen[2].x - screen[0].x);
+    if (std::abs(area) < 1e-6f) {
+      continue;
+    }
+
+    Triangle triangle;
+    triangle.minX = std::max(0, static_cast<int>(std::floor(std::min({screen[0].x, screen[1].x, screen[2].x}))));
+    triangle.maxX = std::min(static_cast<int>(OcclusionRasterizer::WIDTH) - 1, static_cast<int>(std::ceil(std::max({screen[0].x, screen[1].x, screen[2].x}))));
+    triangle.minY = std::max(0, static_cast<int>(std::floor(std::min({screen[0].y, screen[1].y, screen[2].y}))));
+    triangle.maxY = std::min(static_cast<int>(OcclusionRasterizer::HEIGHT) - 1, static_cast<int>(std::ceil(std::max({screen[0].y, screen[1].y, screen[2].y}))));
+    if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY) {
+      continue;
+    }
+    // Both windings are drawn, so flip clockwise triangles to keep the inside positive.
+    float sign = area > 0.0f ? 1.0f : -1.0f;
+    for (int e = 0; e < 3; e++) {
+      const glm::vec2 &a = screen[e];
+      const glm::vec2 &b = screen[(e + 1) % 3];
+      triangle.edgeX[e] = sign * (a.y - b.y);
+      triangle.edgeY[e] = sign * (b.x - a.x);
+      triangle.edgeConstant[e] = sign * (a.x * b.y - a.y * b.x);
+    }
+    triangle.depth = depth;
+    triangles.push_back(triangle);
+  }
+}
+
+static void rasterizeBand(uint32_t band) {
+  const int bandMinY = static_cast<int>(band * BAND_HEIGHT);
+  const int bandMaxY = bandMinY + static_cast<int>(BAND_HEIGHT) - 1;
+  const Lanes zero = splat(0.0f);
+  for (const std::vector<Triangle> &triangles : occluderTriangles) {
+    for (const Triangle &triangle : triangles) {
+      const int minY = std::max(triangle.minY, bandMinY);
+      const int maxY = std::min(triangle.maxY, bandMaxY);
+      if (minY > maxY) {
+        continue;
+      }
+      // Rows start on a lane boundary, the edge tests throw away the extra pixels.
+      const int minX = triangle.minX & ~static_cast<int>(LANES - 1);
+      const Lanes depth = splat(triangle.depth);
+      Lanes edgeStep[3];
+      Lanes edgeStart[3];
+      for (int e = 0; e < 3; e++) {
+        edgeStep[e] = splat(triangle.edgeX[e] * LANES);
+        edgeStart[e] = add(splat(triangle.edgeX[e] * (minX + 0.5f) + triangle.edgeConstant[e]),
+                           mul(steps(), splat(triangle.edgeX[e])));
+      }
+
+      for (int y = minY; y <= maxY; y++) {
+        float *row = &occlusionDepth[y * OcclusionRasterizer::WIDTH];
+        Lanes edge[3];
+        for (int e = 0; e < 3; e++) {
+          edge[e] = add(edgeStart[e], splat(triangle.edgeY[e] * (y + 0.5f)));
+        }
+        for (int x = minX; x <= triangle.maxX; x += LANES) {
+          Lanes inside = both(both(greaterEqual(edge[0], zero), greaterEqual(edge[1], zero)), greaterEqual(edge[2], zero));
+          Lanes current = load(row + x);
+          store(row + x, select(inside, min(current, depth), current));
+          for (int e = 0; e < 3; e++) {
+            edge[e] = add(edge[e], edgeStep[e]);
+          }
+        }
+      }
+    }
+  }
+}
+
+// Projects the box around the bounding sphere, the model is hidden when every pixel under it holds something nearer
+// than the box's nearest point.
+static bool testBounds(const Bounds &bounds) {
+  glm::vec2 minScreen(std::numeric_limits<float>::max());
+  glm::vec2 maxScreen(std::numeric_limits<float>::lowest());
+  float nearest = 1.0f;
+  for (int i = 0; i < 8; i++) {
+    glm::vec3 corner = bounds.center + bounds.radius * glm::vec3((i & 1) ? 1.0f : -1.0f, (i & 2) ? 1.0f : -1.0f, (i & 4) ? 1.0f : -1.0f);
+    glm::vec4 clip = occlusionViewProjection * glm::vec4(corner, 1.0f);
+    // Touching the near plane, the projection can't be trusted.
+    if (clip.z <= 0.0f) {
+      return true;
+    }
+    glm::vec3 ndc = glm::vec3(clip) / clip.w;
+    glm::vec2 screen = {(ndc.x * 0.5f + 0.5f) * OcclusionRasterizer::WIDTH, (ndc.y * 0.5f + 0.5f) * OcclusionRasterizer::HEIGHT};
+    minScreen = glm::min(minScreen, screen);
+    maxScreen = glm::max(maxScreen, screen);
+    nearest = std::min(nearest, ndc.z);
+  }
+  // Past the far plane or off screen is culled too, this is all the culling the CPU path gets.
+  if (nearest > 1.0f) {
+    return false;
+  }
+  const int minX = std::max(0, static_cast<int>(std::floor(minScreen.x)));
+  const int maxX = std::min(static_cast<int>(OcclusionRasterizer::WIDTH) - 1, static_cast<int>(std::floor(maxScreen.x)));
+  const int minY = std::max(0, static_cast<int>(std::floor(minScreen.y)));
+  const int maxY = std::min(static_cast<int>(OcclusionRasterizer::HEIGHT) - 1, static_cast<int>(std::floor(maxScreen.y)));
+  if (minX > maxX || minY > maxY) {
+    return false;
+  }
+
+  const Lanes nearestLanes = splat(nearest);
+  const Lanes firstColumn = splat(static_cast<float>(minX));
+  const Lanes lastColumn = splat(static_cast<float>(maxX));
+  for (int y = minY; y <= maxY; y++) {
+    const float *row = &occlusionDepth[y * OcclusionRasterizer::WIDTH];
+    for (int x = minX & ~static_cast<int>(LANES - 1); x <= maxX; x += LANES) {
+      Lanes columns = add(splat(static_cast<float>(x)), steps());
+      Lanes covered = both(greaterEqual(columns, firstColumn), greaterEqual(lastColumn, columns));
+      if (any(both(covered, greaterEqual(load(row + x), nearestLanes)))) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+static void runOcclusion() {
+  Clock::time_point start = Clock::now();
+  std::fill(occlusionDepth.begin(), occlusionDepth.end(), 1.0f);
+  occluderTriangles.resize(frameOccluders.size());
+  ThreadPool::get().parallelFor(static_cast<uint32_t>(frameOccluders.size()), [](uint32_t i) {
+    setupTriangles(frameOccluders[i], occluderTriangles[i]);
+  });
+  ThreadPool::get().parallelFor(OcclusionRasterizer::HEIGHT / BAND_HEIGHT, [](uint32_t band) {
+    rasterizeBand(band);
+  });
+  Clock::time_point rasterized = Clock::now();
+
+  ThreadPool::get().parallelFor(static_cast<uint32_t>(frameBounds.size()), [](uint32_t i) {
+    occlusionVisibility[frameBounds[i].objectID] = testBounds(frameBounds[i]) ? 1 : 0;
+  });
+  Clock::time_point tested = Clock::now();
+
+  jobStats = {};
+  for (const std::vector<Triangle> &triangles : occluderTriangles) {
+    jobStats.occluderTriangles += static_cast<uint32_t>(triangles.size());
+  }
+  jobStats.tested = static_cast<uint32_t>(frameBounds.size());
+  for (const Bounds &bounds : frameBounds) {
+    jobStats.culled += occlusionVisibility[bounds.objectID] ? 0 : 1;
+  }
+  jobStats.rasterMilliseconds = std::chrono::duration<float, std::milli>(rasterized - start).count();
+  jobStats.testMilliseconds = std::chrono::duration<float, std::milli>(tested - rasterized).count();
+}
+
+void OcclusionRasterizer::begin(const glm::mat4 &viewProjection, const std::vector<Model *> &models) {
+  // A frame that gave up before recording (swapchain recreation) can leave one running.
+  ThreadPool::get().wait(occlusionGroup);
+
+  frameOccluders.clear();
+  frameBounds.clear();
+  uint32_t objectRange = 0;
+  for (Model *model : models) {
+    if (model->getOccluder()) {
+      frameOccluders.push_back({&model->getOccluderMesh(), model->getPos()});
+    }
+    frameBounds.push_back({model->getObjectID(), model->getPos() + model->getBoundsCenter(), model->getBoundsRadius()});
+    objectRange = std::max(objectRange, model->getObjectID() + 1);
+  }
+  occlusionVisibility.assign(objectRange, 1);
+  occlusionViewProjection = viewProjection;
+
+  occlusionPending = true;
+  ThreadPool::get().submit(occlusionGroup, [](){ runOcclusion(); });
+}
+bool OcclusionRasterizer::finish() {
+  if (!occlusionPending) {
+    return false;
+  }
+  ThreadPool::get().wait(occlusionGroup);
+  occlusionPending = false;
+  occlusionStats = jobStats;
+  return true;
+}
+bool OcclusionRasterizer::isVisible(uint32_t objectID) {
+  return objectID >= occlusionVisibility.size() || occlusionVisibility[objectID] != 0;
+}
+
+bool &OcclusionRasterizer::getEnabled() { return cpuOcclusionEnabled; }
+const OcclusionRasterizer::Stats &OcclusionRasterizer::getStats() { return occlusionStats; }
@@ -0,0 +1,34 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+class Model;
+
+// CPU occlusion culling for when the GPU driven path is off. Models flagged as occluders have a coarse inner hull of
+// their mesh rasterized (SSE, AVX2 when built with it) into a small depth buffer on the worker threads, then every model's
+// bounds are tested against it. begin() goes out before the frame waits on its fence, so the work overlaps the GPU
+// finishing the previous frame, and recording only has to wait for whatever is left.
+class OcclusionRasterizer {
+public:
+  static constexpr uint32_t WIDTH = 320;
+  static constexpr uint32_t HEIGHT = 192;
+
+  struct Stats {
+    uint32_t occluderTriangles;
+    uint32_t tested;
+    uint32_t culled;
+    float rasterMilliseconds;
+    float testMilliseconds;
+  };
+
+  // Everything needed from the models is copied, they can change again once finish() has returned.
+  static void begin(const glm::mat4 &viewProjection, const std::vector<Model *> &models);
+  // Waits for the workers, false when nothing was started this frame.
+  static bool finish();
+  static bool isVisible(uint32_t objectID);
+
+  static bool &getEnabled();
+  // From the last finished frame.
+  static const Stats &getStats();
+};
@@ -1,13 +1,16 @@
 #include "pipelinebuilder.h"
 #include <cstdio>
+#include <optional>
 #include <vector>
 #include <cstdint>
 #include <vulkan/vulkan_core.h>
 #include "buffers.h"
 #include "../devicelibrary.h"
+#include "../settings.h"
 #include "../utils/helpers.h"
 #include "../utils/deletion.h"
 #include "shader.h"
+#include "temporalaa.h"
 #define STB_INCLUDE_IMPLEMENTATION
 #define STB_INCLUDE_LINE_GLSL
 #include <stb/stb_include.h>
@@ -29,6 +32,7 @@ Shader LoadShaderWithIncludes(VkShaderStageFlagBits stage, const std::filesystem
 
 PipelineBuilder::PipelineBuilder() : vertexShader("src/shaders/base.vert"),
                                      fragmentShader("src/shaders/base.frag"),
+                                     pushConstantSize(sizeof(Agnosia_T::GPUPushConstants)),
                                      iaTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST),
                                      iaPrimitiveRestartEnable(VK_FALSE),
                                      rDepthBiasClamp(0.0f),
@@ -46,7 +50,10 @@ PipelineBuilder::PipelineBuilder() : vertexShader("src/shaders/base.vert"),
                                      dsDepthWriteEnable(VK_TRUE),
                                      dsDepthCompareOp(VK_COMPARE_OP_LESS),
                                      dsDepthBoundsTestEnable(VK_FALSE),
-                                     dsStencilTestEnable(VK_FALSE)
+                                     dsStencilTestEnable(VK_FALSE),
+                                     dynamicDepth(VK_FALSE),
+                                     replaceable(false),
+                                     depthOnlyFormat(VK_FORMAT_UNDEFINED)
                                      {}
                         
   PipelineBuilder& PipelineBuilder::setVertexShader(const std::string& vertexShader) {
@@ -58,6 +65,18 @@ PipelineBuilder::PipelineBuilder() : vertexShader("src/shaders/base.vert"),
     this->fragmentShader = fragmentShader;
     return *this;
   }
+  PipelineBuilder& PipelineBuilder::setComputeShader(const std::string& computeShader) {
+    this->computeShader = computeShader;
+    return *this;
+  }
+  PipelineBuilder& PipelineBuilder::setDescriptorSetLayouts(const std::vector<VkDescriptorSetLayout>& setLayouts) {
+    this->setLayouts = setLayouts;
+    return *this;
+  }
+  PipelineBuilder& PipelineBuilder::setPushConstantSize(uint32_t pushConstantSize) {
+    this->pushConstantSize = pushConstantSize;
+    return *this;
+  }
   PipelineBuilder& PipelineBuilder::setTopology(VkPrimitiveTopology topology) {
     this->iaTopology = topology;
     return *this;
@@ -156,18 +175,70 @@ PipelineBuilder::PipelineBuilder() : vertexShader("src/shaders/base.vert"),
     this->dsMaxDepthBounds = maxDepth;
     return *this;
   }
+  PipelineBuilder& PipelineBuilder::setDynamicDepth(VkBool32 dynamicDepth) {
+    this->dynamicDepth = dynamicDepth;
+    return *this;
+  }
+  PipelineBuilder& PipelineBuilder::setReplaceable(bool replaceable) {
+    this->replaceable = replaceable;
+    return *this;
+  }
+  PipelineBuilder& PipelineBuilder::setDepthOnlyTarget(VkFormat depthFormat) {
+    this->depthOnlyFormat = depthFormat;
+    return *this;
+  }
     
+  VkPipelineLayout PipelineBuilder::createLayout() {
+    VkPipelineLayout pipelineLayout;
+    VkPushConstantRange pushConstant{
+      .stageFlags = VK_SHADER_STAGE_ALL,
+      .offset = 0,
+      .size = this->pushConstantSize,
+    };
+    std::vector<VkDescriptorSetLayout> setLayouts = this->setLayouts;
+    if (setLayouts.empty()) {
+      setLayouts = { Buffers::getTextureDescriptorSetLayouts(), Buffers::getSamplerDescriptorSetLayout() };
+    }
+    
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+      .pNext = nullptr,
+      .setLayoutCount = static_cast<uint32_t>(setLayouts.size()),
+      .pSetLayouts = setLayouts.data(),
+      .pushConstantRangeCount = 1,
+      .pPushConstantRanges = &pushConstant
+    };
+    VK_CHECK(vkCreatePipelineLayout(DeviceControl::getDevice(), &pipelineLayoutInfo, nullptr, &pipelineLayout));
+    return pipelineLayout;
+  }
+  VkPipelineCreateFlags PipelineBuilder::createFlags() {
+    // Only the bindless sets come from descriptor buffers, custom layouts (push descriptors) stay classic.
+    if (this->setLayouts.empty() && Buffers::usesDescriptorBuffer()) {
+      return VK_PIPELINE_CREATE_DESCRIPTOR_BUFFER_BIT_EXT;
+    }
+    return 0;
+  }
+
   Agnosia_T::Pipeline PipelineBuilder::Build() {
     VkPipelineLayout pipelineLayout;
     VkPipeline pipeline;
     
-    const std::vector<VkDynamicState> DYNAMICSTATES = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR, VK_DYNAMIC_STATE_LINE_WIDTH};
+    std::vector<VkDynamicState> DYNAMICSTATES = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR, VK_DYNAMIC_STATE_LINE_WIDTH};
+    if (this->dynamicDepth) {
+      DYNAMICSTATES.push_back(VK_DYNAMIC_STATE_DEPTH_WRITE_ENABLE);
+      DYNAMICSTATES.push_back(VK_DYNAMIC_STATE_DEPTH_COMPARE_OP);
+    }
     
     Shader vertexShader = LoadShaderWithIncludes(VK_SHADER_STAGE_VERTEX_BIT, this->vertexShader);
-    Shader fragmentShader = LoadShaderWithIncludes(VK_SHADER_STAGE_FRAGMENT_BIT, this->fragmentShader);
+    const bool hasFragment = !this->fragmentShader.empty();
+    std::optional<Shader> fragmentShader;
+    if (hasFragment) {
+      fragmentShader.emplace(LoadShaderWithIncludes(VK_SHADER_STAGE_FRAGMENT_BIT, this->fragmentShader));
+    }
       
+    const bool depthOnly = this->depthOnlyFormat != VK_FORMAT_UNDEFINED;
     VkShaderModule vertShaderModule = vertexShader.GetShaderModule();
-    VkShaderModule fragShaderModule = fragmentShader.GetShaderModule();
+    VkShaderModule fragShaderModule = hasFragment ? fragmentShader->GetShaderModule() : VK_NULL_HANDLE;
       
     VkPipelineInputAssemblyStateCreateInfo inputAssembly {
       .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
@@ -208,17 +279,24 @@ PipelineBuilder::PipelineBuilder() : vertexShader("src/shaders/base.vert"),
      
     VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderInfo,fragShaderInfo};
 
-    VkPipelineColorBlendAttachmentState colorBlendAttachment {
-      .blendEnable = this->cbBlendEnable,
-      .colorWriteMask = this->cbColorWriteMask
+    // Every scene pass writes motion vectors next to color, see TemporalAA. They are never blended.
+    VkPipelineColorBlendAttachmentState colorBlendAttachments[] = {
+      {
+        .blendEnable = this->cbBlendEnable,
+        .colorWriteMask = this->cbColorWriteMask
+      },
+      {
+        .blendEnable = VK_FALSE,
+        .colorWriteMask = this->cbColorWriteMask
+      },
     };
     VkPipelineColorBlendStateCreateInfo colorBlending {
       .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
       .pNext = nullptr,
       .logicOpEnable = this->cbLogicOpEnable,
       .logicOp = this->cbLogicOp,
-      .attachmentCount = 1,
-      .pAttachments = &colorBlendAttachment
+      .attachmentCount = depthOnly ? 0u : 2u,
+      .pAttachments = colorBlendAttachments
     };
     VkPipelineViewportStateCreateInfo viewportState {
       .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
@@ -229,8 +307,9 @@ PipelineBuilder::PipelineBuilder() : vertexShader("src/shaders/base.vert"),
     VkPipelineMultisampleStateCreateInfo multisampling {
       .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
       .pNext = nullptr,
-      .rasterizationSamples = DeviceControl::getPerPixelSampleCount(),
-      .sampleShadingEnable = VK_TRUE
+      .rasterizationSamples = depthOnly ? VK_SAMPLE_COUNT_1_BIT : DeviceControl::getPerPixelSampleCount(),
+      .sampleShadingEnable = !depthOnly && Settings::get().sampleShading ? VK_TRUE : VK_FALSE,
+      .minSampleShading = Settings::get().minSampleShading
     };
     VkPipelineDepthStencilStateCreateInfo depthStencil {
       .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
@@ -250,33 +329,20 @@ PipelineBuilder::PipelineBuilder() : vertexShader("src/shaders/base.vert"),
       .pDynamicStates = DYNAMICSTATES.data()
     };
       
-    VkPushConstantRange pushConstant{
-      .stageFlags = VK_SHADER_STAGE_ALL,
-      .offset = 0,
-      .size = sizeof(Agnosia_T::GPUPushConstants),
-    };
-    std::vector<VkDescriptorSetLayout> setLayouts = { Buffers::getTextureDescriptorSetLayouts(), Buffers::getSamplerDescriptorSetLayout() };
-    
-    VkPipelineLayoutCreateInfo pipelineLayoutInfo {
-      .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-      .pNext = nullptr,
-      .setLayoutCount = 2,
-      .pSetLayouts = setLayouts.data(),
-      .pushConstantRangeCount = 1,
-      .pPushConstantRanges = &pushConstant
-    };
-    VK_CHECK(vkCreatePipelineLayout(DeviceControl::getDevice(), &pipelineLayoutInfo, nullptr, &pipelineLayout));
+    pipelineLayout = createLayout();
       
+    const VkFormat colorFormats[] = {DeviceControl::getImageFormat(), TemporalAA::VELOCITY_FORMAT};
     VkPipelineRenderingCreateInfo pipelineRenderingInfo {
       .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO,
-      .colorAttachmentCount = 1,
-      .pColorAttachmentFormats = &DeviceControl::getImageFormat(),
-      .depthAttachmentFormat = DeviceControl::getDepthFormat()
+      .colorAttachmentCount = depthOnly ? 0u : 2u,
+      .pColorAttachmentFormats = colorFormats,
+      .depthAttachmentFormat = depthOnly ? this->depthOnlyFormat : DeviceControl::getDepthFormat()
     };
     VkGraphicsPipelineCreateInfo pipelineInfo {
       .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
       .pNext = &pipelineRenderingInfo,
-      .stageCount = 2,
+      .flags = createFlags(),
+      .stageCount = hasFragment ? 2u : 1u,
       .pStages = shaderStages,
       .pVertexInputState = &vertexInfo,
       .pInputAssemblyState = &inputAssembly,
@@ -293,12 +359,41 @@ PipelineBuilder::PipelineBuilder() : vertexShader("src/shaders/base.vert"),
 
     VK_CHECK(vkCreateGraphicsPipelines(DeviceControl::getDevice(), VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline));
 
-    DeletionQueue::get().push_function([=](){vkDestroyPipeline(DeviceControl::getDevice(), pipeline, nullptr);});
-    DeletionQueue::get().push_function([=](){vkDestroyPipelineLayout(DeviceControl::getDevice(), pipelineLayout, nullptr);});
+    if (!this->replaceable) {
+      DeletionQueue::get().push_function([=](){vkDestroyPipeline(DeviceControl::getDevice(), pipeline, nullptr);});
+      DeletionQueue::get().push_function([=](){vkDestroyPipelineLayout(DeviceControl::getDevice(), pipelineLayout, nullptr);});
+    }
 
     Agnosia_T::Pipeline finalPipeline = {pipeline, pipelineLayout};
       
     return finalPipeline;
   }
 
+  Agnosia_T::Pipeline PipelineBuilder::BuildCompute() {
+    VkPipeline pipeline;
+    VkPipelineLayout pipelineLayout = createLayout();
+
+    Shader computeShader = LoadShaderWithIncludes(VK_SHADER_STAGE_COMPUTE_BIT, this->computeShader);
 
+    VkComputePipelineCreateInfo pipelineInfo {
+      .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+      .pNext = nullptr,
+      .flags = createFlags(),
+      .stage = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+        .pNext = nullptr,
+        .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+        .module = computeShader.GetShaderModule(),
+        .pName = "main"
+      },
+      .layout = pipelineLayout,
+    };
+    VK_CHECK(vkCreateComputePipelines(DeviceControl::getDevice(), VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline));
+
+    if (!this->replaceable) {
+      DeletionQueue::get().push_function([=](){vkDestroyPipeline(DeviceControl::getDevice(), pipeline, nullptr);});
+      DeletionQueue::get().push_function([=](){vkDestroyPipelineLayout(DeviceControl::getDevice(), pipelineLayout, nullptr);});
+    }
+
+    return {pipeline, pipelineLayout};
+  }
@@ -1,6 +1,7 @@
 #pragma once
 #include "volk.h"
 #include <string>
+#include <vector>
 #include "../utils/types.h"
 #include "texture.h"
 
@@ -8,6 +9,10 @@ class PipelineBuilder {
   private:
     std::string vertexShader;
     std::string fragmentShader;
+    std::string computeShader;
+    // Layout //
+    std::vector<VkDescriptorSetLayout> setLayouts;
+    uint32_t pushConstantSize;
     // Input Assembly //
     VkPrimitiveTopology iaTopology;
     VkBool32 iaPrimitiveRestartEnable;
@@ -36,11 +41,22 @@ class PipelineBuilder {
     VkStencilOpState dsBack;
     float dsMinDepthBounds;
     float dsMaxDepthBounds;
+    VkBool32 dynamicDepth;
+    bool replaceable;
+    VkFormat depthOnlyFormat;
+
+    VkPipelineLayout createLayout();
+    VkPipelineCreateFlags createFlags();
   public:
     PipelineBuilder();
 
     PipelineBuilder& setVertexShader(const std::string& vertexShader);
+    // An empty path builds a vertex only pipeline, for depth only passes.
     PipelineBuilder& setFragmentShader(const std::string& fragmentShader);
+    PipelineBuilder& setComputeShader(const std::string& computeShader);
+    // Leaving the set layouts empty uses the bindless texture and sampler sets.
+    PipelineBuilder& setDescriptorSetLayouts(const std::vector<VkDescriptorSetLayout>& setLayouts);
+    PipelineBuilder& setPushConstantSize(uint32_t pushConstantSize);
     PipelineBuilder& setTopology(VkPrimitiveTopology topology);
     PipelineBuilder& setPrimitiveRestart(VkBool32 primitiveRestart);
     PipelineBuilder& setDepthClamp(VkBool32 depthClamp);
@@ -65,6 +81,15 @@ class PipelineBuilder {
     PipelineBuilder& setBackStencilState(VkStencilOpState backState);
     PipelineBuilder& setMinDepthBounds(float minDepth);
     PipelineBuilder& setMaxDepthBounds(float maxDepth);
+    // Depth writes and the compare op are set with vkCmdSet* while drawing instead of baked in.
+    PipelineBuilder& setDynamicDepth(VkBool32 dynamicDepth);
+    // Replaceable pipelines are left off the DeletionQueue, the caller hands them to DeferredDeletion once they're
+    // swapped out (or at shutdown).
+    PipelineBuilder& setReplaceable(bool replaceable);
+    // Renders into a single sampled depth image of `depthFormat` and nothing else (shadow maps), instead of the scene
+    // pass's color, velocity and multisampled depth targets.
+    PipelineBuilder& setDepthOnlyTarget(VkFormat depthFormat);
 
     Agnosia_T::Pipeline Build();
+    Agnosia_T::Pipeline BuildCompute();
 };
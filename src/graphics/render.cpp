@@ -3,54 +3,136 @@
 #include "../devicelibrary.h"
 #include "../entrypoint.h"
 #include "buffers.h"
+#include "deferreddeletion.h"
 #include "graphicspipeline.h"
+#include "hizpyramid.h"
+#include "occlusionrasterizer.h"
 #include "render.h"
+#include "rendergraph.h"
+#include "temporalaa.h"
+#include "../settings.h"
 #include "texture.h"
+#include "texturestreamer.h"
 #include "../utils/helpers.h"
 #include "../utils/deletion.h"
 
+#include <algorithm>
+
 uint32_t currentFrame = 0;
 std::vector<VkSemaphore> imageAvailableSemaphores;
+// One per swapchain image, so they're replaced along with the swapchain.
 std::vector<VkSemaphore> renderFinishedSemaphores;
 std::vector<VkFence> inFlightFences;
+// The DeferredDeletion serial of the last submission made with each frame's fence.
+std::vector<uint64_t> submittedSerials;
+// The swapchain images as the render graph knows them.
+std::vector<RenderGraph::Image> swapChainImages;
 
-void recreateSwapChain() {
+static void createSwapChainResources() {
+  VkSemaphoreCreateInfo semaphoreInfo = {
+    .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+  };
+  renderFinishedSemaphores.resize(DeviceControl::getSwapChainImages().size());
+  for (VkSemaphore &semaphore : renderFinishedSemaphores) {
+    VK_CHECK(vkCreateSemaphore(DeviceControl::getDevice(), &semaphoreInfo, nullptr, &semaphore));
+  }
+  swapChainImages.clear();
+  for (size_t i = 0; i < DeviceControl::getSwapChainImages().size(); i++) {
+    swapChainImages.push_back(RenderGraph::importImage(DeviceControl::getSwapChainImages()[i], DeviceControl::getSwapChainImageViews()[i],
+                                                       VK_IMAGE_ASPECT_COLOR_BIT));
+  }
+}
+static void createRenderTargets() {
+  Texture::createColorImage();
+  Texture::createDepthImage();
+  Texture::createSceneImage();
+  HiZPyramid::create();
+  TemporalAA::create();
+  // The cached draws were recorded against the old targets' sample count.
+  Graphics::invalidateStaticDraws();
+}
+// Through DeferredDeletion, so new targets can be created straight away while the frames in flight finish with these.
+static void destroyRenderTargets() {
+  TemporalAA::destroy();
+  HiZPyramid::destroy();
+  Texture::destroyRenderImages();
+}
+// The swapchain, its views and present semaphores, also deferred.
+static void destroySwapChain() {
+  for (RenderGraph::Image image : swapChainImages) {
+    RenderGraph::releaseImage(image);
+  }
+  swapChainImages.clear();
+  for (VkImageView imageView : DeviceControl::getSwapChainImageViews()) {
+    DeferredDeletion::imageView(imageView);
+  }
+  for (VkSemaphore semaphore : renderFinishedSemaphores) {
+    DeferredDeletion::semaphore(semaphore);
+  }
+  DeferredDeletion::swapChain(DeviceControl::getSwapChain());
+}
+void Render::recreateSwapChain() {
   int width = 0, height = 0;
   glfwGetFramebufferSize(EntryApp::getWindow(), &width, &height);
   while (width == 0 || height == 0) {
     glfwGetFramebufferSize(EntryApp::getWindow(), &width, &height);
     glfwWaitEvents();
   }
-  vkDeviceWaitIdle(DeviceControl::getDevice());
+  // No waiting for the device, the frames in flight keep the old swapchain and targets until they're done with them.
+  destroyRenderTargets();
+  destroySwapChain();
 
-  Render::cleanupSwapChain();
-  
-  DeviceControl::createSwapChain(EntryApp::getWindow());
+  DeviceControl::createSwapChain(EntryApp::getWindow(), DeviceControl::getSwapChain());
   DeviceControl::createImageViews();
-  Texture::createColorImage();
-  Texture::createDepthImage();
+  createSwapChainResources();
+  createRenderTargets();
+}
+void Render::recreateRenderTargets() {
+  destroyRenderTargets();
+  createRenderTargets();
 }
 // At a high level, rendering in Vulkan consists of 5 steps:
 // Wait for the previous frame, acquire a image from the swap chain
 // record a command buffer which draws the scene onto that image
 // submit the recorded command buffer and present the image!
 void Render::drawFrame(AssetCache& cache) {
+  // No GPU culling to fall back on, rasterize occluders on the workers while the GPU finishes the last frame.
+  if (!Graphics::getGPUDriven() && OcclusionRasterizer::getEnabled()) {
+    OcclusionRasterizer::begin(Graphics::getViewProjection(), cache.getModels());
+  }
   VK_CHECK(vkWaitForFences(DeviceControl::getDevice(), 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX));
+  // Whatever was destroyed before this frame's last submission is no longer in use.
+  DeferredDeletion::completed(submittedSerials[currentFrame]);
+
+  if (TextureStreamer::update()) {
+    // A streamed mip has landed on a new slot, point the materials using it there.
+    Texture *streamed = TextureStreamer::commit();
+    for (Material *material : cache.getMaterials()) {
+      if (material->getDiffuseTexture() == streamed || material->getORMTexture() == streamed) {
+        material->markDirty();
+      }
+    }
+  }
   uint32_t imageIndex;
 
   VkResult result = vkAcquireNextImageKHR(DeviceControl::getDevice(), DeviceControl::getSwapChain(), UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
-  if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
+  // A suboptimal image was still acquired and its semaphore signaled, so it is drawn and presented, and the present
+  // below recreates the swapchain.
+  if (result == VK_ERROR_OUT_OF_DATE_KHR) {
     recreateSwapChain();
     return;
   }
-  VK_CHECK(result);
-    
+  if (result != VK_SUBOPTIMAL_KHR) {
+    VK_CHECK(result);
+  }
+
   VK_CHECK(vkResetFences(DeviceControl::getDevice(), 1, &inFlightFences[currentFrame]));
   VK_CHECK(vkResetCommandBuffer(Buffers::getCommandBuffers()[currentFrame], 0));
   Graphics::recordCommandBuffer(Buffers::getCommandBuffers()[currentFrame], imageIndex, cache);
   
+  // The swapchain image is first touched by the upscale blit, the scene doesn't have to wait for it.
   VkPipelineStageFlags waitStages[] = {
-      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+      VK_PIPELINE_STAGE_TRANSFER_BIT};
     
   VkSubmitInfo submitInfo = {
     .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
@@ -65,6 +147,7 @@ void Render::drawFrame(AssetCache& cache) {
   };
 
   VK_CHECK(vkQueueSubmit(DeviceControl::getGraphicsQueue(), 1, &submitInfo, inFlightFences[currentFrame]));
+  submittedSerials[currentFrame] = DeferredDeletion::submitted();
   
   VkPresentInfoKHR presentInfo = {
     .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
@@ -80,9 +163,10 @@ void Render::drawFrame(AssetCache& cache) {
   if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || EntryApp::getInstance().getFramebufferResized()) {
     EntryApp::getInstance().setFramebufferResized(false);
     recreateSwapChain();
+  } else {
+    VK_CHECK(result);
   }
-  VK_CHECK(result);
-  currentFrame = (currentFrame + 1) % Buffers::getMaxFramesInFlight();
+  currentFrame = (currentFrame + 1) % Settings::get().framesInFlight;
 }
 
 #pragma info
@@ -111,8 +195,8 @@ void Render::drawFrame(AssetCache& cache) {
 
 void Render::createSyncObject() {
   imageAvailableSemaphores.resize(Buffers::getMaxFramesInFlight());
-  renderFinishedSemaphores.resize(DeviceControl::getSwapChainImages().size());
   inFlightFences.resize(Buffers::getMaxFramesInFlight());
+  submittedSerials.assign(Buffers::getMaxFramesInFlight(), 0);
 
   VkSemaphoreCreateInfo semaphoreInfo = {
     .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
@@ -129,20 +213,14 @@ void Render::createSyncObject() {
     VK_CHECK(vkCreateFence(DeviceControl::getDevice(), &fenceInfo, nullptr, &inFlightFences[i]));
     DeletionQueue::get().push_function([=](){vkDestroyFence(DeviceControl::getDevice(), inFlightFences[i], nullptr);});
   }
-  for(size_t i = 0; i < DeviceControl::getSwapChainImages().size(); i++) {
-    VK_CHECK(vkCreateSemaphore(DeviceControl::getDevice(), &semaphoreInfo, nullptr, &renderFinishedSemaphores[i]));    
-    DeletionQueue::get().push_function([=](){vkDestroySemaphore(DeviceControl::getDevice(), renderFinishedSemaphores[i], nullptr);});
-  }
+  // Retired with the swapchain they belong to, see destroySwapChain().
+  createSwapChainResources();
 }
 void Render::cleanupSwapChain() {
-  vkDestroyImageView(DeviceControl::getDevice(), Texture::getColorImage().imageView, nullptr);
-  vmaDestroyImage(Buffers::getAllocator(), Texture::getColorImage().image, Texture::getColorImage().alloc);
-  vkDestroyImageView(DeviceControl::getDevice(), Texture::getDepthImage().imageView, nullptr);
-  vmaDestroyImage(Buffers::getAllocator(), Texture::getDepthImage().image, Texture::getDepthImage().alloc);
-
-  for (auto imageView : DeviceControl::getSwapChainImageViews()) {
-    vkDestroyImageView(DeviceControl::getDevice(), imageView, nullptr);
-  }
-  vkDestroySwapchainKHR(DeviceControl::getDevice(), DeviceControl::getSwapChain(), nullptr);
+  // DeferredDeletion destroys them at the end of shutdown, along with anything still waiting on a frame.
+  destroyRenderTargets();
+  destroySwapChain();
 }
 uint32_t Render::getCurrentFrame() { return currentFrame; }
+RenderGraph::Image Render::getSwapChainImage(uint32_t imageIndex) { return swapChainImages[imageIndex]; }
+void Render::setCurrentFrame(uint32_t frame) { currentFrame = frame; }
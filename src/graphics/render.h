@@ -2,11 +2,22 @@
 
 #include <cstdint>
 #include "../assetcache.h"
+#include "rendergraph.h"
 class Render {
 public:
   static void drawFrame(AssetCache& cache);
   static void createSyncObject();
+  // Shutdown only.
   static void cleanupSwapChain();
+  // Without waiting for the device, the old swapchain is handed to the new one and it and everything sized to it go
+  // through DeferredDeletion.
+  static void recreateSwapChain();
+  // The color, depth, Hi-Z and temporal images, for when only the sample count changed. Retired the same way.
+  static void recreateRenderTargets();
   static float getFloatBar();
   static uint32_t getCurrentFrame();
+  // The acquired image's render graph handle, valid until the swapchain is recreated.
+  static RenderGraph::Image getSwapChainImage(uint32_t imageIndex);
+  // Only while nothing is in flight, when the number of frames in flight changes.
+  static void setCurrentFrame(uint32_t frame);
 };
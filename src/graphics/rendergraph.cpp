@@ -0,0 +1,596 @@
+#include "rendergraph.h"
+#include "buffers.h"
+#include "deferreddeletion.h"
+#include "../devicelibrary.h"
+#include "../utils/deletion.h"
+#include "../utils/helpers.h"
+
+#include <algorithm>
+
+constexpr uint32_t NO_PASS = UINT32_MAX;
+constexpr uint32_t NO_SLOT = UINT32_MAX;
+constexpr VkAccessFlags2 WRITE_ACCESS = VK_ACCESS_2_SHADER_WRITE_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT |
+                                        VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+                                        VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_HOST_WRITE_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT;
+
+// What has happened to a resource since it was last written, which is all the next use needs to know to wait for it.
+struct AccessState {
+  VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+  // The last write, or layout transition, and the stages and accesses it has been made visible to since.
+  VkPipelineStageFlags2 writeStage = VK_PIPELINE_STAGE_2_NONE;
+  VkAccessFlags2 writeAccess = 0;
+  VkPipelineStageFlags2 visibleStage = VK_PIPELINE_STAGE_2_NONE;
+  VkAccessFlags2 visibleAccess = 0;
+  // Everything that read it since, the next write waits for these.
+  VkPipelineStageFlags2 readStage = VK_PIPELINE_STAGE_2_NONE;
+};
+enum class UseKind { READ, WRITE, OVERWRITE };
+
+struct GraphImage {
+  bool used;
+  bool transient;
+  VkImage image;
+  VkImageView view;
+  VkImageAspectFlags aspect;
+  uint32_t mipLevels;
+  AccessState state;
+  // Transients only. What placing it takes, the passes of this frame it lives between, the slot of memory that lifetime
+  // puts it in and the one it is bound to now.
+  RenderGraph::ImageDesc desc;
+  VkMemoryRequirements requirements;
+  uint32_t firstPass;
+  uint32_t lastPass;
+  uint32_t slot;
+  uint32_t boundSlot;
+  // In lazily allocated memory, in a slot of its own.
+  bool lazy;
+  // Already used by a pass this frame, the first use is the one that takes over the memory.
+  bool touched;
+};
+struct GraphBuffer {
+  bool used;
+  VkBuffer buffer;
+  AccessState state;
+};
+struct ResourceUse {
+  uint32_t resource;
+  RenderGraph::Use use;
+  UseKind kind;
+};
+struct GraphPass {
+  const char *name;
+  std::function<void(VkCommandBuffer)> record;
+  std::vector<ResourceUse> images;
+  std::vector<ResourceUse> buffers;
+  bool keep;
+  bool live;
+};
+// A piece of memory transients take turns in, sized for the biggest. A lazy one only ever holds one transient, only
+// what a tile based GPU actually spills of it is ever backed.
+struct TransientSlot {
+  uint32_t lastPass;
+  VkMemoryRequirements requirements;
+  bool lazy;
+};
+
+std::vector<GraphImage> graphImages;
+std::vector<uint32_t> freeGraphImages;
+std::vector<GraphBuffer> graphBuffers;
+std::vector<uint32_t> freeGraphBuffers;
+// Entries past passCount are left over from earlier frames, kept for their capacity.
+std::vector<GraphPass> graphPasses;
+uint32_t passCount = 0;
+
+std::vector<TransientSlot> transientSlots;
+std::vector<VmaAllocation> transientMemory;
+uint64_t transientGeneration = 0;
+// A transient was created or destroyed since the last placement.
+bool transientsChanged = false;
+VkDeviceSize transientBytes = 0;
+VkDeviceSize aliasedBytes = 0;
+VkDeviceSize lazyBytes = 0;
+
+std::vector<RenderGraph::PassInfo> lastPasses;
+std::vector<bool> imageNeeded;
+std::vector<bool> bufferNeeded;
+std::vector<uint32_t> placementOrder;
+std::vector<VkImageMemoryBarrier2> imageBarriers;
+std::vector<VkBufferMemoryBarrier2> bufferBarriers;
+
+static VkImageCreateInfo transientImageInfo(const RenderGraph::ImageDesc& desc) {
+  return {
+    .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+    .imageType = VK_IMAGE_TYPE_2D,
+    .format = desc.format,
+    .extent = {desc.extent.width, desc.extent.height, 1},
+    .mipLevels = 1,
+    .arrayLayers = 1,
+    .samples = desc.samples,
+    .tiling = VK_IMAGE_TILING_OPTIMAL,
+    .usage = desc.usage,
+    .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+  };
+}
+// Whether any of the memory types the image can live in is lazily allocated, desktop GPUs usually have none.
+static bool supportsLazyMemory(uint32_t memoryTypeBits) {
+  const VkPhysicalDeviceMemoryProperties *properties;
+  vmaGetMemoryProperties(Buffers::getAllocator(), &properties);
+  for (uint32_t i = 0; i < properties->memoryTypeCount; i++) {
+    if ((memoryTypeBits & (1u << i)) && (properties->memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT)) {
+      return true;
+    }
+  }
+  return false;
+}
+static void addUse(std::vector<ResourceUse>& uses, uint32_t resource, const RenderGraph::Use& use, UseKind kind) {
+  // Used twice in one pass, it waits once for the both of them. Only an overwrite on both counts discards.
+  for (ResourceUse& existing : uses) {
+    if (existing.resource == resource) {
+      existing.use.stage |= use.stage;
+      existing.use.access |= use.access;
+      if (existing.kind != kind) {
+        existing.kind = UseKind::WRITE;
+      }
+      return;
+    }
+  }
+  uses.push_back({resource, use, kind});
+}
+
+// Moves the state past `use`, adding what it has to wait for to srcStage and srcAccess. False when it needs no barrier.
+static bool advance(AccessState& state, const RenderGraph::Use& use, bool discard, VkPipelineStageFlags2& srcStage,
+                    VkAccessFlags2& srcAccess, VkImageLayout& oldLayout) {
+  const bool writes = (use.access & WRITE_ACCESS) != 0;
+  const bool transition = use.layout != VK_IMAGE_LAYOUT_UNDEFINED && (discard || use.layout != state.layout);
+  oldLayout = discard ? VK_IMAGE_LAYOUT_UNDEFINED : state.layout;
+  if (writes || transition) {
+    // A transition is a write too. Both wait for everything since the last write, which has to be available by then.
+    srcStage |= state.writeStage | state.readStage;
+    srcAccess |= state.writeAccess;
+    state = {
+      .layout = use.layout,
+      .writeStage = use.stage,
+      .writeAccess = use.access & WRITE_ACCESS,
+      .visibleStage = use.stage,
+      .visibleAccess = use.access,
+      .readStage = writes ? VK_PIPELINE_STAGE_2_NONE : use.stage,
+    };
+    return transition || srcStage != VK_PIPELINE_STAGE_2_NONE;
+  }
+  // Reads only wait for the last write, and only if it hasn't been made visible to them already.
+  if (state.writeStage != VK_PIPELINE_STAGE_2_NONE &&
+      ((use.stage & ~state.visibleStage) != 0 || (use.access & ~state.visibleAccess) != 0)) {
+    srcStage |= state.writeStage;
+    srcAccess |= state.writeAccess;
+    state.visibleStage |= use.stage;
+    state.visibleAccess |= use.access;
+  }
+  state.readStage |= use.stage;
+  return srcStage != VK_PIPELINE_STAGE_2_NONE;
+}
+
+// Backwards from the end of the frame: a pass lives if it is kept or writes something a later live pass reads, or that
+// is imported and so read after the frame. Overwriting it means nothing earlier has to be kept for it.
+static void cullPasses() {
+  imageNeeded.assign(graphImages.size(), false);
+  for (size_t i = 0; i < graphImages.size(); i++) {
+    imageNeeded[i] = graphImages[i].used && !graphImages[i].transient;
+  }
+  bufferNeeded.assign(graphBuffers.size(), true);
+  for (uint32_t p = passCount; p-- > 0;) {
+    GraphPass& pass = graphPasses[p];
+    pass.live = pass.keep;
+    for (const ResourceUse& use : pass.images) {
+      pass.live |= use.kind != UseKind::READ && imageNeeded[use.resource];
+    }
+    for (const ResourceUse& use : pass.buffers) {
+      pass.live |= use.kind != UseKind::READ && bufferNeeded[use.resource];
+    }
+    if (!pass.live) {
+      continue;
+    }
+    for (const ResourceUse& use : pass.images) {
+      imageNeeded[use.resource] = use.kind != UseKind::OVERWRITE;
+    }
+    for (const ResourceUse& use : pass.buffers) {
+      bufferNeeded[use.resource] = true;
+    }
+  }
+}
+
+// Handed to DeferredDeletion, the frames in flight may still be rendering into them.
+static void retireTransients() {
+  for (GraphImage& image : graphImages) {
+    if (image.used && image.transient && image.image != VK_NULL_HANDLE) {
+      DeferredDeletion::imageView(image.view);
+      DeferredDeletion::image(image.image, VK_NULL_HANDLE);
+      image.image = VK_NULL_HANDLE;
+      image.view = VK_NULL_HANDLE;
+    }
+    image.boundSlot = NO_SLOT;
+  }
+  for (VmaAllocation memory : transientMemory) {
+    DeferredDeletion::memory(memory);
+  }
+  transientMemory.clear();
+}
+// Greedy in order of first use: a transient moves into the first slot whose last tenant is done before it starts and
+// whose memory types it can live in, or gets a new slot. Lazy transients always get their own. Returns whether that
+// differs from how they're bound now.
+static bool assignSlots() {
+  placementOrder.clear();
+  for (uint32_t i = 0; i < graphImages.size(); i++) {
+    GraphImage& image = graphImages[i];
+    image.slot = NO_SLOT;
+    if (image.used && image.transient && image.firstPass != NO_PASS) {
+      placementOrder.push_back(i);
+    }
+  }
+  std::stable_sort(placementOrder.begin(), placementOrder.end(), [](uint32_t a, uint32_t b) {
+    return graphImages[a].firstPass < graphImages[b].firstPass;
+  });
+
+  transientSlots.clear();
+  for (uint32_t index : placementOrder) {
+    GraphImage& image = graphImages[index];
+    for (uint32_t s = 0; s < transientSlots.size() && !image.lazy; s++) {
+      TransientSlot& slot = transientSlots[s];
+      if (!slot.lazy && slot.lastPass < image.firstPass && (slot.requirements.memoryTypeBits & image.requirements.memoryTypeBits) != 0) {
+        image.slot = s;
+        break;
+      }
+    }
+    if (image.slot == NO_SLOT) {
+      image.slot = static_cast<uint32_t>(transientSlots.size());
+      transientSlots.push_back({.lastPass = NO_PASS, .requirements = image.requirements, .lazy = image.lazy});
+    }
+    TransientSlot& slot = transientSlots[image.slot];
+    slot.lastPass = image.lastPass;
+    slot.requirements.size = std::max(slot.requirements.size, image.requirements.size);
+    slot.requirements.alignment = std::max(slot.requirements.alignment, image.requirements.alignment);
+    slot.requirements.memoryTypeBits &= image.requirements.memoryTypeBits;
+  }
+
+  bool changed = transientsChanged;
+  for (const GraphImage& image : graphImages) {
+    changed |= image.used && image.transient && image.slot != image.boundSlot;
+  }
+  return changed;
+}
+// Every transient is recreated, nothing in them outlives a frame anyway.
+static void placeTransients() {
+  retireTransients();
+  transientMemory.resize(transientSlots.size());
+  transientBytes = 0;
+  aliasedBytes = 0;
+  lazyBytes = 0;
+  for (size_t s = 0; s < transientSlots.size(); s++) {
+    const TransientSlot& slot = transientSlots[s];
+    // Dedicated, the commitment can only be asked for a whole VkDeviceMemory.
+    VmaAllocationCreateInfo allocationInfo = {
+      .flags = slot.lazy ? VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT : 0u,
+      .usage = slot.lazy ? VMA_MEMORY_USAGE_GPU_LAZILY_ALLOCATED : VMA_MEMORY_USAGE_GPU_ONLY,
+    };
+    VK_CHECK(vmaAllocateMemory(Buffers::getAllocator(), &slot.requirements, &allocationInfo, &transientMemory[s], nullptr));
+    (slot.lazy ? lazyBytes : transientBytes) += slot.requirements.size;
+  }
+  for (GraphImage& image : graphImages) {
+    if (!image.used || !image.transient || image.slot == NO_SLOT) {
+      continue;
+    }
+    const VkImageCreateInfo imageInfo = transientImageInfo(image.desc);
+    VK_CHECK(vkCreateImage(DeviceControl::getDevice(), &imageInfo, nullptr, &image.image));
+    VK_CHECK(vmaBindImageMemory(Buffers::getAllocator(), transientMemory[image.slot], image.image));
+    image.view = DeviceControl::createImageView(image.image, image.desc.format, image.desc.aspect, 1);
+    image.boundSlot = image.slot;
+    // Fresh memory, nothing from before to wait for.
+    image.state = {};
+    if (!image.lazy) {
+      aliasedBytes += image.requirements.size;
+    }
+  }
+  aliasedBytes -= transientBytes;
+  transientsChanged = false;
+  transientGeneration++;
+}
+
+static uint32_t allocateImage() {
+  if (!freeGraphImages.empty()) {
+    uint32_t index = freeGraphImages.back();
+    freeGraphImages.pop_back();
+    return index;
+  }
+  graphImages.emplace_back();
+  return static_cast<uint32_t>(graphImages.size() - 1);
+}
+
+void RenderGraph::init() {
+  // The device is idle by the time the DeletionQueue is flushed.
+  DeletionQueue::get().push_function([=](){
+    for (GraphImage& image : graphImages) {
+      if (image.used && image.transient && image.image != VK_NULL_HANDLE) {
+        vkDestroyImageView(DeviceControl::getDevice(), image.view, nullptr);
+        vkDestroyImage(DeviceControl::getDevice(), image.image, nullptr);
+        image.image = VK_NULL_HANDLE;
+      }
+    }
+    for (VmaAllocation memory : transientMemory) {
+      vmaFreeMemory(Buffers::getAllocator(), memory);
+    }
+    transientMemory.clear();
+  });
+}
+
+RenderGraph::Image RenderGraph::createTransientImage(const ImageDesc& desc) {
+  const uint32_t index = allocateImage();
+  GraphImage& image = graphImages[index];
+  image = {
+    .used = true,
+    .transient = true,
+    .aspect = desc.aspect,
+    .mipLevels = 1,
+    .desc = desc,
+    .firstPass = NO_PASS,
+    .lastPass = NO_PASS,
+    .slot = NO_SLOT,
+    .boundSlot = NO_SLOT,
+  };
+  // Known without creating it, so slots can be planned before anything is.
+  const VkImageCreateInfo imageInfo = transientImageInfo(desc);
+  const VkDeviceImageMemoryRequirements requirementsInfo = {
+    .sType = VK_STRUCTURE_TYPE_DEVICE_IMAGE_MEMORY_REQUIREMENTS,
+    .pCreateInfo = &imageInfo,
+  };
+  VkMemoryRequirements2 requirements = {
+    .sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2,
+  };
+  vkGetDeviceImageMemoryRequirements(DeviceControl::getDevice(), &requirementsInfo, &requirements);
+  image.requirements = requirements.memoryRequirements;
+  // An attachment that never leaves the tile needs no memory at all on a GPU that can back it lazily.
+  image.lazy = (desc.usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) && supportsLazyMemory(image.requirements.memoryTypeBits);
+  transientsChanged = true;
+  return {index};
+}
+void RenderGraph::destroyTransientImage(Image handle) {
+  GraphImage& image = graphImages[handle.index];
+  if (image.image != VK_NULL_HANDLE) {
+    DeferredDeletion::imageView(image.view);
+    DeferredDeletion::image(image.image, VK_NULL_HANDLE);
+  }
+  image = {};
+  freeGraphImages.push_back(handle.index);
+  transientsChanged = true;
+}
+RenderGraph::Image RenderGraph::importImage(VkImage vkImage, VkImageView view, VkImageAspectFlags aspect, uint32_t mipLevels, VkImageLayout layout) {
+  const uint32_t index = allocateImage();
+  graphImages[index] = {
+    .used = true,
+    .transient = false,
+    .image = vkImage,
+    .view = view,
+    .aspect = aspect,
+    .mipLevels = mipLevels,
+    .state = {.layout = layout},
+    .slot = NO_SLOT,
+    .boundSlot = NO_SLOT,
+  };
+  return {index};
+}
+void RenderGraph::releaseImage(Image handle) {
+  graphImages[handle.index] = {};
+  freeGraphImages.push_back(handle.index);
+}
+RenderGraph::Buffer RenderGraph::importBuffer(VkBuffer buffer) {
+  uint32_t index;
+  if (!freeGraphBuffers.empty()) {
+    index = freeGraphBuffers.back();
+    freeGraphBuffers.pop_back();
+  } else {
+    index = static_cast<uint32_t>(graphBuffers.size());
+    graphBuffers.emplace_back();
+  }
+  graphBuffers[index] = {.used = true, .buffer = buffer};
+  return {index};
+}
+void RenderGraph::releaseBuffer(Buffer handle) {
+  graphBuffers[handle.index] = {};
+  freeGraphBuffers.push_back(handle.index);
+}
+void RenderGraph::acquired(Image handle, VkPipelineStageFlags2 waitStage) {
+  // Waiting on the semaphore's stage chains the first barrier onto the wait.
+  graphImages[handle.index].state = {
+    .layout = VK_IMAGE_LAYOUT_UNDEFINED,
+    .writeStage = waitStage,
+  };
+}
+
+VkImage RenderGraph::getImage(Image handle) {
+  return handle.valid() ? graphImages[handle.index].image : VK_NULL_HANDLE;
+}
+VkImageView RenderGraph::getView(Image handle) {
+  return handle.valid() ? graphImages[handle.index].view : VK_NULL_HANDLE;
+}
+uint64_t RenderGraph::getTransientGeneration() { return transientGeneration; }
+
+RenderGraph::Pass RenderGraph::addPass(const char *name, std::function<void(VkCommandBuffer)> record) {
+  if (passCount == graphPasses.size()) {
+    graphPasses.emplace_back();
+  }
+  GraphPass& pass = graphPasses[passCount];
+  pass.name = name;
+  pass.record = std::move(record);
+  pass.images.clear();
+  pass.buffers.clear();
+  pass.keep = false;
+  pass.live = false;
+  return Pass(passCount++);
+}
+RenderGraph::Pass &RenderGraph::Pass::read(Image image, const Use& use) {
+  addUse(graphPasses[index].images, image.index, use, UseKind::READ);
+  return *this;
+}
+RenderGraph::Pass &RenderGraph::Pass::read(Buffer buffer, const Use& use) {
+  addUse(graphPasses[index].buffers, buffer.index, use, UseKind::READ);
+  return *this;
+}
+RenderGraph::Pass &RenderGraph::Pass::write(Image image, const Use& use) {
+  addUse(graphPasses[index].images, image.index, use, UseKind::WRITE);
+  return *this;
+}
+RenderGraph::Pass &RenderGraph::Pass::write(Buffer buffer, const Use& use) {
+  addUse(graphPasses[index].buffers, buffer.index, use, UseKind::WRITE);
+  return *this;
+}
+RenderGraph::Pass &RenderGraph::Pass::overwrite(Image image, const Use& use) {
+  addUse(graphPasses[index].images, image.index, use, UseKind::OVERWRITE);
+  return *this;
+}
+RenderGraph::Pass &RenderGraph::Pass::keep() {
+  graphPasses[index].keep = true;
+  return *this;
+}
+
+void RenderGraph::execute(VkCommandBuffer commandBuffer) {
+  cullPasses();
+
+  // Transients are discarded at their first use every frame, and live until their last.
+  for (GraphImage& image : graphImages) {
+    image.firstPass = NO_PASS;
+    image.lastPass = NO_PASS;
+    image.touched = false;
+    if (image.transient) {
+      image.state.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    }
+  }
+  for (uint32_t p = 0; p < passCount; p++) {
+    if (!graphPasses[p].live) {
+      continue;
+    }
+    for (const ResourceUse& use : graphPasses[p].images) {
+      GraphImage& image = graphImages[use.resource];
+      if (image.transient) {
+        image.firstPass = std::min(image.firstPass, p);
+        image.lastPass = p;
+      }
+    }
+  }
+  if (assignSlots()) {
+    placeTransients();
+  }
+
+  lastPasses.clear();
+  for (uint32_t p = 0; p < passCount; p++) {
+    GraphPass& pass = graphPasses[p];
+    if (!pass.live) {
+      lastPasses.push_back({.name = pass.name, .culled = true, .barriers = 0});
+      continue;
+    }
+    imageBarriers.clear();
+    bufferBarriers.clear();
+    for (const ResourceUse& use : pass.images) {
+      GraphImage& image = graphImages[use.resource];
+      VkPipelineStageFlags2 srcStage = VK_PIPELINE_STAGE_2_NONE;
+      VkAccessFlags2 srcAccess = 0;
+      bool discard = use.kind == UseKind::OVERWRITE;
+      if (image.transient && !image.touched) {
+        // Since this transient last used its memory, any of the others sharing it may have.
+        discard = true;
+        for (const GraphImage& tenant : graphImages) {
+          if (tenant.used && tenant.transient && tenant.boundSlot == image.boundSlot) {
+            srcStage |= tenant.state.writeStage | tenant.state.readStage;
+            srcAccess |= tenant.state.writeAccess;
+          }
+        }
+      }
+      image.touched = true;
+      VkImageLayout oldLayout;
+      if (!advance(image.state, use.use, discard, srcStage, srcAccess, oldLayout)) {
+        continue;
+      }
+      imageBarriers.push_back({
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+        .srcStageMask = srcStage,
+        .srcAccessMask = srcAccess,
+        .dstStageMask = use.use.stage,
+        .dstAccessMask = use.use.access,
+        .oldLayout = oldLayout,
+        .newLayout = use.use.layout,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = image.image,
+        .subresourceRange = {
+          .aspectMask = image.aspect,
+          .baseMipLevel = 0,
+          .levelCount = image.mipLevels,
+          .baseArrayLayer = 0,
+          .layerCount = VK_REMAINING_ARRAY_LAYERS,
+        },
+      });
+    }
+    for (const ResourceUse& use : pass.buffers) {
+      GraphBuffer& buffer = graphBuffers[use.resource];
+      VkPipelineStageFlags2 srcStage = VK_PIPELINE_STAGE_2_NONE;
+      VkAccessFlags2 srcAccess = 0;
+      VkImageLayout oldLayout;
+      if (!advance(buffer.state, use.use, false, srcStage, srcAccess, oldLayout)) {
+        continue;
+      }
+      bufferBarriers.push_back({
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2,
+        .srcStageMask = srcStage,
+        .srcAccessMask = srcAccess,
+        .dstStageMask = use.use.stage,
+        .dstAccessMask = use.use.access,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = buffer.buffer,
+        .offset = 0,
+        .size = VK_WHOLE_SIZE,
+      });
+    }
+    if (!imageBarriers.empty() || !bufferBarriers.empty()) {
+      const VkDependencyInfo dependency = {
+        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        .bufferMemoryBarrierCount = static_cast<uint32_t>(bufferBarriers.size()),
+        .pBufferMemoryBarriers = bufferBarriers.data(),
+        .imageMemoryBarrierCount = static_cast<uint32_t>(imageBarriers.size()),
+        .pImageMemoryBarriers = imageBarriers.data(),
+      };
+      vkCmdPipelineBarrier2(commandBuffer, &dependency);
+    }
+    if (pass.record) {
+      pass.record(commandBuffer);
+    }
+    lastPasses.push_back({
+      .name = pass.name,
+      .culled = false,
+      .barriers = static_cast<uint32_t>(imageBarriers.size() + bufferBarriers.size()),
+    });
+  }
+
+  // Drop the captures now, they may hold on to things the frame is done with.
+  for (uint32_t p = 0; p < passCount; p++) {
+    graphPasses[p].record = nullptr;
+  }
+  passCount = 0;
+}
+
+const std::vector<RenderGraph::PassInfo> &RenderGraph::getLastPasses() { return lastPasses; }
+VkDeviceSize RenderGraph::getTransientBytes() { return transientBytes; }
+VkDeviceSize RenderGraph::getAliasedBytes() { return aliasedBytes; }
+VkDeviceSize RenderGraph::getLazyBytes() { return lazyBytes; }
+VkDeviceSize RenderGraph::getLazyCommittedBytes() {
+  VkDeviceSize committed = 0;
+  for (size_t s = 0; s < transientMemory.size(); s++) {
+    if (!transientSlots[s].lazy) {
+      continue;
+    }
+    VmaAllocationInfo allocationInfo;
+    vmaGetAllocationInfo(Buffers::getAllocator(), transientMemory[s], &allocationInfo);
+    VkDeviceSize bytes = 0;
+    vkGetDeviceMemoryCommitment(DeviceControl::getDevice(), allocationInfo.deviceMemory, &bytes);
+    committed += bytes;
+  }
+  return committed;
+}
@@ -0,0 +1,195 @@
+#pragma once
+#include "volk.h"
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// The frame as a list of passes, each saying which images and buffers it reads and writes. From that the graph records
+// every barrier (batched into one vkCmdPipelineBarrier2 in front of each pass that needs any), skips passes whose
+// results nothing reads, and places transient render targets whose lifetimes within the frame don't overlap in the same
+// memory. Images and buffers are registered once and their layout and last access are tracked across frames, so a pass
+// only says how it uses something, never what came before. Passes are added every frame, then recorded by execute().
+class RenderGraph {
+public:
+  // Handles stay valid until the image is destroyed or released, they're not per frame.
+  struct Image {
+    uint32_t index = UINT32_MAX;
+    bool valid() const { return index != UINT32_MAX; }
+  };
+  struct Buffer {
+    uint32_t index = UINT32_MAX;
+    bool valid() const { return index != UINT32_MAX; }
+  };
+
+  // How a pass touches a resource, any WRITE bit in the access makes it a write.
+  struct Use {
+    VkPipelineStageFlags2 stage;
+    VkAccessFlags2 access;
+    // Ignored for buffers.
+    VkImageLayout layout;
+  };
+  static constexpr Use COLOR_ATTACHMENT = {
+    VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+    VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+    VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+  };
+  // Resolves count as color attachment writes, depth ones too.
+  static constexpr Use RESOLVE_ATTACHMENT = {
+    VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+    VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+    VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+  };
+  static constexpr Use DEPTH_RESOLVE_ATTACHMENT = {
+    VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+    VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+    VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
+  };
+  static constexpr Use DEPTH_ATTACHMENT = {
+    VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+    VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+    VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
+  };
+  static constexpr Use COMPUTE_SAMPLED = {
+    VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+    VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+  };
+  static constexpr Use COMPUTE_SAMPLED_DEPTH = {
+    VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+    VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+    VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL,
+  };
+  static constexpr Use FRAGMENT_SAMPLED = {
+    VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+    VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+  };
+  static constexpr Use COMPUTE_STORAGE = {
+    VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+    VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+    VK_IMAGE_LAYOUT_GENERAL,
+  };
+  static constexpr Use BLIT_SOURCE = {
+    VK_PIPELINE_STAGE_2_BLIT_BIT,
+    VK_ACCESS_2_TRANSFER_READ_BIT,
+    VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+  };
+  static constexpr Use BLIT_DESTINATION = {
+    VK_PIPELINE_STAGE_2_BLIT_BIT,
+    VK_ACCESS_2_TRANSFER_WRITE_BIT,
+    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+  };
+  static constexpr Use COPY_SOURCE = {
+    VK_PIPELINE_STAGE_2_COPY_BIT,
+    VK_ACCESS_2_TRANSFER_READ_BIT,
+    VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+  };
+  static constexpr Use COPY_DESTINATION = {
+    VK_PIPELINE_STAGE_2_COPY_BIT,
+    VK_ACCESS_2_TRANSFER_WRITE_BIT,
+    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+  };
+  static constexpr Use PRESENT = {
+    VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT,
+    0,
+    VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+  };
+  static constexpr Use BUFFER_CLEAR = {
+    VK_PIPELINE_STAGE_2_CLEAR_BIT,
+    VK_ACCESS_2_TRANSFER_WRITE_BIT,
+    VK_IMAGE_LAYOUT_UNDEFINED,
+  };
+  static constexpr Use BUFFER_COMPUTE_STORAGE = {
+    VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+    VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+    VK_IMAGE_LAYOUT_UNDEFINED,
+  };
+  static constexpr Use BUFFER_FRAGMENT_STORAGE = {
+    VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+    VK_ACCESS_2_SHADER_STORAGE_READ_BIT,
+    VK_IMAGE_LAYOUT_UNDEFINED,
+  };
+  static constexpr Use BUFFER_INDIRECT = {
+    VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT,
+    VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT,
+    VK_IMAGE_LAYOUT_UNDEFINED,
+  };
+
+  // Single mip, single layer, swapchain sized or whatever the owner asks for.
+  struct ImageDesc {
+    VkFormat format;
+    VkExtent2D extent;
+    VkSampleCountFlagBits samples;
+    VkImageUsageFlags usage;
+    VkImageAspectFlags aspect;
+  };
+
+  // Chained off addPass(), like the PipelineBuilder. Only valid until the next addPass().
+  class Pass {
+  public:
+    // Needs what is there.
+    Pass &read(Image image, const Use& use);
+    Pass &read(Buffer buffer, const Use& use);
+    // Reads and writes, what is there is kept (an attachment the pass loads, a buffer it partly rewrites).
+    Pass &write(Image image, const Use& use);
+    Pass &write(Buffer buffer, const Use& use);
+    // Rewrites (or clears) everything the frame cares about, so what was there is discarded.
+    Pass &overwrite(Image image, const Use& use);
+    // Recorded even when nothing reads what it writes: presenting, queries, timestamps.
+    Pass &keep();
+
+  private:
+    friend class RenderGraph;
+    explicit Pass(uint32_t index) : index(index) {}
+    uint32_t index;
+  };
+
+  // Frees the transients still around at shutdown. Call once the allocator exists.
+  static void init();
+
+  // Owned by the graph. It only has memory (and a VkImage) while a pass of the frame uses it, and shares that memory with
+  // transients whose passes don't overlap with its own. Nothing in it survives the frame, the first pass to use it each
+  // frame has to overwrite it. With VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT it goes in lazily allocated memory instead,
+  // where the device has any.
+  static Image createTransientImage(const ImageDesc& desc);
+  // Through DeferredDeletion, the memory it shared is repacked on the next execute().
+  static void destroyTransientImage(Image image);
+  // An image someone else owns, currently in `layout`. Every array layer is tracked as one, a pass touching any layer
+  // waits on (and moves) all of them.
+  static Image importImage(VkImage image, VkImageView view, VkImageAspectFlags aspect, uint32_t mipLevels = 1,
+                           VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED);
+  // Forget an imported image, before it is handed to DeferredDeletion.
+  static void releaseImage(Image image);
+  static Buffer importBuffer(VkBuffer buffer);
+  static void releaseBuffer(Buffer buffer);
+  // The presentation engine hands the image back through a semaphore the frame's submission waits on at waitStage.
+  // What it held is gone, the first pass using it has to overwrite it.
+  static void acquired(Image image, VkPipelineStageFlags2 waitStage);
+
+  // While recording a pass. A transient's handles change whenever the frame's passes change how the transients can
+  // share memory, so they're looked up every frame rather than kept.
+  static VkImage getImage(Image image);
+  static VkImageView getView(Image image);
+  // Bumped whenever the transients are placed again, anything holding on to their views has to rebuild.
+  static uint64_t getTransientGeneration();
+
+  static Pass addPass(const char *name, std::function<void(VkCommandBuffer)> record = {});
+  // Drops the passes nothing needs, (re)places the transients if the frame's passes moved their lifetimes, then records
+  // every live pass behind its barriers. The passes are gone afterwards.
+  static void execute(VkCommandBuffer commandBuffer);
+
+  // What the last execute() did, for the UI.
+  struct PassInfo {
+    const char *name;
+    bool culled;
+    uint32_t barriers;
+  };
+  static const std::vector<PassInfo> &getLastPasses();
+  // Memory held by the transients, and how much more they'd take with an allocation each.
+  static VkDeviceSize getTransientBytes();
+  static VkDeviceSize getAliasedBytes();
+  // What the TRANSIENT_ATTACHMENT transients reserved in lazily allocated memory, and how much of that the device has
+  // actually backed. Zero without a lazily allocated memory type, they're aliased with the rest then.
+  static VkDeviceSize getLazyBytes();
+  static VkDeviceSize getLazyCommittedBytes();
+};
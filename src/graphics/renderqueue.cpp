@@ -0,0 +1,89 @@
+#include "renderqueue.h"
+
+#include <algorithm>
+#include <array>
+
+constexpr uint32_t PIPELINE_BITS = 8;
+constexpr uint32_t DEPTH_BITS = 24;
+constexpr uint32_t MATERIAL_BITS = 16;
+constexpr uint32_t MESH_BITS = 16;
+
+std::vector<RenderQueue::Draw> queuedDraws;
+std::vector<RenderQueue::Draw> sortScratch;
+// Keys hold an index into this rather than the handle, only the first 2^8 distinct pipelines sort apart.
+std::vector<VkPipeline> queuedPipelines;
+
+uint64_t RenderQueue::makeKey(uint32_t pipeline, float depth, uint32_t material, uint32_t mesh) {
+  const uint64_t depthBits = static_cast<uint64_t>(std::clamp(depth, 0.0f, 1.0f) * static_cast<float>((1u << DEPTH_BITS) - 1));
+  return (static_cast<uint64_t>(pipeline & ((1u << PIPELINE_BITS) - 1)) << (DEPTH_BITS + MATERIAL_BITS + MESH_BITS)) |
+         (depthBits << (MATERIAL_BITS + MESH_BITS)) |
+         (static_cast<uint64_t>(material & ((1u << MATERIAL_BITS) - 1)) << MESH_BITS) |
+         static_cast<uint64_t>(mesh & ((1u << MESH_BITS) - 1));
+}
+
+void RenderQueue::clear() {
+  queuedDraws.clear();
+  queuedPipelines.clear();
+}
+
+void RenderQueue::push(VkPipeline pipeline, VkBuffer indexBuffer, float depth, uint32_t material, uint32_t mesh,
+                       uint32_t indexCount, uint32_t firstIndex, uint32_t objectID) {
+  // A frame only ever has a handful.
+  auto it = std::find(queuedPipelines.begin(), queuedPipelines.end(), pipeline);
+  const uint32_t pipelineIndex = static_cast<uint32_t>(it - queuedPipelines.begin());
+  if (it == queuedPipelines.end()) {
+    queuedPipelines.push_back(pipeline);
+  }
+  queuedDraws.push_back({
+    .key = makeKey(pipelineIndex, depth, material, mesh),
+    .pipeline = pipeline,
+    .indexBuffer = indexBuffer,
+    .indexCount = indexCount,
+    .firstIndex = firstIndex,
+    .objectID = objectID,
+  });
+}
+
+void RenderQueue::sort() {
+  sortScratch.resize(queuedDraws.size());
+  for (uint32_t shift = 0; shift < 64; shift += 8) {
+    std::array<uint32_t, 256> offsets{};
+    for (const Draw &draw : queuedDraws) {
+      offsets[(draw.key >> shift) & 0xFF]++;
+    }
+    // Every key in one bucket, this byte doesn't change the order.
+    if (std::find(offsets.begin(), offsets.end(), static_cast<uint32_t>(queuedDraws.size())) != offsets.end()) {
+      continue;
+    }
+    uint32_t total = 0;
+    for (uint32_t &offset : offsets) {
+      uint32_t count = offset;
+      offset = total;
+      total += count;
+    }
+    for (const Draw &draw : queuedDraws) {
+      sortScratch[offsets[(draw.key >> shift) & 0xFF]++] = draw;
+    }
+    queuedDraws.swap(sortScratch);
+  }
+}
+
+const std::vector<RenderQueue::Draw> &RenderQueue::getDraws() { return queuedDraws; }
+
+void RenderQueue::record(VkCommandBuffer commandBuffer, uint32_t first, uint32_t last, VkPipeline pipeline) {
+  VkPipeline boundPipeline = VK_NULL_HANDLE;
+  VkBuffer boundIndexBuffer = VK_NULL_HANDLE;
+  for (uint32_t i = first; i < last; i++) {
+    const Draw &draw = queuedDraws[i];
+    const VkPipeline drawPipeline = pipeline != VK_NULL_HANDLE ? pipeline : draw.pipeline;
+    if (drawPipeline != boundPipeline) {
+      vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, drawPipeline);
+      boundPipeline = drawPipeline;
+    }
+    if (draw.indexBuffer != boundIndexBuffer) {
+      vkCmdBindIndexBuffer(commandBuffer, draw.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+      boundIndexBuffer = draw.indexBuffer;
+    }
+    vkCmdDrawIndexed(commandBuffer, draw.indexCount, 1, draw.firstIndex, 0, draw.objectID);
+  }
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include "volk.h"
+#include <cstdint>
+#include <vector>
+
+// The CPU path's draws for a frame, sorted by a 64 bit key so draws sharing state sit together and opaque geometry is
+// drawn front to back for early-Z. Materials and meshes are bindless here (MaterialTable, MeshPool), switching them
+// costs nothing, so only the pipeline outranks depth and they just break ties.
+class RenderQueue {
+public:
+  struct Draw {
+    uint64_t key;
+    VkPipeline pipeline;
+    VkBuffer indexBuffer;
+    uint32_t indexCount;
+    uint32_t firstIndex;
+    uint32_t objectID;
+  };
+
+  // High to low: pipeline (8 bits), depth (24), material (16), mesh (16). Depth is 0 at the camera, 1 at the far plane.
+  static uint64_t makeKey(uint32_t pipeline, float depth, uint32_t material, uint32_t mesh);
+
+  static void clear();
+  static void push(VkPipeline pipeline, VkBuffer indexBuffer, float depth, uint32_t material, uint32_t mesh,
+                   uint32_t indexCount, uint32_t firstIndex, uint32_t objectID);
+  // LSD radix sort, a byte per pass, passes where every key has the same byte are skipped.
+  static void sort();
+  static const std::vector<Draw> &getDraws();
+
+  // Records [first, last) of the draws, binding the pipeline and index buffer only when they change. Anything else
+  // the draws need (viewport, descriptors, push constants) has to be set already. Safe to call from several threads.
+  // A pipeline replaces every draw's own, for passes like the depth pre-pass that draw everything the same way.
+  static void record(VkCommandBuffer commandBuffer, uint32_t first, uint32_t last, VkPipeline pipeline = VK_NULL_HANDLE);
+};
@@ -0,0 +1,138 @@
+#include "samplercache.h"
+#include "buffers.h"
+#include "../devicelibrary.h"
+#include "../settings.h"
+#include "../utils/deletion.h"
+#include "../utils/helpers.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+// Everything in VkSamplerCreateInfo that changes the sampler, floats are stored with -0 folded into 0 so equal keys
+// always hash the same.
+struct SamplerKey {
+  uint32_t flags;
+  uint32_t magFilter;
+  uint32_t minFilter;
+  uint32_t mipmapMode;
+  uint32_t addressModeU;
+  uint32_t addressModeV;
+  uint32_t addressModeW;
+  float mipLodBias;
+  uint32_t anisotropyEnable;
+  float maxAnisotropy;
+  uint32_t compareEnable;
+  uint32_t compareOp;
+  float minLod;
+  float maxLod;
+  uint32_t borderColor;
+  uint32_t unnormalizedCoordinates;
+
+  bool operator==(const SamplerKey&) const = default;
+};
+struct SamplerKeyHash {
+  size_t operator()(const SamplerKey& key) const {
+    // The key is all 4 byte fields so there is no padding to trip over.
+    return static_cast<size_t>(hashBytes(&key, sizeof(SamplerKey)));
+  }
+};
+
+std::unordered_map<SamplerKey, uint32_t, SamplerKeyHash> samplerIndices;
+std::vector<VkSampler> samplers;
+float deviceMaxAnisotropy = 1.0f;
+
+void SamplerCache::init() {
+  VkPhysicalDeviceProperties properties{};
+  vkGetPhysicalDeviceProperties(DeviceControl::getPhysicalDevice(), &properties);
+  deviceMaxAnisotropy = properties.limits.maxSamplerAnisotropy;
+
+  DeletionQueue::get().push_function([=](){
+    for (VkSampler sampler : samplers) {
+      vkDestroySampler(DeviceControl::getDevice(), sampler, nullptr);
+    }
+    samplers.clear();
+    samplerIndices.clear();
+  });
+  // The first request is guaranteed to land on DEFAULT_SAMPLER.
+  getSampler(Settings{.maxAnisotropy = deviceMaxAnisotropy});
+}
+
+VkSamplerCreateInfo SamplerCache::makeCreateInfo(const Settings& settings) {
+  VkSamplerCreateInfo samplerInfo = {
+    .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+    .pNext = nullptr,
+    .magFilter = settings.filter,
+    .minFilter = settings.filter,
+    .mipmapMode = settings.filter == VK_FILTER_NEAREST ? VK_SAMPLER_MIPMAP_MODE_NEAREST : VK_SAMPLER_MIPMAP_MODE_LINEAR,
+    .addressModeU = settings.addressMode,
+    .addressModeV = settings.addressMode,
+    .addressModeW = settings.addressMode,
+    .mipLodBias = 0.0f,
+    .anisotropyEnable = settings.maxAnisotropy > 1.0f,
+    .maxAnisotropy = settings.maxAnisotropy,
+    .compareEnable = VK_FALSE,
+    .compareOp = VK_COMPARE_OP_ALWAYS,
+    .minLod = 0.0f,
+    .maxLod = VK_LOD_CLAMP_NONE,
+    .borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK,
+    .unnormalizedCoordinates = VK_FALSE,
+  };
+  return samplerInfo;
+}
+
+uint32_t SamplerCache::getSampler(const Settings& settings) {
+  return getSampler(makeCreateInfo(settings));
+}
+uint32_t SamplerCache::getSampler(const VkSamplerCreateInfo& samplerInfo) {
+  // Normalize first, so requests that would build the same sampler share it. Anisotropy is meaningless when
+  // disabled and past the device limit (or the quality setting's cap), and hardware only takes power of two tap
+  // counts anyway.
+  VkSamplerCreateInfo createInfo = samplerInfo;
+  createInfo.pNext = nullptr;
+  createInfo.maxAnisotropy = std::clamp(std::exp2(std::round(std::log2(std::max(createInfo.maxAnisotropy, 1.0f)))),
+                                        1.0f, std::min(deviceMaxAnisotropy, ::Settings::get().maxAnisotropy));
+  if (!createInfo.anisotropyEnable || createInfo.maxAnisotropy <= 1.0f) {
+    createInfo.anisotropyEnable = VK_FALSE;
+    createInfo.maxAnisotropy = 1.0f;
+  }
+
+  SamplerKey key = {
+    .flags = createInfo.flags,
+    .magFilter = createInfo.magFilter,
+    .minFilter = createInfo.minFilter,
+    .mipmapMode = createInfo.mipmapMode,
+    .addressModeU = createInfo.addressModeU,
+    .addressModeV = createInfo.addressModeV,
+    .addressModeW = createInfo.addressModeW,
+    .mipLodBias = createInfo.mipLodBias + 0.0f,
+    .anisotropyEnable = createInfo.anisotropyEnable,
+    .maxAnisotropy = createInfo.maxAnisotropy + 0.0f,
+    .compareEnable = createInfo.compareEnable,
+    .compareOp = createInfo.compareOp,
+    .minLod = createInfo.minLod + 0.0f,
+    .maxLod = createInfo.maxLod + 0.0f,
+    .borderColor = createInfo.borderColor,
+    .unnormalizedCoordinates = createInfo.unnormalizedCoordinates,
+  };
+  auto it = samplerIndices.find(key);
+  if (it != samplerIndices.end()) {
+    return it->second;
+  }
+
+  if (samplers.size() >= MAX_SAMPLERS) {
+    throw std::runtime_error("Ran out of bindless sampler slots!");
+  }
+  VkSampler sampler;
+  VK_CHECK(vkCreateSampler(DeviceControl::getDevice(), &createInfo, nullptr, &sampler));
+  uint32_t index = static_cast<uint32_t>(samplers.size());
+  samplers.push_back(sampler);
+  samplerIndices.emplace(key, index);
+  // A fresh slot, nothing in flight can be reading it yet.
+  Buffers::writeSamplerSlot(index, sampler);
+  return index;
+}
+
+uint32_t SamplerCache::getSamplerCount() { return static_cast<uint32_t>(samplers.size()); }
@@ -0,0 +1,30 @@
+#pragma once
+#include "volk.h"
+#include <cstdint>
+
+// Samplers are deduplicated by their create info and placed in the bindless sampler array, callers only ever deal in
+// indices into it. There are only a handful of distinct samplers in practice, so they live until shutdown.
+class SamplerCache {
+public:
+  // Every implementation has to allow at least this many live samplers.
+  static constexpr uint32_t MAX_SAMPLERS = 4000;
+  // Linear, clamped and the max anisotropy at startup, created by init() for anything that doesn't pick its own.
+  static constexpr uint32_t DEFAULT_SAMPLER = 0;
+
+  // The per texture choices a material gets to make, the rest of the create info is shared by every sampler.
+  struct Settings {
+    VkFilter filter = VK_FILTER_LINEAR;
+    VkSamplerAddressMode addressMode = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    // 1 turns anisotropic filtering off, anything above the device limit or the quality setting is clamped to it.
+    float maxAnisotropy = 16.0f;
+  };
+
+  // Must be called after the bindless sets exist.
+  static void init();
+  static uint32_t getSampler(const Settings& settings);
+  // pNext chains are not supported.
+  static uint32_t getSampler(const VkSamplerCreateInfo& samplerInfo);
+  static VkSamplerCreateInfo makeCreateInfo(const Settings& settings);
+
+  static uint32_t getSamplerCount();
+};
@@ -0,0 +1,92 @@
+#include "secondarycommands.h"
+#include "buffers.h"
+#include "../devicelibrary.h"
+#include "../utils/deletion.h"
+#include "../utils/helpers.h"
+#include "../utils/threadpool.h"
+
+#include <vector>
+
+namespace {
+  struct ThreadCommands {
+    VkCommandPool pool;
+    std::vector<VkCommandBuffer> buffers;
+    uint32_t used;
+  };
+}
+
+// Indexed [frame][thread].
+std::vector<std::vector<ThreadCommands>> secondaryCommands;
+VkCommandPool persistentPool;
+std::vector<VkCommandBuffer> persistentCommands;
+
+void SecondaryCommands::create() {
+  DeviceControl::QueueFamilyIndices queueFamilyIndices = DeviceControl::findQueueFamilies(DeviceControl::getPhysicalDevice());
+  VkCommandPoolCreateInfo poolInfo{
+    .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+    // Reset as a whole every frame, never buffer by buffer.
+    .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+    .queueFamilyIndex = queueFamilyIndices.graphicsFamily.value(),
+  };
+
+  secondaryCommands.resize(Buffers::getMaxFramesInFlight());
+  for (std::vector<ThreadCommands> &frame : secondaryCommands) {
+    frame.resize(ThreadPool::get().getThreadCount());
+    for (ThreadCommands &thread : frame) {
+      VK_CHECK(vkCreateCommandPool(DeviceControl::getDevice(), &poolInfo, nullptr, &thread.pool));
+      thread.used = 0;
+    }
+  }
+
+  // Its buffers are re-recorded one at a time, never reset as a pool.
+  VkCommandPoolCreateInfo persistentPoolInfo = poolInfo;
+  persistentPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  VK_CHECK(vkCreateCommandPool(DeviceControl::getDevice(), &persistentPoolInfo, nullptr, &persistentPool));
+  persistentCommands.resize(Buffers::getMaxFramesInFlight());
+  VkCommandBufferAllocateInfo allocInfo{
+    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+    .commandPool = persistentPool,
+    .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+    .commandBufferCount = static_cast<uint32_t>(persistentCommands.size()),
+  };
+  VK_CHECK(vkAllocateCommandBuffers(DeviceControl::getDevice(), &allocInfo, persistentCommands.data()));
+
+  DeletionQueue::get().push_function([=](){
+    vkDestroyCommandPool(DeviceControl::getDevice(), persistentPool, nullptr);
+    persistentCommands.clear();
+    for (std::vector<ThreadCommands> &frame : secondaryCommands) {
+      for (ThreadCommands &thread : frame) {
+        vkDestroyCommandPool(DeviceControl::getDevice(), thread.pool, nullptr);
+      }
+    }
+    secondaryCommands.clear();
+  });
+}
+
+void SecondaryCommands::reset(uint32_t frame) {
+  for (ThreadCommands &thread : secondaryCommands[frame]) {
+    if (thread.used > 0) {
+      VK_CHECK(vkResetCommandPool(DeviceControl::getDevice(), thread.pool, 0));
+      thread.used = 0;
+    }
+  }
+}
+
+VkCommandBuffer SecondaryCommands::acquire(uint32_t frame, uint32_t thread) {
+  ThreadCommands &commands = secondaryCommands[frame][thread];
+  if (commands.used == commands.buffers.size()) {
+    VkCommandBufferAllocateInfo allocInfo{
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+      .commandPool = commands.pool,
+      .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+      .commandBufferCount = 1,
+    };
+    VkCommandBuffer commandBuffer;
+    VK_CHECK(vkAllocateCommandBuffers(DeviceControl::getDevice(), &allocInfo, &commandBuffer));
+    commands.buffers.push_back(commandBuffer);
+  }
+  return commands.buffers[commands.used++];
+}
+
+VkCommandBuffer SecondaryCommands::getPersistent(uint32_t frame) { return persistentCommands[frame]; }
+uint32_t SecondaryCommands::getThreadCount() { return static_cast<uint32_t>(secondaryCommands.empty() ? 0 : secondaryCommands[0].size()); }
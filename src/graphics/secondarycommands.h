@@ -0,0 +1,18 @@
+#pragma once
+#include "volk.h"
+#include <cstdint>
+
+// Command pools for secondary command buffers, one per thread per frame in flight, so workers can record draws without
+// sharing a pool. Buffers are recycled when their frame comes around again. Each frame also keeps one buffer that
+// survives the reset, for commands recorded once and executed until something they depend on changes.
+class SecondaryCommands {
+public:
+  static void create();
+  // The frame's fence has to have been waited on, every buffer it handed out goes back to its pool.
+  static void reset(uint32_t frame);
+  // Only one thread may use a (frame, thread) pair at a time, ThreadPool batch indices are a good fit.
+  static VkCommandBuffer acquire(uint32_t frame, uint32_t thread);
+  // Not touched by reset(), beginning it again re-records it. Main thread only.
+  static VkCommandBuffer getPersistent(uint32_t frame);
+  static uint32_t getThreadCount();
+};
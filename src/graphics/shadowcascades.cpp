@@ -0,0 +1,414 @@
+#include "shadowcascades.h"
+#include "buffers.h"
+#include "meshpool.h"
+#include "pipelinebuilder.h"
+#include "samplercache.h"
+#include "texture.h"
+#include "../devicelibrary.h"
+#include "../utils/deletion.h"
+#include "../utils/helpers.h"
+
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/ext/matrix_clip_space.hpp>
+#include <glm/ext/matrix_transform.hpp>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+  // Matches shadow.vert.
+  struct ShadowPushConstants {
+    VkDeviceAddress sceneBufferAddress;
+    glm::mat4 cascadeViewProj;
+  };
+  struct Caster {
+    uint32_t indexCount;
+    uint32_t firstIndex;
+    uint32_t objectID;
+  };
+  // What a cascade's cache layer was last drawn with.
+  struct Cascade {
+    bool valid;
+    glm::vec3 lightDirection;
+    // The bounding sphere radius of the slice it was drawn for, and the (texel snapped) center of what it covers.
+    float radius;
+    glm::vec3 center;
+    // Half the width it covers, the radius plus the margin, and how deep along the light it reaches.
+    float extent;
+    float depthRange;
+    glm::mat4 view;
+    glm::mat4 viewProj;
+    uint64_t staticKey;
+    // The shadow map layer holds dynamic casters on top of the cache, it has to be restored once none are left.
+    bool composited;
+  };
+  // This frame's work for one cascade.
+  struct CascadeWork {
+    bool render;
+    bool composite;
+    glm::mat4 viewProj;
+    std::vector<Caster> staticCasters;
+    std::vector<Caster> dynamicCasters;
+  };
+}
+
+static_assert(sizeof(Agnosia_T::SceneBuffer::cascadeViewProj) / sizeof(glm::mat4) == ShadowCascades::CASCADE_COUNT,
+              "the scene buffer holds a matrix per cascade");
+
+Agnosia_T::Pipeline shadowPipeline;
+VkFormat shadowFormat;
+// Whether the format can be filtered, the comparison sampler falls back to single taps otherwise.
+bool shadowFilterLinear;
+// The static casters alone, and what the scene samples, that plus the dynamic ones. An array layer per cascade.
+Texture::Image cacheImage;
+Texture::Image shadowImage;
+VkImageView cacheLayerViews[ShadowCascades::CASCADE_COUNT];
+VkImageView shadowLayerViews[ShadowCascades::CASCADE_COUNT];
+RenderGraph::Image cacheResource;
+RenderGraph::Image shadowResource;
+uint32_t shadowSlot;
+uint32_t shadowSampler;
+
+Cascade cascades[ShadowCascades::CASCADE_COUNT] = {};
+CascadeWork cascadeWork[ShadowCascades::CASCADE_COUNT];
+ShadowCascades::Stats stats = {};
+
+bool shadowsEnabled = true;
+float shadowDistance = 40.0f;
+float splitLambda = 0.75f;
+float lightThreshold = 0.5f;
+float margin = 0.25f;
+
+// Any pure depth format will do, D16 is the one every device can both render and sample.
+static void pickFormat() {
+  const VkFormatFeatureFlags needed = VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+  VkFormat format = VK_FORMAT_D16_UNORM;
+  VkFormatProperties properties;
+  vkGetPhysicalDeviceFormatProperties(DeviceControl::getPhysicalDevice(), VK_FORMAT_D32_SFLOAT, &properties);
+  if ((properties.optimalTilingFeatures & needed) == needed) {
+    format = VK_FORMAT_D32_SFLOAT;
+  } else {
+    vkGetPhysicalDeviceFormatProperties(DeviceControl::getPhysicalDevice(), format, &properties);
+  }
+  shadowFormat = format;
+  shadowFilterLinear = (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) != 0;
+}
+static Texture::Image createImage(VkImageUsageFlags usage) {
+  VkImageCreateInfo imageInfo{
+    .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+    .imageType = VK_IMAGE_TYPE_2D,
+    .format = shadowFormat,
+    .extent = {ShadowCascades::RESOLUTION, ShadowCascades::RESOLUTION, 1},
+    .mipLevels = 1,
+    .arrayLayers = ShadowCascades::CASCADE_COUNT,
+    .samples = VK_SAMPLE_COUNT_1_BIT,
+    .tiling = VK_IMAGE_TILING_OPTIMAL,
+    .usage = usage,
+    .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+  };
+  VmaAllocationCreateInfo vmaCreateInfo = {
+    .usage = VMA_MEMORY_USAGE_GPU_ONLY,
+  };
+  Texture::Image image;
+  VK_CHECK(vmaCreateImage(Buffers::getAllocator(), &imageInfo, &vmaCreateInfo, &image.image, &image.alloc, nullptr));
+  return image;
+}
+static VkImageView createView(VkImage image, uint32_t baseLayer, uint32_t layerCount) {
+  VkImageViewCreateInfo viewInfo{
+    .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+    .image = image,
+    .viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY,
+    .format = shadowFormat,
+    .subresourceRange = {
+      .aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
+      .baseMipLevel = 0,
+      .levelCount = 1,
+      .baseArrayLayer = baseLayer,
+      .layerCount = layerCount,
+    },
+  };
+  VkImageView view;
+  VK_CHECK(vkCreateImageView(DeviceControl::getDevice(), &viewInfo, nullptr, &view));
+  return view;
+}
+// Around the slice's bounding sphere with the margin on top. Its center is snapped to whole texels across the light, so
+// static shadow edges land on the same texels whenever the cascade has to move.
+static void placeCascade(Cascade& cascade, glm::vec3 center, float radius, glm::vec3 lightDirection, float casterRange) {
+  const glm::vec3 up = std::abs(lightDirection.z) > 0.99f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(0.0f, 0.0f, 1.0f);
+  const glm::mat4 rotation = glm::lookAt(glm::vec3(0.0f), -lightDirection, up);
+  const float extent = radius * (1.0f + margin);
+  const float texel = 2.0f * extent / ShadowCascades::RESOLUTION;
+  glm::vec3 lightCenter = glm::vec3(rotation * glm::vec4(center, 1.0f));
+  lightCenter.x = std::floor(lightCenter.x / texel) * texel;
+  lightCenter.y = std::floor(lightCenter.y / texel) * texel;
+  const glm::vec3 snapped = glm::vec3(glm::inverse(rotation) * glm::vec4(lightCenter, 1.0f));
+
+  cascade.valid = true;
+  cascade.lightDirection = lightDirection;
+  cascade.radius = radius;
+  cascade.center = snapped;
+  cascade.extent = extent;
+  // Whatever stands between the sun and the slice, up to casterRange away, still shades it.
+  cascade.depthRange = 2.0f * extent + casterRange;
+  cascade.view = glm::lookAt(snapped + lightDirection * (extent + casterRange), snapped, up);
+  cascade.viewProj = glm::ortho(-extent, extent, -extent, extent, 0.0f, cascade.depthRange) * cascade.view;
+}
+static void recordCasters(VkCommandBuffer commandBuffer, VkImageView layerView, VkAttachmentLoadOp loadOp, VkDeviceAddress sceneAddress,
+                          const glm::mat4& viewProj, const std::vector<Caster>& casters) {
+  const VkRenderingAttachmentInfo depthAttachmentInfo = {
+    .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+    .imageView = layerView,
+    .imageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
+    .loadOp = loadOp,
+    .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+    .clearValue = {.depthStencil = {1.0f, 0}},
+  };
+  const VkExtent2D extent = {ShadowCascades::RESOLUTION, ShadowCascades::RESOLUTION};
+  const VkRenderingInfo renderInfo{
+    .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
+    .renderArea = { .offset = {0, 0}, .extent = extent },
+    .layerCount = 1,
+    .pDepthAttachment = &depthAttachmentInfo,
+  };
+  vkCmdBeginRendering(commandBuffer, &renderInfo);
+
+  const VkViewport viewport = {
+    .x = 0.0f,
+    .y = 0.0f,
+    .width = static_cast<float>(extent.width),
+    .height = static_cast<float>(extent.height),
+    .minDepth = 0.0f,
+    .maxDepth = 1.0f,
+  };
+  const VkRect2D scissor = { .offset = {0, 0}, .extent = extent };
+  vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+  vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+  vkCmdSetLineWidth(commandBuffer, 1.0f);
+
+  const ShadowPushConstants pushConstants = {
+    .sceneBufferAddress = sceneAddress,
+    .cascadeViewProj = viewProj,
+  };
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadowPipeline.pipeline);
+  vkCmdPushConstants(commandBuffer, shadowPipeline.layout, VK_SHADER_STAGE_ALL, 0, sizeof(ShadowPushConstants), &pushConstants);
+  vkCmdBindIndexBuffer(commandBuffer, MeshPool::getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
+  for (const Caster& caster : casters) {
+    vkCmdDrawIndexed(commandBuffer, caster.indexCount, 1, caster.firstIndex, 0, caster.objectID);
+  }
+  vkCmdEndRendering(commandBuffer);
+}
+
+void ShadowCascades::createPipeline() {
+  pickFormat();
+  // Both sides of thin geometry cast, and the bias keeps surfaces from shadowing themselves.
+  shadowPipeline = PipelineBuilder()
+    .setVertexShader("src/shaders/shadow.vert")
+    .setFragmentShader("")
+    .setPushConstantSize(sizeof(ShadowPushConstants))
+    .setCullMode(VK_CULL_MODE_NONE)
+    .setDepthBias(VK_TRUE)
+    .setDepthBiasConstantFactor(1.25f)
+    .setDepthBiasSlopeFactor(1.75f)
+    .setDepthOnlyTarget(shadowFormat)
+    .Build();
+}
+void ShadowCascades::create() {
+  cacheImage = createImage(VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+  shadowImage = createImage(VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
+  shadowImage.imageView = createView(shadowImage.image, 0, CASCADE_COUNT);
+  for (uint32_t i = 0; i < CASCADE_COUNT; i++) {
+    cacheLayerViews[i] = createView(cacheImage.image, i, 1);
+    shadowLayerViews[i] = createView(shadowImage.image, i, 1);
+  }
+  cacheResource = RenderGraph::importImage(cacheImage.image, VK_NULL_HANDLE, VK_IMAGE_ASPECT_DEPTH_BIT);
+  shadowResource = RenderGraph::importImage(shadowImage.image, shadowImage.imageView, VK_IMAGE_ASPECT_DEPTH_BIT);
+  shadowSlot = Buffers::allocateTextureSlot(shadowImage.imageView);
+
+  // Hardware PCF, 2x2 taps compared against the reference depth. Outside the map counts as lit.
+  const VkFilter filter = shadowFilterLinear ? VK_FILTER_LINEAR : VK_FILTER_NEAREST;
+  VkSamplerCreateInfo samplerInfo = SamplerCache::makeCreateInfo({.filter = filter, .addressMode = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER,
+                                                                  .maxAnisotropy = 1.0f});
+  samplerInfo.compareEnable = VK_TRUE;
+  samplerInfo.compareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+  samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+  shadowSampler = SamplerCache::getSampler(samplerInfo);
+
+  DeletionQueue::get().push_function([=](){
+    Buffers::freeTextureSlot(shadowSlot);
+    RenderGraph::releaseImage(cacheResource);
+    RenderGraph::releaseImage(shadowResource);
+    for (uint32_t i = 0; i < CASCADE_COUNT; i++) {
+      vkDestroyImageView(DeviceControl::getDevice(), cacheLayerViews[i], nullptr);
+      vkDestroyImageView(DeviceControl::getDevice(), shadowLayerViews[i], nullptr);
+    }
+    vkDestroyImageView(DeviceControl::getDevice(), shadowImage.imageView, nullptr);
+    vmaDestroyImage(Buffers::getAllocator(), cacheImage.image, cacheImage.alloc);
+    vmaDestroyImage(Buffers::getAllocator(), shadowImage.image, shadowImage.alloc);
+  });
+}
+
+void ShadowCascades::update(const glm::mat4& view, float fovY, float aspect, float nearPlane, float farPlane, glm::vec3 sunDirection,
+                            const std::vector<Model *>& models, Agnosia_T::SceneBuffer& sceneData) {
+  stats = {};
+  for (CascadeWork& work : cascadeWork) {
+    work.render = false;
+    work.composite = false;
+    work.staticCasters.clear();
+    work.dynamicCasters.clear();
+  }
+  sceneData.shadowSlot = shadowSlot;
+  sceneData.shadowSampler = shadowSampler;
+  sceneData.cascadeCount = 0;
+  if (!shadowsEnabled || glm::length(sunDirection) == 0.0f) {
+    return;
+  }
+
+  const glm::vec3 lightDirection = glm::normalize(sunDirection);
+  const float distance = std::max(std::min(shadowDistance, farPlane), nearPlane * 2.0f);
+  const glm::mat4 inverseView = glm::inverse(view);
+  const glm::vec3 eye = glm::vec3(inverseView[3]);
+  const glm::vec3 forward = -glm::normalize(glm::vec3(inverseView[2]));
+  // Squared tangent from the view axis to a corner of the frustum.
+  const float tanHalf = std::tan(fovY * 0.5f);
+  const float k2 = tanHalf * tanHalf * (1.0f + aspect * aspect);
+  const float cosThreshold = std::cos(glm::radians(lightThreshold));
+
+  float sliceNear = nearPlane;
+  for (uint32_t i = 0; i < CASCADE_COUNT; i++) {
+    // Practical splits, logarithmic up close where texels matter most and uniform further out.
+    const float p = static_cast<float>(i + 1) / CASCADE_COUNT;
+    const float sliceFar = glm::mix(nearPlane + (distance - nearPlane) * p, nearPlane * std::pow(distance / nearPlane, p), splitLambda);
+    // The smallest sphere around the slice, its center slides along the view axis and stops at the far plane once the
+    // slice is wider than it is deep. Rounded up so float noise doesn't count as a change.
+    const float z = std::min(0.5f * (sliceNear + sliceFar) * (1.0f + k2), sliceFar);
+    float radius = std::sqrt(std::max((z - sliceNear) * (z - sliceNear) + sliceNear * sliceNear * k2,
+                                      (sliceFar - z) * (sliceFar - z) + sliceFar * sliceFar * k2));
+    radius = std::ceil(radius * 16.0f) / 16.0f;
+    const glm::vec3 center = eye + forward * z;
+
+    Cascade& cascade = cascades[i];
+    CascadeWork& work = cascadeWork[i];
+    work.render = !cascade.valid || radius != cascade.radius || glm::dot(lightDirection, cascade.lightDirection) < cosThreshold;
+    if (!work.render) {
+      // Still inside what the cache covers, margin and all.
+      const glm::vec3 offset = glm::mat3(cascade.view) * (center - cascade.center);
+      work.render = std::max({std::abs(offset.x), std::abs(offset.y), std::abs(offset.z)}) + radius > cascade.extent;
+    }
+    if (work.render) {
+      placeCascade(cascade, center, radius, lightDirection, distance);
+    }
+
+    // Casters whose bounds reach into the cascade's box, the light looks down -Z. The static ones are hashed along with
+    // their positions, which is everything the cascade's cache depends on besides its placement.
+    uint64_t staticKey = hashBytes(nullptr, 0);
+    for (Model *model : models) {
+      const glm::vec3 bounds = glm::vec3(cascade.view * glm::vec4(model->getPos() + model->getBoundsCenter(), 1.0f));
+      const float boundsRadius = model->getBoundsRadius();
+      if (std::abs(bounds.x) > cascade.extent + boundsRadius || std::abs(bounds.y) > cascade.extent + boundsRadius ||
+          -bounds.z + boundsRadius < 0.0f || -bounds.z - boundsRadius > cascade.depthRange) {
+        continue;
+      }
+      const Caster caster = {model->getIndices(), model->getFirstIndex(), model->getObjectID()};
+      if (model->getDynamic()) {
+        work.dynamicCasters.push_back(caster);
+        continue;
+      }
+      work.staticCasters.push_back(caster);
+      staticKey = hashBytes(&caster, sizeof(Caster), staticKey);
+      staticKey = hashBytes(&model->getPos(), sizeof(glm::vec3), staticKey);
+    }
+    // A static caster came, went or moved.
+    work.render |= staticKey != cascade.staticKey;
+    cascade.staticKey = staticKey;
+
+    work.composite = work.render || !work.dynamicCasters.empty() || cascade.composited;
+    cascade.composited = !work.dynamicCasters.empty();
+    work.viewProj = cascade.viewProj;
+    if (work.render) {
+      stats.cascadesRendered++;
+      stats.staticCasters += static_cast<uint32_t>(work.staticCasters.size());
+    }
+    if (work.composite) {
+      stats.cascadesComposited++;
+      stats.dynamicCasters += static_cast<uint32_t>(work.dynamicCasters.size());
+    }
+
+    sceneData.cascadeSplits[i] = sliceFar;
+    sceneData.cascadeTexelSizes[i] = 2.0f * cascade.extent / RESOLUTION;
+    sceneData.cascadeViewProj[i] = cascade.viewProj;
+    sliceNear = sliceFar;
+  }
+  sceneData.cascadeCount = CASCADE_COUNT;
+}
+
+void ShadowCascades::addPasses(VkDeviceAddress sceneAddress) {
+  std::vector<uint32_t> rendered;
+  std::vector<uint32_t> composited;
+  bool anyDynamic = false;
+  for (uint32_t i = 0; i < CASCADE_COUNT; i++) {
+    if (cascadeWork[i].render) {
+      rendered.push_back(i);
+    }
+    if (cascadeWork[i].composite) {
+      composited.push_back(i);
+      anyDynamic |= !cascadeWork[i].dynamicCasters.empty();
+    }
+  }
+  // Each pass covers every cascade that needs it, so the barriers between them are paid once a frame rather than per
+  // cascade. The untouched layers just come along for the layout changes.
+  if (!rendered.empty()) {
+    RenderGraph::addPass("shadow cache", [=](VkCommandBuffer commandBuffer) {
+      for (uint32_t i : rendered) {
+        recordCasters(commandBuffer, cacheLayerViews[i], VK_ATTACHMENT_LOAD_OP_CLEAR, sceneAddress, cascadeWork[i].viewProj,
+                      cascadeWork[i].staticCasters);
+      }
+    }).write(cacheResource, RenderGraph::DEPTH_ATTACHMENT);
+  }
+  if (composited.empty()) {
+    return;
+  }
+  RenderGraph::addPass("shadow copy", [=](VkCommandBuffer commandBuffer) {
+    std::vector<VkImageCopy> regions;
+    for (uint32_t i : composited) {
+      const VkImageSubresourceLayers layer = {
+        .aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
+        .mipLevel = 0,
+        .baseArrayLayer = i,
+        .layerCount = 1,
+      };
+      regions.push_back({
+        .srcSubresource = layer,
+        .dstSubresource = layer,
+        .extent = {RESOLUTION, RESOLUTION, 1},
+      });
+    }
+    vkCmdCopyImage(commandBuffer, cacheImage.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, shadowImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                   static_cast<uint32_t>(regions.size()), regions.data());
+  }).read(cacheResource, RenderGraph::COPY_SOURCE)
+    .write(shadowResource, RenderGraph::COPY_DESTINATION);
+  if (!anyDynamic) {
+    return;
+  }
+  RenderGraph::addPass("shadow dynamic", [=](VkCommandBuffer commandBuffer) {
+    for (uint32_t i : composited) {
+      if (!cascadeWork[i].dynamicCasters.empty()) {
+        recordCasters(commandBuffer, shadowLayerViews[i], VK_ATTACHMENT_LOAD_OP_LOAD, sceneAddress, cascadeWork[i].viewProj,
+                      cascadeWork[i].dynamicCasters);
+      }
+    }
+  }).write(shadowResource, RenderGraph::DEPTH_ATTACHMENT);
+}
+
+RenderGraph::Image ShadowCascades::getShadowImage() { return shadowResource; }
+const ShadowCascades::Stats &ShadowCascades::getStats() { return stats; }
+
+bool &ShadowCascades::getEnabled() { return shadowsEnabled; }
+float &ShadowCascades::getShadowDistance() { return shadowDistance; }
+float &ShadowCascades::getSplitLambda() { return splitLambda; }
+float &ShadowCascades::getLightThreshold() { return lightThreshold; }
+float &ShadowCascades::getMargin() { return margin; }
+void ShadowCascades::invalidate() {
+  for (Cascade& cascade : cascades) {
+    cascade.valid = false;
+  }
+}
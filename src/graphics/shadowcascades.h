@@ -0,0 +1,55 @@
+#pragma once
+#include "volk.h"
+#include "rendergraph.h"
+#include "model.h"
+#include "../utils/types.h"
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+// Cascaded shadow maps for the sun. The view frustum up to the shadow distance is split into CASCADE_COUNT slices, each
+// covered by an orthographic shadow map along the sun's direction. Every cascade keeps a cache layer with only the
+// static casters in it, rendered with some margin around the slice, and that is only redrawn when the slice leaves the
+// margin, the sun turns past a threshold or the static casters inside it change. Dynamic models are drawn fresh every
+// frame into a copy of the cache, so a still scene costs nothing and a moving object only its own draws.
+class ShadowCascades {
+public:
+  // Matches common.glsl.
+  static constexpr uint32_t CASCADE_COUNT = 4;
+  static constexpr uint32_t RESOLUTION = 2048;
+
+  // Also picks the shadow map format, before create().
+  static void createPipeline();
+  // The cache and shadow map arrays, their bindless slot and the comparison sampler. After SamplerCache::init().
+  static void create();
+
+  // Works out where each cascade has to be for this camera and sun, and which of them need their cache redrawn or their
+  // dynamic casters composited. `sunDirection` points toward the sun. Fills the cascade fields of `sceneData`.
+  static void update(const glm::mat4& view, float fovY, float aspect, float nearPlane, float farPlane, glm::vec3 sunDirection,
+                     const std::vector<Model *>& models, Agnosia_T::SceneBuffer& sceneData);
+  // The passes redrawing and compositing what update() found changed, before the scene passes. None when nothing did.
+  static void addPasses(VkDeviceAddress sceneAddress);
+  // For the scene passes to declare their reads to the render graph.
+  static RenderGraph::Image getShadowImage();
+
+  // What the last update() asked for, for the UI.
+  struct Stats {
+    uint32_t cascadesRendered;
+    uint32_t cascadesComposited;
+    uint32_t staticCasters;
+    uint32_t dynamicCasters;
+  };
+  static const Stats &getStats();
+
+  static bool &getEnabled();
+  // How far from the camera shadows reach, capped by the far plane.
+  static float &getShadowDistance();
+  // Blend between uniform (0) and logarithmic (1) cascade splits.
+  static float &getSplitLambda();
+  // How many degrees the sun can turn before the cached cascades are redrawn.
+  static float &getLightThreshold();
+  // Extra coverage around each slice, as a fraction of its radius. The camera can move that far before a redraw.
+  static float &getMargin();
+  // Redraw every cascade next frame, for when its casters changed in a way update() can't see.
+  static void invalidate();
+};
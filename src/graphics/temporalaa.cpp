@@ -0,0 +1,232 @@
+#include "temporalaa.h"
+#include "buffers.h"
+#include "deferreddeletion.h"
+#include "pipelinebuilder.h"
+#include "texture.h"
+#include "../devicelibrary.h"
+#include "../utils/deletion.h"
+#include "../utils/helpers.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+  // Matches taa.comp.
+  struct TemporalPushConstants {
+    glm::vec2 jitter;
+    uint32_t renderSize[2];
+    uint32_t outputSize[2];
+    float blend;
+    uint32_t historyValid;
+  };
+}
+
+// Blending in 8 bits (and through sRGB) bands, the history keeps half floats.
+constexpr VkFormat HISTORY_FORMAT = VK_FORMAT_R16G16B16A16_SFLOAT;
+// Jitter positions per output pixel at native resolution, more when upscaling so each output pixel still gets them all.
+constexpr uint32_t BASE_JITTER_PHASES = 8;
+constexpr uint32_t MAX_JITTER_PHASES = 64;
+
+bool temporalEnabled = false;
+float temporalBlend = 0.1f;
+uint32_t jitterIndex = 0;
+
+VkSampler temporalSampler;
+VkDescriptorSetLayout temporalSetLayout;
+Agnosia_T::Pipeline temporalPipeline;
+
+// Multisampled along with the color image, then resolved like it is. Single sampled, it is read directly. Both are
+// render graph transients.
+RenderGraph::Image velocityImage;
+RenderGraph::Image velocityResolve;
+// Ping-ponged, one is last frame's result being read while the other is written.
+Texture::Image historyImages[2];
+RenderGraph::Image historyTargets[2];
+uint32_t historyIndex = 0;
+bool historyValid = false;
+
+static RenderGraph::Image createVelocity(VkSampleCountFlagBits samples, VkImageUsageFlags usage) {
+  return RenderGraph::createTransientImage({
+    .format = TemporalAA::VELOCITY_FORMAT,
+    .extent = DeviceControl::getSwapChainExtent(),
+    .samples = samples,
+    .usage = usage,
+    .aspect = VK_IMAGE_ASPECT_COLOR_BIT,
+  });
+}
+static Texture::Image createHistory() {
+  VkExtent2D extent = DeviceControl::getSwapChainExtent();
+  VkImageCreateInfo imageInfo{
+    .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+    .imageType = VK_IMAGE_TYPE_2D,
+    .format = HISTORY_FORMAT,
+    .extent = {extent.width, extent.height, 1},
+    .mipLevels = 1,
+    .arrayLayers = 1,
+    .samples = VK_SAMPLE_COUNT_1_BIT,
+    .tiling = VK_IMAGE_TILING_OPTIMAL,
+    .usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+    .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+  };
+  VmaAllocationCreateInfo vmaCreateInfo = {
+    .usage = VMA_MEMORY_USAGE_GPU_ONLY,
+  };
+  Texture::Image image;
+  VK_CHECK(vmaCreateImage(Buffers::getAllocator(), &imageInfo, &vmaCreateInfo, &image.image, &image.alloc, nullptr));
+  image.imageView = DeviceControl::createImageView(image.image, HISTORY_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+  return image;
+}
+// Low discrepancy, consecutive indices land far apart and any run of them covers the pixel evenly.
+static float halton(uint32_t index, uint32_t base) {
+  float result = 0.0f;
+  float fraction = 1.0f;
+  while (index > 0) {
+    fraction /= static_cast<float>(base);
+    result += fraction * static_cast<float>(index % base);
+    index /= base;
+  }
+  return result;
+}
+
+void TemporalAA::createPipeline() {
+  // Bilinear, the current frame is sampled between its texels and the history wherever the motion points.
+  VkSamplerCreateInfo samplerInfo{
+    .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+    .magFilter = VK_FILTER_LINEAR,
+    .minFilter = VK_FILTER_LINEAR,
+    .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+    .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+    .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+    .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+  };
+  VK_CHECK(vkCreateSampler(DeviceControl::getDevice(), &samplerInfo, nullptr, &temporalSampler));
+
+  // Everything it reads is recreated with the swapchain, and the histories swap every frame, so it's all pushed.
+  VkDescriptorSetLayoutBinding bindings[4];
+  for (uint32_t i = 0; i < 3; i++) {
+    bindings[i] = {
+      .binding = i,
+      .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+      .descriptorCount = 1,
+      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+      .pImmutableSamplers = &temporalSampler,
+    };
+  }
+  bindings[3] = {
+    .binding = 3,
+    .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+    .descriptorCount = 1,
+    .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+  };
+  VkDescriptorSetLayoutCreateInfo layoutInfo{
+    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+    .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT,
+    .bindingCount = 4,
+    .pBindings = bindings,
+  };
+  VK_CHECK(vkCreateDescriptorSetLayout(DeviceControl::getDevice(), &layoutInfo, nullptr, &temporalSetLayout));
+
+  temporalPipeline = PipelineBuilder()
+    .setComputeShader("src/shaders/taa.comp")
+    .setDescriptorSetLayouts({temporalSetLayout})
+    .setPushConstantSize(sizeof(TemporalPushConstants))
+    .BuildCompute();
+
+  DeletionQueue::get().push_function([=](){vkDestroyDescriptorSetLayout(DeviceControl::getDevice(), temporalSetLayout, nullptr);});
+  DeletionQueue::get().push_function([=](){vkDestroySampler(DeviceControl::getDevice(), temporalSampler, nullptr);});
+}
+
+void TemporalAA::create() {
+  const VkSampleCountFlagBits samples = DeviceControl::getPerPixelSampleCount();
+  if (samples != VK_SAMPLE_COUNT_1_BIT) {
+    velocityImage = createVelocity(samples, VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT);
+    velocityResolve = createVelocity(VK_SAMPLE_COUNT_1_BIT, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
+  } else {
+    velocityImage = createVelocity(samples, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
+    velocityResolve = {};
+  }
+  // Undefined until first written, the first resolve reads one anyway but ignores it with the history invalid.
+  for (uint32_t i = 0; i < 2; i++) {
+    historyImages[i] = createHistory();
+    historyTargets[i] = RenderGraph::importImage(historyImages[i].image, historyImages[i].imageView, VK_IMAGE_ASPECT_COLOR_BIT);
+  }
+  historyIndex = 0;
+  historyValid = false;
+}
+void TemporalAA::destroy() {
+  RenderGraph::destroyTransientImage(velocityImage);
+  if (velocityResolve.valid()) {
+    RenderGraph::destroyTransientImage(velocityResolve);
+    velocityResolve = {};
+  }
+  for (uint32_t i = 0; i < 2; i++) {
+    RenderGraph::releaseImage(historyTargets[i]);
+    DeferredDeletion::imageView(historyImages[i].imageView);
+    DeferredDeletion::image(historyImages[i].image, historyImages[i].alloc);
+    historyImages[i] = {};
+  }
+}
+
+glm::vec2 TemporalAA::nextJitter(VkExtent2D renderExtent) {
+  if (!temporalEnabled) {
+    return glm::vec2(0.0f);
+  }
+  const float upscale = static_cast<float>(DeviceControl::getSwapChainExtent().width) / static_cast<float>(renderExtent.width);
+  const uint32_t phases = std::clamp(static_cast<uint32_t>(std::ceil(BASE_JITTER_PHASES * upscale * upscale)), BASE_JITTER_PHASES, MAX_JITTER_PHASES);
+  // Index zero is the pixel's corner in both bases, the sequence starts at one.
+  jitterIndex = jitterIndex % phases + 1;
+  return glm::vec2(halton(jitterIndex, 2), halton(jitterIndex, 3)) - 0.5f;
+}
+RenderGraph::Image TemporalAA::getVelocityImage() { return velocityImage; }
+RenderGraph::Image TemporalAA::getVelocityResolveImage() {
+  return temporalEnabled ? velocityResolve : RenderGraph::Image{};
+}
+RenderGraph::Image TemporalAA::addResolvePass(RenderGraph::Image scene, VkExtent2D renderExtent, glm::vec2 jitter) {
+  const RenderGraph::Image previous = historyTargets[historyIndex ^ 1];
+  const RenderGraph::Image next = historyTargets[historyIndex];
+  const RenderGraph::Image velocity = velocityResolve.valid() ? velocityResolve : velocityImage;
+  const VkExtent2D outputExtent = DeviceControl::getSwapChainExtent();
+  const TemporalPushConstants pushConstants = {
+    .jitter = jitter,
+    .renderSize = {renderExtent.width, renderExtent.height},
+    .outputSize = {outputExtent.width, outputExtent.height},
+    .blend = temporalBlend,
+    .historyValid = historyValid ? 1u : 0u,
+  };
+
+  // The history being written is rewritten whole, what the blit two frames back read of it is discarded.
+  RenderGraph::addPass("temporal resolve", [=](VkCommandBuffer commandBuffer) {
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, temporalPipeline.pipeline);
+    const VkDescriptorImageInfo imageInfos[] = {
+      {.imageView = RenderGraph::getView(scene), .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL},
+      {.imageView = RenderGraph::getView(velocity), .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL},
+      {.imageView = RenderGraph::getView(previous), .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL},
+      {.imageView = RenderGraph::getView(next), .imageLayout = VK_IMAGE_LAYOUT_GENERAL},
+    };
+    VkWriteDescriptorSet writes[4];
+    for (uint32_t i = 0; i < 4; i++) {
+      writes[i] = {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstBinding = i,
+        .descriptorCount = 1,
+        .descriptorType = i < 3 ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER : VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+        .pImageInfo = &imageInfos[i],
+      };
+    }
+    vkCmdPushDescriptorSet(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, temporalPipeline.layout, 0, 4, writes);
+    vkCmdPushConstants(commandBuffer, temporalPipeline.layout, VK_SHADER_STAGE_ALL, 0, sizeof(TemporalPushConstants), &pushConstants);
+    vkCmdDispatch(commandBuffer, (outputExtent.width + 7) / 8, (outputExtent.height + 7) / 8, 1);
+  }).read(scene, RenderGraph::COMPUTE_SAMPLED)
+    .read(velocity, RenderGraph::COMPUTE_SAMPLED)
+    .read(previous, RenderGraph::COMPUTE_SAMPLED)
+    .overwrite(next, RenderGraph::COMPUTE_STORAGE);
+
+  historyIndex ^= 1;
+  historyValid = true;
+  return next;
+}
+void TemporalAA::resetHistory() { historyValid = false; }
+
+bool &TemporalAA::getEnabled() { return temporalEnabled; }
+float &TemporalAA::getBlend() { return temporalBlend; }
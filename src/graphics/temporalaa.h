@@ -0,0 +1,42 @@
+#pragma once
+#include "volk.h"
+#include "rendergraph.h"
+#include <cstdint>
+#include <glm/glm.hpp>
+
+// Temporal anti-aliasing and upscaling. Every frame the projection is nudged by a sub-pixel jitter, so over a few
+// frames each screen pixel gets covered by samples from all over its area. The scene pass writes motion vectors next to
+// color, and the resolve (taa.comp) follows them back into a swapchain sized history, clamps that to what the current
+// frame's neighbourhood allows (so disocclusions don't ghost) and blends the new frame in. The history keeps full
+// resolution even when the dynamic resolution renders a fraction of it, which is what lets the scene get away with a
+// single sample and fewer pixels.
+class TemporalAA {
+public:
+  // Screen space motion since last frame, in uv units.
+  static constexpr VkFormat VELOCITY_FORMAT = VK_FORMAT_R16G16_SFLOAT;
+
+  static void createPipeline();
+  // Swapchain sized, recreated with the other render targets. Starts over with an empty history.
+  static void create();
+  // Like HiZPyramid::destroy(), deferred until the frames in flight are done.
+  static void destroy();
+
+  // This frame's offset in render pixels (each axis within half a pixel of the center), zero when off. Cycles
+  // through more positions the further the render extent is below the swapchain, each output pixel needs as many.
+  static glm::vec2 nextJitter(VkExtent2D renderExtent);
+  // The scene pass's second color attachment, a render graph transient. Every scene pipeline writes it, so it's bound
+  // even while off (a null view would need VK_EXT_dynamic_rendering_unused_attachments), the pass just doesn't keep or
+  // resolve it then.
+  static RenderGraph::Image getVelocityImage();
+  // What the multisampled velocity resolves into, invalid when it is single sampled already or when off.
+  static RenderGraph::Image getVelocityResolveImage();
+  // The pass resolving the renderExtent corner of the scene image into the next history, after the scene pass.
+  // Returns that history, swapchain sized, for the blit to the swapchain.
+  static RenderGraph::Image addResolvePass(RenderGraph::Image scene, VkExtent2D renderExtent, glm::vec2 jitter);
+  // The next resolve takes the current frame as is, for when the history no longer matches what is on screen.
+  static void resetHistory();
+
+  static bool &getEnabled();
+  // How much of the current frame goes into the history, lower is smoother but slower to catch up.
+  static float &getBlend();
+};
@@ -1,64 +1,56 @@
 #include "../devicelibrary.h"
 #include "buffers.h"
+#include "deferreddeletion.h"
 #include "texture.h"
+#include "texturestreamer.h"
+#include "downsampler.h"
 #include "../utils/deletion.h"
+#include "../utils/helpers.h"
 
+#include <algorithm>
+#include <cmath>
 #include <cstdio>
+#include <filesystem>
 #include <stdexcept>
 #include <string>
+#include <vector>
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb/stb_image.h>
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb/stb_image_write.h>
 
 VkDeviceMemory textureImageMemory;
 VkPipelineStageFlags sourceStage;
 VkPipelineStageFlags destinationStage;
 
-Texture::Image colorImage;
-Texture::Image depthImage;
-
-VkCommandBuffer beginSingleTimeCommands() {
-  // This is a neat function! This sets up a command buffer using our previously
-  // set command pool to return a command buffer to execute commands!
-  VkCommandBufferAllocateInfo allocInfo = {
-    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-    .commandPool = Buffers::getCommandPool(),
-    .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-    .commandBufferCount = 1,
-  };
-  
-  VkCommandBuffer commandBuffer;
-  vkAllocateCommandBuffers(DeviceControl::getDevice(), &allocInfo, &commandBuffer);
-
-  VkCommandBufferBeginInfo beginInfo = {
-    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-    .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
-  };
-  vkBeginCommandBuffer(commandBuffer, &beginInfo);
-
-  return commandBuffer;
-}
-void endSingleTimeCommands(VkCommandBuffer commandBuffer) {
-  // This function takes a command buffer with the data we wish to execute and
-  // submits it to the graphics queue. Afterwards, it purges the command buffer.
-  vkEndCommandBuffer(commandBuffer);
-
-  VkSubmitInfo submitInfo = {
-  .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-  .commandBufferCount = 1,
-  .pCommandBuffers = &commandBuffer,
-  };
-  vkQueueSubmit(DeviceControl::getGraphicsQueue(), 1, &submitInfo,
-                VK_NULL_HANDLE);
-  vkQueueWaitIdle(DeviceControl::getGraphicsQueue());
-
-  vkFreeCommandBuffers(DeviceControl::getDevice(), Buffers::getCommandPool(), 1, &commandBuffer);
+RenderGraph::Image colorImage;
+RenderGraph::Image depthImage;
+RenderGraph::Image sceneImage;
+
+// Commands of the textures created between Texture::beginUploads() and submitUploads(), and what has to outlive them.
+struct UploadBatch {
+  VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+  std::vector<Agnosia_T::AllocatedBuffer> stagingBuffers;
+  std::vector<Downsampler::Target> targets;
+};
+UploadBatch uploadBatch;
+
+// Record into the open batch, or submit on its own when there is none.
+static void recordUpload(const std::function<void(VkCommandBuffer)>& record) {
+  bool batched = uploadBatch.commandBuffer != VK_NULL_HANDLE;
+  if (!batched) {
+    Texture::beginUploads();
+  }
+  record(uploadBatch.commandBuffer);
+  if (!batched) {
+    Texture::submitUploads();
+  }
 }
 
-void transitionImageLayout(VkImage image, VkFormat format,
+void transitionImageLayout(VkCommandBuffer commandBuffer, VkImage image, VkFormat format,
                            VkImageLayout oldLayout, VkImageLayout newLayout,
-                           uint32_t mipLevels) {
+                           uint32_t mipLevels, uint32_t layer = 0) {
   // This function handles transitioning image layout data from one layout to another.
-  VkCommandBuffer commandBuffer = beginSingleTimeCommands();
 
   VkImageMemoryBarrier barrier{};
   barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -71,7 +63,7 @@ void transitionImageLayout(VkImage image, VkFormat format,
   barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
   barrier.subresourceRange.baseMipLevel = 0;
   barrier.subresourceRange.levelCount = mipLevels;
-  barrier.subresourceRange.baseArrayLayer = 0;
+  barrier.subresourceRange.baseArrayLayer = layer;
   barrier.subresourceRange.layerCount = 1;
 
   if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED &&
@@ -94,14 +86,11 @@ void transitionImageLayout(VkImage image, VkFormat format,
 
   vkCmdPipelineBarrier(commandBuffer, sourceStage, destinationStage, 0, 0,
                        nullptr, 0, nullptr, 1, &barrier);
-
-  endSingleTimeCommands(commandBuffer);
 }
-void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width,
-                       uint32_t height) {
+void copyBufferToImage(VkCommandBuffer commandBuffer, VkBuffer buffer, VkImage image, uint32_t width,
+                       uint32_t height, uint32_t layer = 0) {
   // This handles copying from the buffer to the image, specifically what
   // *parts* to copy to the image.
-  VkCommandBuffer commandBuffer = beginSingleTimeCommands();
 
   VkBufferImageCopy region{};
   region.bufferOffset = 0;
@@ -110,7 +99,7 @@ void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width,
 
   region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
   region.imageSubresource.mipLevel = 0;
-  region.imageSubresource.baseArrayLayer = 0;
+  region.imageSubresource.baseArrayLayer = layer;
   region.imageSubresource.layerCount = 1;
 
   region.imageOffset = {0, 0, 0};
@@ -118,108 +107,143 @@ void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width,
 
   vkCmdCopyBufferToImage(commandBuffer, buffer, image,
                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-
-  endSingleTimeCommands(commandBuffer);
 }
 
 bool hasStencilComponent(VkFormat format) {
   return format == VK_FORMAT_D32_SFLOAT_S8_UINT ||
          format == VK_FORMAT_D24_UNORM_S8_UINT;
 }
-void generateMipmaps(VkImage image, VkFormat imageFormat, int32_t textureWidth,
-                     int32_t textureHeight, uint32_t mipLevels) {
-  // Check if image format supports linear blitting
-  VkFormatProperties formatProperties;
-  vkGetPhysicalDeviceFormatProperties(DeviceControl::getPhysicalDevice(), imageFormat, &formatProperties);
-
-  if (!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)) {
-    throw std::runtime_error("texture image format does not support linear blitting!");
+void generateMipmaps(VkCommandBuffer commandBuffer, VkImage image, VkFormat imageFormat, int32_t textureWidth,
+                     int32_t textureHeight, uint32_t mipLevels, uint32_t layer = 0) {
+  // Level 0 was just copied in, hand it over to the downsampler (or straight to the shaders) for reading.
+  const VkImageMemoryBarrier2 sourceBarrier{
+    .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+    .srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT,
+    .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+    .dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+    .dstAccessMask = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+    .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+    .newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+    .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .image = image,
+    .subresourceRange = {
+      .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+      .baseMipLevel = 0,
+      .levelCount = 1,
+      .baseArrayLayer = layer,
+      .layerCount = 1,
+    },
+  };
+  const VkDependencyInfo dependencyInfo{
+    .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+    .imageMemoryBarrierCount = 1,
+    .pImageMemoryBarriers = &sourceBarrier,
+  };
+  vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+  if (mipLevels <= 1) {
+    return;
   }
+  // Every level past the first comes out of one compute dispatch, filtered in linear space even for sRGB data.
+  Downsampler::Target target = Downsampler::createTarget(image, imageFormat,
+    {static_cast<uint32_t>(textureWidth), static_cast<uint32_t>(textureHeight)}, mipLevels, layer);
+  Downsampler::record(commandBuffer, target);
+  uploadBatch.targets.push_back(std::move(target));
+}
 
-  VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-  // Specify the parameters of an image memory barrier
-  VkImageMemoryBarrier barrier{};
-  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-  barrier.image = image;
-  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-  barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-  barrier.subresourceRange.baseArrayLayer = 0;
-  barrier.subresourceRange.layerCount = 1;
-  barrier.subresourceRange.levelCount = 1;
-
-  int32_t mipWidth = textureWidth;
-  int32_t mipHeight = textureHeight;
-
-  for (uint32_t mip = 1; mip < mipLevels; mip++) {
-    barrier.subresourceRange.baseMipLevel = mip - 1;
-    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-
-    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
-                         nullptr, 1, &barrier);
-
-    VkImageBlit blit{};
-    blit.srcOffsets[0] = {0, 0, 0};
-    blit.srcOffsets[1] = {mipWidth, mipHeight, 1};
-    blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    blit.srcSubresource.mipLevel = mip - 1;
-    blit.srcSubresource.baseArrayLayer = 0;
-    blit.srcSubresource.layerCount = 1;
-    blit.dstOffsets[0] = {0, 0, 0};
-    blit.dstOffsets[1] = {mipWidth > 1 ? mipWidth / 2 : 1,
-                          mipHeight > 1 ? mipHeight / 2 : 1, 1};
-    blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    blit.dstSubresource.mipLevel = mip;
-    blit.dstSubresource.baseArrayLayer = 0;
-    blit.dstSubresource.layerCount = 1;
-
-    vkCmdBlitImage(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                   image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit,
-                   VK_FILTER_LINEAR);
-
-    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr,
-                         0, nullptr, 1, &barrier);
-
-    if (mipWidth > 1)
-      mipWidth /= 2;
-    if (mipHeight > 1)
-      mipHeight /= 2;
+Texture::DecodedImage Texture::decode(const std::vector<unsigned char>& fileData, const std::string& texturePath) {
+  // Decode from the file bytes already in memory, the cache has read them to hash the file anyway.
+  int textureWidth, textureHeight, textureChannels;
+  stbi_uc *pixels = stbi_load_from_memory(fileData.data(), static_cast<int>(fileData.size()), &textureWidth, &textureHeight, &textureChannels, STBI_rgb_alpha);
+  if (!pixels) {
+    throw std::runtime_error("Failed to load texture: " + texturePath);
   }
-  barrier.subresourceRange.baseMipLevel = mipLevels - 1;
-  barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-  barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  DecodedImage decoded = {
+    .pixels = std::vector<unsigned char>(pixels, pixels + static_cast<size_t>(textureWidth) * textureHeight * 4),
+    .width = textureWidth,
+    .height = textureHeight,
+  };
+  stbi_image_free(pixels);
+  return decoded;
+}
 
-  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                       VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0,
-                       nullptr, 1, &barrier);
+// Build every mip level on the CPU with a 2x2 box filter, averaging sRGB data in linear space.
+std::vector<std::vector<unsigned char>> buildMipChain(const Texture::DecodedImage& decoded, uint32_t mipLevels, bool srgb) {
+  float toLinear[256];
+  for (int i = 0; i < 256; i++) {
+    float c = i / 255.0f;
+    toLinear[i] = srgb ? (c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f)) : c;
+  }
+  auto fromLinear = [srgb](float c) {
+    c = srgb ? (c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f) : c;
+    return static_cast<unsigned char>(std::clamp(c, 0.0f, 1.0f) * 255.0f + 0.5f);
+  };
 
-  endSingleTimeCommands(commandBuffer);
+  std::vector<std::vector<unsigned char>> chain(mipLevels);
+  chain[0] = decoded.pixels;
+  int srcWidth = decoded.width;
+  int srcHeight = decoded.height;
+  for (uint32_t level = 1; level < mipLevels; level++) {
+    int dstWidth = std::max(srcWidth / 2, 1);
+    int dstHeight = std::max(srcHeight / 2, 1);
+    const std::vector<unsigned char>& src = chain[level - 1];
+    std::vector<unsigned char>& dst = chain[level];
+    dst.resize(static_cast<size_t>(dstWidth) * dstHeight * 4);
+
+    for (int y = 0; y < dstHeight; y++) {
+      int y0 = std::min(y * 2, srcHeight - 1);
+      int y1 = std::min(y * 2 + 1, srcHeight - 1);
+      for (int x = 0; x < dstWidth; x++) {
+        int x0 = std::min(x * 2, srcWidth - 1);
+        int x1 = std::min(x * 2 + 1, srcWidth - 1);
+        const unsigned char *texels[4] = {
+          &src[(static_cast<size_t>(y0) * srcWidth + x0) * 4], &src[(static_cast<size_t>(y0) * srcWidth + x1) * 4],
+          &src[(static_cast<size_t>(y1) * srcWidth + x0) * 4], &src[(static_cast<size_t>(y1) * srcWidth + x1) * 4],
+        };
+        unsigned char *out = &dst[(static_cast<size_t>(y) * dstWidth + x) * 4];
+        for (int c = 0; c < 3; c++) {
+          out[c] = fromLinear((toLinear[texels[0][c]] + toLinear[texels[1][c]] + toLinear[texels[2][c]] + toLinear[texels[3][c]]) * 0.25f);
+        }
+        // Alpha is always linear.
+        out[3] = static_cast<unsigned char>((texels[0][3] + texels[1][3] + texels[2][3] + texels[3][3] + 2) / 4);
+      }
+    }
+    srcWidth = dstWidth;
+    srcHeight = dstHeight;
+  }
+  return chain;
 }
 
-Texture::Texture(const std::string& ID, const std::string& texturePath) {
-  int textureWidth, textureHeight, textureChannels;
-  stbi_uc *pixels = stbi_load(texturePath.c_str(), &textureWidth, &textureHeight, &textureChannels, STBI_rgb_alpha);
+Texture::Texture(const std::string& ID, const DecodedImage& decoded, VkFormat format, bool streaming)
+  : format(format), width(decoded.width), height(decoded.height), streaming(streaming), residentMip(0), pooled{nullptr, 0}, slot(UINT32_MAX) {
+  int textureWidth = decoded.width;
+  int textureHeight = decoded.height;
 
   this->mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(textureWidth, textureHeight)))) + 1;
 
-  VkDeviceSize imageSize = textureWidth * textureHeight * 4;
-
-  if (!pixels) {
-    throw std::runtime_error("Failed to load texture!");
+  if (streaming) {
+    // Only upload the smallest mips, the TextureStreamer brings in finer ones once something asks for them.
+    this->mipChain = buildMipChain(decoded, this->mipLevels, format == VK_FORMAT_R8G8B8A8_SRGB);
+    uint32_t firstMip = TextureStreamer::getMinimumResidentMip(this);
+    // Nothing is on the GPU yet, so every level comes from the CPU.
+    this->image = VK_NULL_HANDLE;
+    this->residentMip = this->mipLevels;
+    Agnosia_T::AllocatedBuffer staging = {};
+    Agnosia_T::AllocatedBuffer readback = {};
+    Image resident;
+    recordUpload([&](VkCommandBuffer commandBuffer) {
+      resident = createResidentImage(commandBuffer, firstMip, staging, readback);
+      uploadBatch.stagingBuffers.push_back(staging);
+    });
+    // Only bookkeeping, the staging buffer already holds everything it drops from the CPU.
+    swapResidentImage(resident, firstMip, readback);
+    this->slot = Buffers::allocateTextureSlot(this->imageView);
+    TextureStreamer::registerTexture(this);
+    return;
   }
+
+  VkDeviceSize imageSize = decoded.pixels.size();
+
   Agnosia_T::AllocatedBuffer stagingBuffer = Buffers::createBuffer(imageSize,
     VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT,
     VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
@@ -228,113 +252,465 @@ Texture::Texture(const std::string& ID, const std::string& texturePath) {
   void *data;
     
   vmaMapMemory(Buffers::getAllocator(), stagingBuffer.allocation, &data);
-  memcpy(data, pixels, static_cast<size_t>(imageSize));
+  memcpy(data, decoded.pixels.data(), static_cast<size_t>(imageSize));
   vmaUnmapMemory(Buffers::getAllocator(), stagingBuffer.allocation);
-    
-  stbi_image_free(pixels);
   
+  if (TextureArrayPool::accepts(this->width, this->height)) {
+    // Small enough to share an image, upload into our own layer of a page.
+    this->pooled = TextureArrayPool::allocate(this->width, this->height, this->format, this->mipLevels);
+    this->image = this->pooled.page->image;
+    this->imageView = this->pooled.page->imageView;
+    this->alloc = this->pooled.page->alloc;
+  } else {
+    VkImageCreateInfo imageInfo{};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.extent.width = textureWidth;
+    imageInfo.extent.height = textureHeight;
+    imageInfo.extent.depth = 1;
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.format = this->format;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.mipLevels = mipLevels;
+    // Mips are written by the downsampler.
+    Downsampler::addTargetUsage(imageInfo);
+
+    VmaAllocationCreateInfo vmaCreateInfo = {
+      .usage = VMA_MEMORY_USAGE_GPU_ONLY,
+    };
+    VmaAllocationInfo allocInfo;
+    
+    vmaCreateImage(Buffers::getAllocator(), &imageInfo, &vmaCreateInfo, &this->image, &this->alloc, &allocInfo);
+    // Create a texture image view, which is a struct of information about the image.
+    this->imageView = createArrayView(this->image, this->format, this->mipLevels, 1);
+    this->slot = Buffers::allocateTextureSlot(this->imageView);
+  }
+  uint32_t layer = this->pooled.layer;
+
+  recordUpload([&](VkCommandBuffer commandBuffer) {
+    transitionImageLayout(commandBuffer, this->image, this->format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, this->mipLevels, layer);
+    copyBufferToImage(commandBuffer, stagingBuffer.buffer, this->image, static_cast<uint32_t>(textureWidth), static_cast<uint32_t>(textureHeight), layer);
+    generateMipmaps(commandBuffer, this->image, this->format, textureWidth, textureHeight, this->mipLevels, layer);
+    uploadBatch.stagingBuffers.push_back(stagingBuffer);
+  });
+}
+void Texture::beginUploads() {
+  VkCommandBufferAllocateInfo allocInfo = {
+    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+    .commandPool = Buffers::getCommandPool(),
+    .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+    .commandBufferCount = 1,
+  };
+  VK_CHECK(vkAllocateCommandBuffers(DeviceControl::getDevice(), &allocInfo, &uploadBatch.commandBuffer));
+  VkCommandBufferBeginInfo beginInfo = {
+    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+    .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+  };
+  VK_CHECK(vkBeginCommandBuffer(uploadBatch.commandBuffer, &beginInfo));
+}
+void Texture::submitUploads() {
+  VK_CHECK(vkEndCommandBuffer(uploadBatch.commandBuffer));
+  VkSubmitInfo submitInfo = {
+    .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+    .commandBufferCount = 1,
+    .pCommandBuffers = &uploadBatch.commandBuffer,
+  };
+  VK_CHECK(vkQueueSubmit(DeviceControl::getGraphicsQueue(), 1, &submitInfo, VK_NULL_HANDLE));
+  VK_CHECK(vkQueueWaitIdle(DeviceControl::getGraphicsQueue()));
+  vkFreeCommandBuffers(DeviceControl::getDevice(), Buffers::getCommandPool(), 1, &uploadBatch.commandBuffer);
+
+  for (Agnosia_T::AllocatedBuffer& staging : uploadBatch.stagingBuffers) {
+    vmaDestroyBuffer(Buffers::getAllocator(), staging.buffer, staging.allocation);
+  }
+  for (Downsampler::Target& target : uploadBatch.targets) {
+    Downsampler::destroyTarget(target);
+  }
+  uploadBatch = {};
+}
+VkImageView Texture::createArrayView(VkImage image, VkFormat format, uint32_t mipLevels, uint32_t layerCount) {
+  // Images that the downsampler writes have STORAGE usage, which sRGB formats can't support, so the view only samples.
+  VkImageViewUsageCreateInfo usageInfo = {
+    .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_USAGE_CREATE_INFO,
+    .usage = VK_IMAGE_USAGE_SAMPLED_BIT,
+  };
+  VkImageViewCreateInfo viewInfo = {
+    .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+    .pNext = &usageInfo,
+    .image = image,
+    .viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY,
+    .format = format,
+    .subresourceRange = {
+      .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+      .baseMipLevel = 0,
+      .levelCount = mipLevels,
+      .baseArrayLayer = 0,
+      .layerCount = layerCount,
+    },
+  };
+  VkImageView imageView;
+  VK_CHECK(vkCreateImageView(DeviceControl::getDevice(), &viewInfo, nullptr, &imageView));
+  return imageView;
+}
+Texture::Image Texture::createResidentImage(VkCommandBuffer commandBuffer, uint32_t firstMip, Agnosia_T::AllocatedBuffer& staging,
+                                            Agnosia_T::AllocatedBuffer& readback) {
+  uint32_t levels = this->mipLevels - firstMip;
+  // Levels from residentMip down are already on the GPU and their CPU copies are gone, everything finer comes from the CPU.
+  uint32_t gpuMip = std::max(firstMip, this->residentMip);
+  auto extent = [&](uint32_t level) {
+    return VkExtent3D{std::max(this->width >> level, 1u), std::max(this->height >> level, 1u), 1};
+  };
+  auto subresource = [](uint32_t level) {
+    return VkImageSubresourceLayers{VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1};
+  };
+
+  // Pack the levels only the CPU has into the staging buffer back to back, one copy region per level.
+  std::vector<VkBufferImageCopy> uploads;
+  VkDeviceSize uploadSize = getResidentSize(firstMip) - getResidentSize(gpuMip);
+  if (uploadSize > 0) {
+    staging = Buffers::createBuffer(uploadSize,
+      VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT,
+      VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+      VMA_MEMORY_USAGE_AUTO);
+  }
+  VkDeviceSize offset = 0;
+  for (uint32_t level = firstMip; level < gpuMip; level++) {
+    memcpy(static_cast<char *>(staging.info.pMappedData) + offset, this->mipChain[level].data(), this->mipChain[level].size());
+    uploads.push_back({
+      .bufferOffset = offset,
+      .imageSubresource = subresource(level - firstMip),
+      .imageExtent = extent(level),
+    });
+    offset += this->mipChain[level].size();
+  }
+
+  // Levels being evicted have no CPU copy left either, read them back so they can be streamed in again later.
+  std::vector<VkBufferImageCopy> readbacks;
+  VkDeviceSize readbackSize = getResidentSize(this->residentMip) - getResidentSize(gpuMip);
+  if (readbackSize > 0) {
+    readback = Buffers::createBuffer(readbackSize,
+      VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT,
+      VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VMA_MEMORY_USAGE_AUTO);
+  }
+  offset = 0;
+  for (uint32_t level = this->residentMip; level < gpuMip; level++) {
+    readbacks.push_back({
+      .bufferOffset = offset,
+      .imageSubresource = subresource(level - this->residentMip),
+      .imageExtent = extent(level),
+    });
+    offset += static_cast<VkDeviceSize>(extent(level).width) * extent(level).height * 4;
+  }
+
+  // The rest is copied straight across from the current image.
+  std::vector<VkImageCopy> copies;
+  bool hasPrevious = this->image != VK_NULL_HANDLE;
+  for (uint32_t level = gpuMip; hasPrevious && level < this->mipLevels; level++) {
+    copies.push_back({
+      .srcSubresource = subresource(level - this->residentMip),
+      .dstSubresource = subresource(level - firstMip),
+      .extent = extent(level),
+    });
+  }
+
   VkImageCreateInfo imageInfo{};
   imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
   imageInfo.imageType = VK_IMAGE_TYPE_2D;
-  imageInfo.extent.width = textureWidth;
-  imageInfo.extent.height = textureHeight;
+  imageInfo.extent.width = std::max(this->width >> firstMip, 1u);
+  imageInfo.extent.height = std::max(this->height >> firstMip, 1u);
   imageInfo.extent.depth = 1;
-  imageInfo.mipLevels = 1;
+  imageInfo.mipLevels = levels;
   imageInfo.arrayLayers = 1;
-  imageInfo.format = VK_FORMAT_R8G8B8A8_SRGB;
+  imageInfo.format = this->format;
   imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
   imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  // The next image built from this one copies out of it.
   imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
   imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
   imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-  imageInfo.mipLevels = mipLevels;
 
   VmaAllocationCreateInfo vmaCreateInfo = {
     .usage = VMA_MEMORY_USAGE_GPU_ONLY,
   };
-  VmaAllocation alloc;
-  VmaAllocationInfo allocInfo;
-  
-  vmaCreateImage(Buffers::getAllocator(), &imageInfo, &vmaCreateInfo, &this->image, &alloc, &allocInfo);
+  Image resident;
+  VK_CHECK(vmaCreateImage(Buffers::getAllocator(), &imageInfo, &vmaCreateInfo, &resident.image, &resident.alloc, nullptr));
+
+  VkImageMemoryBarrier barriers[2] = {};
+  barriers[0].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barriers[0].srcAccessMask = 0;
+  barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barriers[0].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  barriers[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barriers[0].image = resident.image;
+  barriers[0].subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, levels, 0, 1};
+  // Frames submitted before us may still be sampling the current image, the copies only wait for them to finish.
+  barriers[1].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barriers[1].srcAccessMask = 0;
+  barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  barriers[1].oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  barriers[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  barriers[1].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barriers[1].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barriers[1].image = this->image;
+  barriers[1].subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, this->mipLevels - this->residentMip, 0, 1};
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       0, 0, nullptr, 0, nullptr, hasPrevious ? 2 : 1, barriers);
+
+  if (!uploads.empty()) {
+    vkCmdCopyBufferToImage(commandBuffer, staging.buffer, resident.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(uploads.size()), uploads.data());
+  }
+  if (!copies.empty()) {
+    vkCmdCopyImage(commandBuffer, this->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, resident.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                   static_cast<uint32_t>(copies.size()), copies.data());
+  }
+  if (!readbacks.empty()) {
+    vkCmdCopyImageToBuffer(commandBuffer, this->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readback.buffer, static_cast<uint32_t>(readbacks.size()), readbacks.data());
+    VkBufferMemoryBarrier hostBarrier = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+      .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+      .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .buffer = readback.buffer,
+      .offset = 0,
+      .size = VK_WHOLE_SIZE,
+    };
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &hostBarrier, 0, nullptr);
+  }
 
-  transitionImageLayout(this->image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, this->mipLevels);
-  copyBufferToImage(stagingBuffer.buffer, this->image, static_cast<uint32_t>(textureWidth), static_cast<uint32_t>(textureHeight));
+  barriers[0].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  barriers[0].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barriers[0].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  // Frames submitted after us keep sampling the current image until commit() swaps it.
+  barriers[1].srcAccessMask = 0;
+  barriers[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  barriers[1].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  barriers[1].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       0, 0, nullptr, 0, nullptr, hasPrevious ? 2 : 1, barriers);
+
+  resident.imageView = createArrayView(resident.image, this->format, levels, 1);
+  return resident;
+}
+Texture::Image Texture::swapResidentImage(const Image& resident, uint32_t firstMip, const Agnosia_T::AllocatedBuffer& readback) {
+  // Take back the levels that were evicted, and let go of the CPU copies of everything that is now on the GPU.
+  if (readback.buffer != VK_NULL_HANDLE) {
+    vmaInvalidateAllocation(Buffers::getAllocator(), readback.allocation, 0, VK_WHOLE_SIZE);
+    const unsigned char *data = static_cast<const unsigned char *>(readback.info.pMappedData);
+    for (uint32_t level = this->residentMip; level < firstMip; level++) {
+      VkDeviceSize size = getResidentSize(level) - getResidentSize(level + 1);
+      this->mipChain[level].assign(data, data + size);
+      data += size;
+    }
+  }
+  for (uint32_t level = firstMip; level < this->mipLevels; level++) {
+    std::vector<unsigned char>().swap(this->mipChain[level]);
+  }
 
-  vmaDestroyBuffer(Buffers::getAllocator(), stagingBuffer.buffer, stagingBuffer.allocation);
+  Image previous = {this->image, this->imageView, this->alloc};
+  this->image = resident.image;
+  this->imageView = resident.imageView;
+  this->alloc = resident.alloc;
+  this->residentMip = firstMip;
+  // Frames in flight may still read the old slot, so the new view gets a fresh one and the old slot is retired like
+  // any other. Materials pointing at this texture have to pick the new slot up, see Material::markDirty().
+  if (this->slot != UINT32_MAX) {
+    Buffers::freeTextureSlot(this->slot);
+    this->slot = Buffers::allocateTextureSlot(this->imageView);
+  }
+  return previous;
+}
+VkDeviceSize Texture::getResidentSize(uint32_t firstMip) {
+  VkDeviceSize size = 0;
+  for (uint32_t level = firstMip; level < this->mipLevels; level++) {
+    size += static_cast<VkDeviceSize>(std::max(this->width >> level, 1u)) * std::max(this->height >> level, 1u) * 4;
+  }
+  return size;
+}
 
-  generateMipmaps(this->image, VK_FORMAT_R8G8B8A8_SRGB, textureWidth, textureHeight, this->mipLevels);
-  // Create a texture image view, which is a struct of information about the image.
-  this->imageView = DeviceControl::createImageView(this->image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels);
+void Texture::destroy() {
+  // Textures are shared between cache entries, so the AssetCache owns their lifetime rather than the DeletionQueue.
+  // The image itself goes through DeferredDeletion, frames in flight may still sample it.
+  if (this->streaming) {
+    TextureStreamer::unregisterTexture(this);
+  }
+  if (this->pooled.page) {
+    TextureArrayPool::release(this->pooled);
+    this->pooled = {nullptr, 0};
+    this->slot = UINT32_MAX;
+    this->imageView = VK_NULL_HANDLE;
+    this->image = VK_NULL_HANDLE;
+    return;
+  }
+  Buffers::freeTextureSlot(this->slot);
+  this->slot = UINT32_MAX;
+  DeferredDeletion::imageView(this->imageView);
+  DeferredDeletion::image(this->image, this->alloc);
+  this->imageView = VK_NULL_HANDLE;
+  this->image = VK_NULL_HANDLE;
+}
 
-  VkImage image = this->image;
-  VkImageView imageView = this->imageView;
-  
-  DeletionQueue::get().push_function([=](){vmaDestroyImage(Buffers::getAllocator(), image, alloc);});
-  DeletionQueue::get().push_function([=](){vkDestroyImageView(DeviceControl::getDevice(), imageView, nullptr);});
-  
+// Sample a single channel image with bilinear filtering, so maps of differing resolutions can be packed together.
+float sampleChannel(const stbi_uc *pixels, int width, int height, float u, float v) {
+  float x = std::clamp(u * width - 0.5f, 0.0f, static_cast<float>(width - 1));
+  float y = std::clamp(v * height - 0.5f, 0.0f, static_cast<float>(height - 1));
+  int x0 = static_cast<int>(x);
+  int y0 = static_cast<int>(y);
+  int x1 = std::min(x0 + 1, width - 1);
+  int y1 = std::min(y0 + 1, height - 1);
+  float fx = x - x0;
+  float fy = y - y0;
+
+  float top = pixels[y0 * width + x0] * (1.0f - fx) + pixels[y0 * width + x1] * fx;
+  float bottom = pixels[y1 * width + x0] * (1.0f - fx) + pixels[y1 * width + x1] * fx;
+  return top * (1.0f - fy) + bottom * fy;
 }
 
-void Texture::createColorImage() {
-  VkImageCreateInfo imageInfo{};
-  imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-  imageInfo.imageType = VK_IMAGE_TYPE_2D;
-  imageInfo.extent.width = DeviceControl::getSwapChainExtent().width;
-  imageInfo.extent.height = DeviceControl::getSwapChainExtent().height;
-  imageInfo.extent.depth = 1;
-  imageInfo.mipLevels = 1;
-  imageInfo.arrayLayers = 1;
-  imageInfo.format = DeviceControl::getImageFormat();
-  imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
-  imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-  imageInfo.usage = VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
-  imageInfo.samples = DeviceControl::getPerPixelSampleCount();
-  imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-  imageInfo.mipLevels = 1;
+std::string Texture::packORM(const std::string& ID, const std::string& aoPath, const std::string& roughnessPath, const std::string& metallicPath) {
+  // Packed maps live next to the other assets, so they are reused between runs and only rebuilt when a source changes.
+  // The name carries a hash of which sources went in, so pointing the ID elsewhere or adding a missing map repacks.
+  const std::string sources[3] = {aoPath, roughnessPath, metallicPath};
+  uint64_t sourcesHash = hashBytes(nullptr, 0);
+  for (const std::string& source : sources) {
+    std::error_code existsError;
+    const uint64_t present = std::filesystem::exists(source, existsError) ? 1 : 0;
+    const uint64_t length = source.size();
+    sourcesHash = hashBytes(&length, sizeof(length), sourcesHash);
+    sourcesHash = hashBytes(source.data(), source.size(), sourcesHash);
+    sourcesHash = hashBytes(&present, sizeof(present), sourcesHash);
+  }
+  char hashName[17];
+  snprintf(hashName, sizeof(hashName), "%016llx", static_cast<unsigned long long>(sourcesHash));
+  std::filesystem::path cachePath = std::filesystem::path("assets/cache") / (ID + "_" + hashName + "_orm.png");
+
+  // A source that can't be read can't be newer than the cache either, and a missing cache just gets packed.
+  std::error_code error;
+  auto cacheTime = std::filesystem::last_write_time(cachePath, error);
+  if (!error) {
+    bool stale = false;
+    for (const std::string& source : sources) {
+      auto sourceTime = std::filesystem::last_write_time(source, error);
+      stale |= !error && sourceTime > cacheTime;
+    }
+    if (!stale) {
+      return cachePath.string();
+    }
+  }
 
-  VmaAllocationCreateInfo vmaCreateInfo = {
-    .usage = VMA_MEMORY_USAGE_GPU_ONLY,
-  };
-  VmaAllocation alloc;
-  VmaAllocationInfo allocInfo;
-  vmaCreateImage(Buffers::getAllocator(), &imageInfo, &vmaCreateInfo, &colorImage.image, &alloc, &allocInfo);
+  // R = Ambient Occlusion, G = Roughness, B = Metallic. All three are greyscale, so load them as a single channel.
+  // A map that is missing or fails to load leaves its channel at the neutral value: unoccluded, rough and dielectric.
+  const stbi_uc defaults[3] = {255, 255, 0};
+  stbi_uc *channels[3];
+  int widths[3], heights[3];
+  int packedWidth = 0, packedHeight = 0;
+  for (int i = 0; i < 3; i++) {
+    int sourceChannels;
+    channels[i] = stbi_load(sources[i].c_str(), &widths[i], &heights[i], &sourceChannels, STBI_grey);
+    if (!channels[i]) {
+      fprintf(stderr, "ORM packing for %s: failed to load %s (%s), using a neutral channel\n", ID.c_str(), sources[i].c_str(), stbi_failure_reason());
+      continue;
+    }
+    packedWidth = std::max(packedWidth, widths[i]);
+    packedHeight = std::max(packedHeight, heights[i]);
+  }
+  if (!channels[0] && !channels[1] && !channels[2]) {
+    throw std::runtime_error("Failed to load any texture for ORM packing: " + ID);
+  }
 
-  colorImage.imageView = DeviceControl::createImageView(colorImage.image, DeviceControl::getImageFormat(), VK_IMAGE_ASPECT_COLOR_BIT, 1);
-  colorImage.alloc = alloc;
-}
-void Texture::createDepthImage() {
+  std::vector<stbi_uc> packed(static_cast<size_t>(packedWidth) * packedHeight * 4);
+  for (int y = 0; y < packedHeight; y++) {
+    for (int x = 0; x < packedWidth; x++) {
+      float u = (x + 0.5f) / packedWidth;
+      float v = (y + 0.5f) / packedHeight;
+      stbi_uc *texel = &packed[(static_cast<size_t>(y) * packedWidth + x) * 4];
+      for (int i = 0; i < 3; i++) {
+        if (!channels[i]) {
+          texel[i] = defaults[i];
+          continue;
+        }
+        // Skip the filtering when the map is already the packed resolution.
+        texel[i] = (widths[i] == packedWidth && heights[i] == packedHeight)
+                     ? channels[i][y * packedWidth + x]
+                     : static_cast<stbi_uc>(sampleChannel(channels[i], widths[i], heights[i], u, v) + 0.5f);
+      }
+      texel[3] = 255;
+    }
+  }
+  for (int i = 0; i < 3; i++) {
+    stbi_image_free(channels[i]);
+  }
 
-  VkImageCreateInfo imageInfo{};
-  imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-  imageInfo.imageType = VK_IMAGE_TYPE_2D;
-  imageInfo.extent.width = DeviceControl::getSwapChainExtent().width;
-  imageInfo.extent.height = DeviceControl::getSwapChainExtent().height;
-  imageInfo.extent.depth = 1;
-  imageInfo.mipLevels = 1;
-  imageInfo.arrayLayers = 1;
-  imageInfo.format = DeviceControl::getDepthFormat();
-  imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
-  imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-  imageInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
-  imageInfo.samples = DeviceControl::getPerPixelSampleCount();
-  imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-  imageInfo.mipLevels = 1;
+  std::filesystem::create_directories(cachePath.parent_path());
+  if (!stbi_write_png(cachePath.string().c_str(), packedWidth, packedHeight, 4, packed.data(), packedWidth * 4)) {
+    throw std::runtime_error("Failed to write packed ORM texture: " + cachePath.string());
+  }
+  return cachePath.string();
+}
 
-  VmaAllocationCreateInfo vmaCreateInfo = {
-    .usage = VMA_MEMORY_USAGE_GPU_ONLY,
-  };
-  VmaAllocation alloc;
-  VmaAllocationInfo allocInfo;
-  vmaCreateImage(Buffers::getAllocator(), &imageInfo, &vmaCreateInfo, &depthImage.image, &alloc, &allocInfo);
-  
-  depthImage.imageView = DeviceControl::createImageView(depthImage.image, DeviceControl::getDepthFormat(), VK_IMAGE_ASPECT_DEPTH_BIT, 1);
-  depthImage.alloc = alloc;
+void Texture::createColorImage() {
+  colorImage = RenderGraph::createTransientImage({
+    .format = DeviceControl::getImageFormat(),
+    .extent = DeviceControl::getSwapChainExtent(),
+    .samples = DeviceControl::getPerPixelSampleCount(),
+    .usage = VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+    .aspect = VK_IMAGE_ASPECT_COLOR_BIT,
+  });
+}
+void Texture::createSceneImage() {
+  sceneImage = RenderGraph::createTransientImage({
+    .format = DeviceControl::getImageFormat(),
+    .extent = DeviceControl::getSwapChainExtent(),
+    .samples = VK_SAMPLE_COUNT_1_BIT,
+    // Blitted to the swapchain, or sampled by the temporal resolve.
+    .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+    .aspect = VK_IMAGE_ASPECT_COLOR_BIT,
+  });
+}
+void Texture::createDepthImage() {
+  VkImageUsageFlags usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+  // Without MSAA there is no resolve, the Hi-Z pyramid is built straight from this image. With it, nothing reads the
+  // samples outside the scene passes, so like the color samples it can live in lazily allocated memory.
+  if (DeviceControl::getPerPixelSampleCount() == VK_SAMPLE_COUNT_1_BIT) {
+    usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+  } else {
+    usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+  }
+  depthImage = RenderGraph::createTransientImage({
+    .format = DeviceControl::getDepthFormat(),
+    .extent = DeviceControl::getSwapChainExtent(),
+    .samples = DeviceControl::getPerPixelSampleCount(),
+    .usage = usage,
+    .aspect = VK_IMAGE_ASPECT_DEPTH_BIT,
+  });
+}
+void Texture::destroyRenderImages() {
+  RenderGraph::destroyTransientImage(colorImage);
+  RenderGraph::destroyTransientImage(depthImage);
+  RenderGraph::destroyTransientImage(sceneImage);
 }
 
 // ---------------------------- Getters & Setters ---------------------------------//
 uint32_t Texture::getMipLevels() { return this->mipLevels; }
-
-Texture::Image &Texture::getColorImage() { return colorImage; }
-Texture::Image &Texture::getDepthImage() { return depthImage; }
+VkFormat Texture::getFormat() { return this->format; }
+uint32_t Texture::getWidth() { return this->width; }
+uint32_t Texture::getHeight() { return this->height; }
+bool Texture::isStreaming() { return this->streaming; }
+uint32_t Texture::getResidentMip() { return this->residentMip; }
+bool Texture::isPooled() { return this->pooled.page != nullptr; }
+uint32_t Texture::getLayer() { return this->pooled.layer; }
+uint32_t Texture::getSlot() { return this->pooled.page ? this->pooled.page->slot : this->slot; }
+
+RenderGraph::Image Texture::getColorImage() { return colorImage; }
+RenderGraph::Image Texture::getDepthImage() { return depthImage; }
+RenderGraph::Image Texture::getSceneImage() { return sceneImage; }
 
 VkImage &Texture::getImage() { return this->image; }
 VkImageView &Texture::getImageView() { return this->imageView; }
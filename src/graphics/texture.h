@@ -1,32 +1,97 @@
 #pragma once
 
 #include <string>
+#include <vector>
 #include "volk.h"
 #include <cstdint>
 #include "vk_mem_alloc.h"
+#include "../utils/types.h"
+#include "rendergraph.h"
+#include "texturearray.h"
 
 class Texture {
 protected:
   uint32_t mipLevels;
+  VkFormat format;
   VkImage image;
   VkImageView imageView;
+  VmaAllocation alloc;
+  uint32_t width;
+  uint32_t height;
+  // Streaming textures hold [residentMip, mipLevels) on the GPU and only keep the finer levels on the CPU.
+  // The resident image is sized to residentMip, so the sampler can never pick a level that is not resident.
+  bool streaming;
+  uint32_t residentMip;
+  std::vector<std::vector<unsigned char>> mipChain;
+  // Small textures live in a layer of a shared array page instead of owning their image, see TextureArrayPool.
+  TextureArrayPool::Slot pooled;
+  // Bindless slot of our own image view, pooled textures use the slot of their page.
+  uint32_t slot;
 
 public:
-  Texture(const std::string& ID, const std::string& texturePath);
+  // RGBA8 pixels decoded from an image file, kept on the CPU so they can be hashed before anything is uploaded.
+  struct DecodedImage {
+    std::vector<unsigned char> pixels;
+    int width;
+    int height;
+  };
+  static DecodedImage decode(const std::vector<unsigned char>& fileData, const std::string& texturePath);
+
+  // Color data (albedo) is stored in sRGB, anything that holds raw values (ORM maps) should be loaded as UNORM.
+  Texture(const std::string& ID, const DecodedImage& decoded, VkFormat format = VK_FORMAT_R8G8B8A8_SRGB, bool streaming = false);
+  void destroy();
+
+  // Creating a texture waits for its upload. Textures created between these two share one submit (and one wait)
+  // instead, and can't be used before submitUploads(), so no frame may be drawn in between.
+  static void beginUploads();
+  static void submitUploads();
+
+  // Pack occlusion, roughness and metallic maps into the R, G and B channels of a single image on disk.
+  // Returns the path of the packed image, which is only rebuilt when a source map is newer than the cached one.
+  // Missing maps are logged and leave their channel at its neutral value, only failing when none of them loads.
+  static std::string packORM(const std::string& ID, const std::string& aoPath,
+                             const std::string& roughnessPath, const std::string& metallicPath);
+
+  struct Image {
+    VkImage image;
+    VkImageView imageView;
+    VmaAllocation alloc;
+  };
+  // Record the creation of an image holding mips [firstMip, mipLevels). Levels already resident are copied from the
+  // current image, finer ones are uploaded from the CPU and evicted ones are read back into `readback`. Both buffers
+  // are left empty when unused, and are for the caller to free once the commands have completed.
+  Image createResidentImage(VkCommandBuffer commandBuffer, uint32_t firstMip, Agnosia_T::AllocatedBuffer& staging,
+                            Agnosia_T::AllocatedBuffer& readback);
+  // Replace the resident image once those commands have completed, moving the texture to a new bindless slot.
+  // Returns the previous image for the caller to destroy once the GPU is done with it.
+  Image swapResidentImage(const Image& resident, uint32_t firstMip, const Agnosia_T::AllocatedBuffer& readback);
+  // GPU memory needed to hold mips [firstMip, mipLevels).
+  VkDeviceSize getResidentSize(uint32_t firstMip);
+  // Every texture is sampled as an array in the shaders, standalone ones just have a single layer.
+  static VkImageView createArrayView(VkImage image, VkFormat format, uint32_t mipLevels, uint32_t layerCount);
 
   VkImage& getImage();
   VkImageView& getImageView();
   uint32_t getMipLevels();
+  VkFormat getFormat();
+  uint32_t getWidth();
+  uint32_t getHeight();
+  bool isStreaming();
+  uint32_t getResidentMip();
+  bool isPooled();
+  uint32_t getLayer();
+  uint32_t getSlot();
   
+  // Render graph transients, they only get memory in frames that use them (the color image only with MSAA).
   static void createDepthImage();
   static void createColorImage();
+  // The scene resolved (or drawn, without MSAA) at the render resolution, upscaled into the swapchain from here (or
+  // through the temporal resolve).
+  static void createSceneImage();
+  static void destroyRenderImages();
   
   // ------------ Getters & Setters ------------ //
-  struct Image {
-    VkImage image;
-    VkImageView imageView;
-    VmaAllocation alloc;
-  };
-  static Image &getColorImage();
-  static Image &getDepthImage();
+  static RenderGraph::Image getColorImage();
+  static RenderGraph::Image getDepthImage();
+  static RenderGraph::Image getSceneImage();
 };
@@ -0,0 +1,91 @@
+#include "texturearray.h"
+#include "buffers.h"
+#include "deferreddeletion.h"
+#include "downsampler.h"
+#include "texture.h"
+#include "../devicelibrary.h"
+#include "../utils/helpers.h"
+
+#include <algorithm>
+#include <memory>
+
+// Roughly how much of level 0 a page holds, smaller textures get more layers per page.
+constexpr VkDeviceSize PAGE_SIZE = 4 * 1024 * 1024;
+constexpr uint32_t MIN_PAGE_LAYERS = 4;
+
+std::vector<std::unique_ptr<TextureArrayPool::Page>> pages;
+uint32_t pooledTextures = 0;
+
+bool TextureArrayPool::accepts(uint32_t width, uint32_t height) {
+  return width <= MAX_POOLED_SIZE && height <= MAX_POOLED_SIZE;
+}
+
+TextureArrayPool::Slot TextureArrayPool::allocate(uint32_t width, uint32_t height, VkFormat format, uint32_t mipLevels) {
+  for (std::unique_ptr<Page>& page : pages) {
+    if (page->width == width && page->height == height && page->format == format && !page->freeLayers.empty()) {
+      uint32_t layer = page->freeLayers.back();
+      page->freeLayers.pop_back();
+      pooledTextures++;
+      return {page.get(), layer};
+    }
+  }
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(DeviceControl::getPhysicalDevice(), &properties);
+  VkDeviceSize layerSize = static_cast<VkDeviceSize>(width) * height * 4;
+  uint32_t layerCount = static_cast<uint32_t>(std::clamp<VkDeviceSize>(PAGE_SIZE / layerSize, MIN_PAGE_LAYERS, properties.limits.maxImageArrayLayers));
+
+  auto page = std::make_unique<Page>();
+  page->width = width;
+  page->height = height;
+  page->mipLevels = mipLevels;
+  page->layerCount = layerCount;
+  page->format = format;
+
+  VkImageCreateInfo imageInfo{};
+  imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  imageInfo.imageType = VK_IMAGE_TYPE_2D;
+  imageInfo.extent = {width, height, 1};
+  imageInfo.mipLevels = mipLevels;
+  imageInfo.arrayLayers = layerCount;
+  imageInfo.format = format;
+  imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+  imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+  imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+  imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  // Same as a standalone texture, the downsampler writes the mips of each layer.
+  Downsampler::addTargetUsage(imageInfo);
+
+  VmaAllocationCreateInfo vmaCreateInfo = {
+    .usage = VMA_MEMORY_USAGE_GPU_ONLY,
+  };
+  VK_CHECK(vmaCreateImage(Buffers::getAllocator(), &imageInfo, &vmaCreateInfo, &page->image, &page->alloc, nullptr));
+  page->imageView = Texture::createArrayView(page->image, format, mipLevels, layerCount);
+  page->slot = Buffers::allocateTextureSlot(page->imageView);
+
+  // Hand out the lowest layers first.
+  for (uint32_t layer = layerCount; layer > 1; layer--) {
+    page->freeLayers.push_back(layer - 1);
+  }
+  pooledTextures++;
+  pages.push_back(std::move(page));
+  return {pages.back().get(), 0};
+}
+
+void TextureArrayPool::release(const Slot& slot) {
+  Page *page = slot.page;
+  page->freeLayers.push_back(slot.layer);
+  pooledTextures--;
+  if (page->freeLayers.size() < page->layerCount) {
+    return;
+  }
+
+  Buffers::freeTextureSlot(page->slot);
+  DeferredDeletion::imageView(page->imageView);
+  DeferredDeletion::image(page->image, page->alloc);
+  pages.erase(std::find_if(pages.begin(), pages.end(), [page](const std::unique_ptr<Page>& p) { return p.get() == page; }));
+}
+
+uint32_t TextureArrayPool::getPageCount() { return static_cast<uint32_t>(pages.size()); }
+uint32_t TextureArrayPool::getPooledTextureCount() { return pooledTextures; }
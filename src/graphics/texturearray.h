@@ -0,0 +1,40 @@
+#pragma once
+#include "volk.h"
+#include <cstdint>
+#include <vector>
+#include "vk_mem_alloc.h"
+
+// Small textures of the same size and format share one image as layers of an array, rather than each paying for
+// its own allocation, view and bindless slot. Pages are created on demand and destroyed once their last layer is freed.
+class TextureArrayPool {
+public:
+  // Anything at or under this size on both axes is pooled.
+  static constexpr uint32_t MAX_POOLED_SIZE = 256;
+
+  struct Page {
+    VkImage image;
+    VkImageView imageView;
+    VmaAllocation alloc;
+    uint32_t width;
+    uint32_t height;
+    uint32_t mipLevels;
+    uint32_t layerCount;
+    VkFormat format;
+    // Every layer is reached through the page's one bindless slot.
+    uint32_t slot;
+    std::vector<uint32_t> freeLayers;
+  };
+  struct Slot {
+    Page *page;
+    uint32_t layer;
+  };
+
+  static bool accepts(uint32_t width, uint32_t height);
+  // Find a free layer in a page matching the texture, creating a new page if they are all full.
+  static Slot allocate(uint32_t width, uint32_t height, VkFormat format, uint32_t mipLevels);
+  // The caller makes sure the GPU is done with the layer.
+  static void release(const Slot& slot);
+
+  static uint32_t getPageCount();
+  static uint32_t getPooledTextureCount();
+};
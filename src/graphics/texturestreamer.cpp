@@ -0,0 +1,205 @@
+#include "texturestreamer.h"
+#include "../devicelibrary.h"
+#include "../utils/deletion.h"
+#include "../utils/helpers.h"
+#include "buffers.h"
+#include "deferreddeletion.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <unordered_map>
+
+// Mips at or below this size are loaded up front and never evicted.
+constexpr uint32_t MIN_RESIDENT_SIZE = 64;
+
+struct StreamState {
+  // Finest mip requested since the last update, a fractional level straight from the projected size.
+  float requestedMip;
+};
+std::unordered_map<Texture *, StreamState> streamingTextures;
+
+// Only one upload is in flight at a time, its image is swapped in on commit().
+struct PendingUpload {
+  Texture *texture;
+  uint32_t firstMip;
+  Texture::Image image;
+  Agnosia_T::AllocatedBuffer staging;
+  Agnosia_T::AllocatedBuffer readback;
+};
+PendingUpload pending = {};
+
+VkCommandPool streamCommandPool;
+VkCommandBuffer streamCommandBuffer;
+VkFence streamFence;
+
+VkDeviceSize streamingBudget = 512ull * 1024 * 1024;
+
+void TextureStreamer::init() {
+  // Uploads get their own pool and fence so they can be polled instead of waited on like immediate_submit.
+  VkCommandPoolCreateInfo poolInfo = {
+    .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+    .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+    .queueFamilyIndex = DeviceControl::findQueueFamilies(DeviceControl::getPhysicalDevice()).graphicsFamily.value(),
+  };
+  VK_CHECK(vkCreateCommandPool(DeviceControl::getDevice(), &poolInfo, nullptr, &streamCommandPool));
+  DeletionQueue::get().push_function([=](){vkDestroyCommandPool(DeviceControl::getDevice(), streamCommandPool, nullptr);});
+
+  VkCommandBufferAllocateInfo allocInfo = {
+    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+    .commandPool = streamCommandPool,
+    .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+    .commandBufferCount = 1,
+  };
+  VK_CHECK(vkAllocateCommandBuffers(DeviceControl::getDevice(), &allocInfo, &streamCommandBuffer));
+
+  VkFenceCreateInfo fenceInfo = {
+    .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+  };
+  VK_CHECK(vkCreateFence(DeviceControl::getDevice(), &fenceInfo, nullptr, &streamFence));
+  DeletionQueue::get().push_function([=](){vkDestroyFence(DeviceControl::getDevice(), streamFence, nullptr);});
+}
+
+void TextureStreamer::registerTexture(Texture *texture) {
+  streamingTextures[texture] = {static_cast<float>(texture->getMipLevels())};
+}
+void TextureStreamer::unregisterTexture(Texture *texture) {
+  if (pending.texture == texture) {
+    // The upload may still be executing, wait for it before throwing its image away.
+    VK_CHECK(vkWaitForFences(DeviceControl::getDevice(), 1, &streamFence, VK_TRUE, UINT64_MAX));
+    vkDestroyImageView(DeviceControl::getDevice(), pending.image.imageView, nullptr);
+    vmaDestroyImage(Buffers::getAllocator(), pending.image.image, pending.image.alloc);
+    vmaDestroyBuffer(Buffers::getAllocator(), pending.staging.buffer, pending.staging.allocation);
+    vmaDestroyBuffer(Buffers::getAllocator(), pending.readback.buffer, pending.readback.allocation);
+    VK_CHECK(vkResetFences(DeviceControl::getDevice(), 1, &streamFence));
+    pending = {};
+  }
+  streamingTextures.erase(texture);
+}
+
+void TextureStreamer::requestProjectedSize(Texture *texture, float projectedPixels) {
+  auto it = streamingTextures.find(texture);
+  if (it == streamingTextures.end()) {
+    return;
+  }
+  // One texel per pixel is enough, so the mip we want is how many times the texture halves to reach the projected size.
+  float texels = static_cast<float>(std::max(texture->getWidth(), texture->getHeight()));
+  float mip = std::max(std::log2(texels / std::max(projectedPixels, 1.0f)), 0.0f);
+  it->second.requestedMip = std::min(it->second.requestedMip, mip);
+}
+
+uint32_t TextureStreamer::getMinimumResidentMip(Texture *texture) {
+  uint32_t mip = 0;
+  while (mip + 1 < texture->getMipLevels() && std::max(texture->getWidth() >> mip, texture->getHeight() >> mip) > MIN_RESIDENT_SIZE) {
+    mip++;
+  }
+  return mip;
+}
+
+// Decide which mip every texture should have resident. Start from what was requested, then while over budget
+// keep coarsening whichever texture currently costs the most, so quality degrades evenly across the scene.
+std::unordered_map<Texture *, uint32_t> computeTargets() {
+  std::unordered_map<Texture *, uint32_t> targets;
+  VkDeviceSize total = 0;
+  for (auto &[texture, state] : streamingTextures) {
+    uint32_t minimum = TextureStreamer::getMinimumResidentMip(texture);
+    uint32_t target = std::min(static_cast<uint32_t>(std::floor(state.requestedMip)), minimum);
+    targets[texture] = target;
+    total += texture->getResidentSize(target);
+  }
+
+  while (total > streamingBudget) {
+    Texture *largest = nullptr;
+    VkDeviceSize largestSize = 0;
+    for (auto &[texture, target] : targets) {
+      VkDeviceSize size = texture->getResidentSize(target);
+      if (target < TextureStreamer::getMinimumResidentMip(texture) && size > largestSize) {
+        largest = texture;
+        largestSize = size;
+      }
+    }
+    if (!largest) {
+      // Everything is already at its minimum, the budget is simply too small.
+      break;
+    }
+    total -= largestSize;
+    total += largest->getResidentSize(++targets[largest]);
+  }
+  return targets;
+}
+
+bool TextureStreamer::update() {
+  if (pending.texture) {
+    return vkGetFenceStatus(DeviceControl::getDevice(), streamFence) == VK_SUCCESS;
+  }
+
+  // Pick the next change: evictions first since they free memory, then the promotion furthest from its target.
+  Texture *next = nullptr;
+  uint32_t nextMip = 0;
+  uint32_t bestGap = 0;
+  for (auto &[texture, target] : computeTargets()) {
+    uint32_t resident = texture->getResidentMip();
+    if (target > resident) {
+      next = texture;
+      nextMip = target;
+      break;
+    }
+    if (resident - target > bestGap) {
+      bestGap = resident - target;
+      next = texture;
+      // Step one level at a time, so a single upload never has to carry the whole chain.
+      nextMip = resident - 1;
+    }
+  }
+  for (auto &[texture, state] : streamingTextures) {
+    state.requestedMip = static_cast<float>(texture->getMipLevels());
+  }
+  if (!next) {
+    return false;
+  }
+
+  VK_CHECK(vkResetCommandBuffer(streamCommandBuffer, 0));
+  VkCommandBufferBeginInfo beginInfo = {
+    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+    .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+  };
+  VK_CHECK(vkBeginCommandBuffer(streamCommandBuffer, &beginInfo));
+  pending.image = next->createResidentImage(streamCommandBuffer, nextMip, pending.staging, pending.readback);
+  VK_CHECK(vkEndCommandBuffer(streamCommandBuffer));
+
+  VkSubmitInfo submitInfo = {
+    .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+    .commandBufferCount = 1,
+    .pCommandBuffers = &streamCommandBuffer,
+  };
+  VK_CHECK(vkQueueSubmit(DeviceControl::getGraphicsQueue(), 1, &submitInfo, streamFence));
+  pending.texture = next;
+  pending.firstMip = nextMip;
+  return false;
+}
+
+Texture *TextureStreamer::commit() {
+  if (!pending.texture) {
+    return nullptr;
+  }
+  Texture *texture = pending.texture;
+  Texture::Image previous = texture->swapResidentImage(pending.image, pending.firstMip, pending.readback);
+  // Frames in flight may still sample the old image through its old slot.
+  DeferredDeletion::imageView(previous.imageView);
+  DeferredDeletion::image(previous.image, previous.alloc);
+  // The stream fence has signaled, so nothing reads these anymore.
+  vmaDestroyBuffer(Buffers::getAllocator(), pending.staging.buffer, pending.staging.allocation);
+  vmaDestroyBuffer(Buffers::getAllocator(), pending.readback.buffer, pending.readback.allocation);
+  VK_CHECK(vkResetFences(DeviceControl::getDevice(), 1, &streamFence));
+  pending = {};
+  return texture;
+}
+
+VkDeviceSize &TextureStreamer::getBudget() { return streamingBudget; }
+VkDeviceSize TextureStreamer::getResidentBytes() {
+  VkDeviceSize total = 0;
+  for (auto &[texture, state] : streamingTextures) {
+    total += texture->getResidentSize(texture->getResidentMip());
+  }
+  return total;
+}
+uint32_t TextureStreamer::getStreamingTextureCount() { return static_cast<uint32_t>(streamingTextures.size()); }
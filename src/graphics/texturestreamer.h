@@ -0,0 +1,31 @@
+#pragma once
+
+#include "texture.h"
+#include "volk.h"
+#include <cstdint>
+
+// Streams the mip levels of streaming textures in and out of VRAM, keeping the sum of resident mips under a budget.
+// Every frame the renderer requests a mip per texture from how large it is on screen, the streamer then uploads
+// finer levels (one texture at a time, in the background) or drops them when the budget is exceeded.
+class TextureStreamer {
+public:
+  static void init();
+
+  static void registerTexture(Texture *texture);
+  static void unregisterTexture(Texture *texture);
+
+  // Ask for the mip a texture needs this frame, given how many pixels tall the surface using it is on screen.
+  static void requestProjectedSize(Texture *texture, float projectedPixels);
+  // Smallest set of mips that always stays resident, regardless of the budget.
+  static uint32_t getMinimumResidentMip(Texture *texture);
+
+  // Poll the pending upload and kick off the next one. Returns true once an upload has landed and is ready to be committed.
+  static bool update();
+  // Swap the landed image in. The texture moves to a new bindless slot, so the returned texture's materials must be
+  // marked dirty. The old image and slot are retired once the frames in flight are done with them.
+  static Texture *commit();
+
+  static VkDeviceSize &getBudget();
+  static VkDeviceSize getResidentBytes();
+  static uint32_t getStreamingTextureCount();
+};
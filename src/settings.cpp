@@ -0,0 +1,114 @@
+#include "settings.h"
+
+#include <algorithm>
+#include <bit>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+const char *SETTINGS_PATH = "settings.cfg";
+
+Settings::Quality currentQuality;
+Settings::Quality requestedQuality;
+bool qualityRequested = false;
+
+struct PresentModeName {
+  VkPresentModeKHR mode;
+  const char *name;
+};
+constexpr PresentModeName PRESENT_MODE_NAMES[] = {
+  {VK_PRESENT_MODE_IMMEDIATE_KHR, "immediate"},
+  {VK_PRESENT_MODE_MAILBOX_KHR, "mailbox"},
+  {VK_PRESENT_MODE_FIFO_KHR, "fifo"},
+  {VK_PRESENT_MODE_FIFO_RELAXED_KHR, "fifo_relaxed"},
+};
+
+// Anything out of range is pulled back in, so a hand edited file can't ask for something nonsensical.
+static Settings::Quality sanitize(Settings::Quality quality) {
+  uint32_t samples = std::clamp(static_cast<uint32_t>(quality.msaaSamples), 1u, 64u);
+  quality.msaaSamples = static_cast<VkSampleCountFlagBits>(1u << (std::bit_width(samples) - 1));
+  quality.minSampleShading = std::clamp(quality.minSampleShading, 0.0f, 1.0f);
+  quality.maxAnisotropy = std::clamp(quality.maxAnisotropy, 1.0f, 16.0f);
+  quality.framesInFlight = std::clamp(quality.framesInFlight, 1u, Settings::MAX_FRAMES_IN_FLIGHT);
+  return quality;
+}
+
+void Settings::load() {
+  std::ifstream file(SETTINGS_PATH);
+  if (!file) {
+    return;
+  }
+  Quality quality;
+  std::string line;
+  while (std::getline(file, line)) {
+    // key = value, # starts a comment.
+    line = line.substr(0, line.find('#'));
+    size_t equals = line.find('=');
+    if (equals == std::string::npos) {
+      continue;
+    }
+    std::string key;
+    std::string value;
+    std::istringstream(line.substr(0, equals)) >> key;
+    std::istringstream(line.substr(equals + 1)) >> value;
+    if (key.empty() || value.empty()) {
+      continue;
+    }
+    try {
+      if (key == "msaa_samples") {
+        quality.msaaSamples = static_cast<VkSampleCountFlagBits>(std::stoul(value));
+      } else if (key == "sample_shading") {
+        quality.sampleShading = value == "true" || value == "1";
+      } else if (key == "min_sample_shading") {
+        quality.minSampleShading = std::stof(value);
+      } else if (key == "max_anisotropy") {
+        quality.maxAnisotropy = std::stof(value);
+      } else if (key == "present_mode") {
+        for (const PresentModeName &name : PRESENT_MODE_NAMES) {
+          if (value == name.name) {
+            quality.presentMode = name.mode;
+          }
+        }
+      } else if (key == "frames_in_flight") {
+        quality.framesInFlight = static_cast<uint32_t>(std::stoul(value));
+      }
+    } catch (const std::exception &) {
+      // Not a number, keep the default.
+    }
+  }
+  currentQuality = sanitize(quality);
+}
+
+void Settings::save() {
+  std::ofstream file(SETTINGS_PATH);
+  if (!file) {
+    return;
+  }
+  const char *presentMode = "fifo";
+  for (const PresentModeName &name : PRESENT_MODE_NAMES) {
+    if (currentQuality.presentMode == name.mode) {
+      presentMode = name.name;
+    }
+  }
+  file << "msaa_samples = " << static_cast<uint32_t>(currentQuality.msaaSamples) << "\n"
+       << "sample_shading = " << (currentQuality.sampleShading ? "true" : "false") << "\n"
+       << "min_sample_shading = " << currentQuality.minSampleShading << "\n"
+       << "max_anisotropy = " << currentQuality.maxAnisotropy << "\n"
+       << "present_mode = " << presentMode << "\n"
+       << "frames_in_flight = " << currentQuality.framesInFlight << "\n";
+}
+
+const Settings::Quality &Settings::get() { return currentQuality; }
+void Settings::request(const Quality &quality) {
+  requestedQuality = sanitize(quality);
+  qualityRequested = true;
+}
+bool Settings::takeRequest(Quality &quality) {
+  if (!qualityRequested) {
+    return false;
+  }
+  qualityRequested = false;
+  quality = requestedQuality;
+  currentQuality = requestedQuality;
+  return true;
+}
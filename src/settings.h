@@ -0,0 +1,37 @@
+#pragma once
+#include "volk.h"
+#include <cstdint>
+
+// Render quality choices that need dialing per machine. Loaded from settings.cfg at startup, edited in the Settings
+// tab, and written back whenever a change is applied. Changes are queued and applied between frames (see
+// applySettings() in entrypoint.cpp), only rebuilding what depends on the values that changed.
+class Settings {
+public:
+  // Per frame resources are sized for this many frames, the setting only picks how many of them are used.
+  static constexpr uint32_t MAX_FRAMES_IN_FLIGHT = 3;
+
+  struct Quality {
+    // Clamped down to what the device supports.
+    VkSampleCountFlagBits msaaSamples = VK_SAMPLE_COUNT_4_BIT;
+    // Run the fragment shader per sample (at least minSampleShading of them) instead of per pixel.
+    bool sampleShading = false;
+    float minSampleShading = 1.0f;
+    // Upper bound on every material sampler's anisotropy.
+    float maxAnisotropy = 16.0f;
+    // Falls back to FIFO, which is always supported.
+    VkPresentModeKHR presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+    uint32_t framesInFlight = 2;
+
+    bool operator==(const Quality&) const = default;
+  };
+
+  // Missing files and unknown keys leave the defaults in place.
+  static void load();
+  static void save();
+
+  static const Quality &get();
+  // Takes effect before the next frame is built.
+  static void request(const Quality &quality);
+  // The queued request if there is one, it becomes the current settings once taken.
+  static bool takeRequest(Quality &quality);
+};
@@ -1,14 +1,20 @@
 #version 460 core
 #include "common.glsl"
 
-layout(set = 0, binding = 1) uniform texture2D _texture[];
-layout(set = 1, binding = 2) uniform sampler _sampler;
+// Every texture is an array, small ones share an image and are told apart by layer.
+layout(set = 0, binding = 1) uniform texture2DArray _texture[];
+// Shared samplers from the SamplerCache, each material picks one per texture.
+layout(set = 1, binding = 2) uniform sampler _sampler[];
 
 layout(location = 0) in vec3 v_norm;
 layout(location = 1) in vec3 v_pos;
 layout(location = 2) in vec2 texCoord;
+layout(location = 3) flat in uint v_materialID;
+layout(location = 4) in vec4 v_currentClip;
+layout(location = 5) in vec4 v_previousClip;
 
 layout(location = 0) out vec4 outColor;
+layout(location = 1) out vec2 outVelocity;
 
 // Trowbridge-Reitz GGX NDF- Approximate the relative surface area of microfacets exactly aligned to the halfway vector.
 vec3 DistributionTRGGX(vec3 N, vec3 H, vec3 roughness) {
@@ -46,48 +52,107 @@ vec3 GeometrySmith(vec3 normal, vec3 viewDir, vec3 lightDir, vec3 k) {
 vec3 fresnelSchlick(float cosTheta, vec3 F0) {
   return F0 + (1.0 - F0) * pow(clamp(1.0 - cosTheta, 0.0, 1.0), 5.0);
 }
+// Cook-Torrance BRDF, what one light arriving from L with `radiance` sends toward the viewer.
+vec3 shade(vec3 N, vec3 V, vec3 L, vec3 radiance, vec3 albedo, vec3 roughness, vec3 metallic, vec3 F0) {
+  const float PI = 3.14159265359;
+  vec3 H = normalize(V+L);
+
+  vec3 NDF = DistributionTRGGX(N, H, roughness);       
+  vec3 G = GeometrySmith(N, V, L, roughness);       
+  vec3 F = fresnelSchlick(max(dot(H, V), 0.0), F0);
+  
+  vec3 kS = F;
+  vec3 kD = vec3(1.0) - kS;
+  kD *= 1.0 - metallic;
+  
+  vec3 numerator = NDF * G * F;
+  float denominator = 4.0 * max(dot(N, V), 0.0) * max(dot(N, L), 0.0) + 0.0001;
+  vec3 specular = numerator / denominator;
+
+  float NdotL = max(dot(N, L), 0.0);
+  return (kD * albedo / PI + specular) * radiance * NdotL;
+}
+// How much of the sun reaches a fragment at view depth `viewDepth`, from the nearest cascade reaching that far. The
+// position is pushed out along the normal by a texel and a half against acne, then 3x3 taps of the hardware's 2x2
+// comparison filter soften the edge. Fades out over the last tenth of the last cascade instead of cutting off.
+float sunShadow(vec3 worldPos, vec3 N, float viewDepth) {
+  if (scene.cascadeCount == 0) {
+    return 1.0;
+  }
+  float shadowDistance = scene.cascadeSplits[scene.cascadeCount - 1];
+  if (viewDepth >= shadowDistance) {
+    return 1.0;
+  }
+  uint cascade = 0;
+  while (cascade < scene.cascadeCount - 1 && viewDepth > scene.cascadeSplits[cascade]) {
+    cascade++;
+  }
+  vec3 offsetPos = worldPos + N * scene.cascadeTexelSizes[cascade] * 1.5;
+  vec3 coord = (scene.cascadeViewProj[cascade] * vec4(offsetPos, 1.0)).xyz;
+  vec2 uv = coord.xy * 0.5 + 0.5;
+
+  // A single mip, so the implicit level can't go wrong even though the cascade differs between neighbours.
+  vec2 texel = 1.0 / vec2(textureSize(sampler2DArrayShadow(_texture[scene.shadowSlot], _sampler[scene.shadowSampler]), 0).xy);
+  float lit = 0.0;
+  for (int y = -1; y <= 1; y++) {
+    for (int x = -1; x <= 1; x++) {
+      lit += texture(sampler2DArrayShadow(_texture[scene.shadowSlot], _sampler[scene.shadowSampler]),
+                     vec4(uv + vec2(x, y) * texel, float(cascade), coord.z));
+    }
+  }
+  float fade = clamp((shadowDistance - viewDepth) / (shadowDistance * 0.1), 0.0, 1.0);
+  return mix(1.0, lit / 9.0, fade);
+}
+// The froxel this fragment is in, from its unjittered clip position. Its w is the view depth.
+uint clusterIndex(vec4 clip) {
+  vec2 uv = clamp(clip.xy / clip.w * 0.5 + 0.5, 0.0, 1.0);
+  uvec2 tile = min(uvec2(uv * vec2(CLUSTER_X, CLUSTER_Y)), uvec2(CLUSTER_X - 1, CLUSTER_Y - 1));
+  uint slice = uint(clamp(log(clip.w) * scene.clusterScale + scene.clusterBias, 0.0, float(CLUSTER_Z - 1)));
+  return tile.x + tile.y * CLUSTER_X + slice * CLUSTER_X * CLUSTER_Y;
+}
 
 void main() {
-  const float PI = 3.14159265359;
+  outVelocity = motionVector(v_currentClip, v_previousClip);
+
+  Material material = scene.materialBuffer.materials[v_materialID];
 
-  vec3 lightColor = gpuBuffer.lightColor * gpuBuffer.lightPower;
-  vec3 albedo = texture(sampler2D(_texture[gpuBuffer.diffuseID], _sampler), texCoord).rgb;
-  vec3 metallic = texture(sampler2D(_texture[gpuBuffer.metallicID], _sampler), texCoord).rgb;
-  vec3 ao = texture(sampler2D(_texture[gpuBuffer.aoID], _sampler), texCoord).rgb;
-  vec3 roughness = texture(sampler2D(_texture[gpuBuffer.roughnessID], _sampler), texCoord).rgb;
+  vec3 albedo = texture(sampler2DArray(_texture[material.diffuseSlot], _sampler[material.diffuseSampler]), vec3(texCoord, material.diffuseLayer)).rgb * material.baseColorFactor.rgb;
+  if ((material.flags & MATERIAL_UNLIT) != 0) {
+    outColor = vec4(pow(albedo, vec3(1.0/2.2)), 1.0);
+    return;
+  }
+  // Occlusion, Roughness and Metallic are packed into one texture, R = AO, G = Roughness, B = Metallic.
+  vec3 orm = texture(sampler2DArray(_texture[material.ormSlot], _sampler[material.ormSampler]), vec3(texCoord, material.ormLayer)).rgb;
+  vec3 ao = vec3(orm.r);
+  vec3 roughness = vec3(orm.g * material.roughnessFactor);
+  vec3 metallic = vec3(orm.b * material.metallicFactor);
   
   vec3 F0 = vec3(0.04); 
   F0 = mix(F0, albedo, metallic);
 
   vec3 N = normalize(v_norm);
-  vec3 V = normalize(gpuBuffer.camPos - v_pos);
+  vec3 V = normalize(scene.camPos - v_pos);
 
   vec3 Lo = vec3(0.0);
 
-  // iterate over each light
-  for(int i = 0; i < 1; ++i) {
-    vec3 L = normalize(gpuBuffer.lightPos - v_pos);
-    vec3 H = normalize(V+L);
-
-    float distance = length(gpuBuffer.lightPos - v_pos);
-    float attenuation = 1.0 / (distance * distance);
-    vec3 radiance = lightColor * attenuation;
-      
-    // Cook-Torrance BRDF
-    vec3 NDF = DistributionTRGGX(N, H, roughness);       
-    vec3 G = GeometrySmith(N, V, L, roughness);       
-    vec3 F = fresnelSchlick(max(dot(H, V), 0.0), F0);
-    
-    vec3 kS = F;
-    vec3 kD = vec3(1.0) - kS;
-    kD *= 1.0 - metallic;
-    
-    vec3 numerator = NDF * G * F;
-    float denominator = 4.0 * max(dot(N, V), 0.0) * max(dot(N, L), 0.0) + 0.0001;
-    vec3 specular = numerator / denominator;
-
-    float NdotL = max(dot(N, L), 0.0);
-    Lo += (kD * albedo / PI + specular) * radiance * NdotL;
+  // The sun, the only light casting shadows.
+  vec3 sunL = normalize(scene.sunDirection);
+  float sunLit = dot(N, sunL) > 0.0 ? sunShadow(v_pos, N, v_currentClip.w) : 0.0;
+  Lo += shade(N, V, sunL, scene.sunColor * scene.sunIntensity * sunLit, albedo, roughness, metallic, F0);
+
+  // Only the lights cluster.comp found reaching this fragment's froxel.
+  uint cluster = clusterIndex(v_currentClip);
+  uint clusterLights = min(scene.clusterBuffer.clusters[cluster].lightCount, MAX_CLUSTER_LIGHTS);
+  for(uint i = 0; i < clusterLights; ++i) {
+    PointLight light = scene.lightBuffer.lights[scene.clusterBuffer.clusters[cluster].lights[i]];
+    vec3 L = normalize(light.position - v_pos);
+
+    float distance = length(light.position - v_pos);
+    // Inverse square, faded out to nothing at the radius the light was binned with.
+    float window = clamp(1.0 - pow(distance / light.radius, 4.0), 0.0, 1.0);
+    float attenuation = window * window / max(distance * distance, 0.0001);
+    vec3 radiance = light.color * light.intensity * attenuation;
+    Lo += shade(N, V, L, radiance, albedo, roughness, metallic, F0);
   }
 
   vec3 ambient = vec3(0.03) * albedo * ao;
@@ -4,15 +4,26 @@
 layout(location = 0) out vec3 v_norm;
 layout(location = 1) out vec3 v_pos;
 layout(location = 2) out vec2 texCoord;
+layout(location = 3) flat out uint v_materialID;
+layout(location = 4) out vec4 v_currentClip;
+layout(location = 5) out vec4 v_previousClip;
+// Matched by depth.vert, so the EQUAL test after the depth pre-pass sees the same depth.
+invariant gl_Position;
 
 
 void main() {
-    Vertex vertex = gpuBuffer.vertBuffer.vertices[gl_VertexIndex];
+    // Every draw's firstInstance is its object ID, whether it was recorded on the CPU or written by the culling pass.
+    ObjectData object = scene.objectBuffer.objects[gl_InstanceIndex];
+    Vertex vertex = object.vertBuffer.vertices[gl_VertexIndex];
     
-    gl_Position = gpuBuffer.proj * gpuBuffer.view * gpuBuffer.model * 
-                    vec4(vertex.pos + gpuBuffer.objPos, 1.0f);
+    gl_Position = scene.proj * scene.view * scene.model * 
+                    vec4(vertex.pos + object.objPos, 1.0f);
+    v_currentClip = scene.viewProj * vec4(vertex.pos + object.objPos, 1.0f);
+    v_previousClip = scene.previousViewProj * vec4(vertex.pos + object.previousPos, 1.0f);
                     
     v_norm = vertex.normal;
-    v_pos = vertex.pos;
+    // World space, where the lights are.
+    v_pos = (scene.model * vec4(vertex.pos + object.objPos, 1.0f)).xyz;
     texCoord = vertex.texCoord;
+    v_materialID = object.materialID;
 }
@@ -12,21 +12,108 @@ struct Vertex {
 layout(buffer_reference, scalar) readonly buffer VertexBuffer { 
 	Vertex vertices[];
 };
-layout(buffer_reference, scalar) readonly buffer GPUBuffer { 
+// The same positions as the VertexBuffer, a quarter of the bytes to fetch.
+layout(buffer_reference, scalar) readonly buffer PositionBuffer {
+    vec3 positions[];
+};
+const uint MATERIAL_UNLIT = 1u << 0;
+
+struct Material {
+    uint diffuseSlot;
+    uint diffuseLayer;
+    uint ormSlot;
+    uint ormLayer;
+    vec4 baseColorFactor;
+    float roughnessFactor;
+    float metallicFactor;
+    uint flags;
+    uint diffuseSampler;
+    uint ormSampler;
+    uint padding[3];
+};
+layout(buffer_reference, scalar) readonly buffer MaterialBuffer {
+    Material materials[];
+};
+
+struct ObjectData {
     VertexBuffer vertBuffer;
+    PositionBuffer posBuffer;
     vec3 objPos;
-    vec3 lightPos;
-    vec3 lightColor;
-    float lightPower;
+    uint materialID;
+    vec3 boundsCenter;
+    float boundsRadius;
+    uint firstIndex;
+    uint indexCount;
+    // Where objPos was last frame, for motion vectors.
+    vec3 previousPos;
+};
+layout(buffer_reference, scalar) readonly buffer ObjectBuffer {
+    ObjectData objects[];
+};
+
+// Clustered lighting, matches the LightGrid. The view frustum is cut into CLUSTER_X by CLUSTER_Y screen tiles and
+// CLUSTER_Z exponential depth slices, cluster.comp lists the lights reaching each of those froxels.
+const uint CLUSTER_X = 16;
+const uint CLUSTER_Y = 9;
+const uint CLUSTER_Z = 24;
+const uint MAX_CLUSTER_LIGHTS = 128;
+
+struct PointLight {
+    vec3 position;
+    float radius;
+    vec3 color;
+    float intensity;
+};
+layout(buffer_reference, scalar) readonly buffer LightBuffer {
+    PointLight lights[];
+};
+struct Cluster {
+    uint lightCount;
+    uint lights[MAX_CLUSTER_LIGHTS];
+};
+layout(buffer_reference, scalar) buffer ClusterBuffer {
+    Cluster clusters[];
+};
+
+// Cascaded shadow maps for the sun, matches the ShadowCascades.
+const uint SHADOW_CASCADES = 4;
+
+layout(buffer_reference, scalar) readonly buffer SceneBuffer { 
+    ObjectBuffer objectBuffer;
+    MaterialBuffer materialBuffer;
     vec3 camPos;
-    int diffuseID;
-    int metallicID;
-    int aoID;
-    int roughnessID;
     mat4 model;
     mat4 view;
     mat4 proj;
+    vec4 frustumPlanes[6];
+    // Without the temporal jitter, model folded in. This frame's and last frame's, for motion vectors.
+    mat4 viewProj;
+    mat4 previousViewProj;
+    LightBuffer lightBuffer;
+    ClusterBuffer clusterBuffer;
+    uint lightCount;
+    // log(view depth) * clusterScale + clusterBias is the froxel slice.
+    float clusterScale;
+    float clusterBias;
+    // Points toward the sun.
+    vec3 sunDirection;
+    float sunIntensity;
+    vec3 sunColor;
+    uint shadowSlot;
+    uint shadowSampler;
+    uint cascadeCount;
+    vec4 cascadeSplits;
+    vec4 cascadeTexelSizes;
+    mat4 cascadeViewProj[SHADOW_CASCADES];
 };
+// Screen space (uv) motion since last frame from the unjittered clip positions, the temporal resolve follows it back
+// into its history.
+vec2 motionVector(vec4 currentClip, vec4 previousClip) {
+    return (currentClip.xy / currentClip.w - previousClip.xy / previousClip.w) * 0.5;
+}
+// Shaders with their own push constants (compute passes) define CUSTOM_PUSH_CONSTANTS before including this.
+#ifndef CUSTOM_PUSH_CONSTANTS
 layout(push_constant, scalar) uniform constants {
-    GPUBuffer gpuBuffer;
+    SceneBuffer scene;
 };
+#endif
@@ -0,0 +1,14 @@
+#version 460 core
+#include "common.glsl"
+
+// Depth pre-pass, only positions from their own stream. Must produce exactly what base.vert does, the main pass
+// shades what's left with an EQUAL depth test.
+invariant gl_Position;
+
+void main() {
+    ObjectData object = scene.objectBuffer.objects[gl_InstanceIndex];
+    vec3 pos = object.posBuffer.positions[gl_VertexIndex];
+
+    gl_Position = scene.proj * scene.view * scene.model * 
+                    vec4(pos + object.objPos, 1.0f);
+}
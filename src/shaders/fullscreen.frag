@@ -4,12 +4,18 @@
 layout(location = 2) in vec2 texCoord;
 
 layout(location = 0) out vec4 outColor;
+layout(location = 1) out vec2 outVelocity;
 
 void main() {
   // Currently texCoord is in clip space (locked to the camera coordinates)
   // We need to sample the position using world space coords though! so we need an inverse MVP matrix
   // The reason we need to apply an inverse matrix even though technically we never applied it already is because of how we
   // import the vertices, without buffers they come in as clip space vertices, position set using NDC.
-  vec4 worldSpaceUV = inverse(gpuBuffer.proj * gpuBuffer.view * gpuBuffer.model) * vec4(texCoord, 1.0f, 1.0f);
+  vec4 worldSpaceUV = inverse(scene.proj * scene.view * scene.model) * vec4(texCoord, 1.0f, 1.0f);
   outColor = vec4(worldSpaceUV.x, worldSpaceUV.y, worldSpaceUV.z, 1.0f);  
+
+  // The background sits on the far plane, it moves with the camera and nothing else.
+  vec4 currentClip = vec4(texCoord * 2.0f - 1.0f, 1.0f, 1.0f);
+  vec4 farPoint = inverse(scene.viewProj) * currentClip;
+  outVelocity = motionVector(currentClip, scene.previousViewProj * farPoint);
 }
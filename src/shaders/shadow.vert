@@ -0,0 +1,17 @@
+#version 460 core
+#define CUSTOM_PUSH_CONSTANTS
+#include "common.glsl"
+
+// Shadow casters into one cascade of the sun's shadow map, positions only like the depth pre-pass.
+layout(push_constant, scalar) uniform constants {
+    SceneBuffer scene;
+    // World space to the cascade's clip space.
+    mat4 cascadeViewProj;
+};
+
+void main() {
+    ObjectData object = scene.objectBuffer.objects[gl_InstanceIndex];
+    vec3 pos = object.posBuffer.positions[gl_VertexIndex];
+
+    gl_Position = cascadeViewProj * scene.model * vec4(pos + object.objPos, 1.0f);
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstdint>
+#include <cstring>
 #include <functional>
 #include <source_location>
 #include "volk.h"
@@ -20,6 +22,24 @@ static void VK_CHECK(VkResult result, std::source_location location = std::sourc
 template<class T> [[nodiscard]] T* Address(T&& v) {
   return std::addressof(v);
 }
+// FNV-1a's basis and prime applied to whole 8 byte words, each followed by a 29 bit xor-shift, then to the leftover bytes.
+// Pass the previous result as `hash` to hash several pieces as one.
+inline uint64_t hashBytes(const void* data, size_t size, uint64_t hash = 0xcbf29ce484222325ULL) {
+  const uint64_t prime = 0x100000001b3ULL;
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, bytes + i, sizeof(uint64_t));
+    hash = (hash ^ word) * prime;
+    hash ^= hash >> 29;
+  }
+  for (; i < size; i++) {
+    hash = (hash ^ bytes[i]) * prime;
+  }
+  return hash;
+}
 inline void immediate_submit(std::function<void(VkCommandBuffer cmd)> &&function) {
   VkCommandBufferAllocateInfo allocInfo{};
   allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
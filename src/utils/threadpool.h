@@ -0,0 +1,144 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Worker threads for CPU side frame work. Jobs are submitted into a group so the caller can wait on just its own,
+// and waiting runs queued jobs instead of sitting idle, so a job can fan out into more jobs and wait on them.
+class ThreadPool {
+  public:
+    struct Group {
+      std::atomic<uint32_t> pending{0};
+    };
+
+    static ThreadPool& get() {
+      if(nullptr == instance) instance = new ThreadPool;
+      return *instance;
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    // Runs whatever is still queued, then joins the workers.
+    static void destruct() {
+      delete instance;
+      instance = nullptr;
+    }
+
+    void submit(Group& group, std::function<void()>&& function) {
+      group.pending++;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back({&group, std::move(function)});
+      }
+      wake.notify_one();
+      finished.notify_all();
+    }
+    void wait(Group& group) {
+      while (group.pending > 0) {
+        if (runOne()) {
+          continue;
+        }
+        // Nothing left to help with, the rest is running on the workers.
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [&](){ return group.pending == 0 || !jobs.empty(); });
+      }
+    }
+    // Split [0, count) into up to `batches` contiguous ranges and run them in parallel, returns once all have run.
+    // Each batch index runs exactly once, so it can pick per thread resources (up to getThreadCount() of them).
+    void parallelBatches(uint32_t count, uint32_t batches, const std::function<void(uint32_t batch, uint32_t first, uint32_t last)>& function) {
+      Group group;
+      batches = std::min(count, batches);
+      for (uint32_t batch = 0; batch < batches; batch++) {
+        uint32_t first = static_cast<uint32_t>(static_cast<uint64_t>(count) * batch / batches);
+        uint32_t last = static_cast<uint32_t>(static_cast<uint64_t>(count) * (batch + 1) / batches);
+        submit(group, [batch, first, last, &function](){ function(batch, first, last); });
+      }
+      wait(group);
+    }
+    // A batch per thread (the caller included).
+    void parallelFor(uint32_t count, const std::function<void(uint32_t)>& function) {
+      parallelBatches(count, getThreadCount(), [&function](uint32_t, uint32_t first, uint32_t last) {
+        for (uint32_t i = first; i < last; i++) {
+          function(i);
+        }
+      });
+    }
+    uint32_t getWorkerCount() { return static_cast<uint32_t>(workers.size()); }
+    uint32_t getThreadCount() { return getWorkerCount() + 1; }
+
+  private:
+    struct Job {
+      Group *group;
+      std::function<void()> function;
+    };
+
+    ThreadPool() {
+      // Leave a core for the main thread, it records and submits while the workers run.
+      uint32_t count = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+      for (uint32_t i = 0; i < count; i++) {
+        workers.emplace_back([this](){ workerLoop(); });
+      }
+    }
+    ~ThreadPool() {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+      }
+      wake.notify_all();
+      for (std::thread &worker : workers) {
+        worker.join();
+      }
+    }
+
+    void finish(Job& job) {
+      job.function();
+      // Under the lock, so a waiter can't miss it. The group may be gone the moment it's released.
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        job.group->pending--;
+      }
+      finished.notify_all();
+    }
+    bool runOne() {
+      Job job;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (jobs.empty()) {
+          return false;
+        }
+        job = std::move(jobs.front());
+        jobs.pop_front();
+      }
+      finish(job);
+      return true;
+    }
+    void workerLoop() {
+      while (true) {
+        Job job;
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          wake.wait(lock, [this](){ return stopping || !jobs.empty(); });
+          if (jobs.empty()) {
+            return;
+          }
+          job = std::move(jobs.front());
+          jobs.pop_front();
+        }
+        finish(job);
+      }
+    }
+
+    static ThreadPool* instance;
+    std::vector<std::thread> workers;
+    std::deque<Job> jobs;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    bool stopping = false;
+};
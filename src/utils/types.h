@@ -29,30 +29,101 @@ public:
     VmaAllocationInfo info;
   };
   struct GPUMeshBuffers {
-    AllocatedBuffer indexBuffer;
-    VkDeviceAddress indexBufferAddress;
     AllocatedBuffer vertexBuffer;
     VkDeviceAddress vertexBufferAddress;
+    // Just the positions again, tightly packed, for passes that don't shade (the depth pre-pass).
+    AllocatedBuffer positionBuffer;
+    VkDeviceAddress positionBufferAddress;
   };
 
-  struct SceneBuffer {
+  // One per material in the MaterialTable, objects reference it by index.
+  struct GPUMaterial {
+    uint32_t diffuseSlot;
+    uint32_t diffuseLayer;
+    uint32_t ormSlot;
+    uint32_t ormLayer;
+    glm::vec4 baseColorFactor;
+    float roughnessFactor;
+    float metallicFactor;
+    uint32_t flags;
+    // Indices into the bindless sampler array.
+    uint32_t diffuseSampler;
+    uint32_t ormSampler;
+    uint32_t padding[3];
+  };
+  // One per model in the ObjectTable.
+  struct ObjectData {
     VkDeviceAddress vertexBuffer;
+    VkDeviceAddress positionBuffer;
     glm::vec3 objPosition;
-    glm::vec3 lightPos;
-    glm::vec3 lightColor;
-    float lightPower;
+    uint32_t materialID;
+    // Bounding sphere in model space, for culling.
+    glm::vec3 boundsCenter;
+    float boundsRadius;
+    // Range in the MeshPool index buffer, a zero indexCount marks a free entry.
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    // objPosition as of the last flush, filled in by the ObjectTable, for motion vectors.
+    glm::vec3 previousPosition;
+  };
+  // One per light in the LightGrid's light buffer, in world space.
+  struct PointLight {
+    glm::vec3 position;
+    // Where it stops lighting anything, see LightGrid::radiusFor().
+    float radius;
+    glm::vec3 color;
+    float intensity;
+  };
+  // Shared by every draw in a frame.
+  struct SceneBuffer {
+    VkDeviceAddress objects;
+    VkDeviceAddress materials;
     glm::vec3 camPos;
-    int diffuseID;
-    int metallicID;
-    int aoID;
-    int roughnessID;
     glm::mat4 model;
     glm::mat4 view;
     glm::mat4 proj;
+    // Frustum planes (xyz inward normal, w distance) with the model matrix folded in, so they test object position +
+    // bounds directly. Left, right, bottom, top, near, far.
+    glm::vec4 frustumPlanes[6];
+    // proj * view * model without the temporal jitter, and last frame's, for motion vectors.
+    glm::mat4 viewProj;
+    glm::mat4 previousViewProj;
+    // This frame's PointLights, and the LightGrid's froxels listing which of them reach each one.
+    VkDeviceAddress lights;
+    VkDeviceAddress clusters;
+    uint32_t lightCount;
+    // log(view depth) * clusterScale + clusterBias is the froxel slice.
+    float clusterScale;
+    float clusterBias;
+    // The sun, a directional light shadowed by the ShadowCascades. The direction points toward it.
+    glm::vec3 sunDirection;
+    float sunIntensity;
+    glm::vec3 sunColor;
+    // Bindless slot of the cascades' depth array and the comparison sampler for it. No cascades, no shadows.
+    uint32_t shadowSlot;
+    uint32_t shadowSampler;
+    uint32_t cascadeCount;
+    // The view depth each cascade reaches out to, and the world size of one of its texels.
+    glm::vec4 cascadeSplits;
+    glm::vec4 cascadeTexelSizes;
+    // World to each cascade's clip space as it was last rendered, which can lag the camera. One per
+    // ShadowCascades::CASCADE_COUNT.
+    glm::mat4 cascadeViewProj[4];
   };
 
+  // Draws find their object through gl_InstanceIndex, so the scene is all that needs pushing.
   struct GPUPushConstants {
-    VkDeviceAddress gpuBufferAddress;
+    VkDeviceAddress sceneBufferAddress;
+  };
+  struct CullPushConstants {
+    VkDeviceAddress sceneBufferAddress;
+    // A uint count followed (16 bytes in) by the VkDrawIndexedIndirectCommands.
+    VkDeviceAddress drawBufferAddress;
+    // A uint per object ID, whether it was visible after last frame's late phase.
+    VkDeviceAddress visibilityAddress;
+    uint32_t objectRange;
+    // Which cull.comp phase to run, frustum only (0), early (1) or late (2).
+    uint32_t phase;
   };
 
   enum PipelineStage  {